@@ -0,0 +1,1079 @@
+/*
+ * Benchmarks of hdf5_struct on a file made by gen_eeg.
+ *
+ *   bench_hdf5_struct [-n repeats] [-w window_rows] [-W windows]
+ *                     [-l lookups] [-m small_writes] [-p dataset]
+ *                     [-s scratch.h5] [-o results.json] [-t trace.json]
+ *                     file.h5
+ *
+ * Every call is timed on its own and the results are written as JSON, with
+ * the number of runs, the latency percentiles in seconds and the throughput of
+ * each benchmark:
+ *
+ *   open          new_hdf5_struct
+ *   tree_walk     evaluating every group and dataset with get_subentry
+ *   get_subentry  looking up entries that are already evaluated
+ *   read_full     get_double_data (get_int_data for integer datasets)
+ *   read_stream   the whole dataset with read_double_rows, a block at a time
+ *   read_window   windows of window_rows rows at random places
+ *   read_block_sync   how long the caller is blocked on each block of a
+ *                     streamed read with read_double_rows
+ *   read_async_stall  the same with read_async reading the next block while
+ *                     the caller works on this one, submitting and waiting
+ *   write_*       each writer, into a scratch file that's removed at the end
+ *   write_pipeline_*  the same data and compression as write_compressed_*
+ *                     through the HDF5 filter pipeline, one H5Dwrite
+ *   commit_batch  a group of small_writes small double datasets with
+ *                 commit_batch, a run per group
+ *   commit_batch_latest  the same in the latest file format
+ *   write_double_array_loop  the same datasets with a loop of
+ *                 write_double_array, a run per loop
+ *   codec_*       eeg_encode and eeg_decode against shuffle and deflate at
+ *                 level 4 with zlib, on the dataset a block at a time in
+ *                 memory, with the compression ratio of the encoders
+ *
+ * Every full read opens the file again, as the data is only read once per
+ * hdf5_struct_t. The reads go through the page cache unless it's dropped
+ * beforehand. When built with STATS=1 the counters of hdf5_stats.h are added
+ * under "stats".
+ *
+ * Build with `make bench_hdf5_struct`, or run `make bench`.
+ */
+
+#define _XOPEN_SOURCE 700   // clock_gettime, getopt
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <zlib.h>
+#include "hdf5.h"
+#include "hdf5_async.h"
+#include "hdf5_batch.h"
+#include "hdf5_chunk.h"
+#include "hdf5_eeg_filter.h"
+#include "hdf5_stats.h"
+#include "hdf5_struct.h"
+
+#define MAX_BENCHMARKS     32
+#define SMALL_LEN          16     // elements of the small datasets written
+#define WRITE_ROWS         65536  // rows of the large datasets written
+#define MATRIX_COLS        64     // columns of the int matrices written
+
+/* the timings of one benchmark */
+struct benchmark {
+    const char *name;
+    double     *seconds;  // the time of every run
+    int         runs;
+    int         capacity;
+    double      bytes;    // bytes read or written over all the runs
+    double      stored;   // bytes after compression, 0 if not a codec
+};
+
+/* options of the run */
+struct bench_options {
+    int         repeats;
+    hsize_t     window_rows;
+    int         windows;
+    int         lookups;
+    int         small_writes;
+    const char *dataset;
+    const char *scratch;
+    const char *output;
+    const char *trace;
+    const char *path;
+};
+
+static struct benchmark benchmarks[MAX_BENCHMARKS];
+static int              num_benchmarks;
+static uint64_t         rng_state = 0x2545f4914f6cdd1dull;
+
+/* helper functions */
+static int parse_options(int argc, char **argv, struct bench_options *opts);
+static int bench_open(const struct bench_options *opts);
+static int bench_tree(const struct bench_options *opts);
+static int bench_reads(const struct bench_options *opts);
+static int bench_async(const struct bench_options *opts);
+static double work_on(const double *buf, hsize_t n);
+static hdf5_entry_t write_pipeline(hdf5_entry_t group, const char *name,
+                                   const hsize_t *dims, const hsize_t *chunk,
+                                   const double *buf, int flags);
+static int bench_writes(const struct bench_options *opts);
+static int bench_codecs(const struct bench_options *opts);
+static void shuffle_bytes(const uint8_t *in, uint8_t *out, size_t n,
+                          size_t size, int reverse);
+static long walk(hdf5_entry_t group, hdf5_entry_t **all, long *num_all,
+                 long *capacity);
+static struct benchmark *new_benchmark(const char *name, int capacity);
+static void add_run(struct benchmark *b, double seconds, double bytes);
+static int write_results(const struct bench_options *opts, FILE *out);
+static int compare_doubles(const void *a, const void *b);
+static double percentile(const struct benchmark *b, double p);
+static double now(void);
+static uint64_t next_random(void);
+static void usage(void);
+
+int main(int argc, char **argv) {
+    int                  i;
+    int                  status = 0;
+    FILE                *out    = stdout;
+    struct bench_options opts;
+
+    if (parse_options(argc, argv, &opts) < 0) {
+        usage();
+        return 1;
+    }
+
+    // so datasets written with COMPRESS_EEG can be read
+    if (register_eeg_filter() < 0) {
+        return 1;
+    }
+    stats_reset();
+    stats_trace(opts.trace != NULL);
+    if (bench_open(&opts) < 0 || bench_tree(&opts) < 0 ||
+        bench_reads(&opts) < 0 || bench_async(&opts) < 0 ||
+        bench_writes(&opts) < 0 || bench_codecs(&opts) < 0) {
+        status = -1;
+    }
+    stats_trace(false);
+
+    if (status == 0) {
+        if (opts.output != NULL && (out = fopen(opts.output, "w")) == NULL) {
+            perror("failed to open output file");
+            status = -1;
+        } else {
+            status = write_results(&opts, out);
+            if (out != stdout && fclose(out) != 0) {
+                status = -1;
+            }
+        }
+    }
+    if (status == 0 && opts.trace != NULL) {
+        status = stats_write_trace(opts.trace);
+    }
+
+    for (i = 0; i < num_benchmarks; i++) {
+        free(benchmarks[i].seconds);
+    }
+    return status < 0 ? 1 : 0;
+}
+
+/*
+ * Reads the command line into a struct bench_options
+ * \param argc the number of arguments
+ * \param argv the arguments
+ * \param opts where to return the options
+ * \return 0 on success or -1 if the command line is invalid
+ */
+static int parse_options(int argc, char **argv, struct bench_options *opts) {
+    int c;
+
+    opts->repeats      = 5;
+    opts->window_rows  = 256;
+    opts->windows      = 1000;
+    opts->lookups      = 100000;
+    opts->small_writes = 1000;
+    opts->dataset      = "EEG/data";
+    opts->scratch      = "bench_scratch.h5";
+    opts->output       = NULL;
+    opts->trace        = NULL;
+
+    while ((c = getopt(argc, argv, "n:w:W:l:m:p:s:o:t:")) != -1) {
+        switch (c) {
+            case 'n':
+                opts->repeats = atoi(optarg);
+                break;
+            case 'w':
+                opts->window_rows = strtoull(optarg, NULL, 10);
+                break;
+            case 'W':
+                opts->windows = atoi(optarg);
+                break;
+            case 'l':
+                opts->lookups = atoi(optarg);
+                break;
+            case 'm':
+                opts->small_writes = atoi(optarg);
+                break;
+            case 'p':
+                opts->dataset = optarg;
+                break;
+            case 's':
+                opts->scratch = optarg;
+                break;
+            case 'o':
+                opts->output = optarg;
+                break;
+            case 't':
+                opts->trace = optarg;
+                break;
+            default:
+                return -1;
+        }
+    }
+    if (optind != argc - 1 || opts->repeats < 1 || opts->window_rows < 1 ||
+        opts->windows < 0 || opts->lookups < 0 || opts->small_writes < 0) {
+        return -1;
+    }
+    opts->path = argv[optind];
+    return 0;
+}
+
+/*
+ * Times opening the file
+ * \param opts the options of the run
+ * \return 0 on success or -1 on failure
+ */
+static int bench_open(const struct bench_options *opts) {
+    int               i;
+    double            start;
+    hdf5_struct_t     hdf5;
+    struct benchmark *b;
+
+    if ((b = new_benchmark("open", opts->repeats)) == NULL) {
+        return -1;
+    }
+    for (i = 0; i < opts->repeats; i++) {
+        start = now();
+        hdf5  = new_hdf5_struct(opts->path);
+        add_run(b, now() - start, 0);
+        if (hdf5 == NULL) {
+            return -1;
+        }
+        if (i == 0 && find_entry(hdf5, opts->dataset) == NULL) {
+            fprintf(stderr, "no entry %s\n", opts->dataset);
+            free_hdf5_struct(hdf5);
+            return -1;
+        }
+        free_hdf5_struct(hdf5);
+    }
+    return 0;
+}
+
+/*
+ * Times evaluating the whole tree of a freshly opened file, then looking up
+ * random entries once they're all evaluated
+ * \param opts the options of the run
+ * \return 0 on success or -1 on failure
+ */
+static int bench_tree(const struct bench_options *opts) {
+    int               i;
+    long              num_all  = 0;
+    long              capacity = 0;
+    double            start;
+    hdf5_entry_t     *all      = NULL;
+    hdf5_entry_t      entry;
+    hdf5_struct_t     hdf5;
+    struct benchmark *walks;
+    struct benchmark *lookups;
+
+    if ((walks = new_benchmark("tree_walk", opts->repeats)) == NULL ||
+        (lookups = new_benchmark("get_subentry", opts->lookups)) == NULL) {
+        return -1;
+    }
+    for (i = 0; i < opts->repeats; i++) {
+        if ((hdf5 = new_hdf5_struct(opts->path)) == NULL) {
+            free(all);
+            return -1;
+        }
+        num_all = 0;
+        start   = now();
+        if (walk(hdf5->root, &all, &num_all, &capacity) < 0) {
+            free_hdf5_struct(hdf5);
+            free(all);
+            return -1;
+        }
+        add_run(walks, now() - start, 0);
+        if (i < opts->repeats - 1) {
+            free_hdf5_struct(hdf5);
+        }
+    }
+
+    for (i = 0; i < opts->lookups && num_all > 0; i++) {
+        entry = all[next_random() % num_all];
+        start = now();
+        if (get_subentry(entry->parent, entry->name) != entry) {
+            fprintf(stderr, "get_subentry returned the wrong entry for %s\n",
+                    entry->name);
+        }
+        add_run(lookups, now() - start, 0);
+    }
+
+    free_hdf5_struct(hdf5);
+    free(all);
+    return 0;
+}
+
+/*
+ * Times reading the dataset whole, streamed and in random windows
+ * \param opts the options of the run
+ * \return 0 on success or -1 on failure
+ */
+static int bench_reads(const struct bench_options *opts) {
+    int               i;
+    int               status = 0;
+    double            start;
+    double            bytes;
+    void             *data;
+    double           *buf;
+    hsize_t           row;
+    hsize_t           rows;
+    hsize_t           count;
+    hsize_t           window;
+    hdf5_struct_t     hdf5;
+    hdf5_entry_t      entry;
+    struct benchmark *full;
+    struct benchmark *stream;
+    struct benchmark *windows;
+
+    if ((full = new_benchmark("read_full", opts->repeats)) == NULL ||
+        (stream = new_benchmark("read_stream", opts->repeats)) == NULL ||
+        (windows = new_benchmark("read_window", opts->windows)) == NULL) {
+        return -1;
+    }
+
+    for (i = 0; i < opts->repeats; i++) {
+        if ((hdf5 = new_hdf5_struct(opts->path)) == NULL) {
+            return -1;
+        }
+        if ((entry = find_entry(hdf5, opts->dataset)) == NULL ||
+            IS_GROUP(entry)) {
+            free_hdf5_struct(hdf5);
+            return -1;
+        }
+        start = now();
+        if (entry->class == H5T_FLOAT) {
+            data  = get_double_data(entry);
+            bytes = sizeof(double);
+        } else {
+            data  = get_int_data(entry);
+            bytes = sizeof(int);
+        }
+        add_run(full, now() - start, bytes * X_DIM(entry) * Y_DIM(entry));
+        free_hdf5_struct(hdf5);
+        if (data == NULL) {
+            fprintf(stderr, "failed to read %s\n", opts->dataset);
+            return -1;
+        }
+    }
+
+    if ((hdf5 = new_hdf5_struct(opts->path)) == NULL) {
+        return -1;
+    }
+    if ((entry = find_entry(hdf5, opts->dataset)) == NULL ||
+        IS_GROUP(entry)) {
+        free_hdf5_struct(hdf5);
+        return -1;
+    }
+    rows   = block_rows(entry);
+    window = opts->window_rows < X_DIM(entry) ? opts->window_rows
+                                              : X_DIM(entry);
+    if ((buf = (double *) malloc(sizeof(double) * Y_DIM(entry) *
+                                 (rows > window ? rows : window))) == NULL) {
+        perror("malloc failed in bench_reads():buf");
+        free_hdf5_struct(hdf5);
+        return -1;
+    }
+
+    for (i = 0; i < opts->repeats && status == 0; i++) {
+        start = now();
+        for (row = 0; row < X_DIM(entry) && status == 0; row += count) {
+            count  = X_DIM(entry) - row < rows ? X_DIM(entry) - row : rows;
+            status = read_double_rows(entry, row, count, buf);
+        }
+        add_run(stream, now() - start,
+                (double) sizeof(double) * X_DIM(entry) * Y_DIM(entry));
+    }
+    for (i = 0; i < opts->windows && status == 0; i++) {
+        row    = next_random() % (X_DIM(entry) - window + 1);
+        start  = now();
+        status = read_double_rows(entry, row, window, buf);
+        add_run(windows, now() - start,
+                (double) sizeof(double) * window * Y_DIM(entry));
+    }
+
+    free(buf);
+    free_hdf5_struct(hdf5);
+    return status;
+}
+
+/*
+ * Times how long a processing loop is blocked on I/O per block, streaming the
+ * dataset synchronously and then with the next block read asynchronously while
+ * the current one is worked on
+ * \param opts the options of the run
+ * \return 0 on success or -1 on failure
+ */
+static int bench_async(const struct bench_options *opts) {
+    int               i;
+    int               status = 0;
+    double            start;
+    double            sum    = 0;
+    double           *buf[2] = {NULL, NULL};
+    hsize_t           k;
+    hsize_t           rows;
+    hsize_t           blocks;
+    hsize_t           count[2];
+    hdf5_struct_t     hdf5;
+    hdf5_entry_t      entry;
+    hdf5_io_queue_t   queue;
+    hdf5_request_t    req[2];
+    struct benchmark *sync_b;
+    struct benchmark *async_b;
+
+    if ((hdf5 = new_hdf5_struct(opts->path)) == NULL) {
+        return -1;
+    }
+    if ((entry = find_entry(hdf5, opts->dataset)) == NULL || IS_GROUP(entry)) {
+        free_hdf5_struct(hdf5);
+        return -1;
+    }
+    rows   = block_rows(entry);
+    blocks = (X_DIM(entry) + rows - 1) / rows;
+    if ((sync_b = new_benchmark("read_block_sync",
+                                opts->repeats * (int) blocks)) == NULL ||
+        (async_b = new_benchmark("read_async_stall",
+                                 opts->repeats * (int) blocks)) == NULL ||
+        (queue = new_io_queue(2)) == NULL) {
+        free_hdf5_struct(hdf5);
+        return -1;
+    }
+    buf[0] = (double *) malloc(sizeof(double) * rows * Y_DIM(entry));
+    buf[1] = (double *) malloc(sizeof(double) * rows * Y_DIM(entry));
+    if (buf[0] == NULL || buf[1] == NULL) {
+        perror("malloc failed in bench_async():buf");
+        status = -1;
+    }
+
+    for (i = 0; i < opts->repeats && status == 0; i++) {
+        for (k = 0; k < blocks && status == 0; k++) {
+            count[0] = X_DIM(entry) - k * rows < rows ? X_DIM(entry) - k * rows
+                                                      : rows;
+            start  = now();
+            status = read_double_rows(entry, k * rows, count[0], buf[0]);
+            add_run(sync_b, now() - start,
+                    (double) sizeof(double) * count[0] * Y_DIM(entry));
+            sum += work_on(buf[0], count[0] * Y_DIM(entry));
+        }
+    }
+
+    for (i = 0; i < opts->repeats && status == 0; i++) {
+        count[0] = rows < X_DIM(entry) ? rows : X_DIM(entry);
+        status   = read_async(queue, entry, 0, count[0], buf[0], &req[0]);
+        for (k = 0; k < blocks && status == 0; k++) {
+            int cur  = k % 2;
+            int next = 1 - cur;
+
+            start = now();
+            if (k + 1 < blocks) {
+                count[next] = X_DIM(entry) - (k + 1) * rows < rows
+                              ? X_DIM(entry) - (k + 1) * rows : rows;
+                status = read_async(queue, entry, (k + 1) * rows, count[next],
+                                    buf[next], &req[next]);
+            }
+            if (wait_request(queue, req[cur]) < 0) {
+                status = -1;
+            }
+            free_request(req[cur]);
+            add_run(async_b, now() - start,
+                    (double) sizeof(double) * count[cur] * Y_DIM(entry));
+            sum += work_on(buf[cur], count[cur] * Y_DIM(entry));
+        }
+    }
+
+    // keep the work from being optimized away
+    if (sum == 42.0) {
+        printf("\n");
+    }
+    free_io_queue(queue);
+    free(buf[0]);
+    free(buf[1]);
+    free_hdf5_struct(hdf5);
+    return status;
+}
+
+/*
+ * Writes a matrix through the HDF5 filter pipeline with the compression
+ * write_compressed_matrix would use, for comparison
+ * \param group the group to create the dataset in
+ * \param name the name of the dataset
+ * \param dims the dimensions of the dataset
+ * \param chunk the chunk dimensions
+ * \param buf the data
+ * \param flags COMPRESS_SHUFFLE | COMPRESS_DEFLATE at level 4, or COMPRESS_EEG
+ * \return the dataset or NULL on failure
+ */
+static hdf5_entry_t write_pipeline(hdf5_entry_t   group,
+                                   const char    *name,
+                                   const hsize_t *dims,
+                                   const hsize_t *chunk,
+                                   const double  *buf,
+                                   int            flags) {
+    hid_t        plist;
+    hdf5_entry_t entry = NULL;
+
+    lock_hdf5();
+    plist = H5Pcreate(H5P_DATASET_CREATE);
+    H5Pset_chunk(plist, 2, chunk);
+    if (flags & COMPRESS_EEG) {
+        set_eeg_filter(plist);
+    } else {
+        H5Pset_shuffle(plist);
+        H5Pset_deflate(plist, 4);
+    }
+    entry = create_dataset(group, name, H5T_NATIVE_DOUBLE, 2, dims, plist);
+    H5Pclose(plist);
+    unlock_hdf5();
+    if (entry == NULL || write_double_rows(entry, 0, dims[0], buf) < 0) {
+        return NULL;
+    }
+    return entry;
+}
+
+/*
+ * Stands for the processing of a block: a few passes over it
+ * \param buf the block
+ * \param n the number of values
+ * \return the sum of squares, so the work isn't optimized away
+ */
+static double work_on(const double *buf, hsize_t n) {
+    int     pass;
+    hsize_t j;
+    double  sum = 0;
+
+    for (pass = 0; pass < 4; pass++) {
+        for (j = 0; j < n; j++) {
+            sum += buf[j] * buf[j] * pass;
+        }
+    }
+    return sum;
+}
+
+/*
+ * Times each writer into a scratch file. The large datasets are made of the
+ * first rows of the dataset, so they compress like it.
+ * \param opts the options of the run
+ * \return 0 on success or -1 on failure
+ */
+static int bench_writes(const struct bench_options *opts) {
+    int               i;
+    int               status = 0;
+    char              name[MAX_LEN];
+    double            start;
+    double            bytes;
+    double           *rows_buf  = NULL;
+    double            small[SMALL_LEN];
+    int              *int_buf   = NULL;
+    hsize_t           j;
+    hsize_t           row;
+    hsize_t           count;
+    hsize_t           block;
+    hsize_t           dims[2];
+    hsize_t           chunk[2];
+    hsize_t           small_dims[1] = {SMALL_LEN};
+    hid_t             file;
+    hid_t             group;
+    hdf5_struct_t     hdf5      = NULL;
+    hdf5_struct_t     scratch   = NULL;
+    hdf5_entry_t      source;
+    hdf5_entry_t      bench;
+    hdf5_entry_t      entry;
+    hdf5_batch_t      batch;
+    batch_node_t      node;
+    int               latest;
+    struct benchmark *b[13];
+
+    if ((file = H5Fcreate(opts->scratch, H5F_ACC_TRUNC, H5P_DEFAULT,
+                          H5P_DEFAULT)) < 0) {
+        fprintf(stderr, "failed to create %s\n", opts->scratch);
+        return -1;
+    }
+    group = H5Gcreate(file, "bench", H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT);
+    H5Gclose(group);
+    H5Fclose(file);
+    if (group < 0) {
+        fprintf(stderr, "failed to create /bench in %s\n", opts->scratch);
+        return -1;
+    }
+
+    b[0] = new_benchmark("write_int_array_small", opts->small_writes);
+    b[1] = new_benchmark("write_double_array_small", opts->small_writes);
+    b[2] = new_benchmark("write_string_small", opts->small_writes);
+    b[3] = new_benchmark("write_int_matrix", opts->repeats);
+    b[4] = new_benchmark("write_double_matrix", opts->repeats);
+    b[5] = new_benchmark("write_double_rows", opts->repeats);
+    b[6] = new_benchmark("write_compressed_deflate", opts->repeats);
+    b[7] = new_benchmark("write_compressed_eeg", opts->repeats);
+    b[8] = new_benchmark("commit_batch", opts->repeats);
+    b[9] = new_benchmark("write_pipeline_deflate", opts->repeats);
+    b[10] = new_benchmark("write_pipeline_eeg", opts->repeats);
+    b[11] = new_benchmark("commit_batch_latest", opts->repeats);
+    b[12] = new_benchmark("write_double_array_loop", opts->repeats);
+    for (i = 0; i < 13; i++) {
+        if (b[i] == NULL) {
+            return -1;
+        }
+    }
+
+    if ((hdf5 = new_hdf5_struct(opts->path)) == NULL ||
+        (scratch = new_hdf5_struct(opts->scratch)) == NULL ||
+        (source = find_entry(hdf5, opts->dataset)) == NULL ||
+        (bench = get_entry(scratch, "bench")) == NULL) {
+        status = -1;
+        goto done;
+    }
+    dims[0]  = X_DIM(source) < WRITE_ROWS ? X_DIM(source) : WRITE_ROWS;
+    dims[1]  = Y_DIM(source);
+    chunk[0] = dims[0] < 4096 ? dims[0] : 4096;
+    chunk[1] = dims[1];
+    bytes    = (double) sizeof(double) * dims[0] * dims[1];
+    rows_buf = (double *) malloc(sizeof(double) * dims[0] * dims[1]);
+    int_buf  = (int *) malloc(sizeof(int) * dims[0] * MATRIX_COLS);
+    if (rows_buf == NULL || int_buf == NULL) {
+        perror("malloc failed in bench_writes():buf");
+        status = -1;
+        goto done;
+    }
+    if (read_double_rows(source, 0, dims[0], rows_buf) < 0) {
+        status = -1;
+        goto done;
+    }
+    for (j = 0; j < dims[0] * MATRIX_COLS; j++) {
+        int_buf[j] = (int) rows_buf[j % (dims[0] * dims[1])];
+    }
+    for (j = 0; j < SMALL_LEN; j++) {
+        small[j] = rows_buf[j % (dims[0] * dims[1])];
+    }
+
+    for (i = 0; i < opts->small_writes; i++) {
+        snprintf(name, MAX_LEN, "int_small%d", i);
+        start = now();
+        write_int_array(bench, name, small_dims, int_buf);
+        add_run(b[0], now() - start, sizeof(int) * SMALL_LEN);
+
+        snprintf(name, MAX_LEN, "double_small%d", i);
+        start = now();
+        write_double_array(bench, name, small_dims, small);
+        add_run(b[1], now() - start, sizeof(double) * SMALL_LEN);
+
+        snprintf(name, MAX_LEN, "string_small%d", i);
+        start = now();
+        write_string(bench, name, "synthetic EEG");
+        add_run(b[2], now() - start, sizeof("synthetic EEG"));
+    }
+
+    for (i = 0; i < opts->repeats && status == 0; i++) {
+        hsize_t int_dims[2] = {dims[0], MATRIX_COLS};
+
+        snprintf(name, MAX_LEN, "int_matrix%d", i);
+        start = now();
+        write_int_matrix(bench, name, int_dims, int_buf);
+        add_run(b[3], now() - start,
+                (double) sizeof(int) * dims[0] * MATRIX_COLS);
+
+        snprintf(name, MAX_LEN, "double_matrix%d", i);
+        start = now();
+        write_double_matrix(bench, name, dims, rows_buf);
+        add_run(b[4], now() - start, bytes);
+
+        snprintf(name, MAX_LEN, "double_rows%d", i);
+        start = now();
+        if ((entry = create_double_matrix(bench, name, dims, chunk)) == NULL) {
+            status = -1;
+            break;
+        }
+        block = block_rows(entry);
+        for (row = 0; row < dims[0] && status == 0; row += count) {
+            count  = dims[0] - row < block ? dims[0] - row : block;
+            status = write_double_rows(entry, row, count,
+                                       rows_buf + row * dims[1]);
+        }
+        add_run(b[5], now() - start, bytes);
+
+        snprintf(name, MAX_LEN, "deflate%d", i);
+        start = now();
+        entry = write_compressed_matrix(bench, name, dims, chunk, rows_buf,
+                                        COMPRESS_SHUFFLE | COMPRESS_DEFLATE,
+                                        4);
+        add_run(b[6], now() - start, bytes);
+        if (entry == NULL) {
+            status = -1;
+            break;
+        }
+
+        snprintf(name, MAX_LEN, "eeg%d", i);
+        start = now();
+        entry = write_compressed_matrix(bench, name, dims, chunk, rows_buf,
+                                        COMPRESS_EEG, 0);
+        add_run(b[7], now() - start, bytes);
+        if (entry == NULL) {
+            status = -1;
+            break;
+        }
+
+        snprintf(name, MAX_LEN, "pipeline_deflate%d", i);
+        start = now();
+        entry = write_pipeline(bench, name, dims, chunk, rows_buf,
+                               COMPRESS_SHUFFLE | COMPRESS_DEFLATE);
+        add_run(b[9], now() - start, bytes);
+        if (entry == NULL) {
+            status = -1;
+            break;
+        }
+
+        snprintf(name, MAX_LEN, "pipeline_eeg%d", i);
+        start = now();
+        entry = write_pipeline(bench, name, dims, chunk, rows_buf,
+                               COMPRESS_EEG);
+        add_run(b[10], now() - start, bytes);
+        if (entry == NULL) {
+            status = -1;
+            break;
+        }
+
+        for (latest = 0; latest < 2 && status == 0; latest++) {
+            snprintf(name, MAX_LEN, "batch%s%d", latest ? "_latest" : "", i);
+            start = now();
+            if ((batch = new_batch()) == NULL) {
+                status = -1;
+                break;
+            }
+            batch->flags = latest ? BATCH_LATEST_FORMAT : 0;
+            node = batch_group(batch, NULL, name);
+            for (j = 0; j < (hsize_t) opts->small_writes && node != NULL;
+                 j++) {
+                snprintf(name, MAX_LEN, "double_small%d", (int) j);
+                if (batch_double_array(batch, node, name, SMALL_LEN, small) ==
+                    NULL) {
+                    node = NULL;
+                }
+            }
+            status = node == NULL ? -1 : commit_batch(batch, bench);
+            free_batch(batch);
+            add_run(b[latest ? 11 : 8], now() - start,
+                    (double) sizeof(double) * SMALL_LEN * opts->small_writes);
+        }
+
+        start = now();
+        for (j = 0; j < (hsize_t) opts->small_writes; j++) {
+            snprintf(name, MAX_LEN, "loop%d_double_small%d", i, (int) j);
+            write_double_array(bench, name, small_dims, small);
+        }
+        add_run(b[12], now() - start,
+                (double) sizeof(double) * SMALL_LEN * opts->small_writes);
+    }
+
+done:
+    free(rows_buf);
+    free(int_buf);
+    if (hdf5 != NULL) {
+        free_hdf5_struct(hdf5);
+    }
+    if (scratch != NULL) {
+        free_hdf5_struct(scratch);
+    }
+    remove(opts->scratch);
+    return status;
+}
+
+/*
+ * Benchmarks the EEG codec against shuffle and deflate, the standard filters
+ * write_compressed_matrix uses without COMPRESS_EEG, on the blocks of the
+ * dataset in memory, checking that every block decodes back
+ * \param opts the options of the run
+ * \return 0 on success or -1 on failure
+ */
+static int bench_codecs(const struct bench_options *opts) {
+    int               i;
+    int               status = 0;
+    double            start;
+    hsize_t           k;
+    hsize_t           rows;
+    hsize_t           count;
+    hsize_t           blocks;
+    size_t            nbytes;
+    size_t            size;
+    uLongf            zsize;
+    uLongf            zbound;
+    uint8_t          *raw      = NULL;
+    uint8_t          *shuffled = NULL;
+    uint8_t          *coded    = NULL;
+    uint8_t          *decoded  = NULL;
+    hdf5_struct_t     hdf5;
+    hdf5_entry_t      entry;
+    struct benchmark *b[4];
+
+    if ((hdf5 = new_hdf5_struct(opts->path)) == NULL) {
+        return -1;
+    }
+    if ((entry = find_entry(hdf5, opts->dataset)) == NULL || IS_GROUP(entry)) {
+        free_hdf5_struct(hdf5);
+        return -1;
+    }
+    rows   = block_rows(entry);
+    blocks = (X_DIM(entry) + rows - 1) / rows;
+    b[0]   = new_benchmark("codec_eeg_encode", opts->repeats * (int) blocks);
+    b[1]   = new_benchmark("codec_eeg_decode", opts->repeats * (int) blocks);
+    b[2]   = new_benchmark("codec_deflate_encode",
+                           opts->repeats * (int) blocks);
+    b[3]   = new_benchmark("codec_deflate_decode",
+                           opts->repeats * (int) blocks);
+    nbytes = sizeof(double) * rows * Y_DIM(entry);
+    zbound = compressBound(nbytes);
+    raw      = (uint8_t *) malloc(nbytes);
+    shuffled = (uint8_t *) malloc(nbytes);
+    coded    = (uint8_t *) malloc(EEG_BOUND(nbytes) > zbound ? EEG_BOUND(nbytes)
+                                                             : zbound);
+    decoded  = (uint8_t *) malloc(nbytes);
+    if (b[0] == NULL || b[1] == NULL || b[2] == NULL || b[3] == NULL ||
+        raw == NULL || shuffled == NULL || coded == NULL || decoded == NULL) {
+        perror("malloc failed in bench_codecs()");
+        status = -1;
+    }
+
+    for (i = 0; i < opts->repeats && status == 0; i++) {
+        for (k = 0; k < blocks && status == 0; k++) {
+            count  = X_DIM(entry) - k * rows < rows ? X_DIM(entry) - k * rows
+                                                    : rows;
+            nbytes = sizeof(double) * count * Y_DIM(entry);
+            if (read_double_rows(entry, k * rows, count, (double *) raw) < 0) {
+                status = -1;
+                break;
+            }
+
+            start = now();
+            size  = eeg_encode(raw, nbytes, sizeof(double), Y_DIM(entry),
+                               coded);
+            add_run(b[0], now() - start, nbytes);
+            b[0]->stored += size;
+            start = now();
+            if (size == 0 ||
+                eeg_decode(coded, size, sizeof(double), Y_DIM(entry), decoded,
+                           nbytes) != nbytes) {
+                status = -1;
+            }
+            add_run(b[1], now() - start, nbytes);
+
+            start = now();
+            zsize = zbound;
+            shuffle_bytes(raw, shuffled, nbytes, sizeof(double), 0);
+            if (compress2(coded, &zsize, shuffled, nbytes, 4) != Z_OK) {
+                status = -1;
+            }
+            add_run(b[2], now() - start, nbytes);
+            b[2]->stored += zsize;
+            start  = now();
+            size   = zsize;
+            zsize  = nbytes;
+            if (uncompress(shuffled, &zsize, coded, size) != Z_OK) {
+                status = -1;
+            }
+            shuffle_bytes(shuffled, decoded, nbytes, sizeof(double), 1);
+            add_run(b[3], now() - start, nbytes);
+
+            if (status == 0 && memcmp(raw, decoded, nbytes) != 0) {
+                fprintf(stderr, "block %llu didn't round trip\n",
+                        (unsigned long long) k);
+                status = -1;
+            }
+        }
+    }
+
+    free(raw);
+    free(shuffled);
+    free(coded);
+    free(decoded);
+    free_hdf5_struct(hdf5);
+    return status;
+}
+
+/*
+ * Byte shuffle as the HDF5 shuffle filter does it: byte j of every element
+ * is stored together
+ * \param in the elements, or the shuffled bytes when reversing
+ * \param out the shuffled bytes, or the elements when reversing
+ * \param n the number of bytes, a multiple of size
+ * \param size the size of an element
+ * \param reverse nonzero to unshuffle
+ */
+static void shuffle_bytes(const uint8_t *in, uint8_t *out, size_t n,
+                          size_t size, int reverse) {
+    size_t i;
+    size_t j;
+    size_t elems = n / size;
+
+    for (i = 0; i < elems; i++) {
+        for (j = 0; j < size; j++) {
+            if (reverse) {
+                out[i * size + j] = in[j * elems + i];
+            } else {
+                out[j * elems + i] = in[i * size + j];
+            }
+        }
+    }
+}
+
+/*
+ * Evaluates every entry under a group and appends them to an array
+ * \param group the group to walk
+ * \param all the array of entries, grown as needed
+ * \param num_all the number of entries in the array
+ * \param capacity the size of the array
+ * \return the number of entries or -1 on failure
+ */
+static long walk(hdf5_entry_t group, hdf5_entry_t **all, long *num_all,
+                 long *capacity) {
+    hsize_t       i;
+    hdf5_entry_t  entry;
+    hdf5_entry_t *grown;
+
+    for (i = 0; i < NUM_ENTRY(group); i++) {
+        if ((entry = get_subentry(group, ENTRY_AT(group, i)->name)) == NULL) {
+            return -1;
+        }
+        if (*num_all == *capacity) {
+            *capacity = *capacity ? 2 * *capacity : 1024;
+            if ((grown = (hdf5_entry_t *)
+                         realloc(*all, sizeof(hdf5_entry_t) *
+                                       *capacity)) == NULL) {
+                perror("realloc failed in walk():all");
+                return -1;
+            }
+            *all = grown;
+        }
+        (*all)[(*num_all)++] = entry;
+        if (IS_GROUP(entry) && walk(entry, all, num_all, capacity) < 0) {
+            return -1;
+        }
+    }
+    return *num_all;
+}
+
+/*
+ * Adds a benchmark to the results
+ * \param name the name of the benchmark
+ * \param capacity the number of runs
+ * \return the benchmark or NULL on failure
+ */
+static struct benchmark *new_benchmark(const char *name, int capacity) {
+    struct benchmark *b = &benchmarks[num_benchmarks];
+
+    if (num_benchmarks == MAX_BENCHMARKS) {
+        fprintf(stderr, "too many benchmarks\n");
+        return NULL;
+    }
+    if ((b->seconds = (double *)
+                      malloc(sizeof(double) * (capacity ? capacity : 1))) ==
+        NULL) {
+        perror("malloc failed in new_benchmark():seconds");
+        return NULL;
+    }
+    b->name     = name;
+    b->runs     = 0;
+    b->capacity = capacity;
+    b->bytes    = 0;
+    b->stored   = 0;
+    num_benchmarks++;
+    return b;
+}
+
+static void add_run(struct benchmark *b, double seconds, double bytes) {
+    if (b->runs < b->capacity) {
+        b->seconds[b->runs++] = seconds;
+        b->bytes += bytes;
+    }
+}
+
+/*
+ * Writes the results as a JSON object
+ * \param opts the options of the run
+ * \param out the stream to write to
+ * \return 0 on success or -1 on failure
+ */
+static int write_results(const struct bench_options *opts, FILE *out) {
+    int               i;
+    int               j;
+    double            total;
+    struct benchmark *b;
+
+    fprintf(out, "{\n\"file\": \"%s\",\n\"dataset\": \"%s\",\n"
+            "\"threads\": %d,\n\"benchmarks\": [", opts->path, opts->dataset,
+            NUM_THREADS());
+    for (i = 0; i < num_benchmarks; i++) {
+        b     = &benchmarks[i];
+        total = 0;
+        for (j = 0; j < b->runs; j++) {
+            total += b->seconds[j];
+        }
+        qsort(b->seconds, b->runs, sizeof(double), compare_doubles);
+        fprintf(out,
+                "%s\n  {\"name\": \"%s\", \"runs\": %d, \"bytes\": %.0f, "
+                "\"total_s\": %.9f,\n   \"seconds\": {\"min\": %.9f, "
+                "\"mean\": %.9f, \"p50\": %.9f, \"p90\": %.9f, "
+                "\"p99\": %.9f, \"max\": %.9f},\n"
+                "   \"ops_per_s\": %.1f, \"mb_per_s\": %.1f",
+                i ? "," : "", b->name, b->runs, b->bytes, total,
+                percentile(b, 0), b->runs ? total / b->runs : 0,
+                percentile(b, 50), percentile(b, 90), percentile(b, 99),
+                percentile(b, 100), total > 0 ? b->runs / total : 0,
+                total > 0 ? b->bytes / total / 1e6 : 0);
+        if (b->stored > 0) {
+            fprintf(out, ", \"ratio\": %.3f", b->bytes / b->stored);
+        }
+        fprintf(out, "}");
+    }
+    fprintf(out, "\n],\n\"stats\": ");
+    stats_write_json(out);
+    fprintf(out, "}\n");
+    return ferror(out) ? -1 : 0;
+}
+
+static int compare_doubles(const void *a, const void *b) {
+    double x = *(const double *) a;
+    double y = *(const double *) b;
+    return (x > y) - (x < y);
+}
+
+/*
+ * Returns a percentile of the runs of a benchmark, by the nearest rank. The
+ * runs must be sorted.
+ * \param b the benchmark
+ * \param p the percentile, from 0 to 100
+ * \return the time in seconds, or 0 if there are no runs
+ */
+static double percentile(const struct benchmark *b, double p) {
+    int rank = (int) (p / 100.0 * b->runs + 0.999999);
+
+    if (b->runs == 0) {
+        return 0;
+    }
+    rank = rank < 1 ? 1 : rank > b->runs ? b->runs : rank;
+    return b->seconds[rank - 1];
+}
+
+static double now(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+/* xorshift64*, so the windows and lookups are the same from run to run */
+static uint64_t next_random(void) {
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return rng_state * 0x2545f4914f6cdd1dull;
+}
+
+static void usage(void) {
+    fprintf(stderr,
+            "usage: bench_hdf5_struct [-n repeats] [-w window_rows] "
+            "[-W windows]\n"
+            "                         [-l lookups] [-m small_writes] "
+            "[-p dataset]\n"
+            "                         [-s scratch.h5] [-o results.json] "
+            "[-t trace.json]\n"
+            "                         file.h5\n");
+}
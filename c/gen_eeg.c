@@ -0,0 +1,491 @@
+/*
+ * Generates a synthetic EEG recording in an HDF5 file, for benchmarks and
+ * tests.
+ *
+ *   gen_eeg [-c channels] [-s samples] [-t double|float|int32|int16]
+ *           [-k chunk_rows] [-z none|deflate|shuffle|eeg] [-l level]
+ *           [-g groups] [-d datasets] [-r srate] [-S seed] file.h5
+ *
+ * The file is laid out like the EEG structures written by the MATLAB side:
+ *
+ *   /EEG/data              samples x channels, in microvolts
+ *   /EEG/srate, nbchan, pnts
+ *   /EEG/setname
+ *   /EEG/channelLocations  a struct channel_locations per channel
+ *   /EEG/etc/groupNNNN/valueNNNN   `groups` groups of `datasets` small datasets
+ *
+ * The signal of each channel is a sum of delta, theta, alpha and beta
+ * oscillations with channel dependent phases, a slow drift and noise, so it
+ * compresses like real EEG rather than like random numbers or zeros. Every
+ * sample is computed from its row and column alone, so the blocks are filled
+ * in parallel and the output only depends on the seed. Integer types get the
+ * signal rounded to whole microvolts.
+ *
+ * Build with `make gen_eeg`.
+ */
+
+#define _XOPEN_SOURCE 700   // getopt
+
+#include <math.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "hdf5.h"
+#include "hdf5_hl.h"
+#include "channel_locations.h"
+#include "hdf5_eeg_filter.h"
+#include "hdf5_struct.h"
+
+#define NUM_BANDS          4
+#define SMALL_DATASET_LEN  16   // doubles in each of the fan-out datasets
+#define NUM_CHANLOC_FIELDS 12
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+/* options of the generated file */
+struct gen_options {
+    hsize_t channels;
+    hsize_t samples;
+    hid_t   type;        // type of /EEG/data in the file
+    bool    integer;     // whether the type is an integer type
+    hsize_t chunk_rows;  // 0 for a contiguous dataset
+    int     compression; // one of the COMPRESSION_* below
+    int     level;       // deflate level
+    int     groups;
+    int     datasets;    // datasets per group
+    double  srate;
+    uint64_t seed;
+};
+
+#define COMPRESSION_NONE    0
+#define COMPRESSION_DEFLATE 1
+#define COMPRESSION_SHUFFLE 2   // shuffle and deflate
+#define COMPRESSION_EEG     3
+
+static const double band_hz[NUM_BANDS]  = {2.0, 6.0, 10.0, 20.0};
+static const double band_amp[NUM_BANDS] = {20.0, 10.0, 15.0, 4.0};
+
+/* helper functions */
+static int parse_options(int argc, char **argv, struct gen_options *opts);
+static int write_metadata(const char *path, const struct gen_options *opts);
+static int write_channel_locations(hid_t group, hsize_t channels);
+static int write_fan_out(hid_t group, const struct gen_options *opts);
+static int write_data(const char *path, const struct gen_options *opts);
+static double sample(const struct gen_options *opts, hsize_t row, hsize_t col);
+static uint64_t mix(uint64_t x);
+static void usage(void);
+
+int main(int argc, char **argv) {
+    struct gen_options opts;
+
+    if (parse_options(argc, argv, &opts) < 0) {
+        usage();
+        return 1;
+    }
+    if (write_metadata(argv[optind], &opts) < 0 ||
+        write_data(argv[optind], &opts) < 0) {
+        return 1;
+    }
+    return 0;
+}
+
+/*
+ * Reads the command line into a struct gen_options, with the defaults for the
+ * options that aren't given: 64 channels, 10 minutes at 256 Hz, doubles in
+ * chunks of 4096 rows, no compression and 16 groups of 16 datasets.
+ * \param argc the number of arguments
+ * \param argv the arguments
+ * \param opts where to return the options
+ * \return 0 on success or -1 if the command line is invalid
+ */
+static int parse_options(int argc, char **argv, struct gen_options *opts) {
+    int c;
+
+    opts->channels    = 64;
+    opts->samples     = 600 * 256;
+    opts->type        = H5T_NATIVE_DOUBLE;
+    opts->chunk_rows  = 4096;
+    opts->compression = COMPRESSION_NONE;
+    opts->level       = 4;
+    opts->groups      = 16;
+    opts->datasets    = 16;
+    opts->srate       = 256.0;
+    opts->seed        = 1;
+
+    while ((c = getopt(argc, argv, "c:s:t:k:z:l:g:d:r:S:")) != -1) {
+        switch (c) {
+            case 'c':
+                opts->channels = strtoull(optarg, NULL, 10);
+                break;
+            case 's':
+                opts->samples = strtoull(optarg, NULL, 10);
+                break;
+            case 't':
+                if (strcmp(optarg, "double") == 0) {
+                    opts->type = H5T_NATIVE_DOUBLE;
+                } else if (strcmp(optarg, "float") == 0) {
+                    opts->type = H5T_NATIVE_FLOAT;
+                } else if (strcmp(optarg, "int32") == 0) {
+                    opts->type = H5T_NATIVE_INT;
+                } else if (strcmp(optarg, "int16") == 0) {
+                    opts->type = H5T_NATIVE_SHORT;
+                } else {
+                    return -1;
+                }
+                break;
+            case 'k':
+                opts->chunk_rows = strtoull(optarg, NULL, 10);
+                break;
+            case 'z':
+                if (strcmp(optarg, "none") == 0) {
+                    opts->compression = COMPRESSION_NONE;
+                } else if (strcmp(optarg, "deflate") == 0) {
+                    opts->compression = COMPRESSION_DEFLATE;
+                } else if (strcmp(optarg, "shuffle") == 0) {
+                    opts->compression = COMPRESSION_SHUFFLE;
+                } else if (strcmp(optarg, "eeg") == 0) {
+                    opts->compression = COMPRESSION_EEG;
+                } else {
+                    return -1;
+                }
+                break;
+            case 'l':
+                opts->level = atoi(optarg);
+                break;
+            case 'g':
+                opts->groups = atoi(optarg);
+                break;
+            case 'd':
+                opts->datasets = atoi(optarg);
+                break;
+            case 'r':
+                opts->srate = atof(optarg);
+                break;
+            case 'S':
+                opts->seed = strtoull(optarg, NULL, 10);
+                break;
+            default:
+                return -1;
+        }
+    }
+    if (optind != argc - 1 || opts->channels == 0 || opts->samples == 0 ||
+        opts->groups < 0 || opts->datasets < 0 || opts->srate <= 0) {
+        return -1;
+    }
+    if (opts->compression != COMPRESSION_NONE && opts->chunk_rows == 0) {
+        printf("compression needs a chunked dataset, see -k\n");
+        return -1;
+    }
+    opts->integer = H5Tget_class(opts->type) == H5T_INTEGER;
+    if (opts->chunk_rows > opts->samples) {
+        opts->chunk_rows = opts->samples;
+    }
+    return 0;
+}
+
+/*
+ * Creates the file with everything but /EEG/data
+ * \param path the file to create, replaced if it exists
+ * \param opts the options of the file
+ * \return 0 on success or -1 on failure
+ */
+static int write_metadata(const char *path, const struct gen_options *opts) {
+    int    status = 0;
+    hid_t  file;
+    hid_t  eeg;
+    double value;
+    hsize_t dims[1] = {1};
+
+    if ((file = H5Fcreate(path, H5F_ACC_TRUNC, H5P_DEFAULT,
+                          H5P_DEFAULT)) < 0) {
+        printf("failed to create %s\n", path);
+        return -1;
+    }
+    if ((eeg = H5Gcreate(file, "EEG", H5P_DEFAULT, H5P_DEFAULT,
+                         H5P_DEFAULT)) < 0) {
+        printf("failed to create /EEG in %s\n", path);
+        H5Fclose(file);
+        return -1;
+    }
+
+    value = opts->srate;
+    status |= H5LTmake_dataset_double(eeg, "srate", 1, dims, &value);
+    value = (double) opts->channels;
+    status |= H5LTmake_dataset_double(eeg, "nbchan", 1, dims, &value);
+    value = (double) opts->samples;
+    status |= H5LTmake_dataset_double(eeg, "pnts", 1, dims, &value);
+    status |= H5LTmake_dataset_string(eeg, "setname", "synthetic EEG");
+    if (status < 0 || write_channel_locations(eeg, opts->channels) < 0 ||
+        write_fan_out(eeg, opts) < 0) {
+        printf("failed to write the metadata of %s\n", path);
+        status = -1;
+    }
+
+    H5Gclose(eeg);
+    H5Fclose(file);
+    return status < 0 ? -1 : 0;
+}
+
+/*
+ * Writes /EEG/channelLocations, with the channels spread evenly over the upper
+ * half of a unit sphere and the polar coordinates EEGLAB derives from them
+ * \param group /EEG
+ * \param channels the number of channels
+ * \return 0 on success or -1 on failure
+ */
+static int write_channel_locations(hid_t group, hsize_t channels) {
+    int     status = 0;
+    hsize_t i;
+    hid_t   str_type;
+    double  z;
+    double  r;
+    double  azimuth;
+    struct channel_locations *locs;
+
+    const char *names[NUM_CHANLOC_FIELDS] = {
+        "labels", "type", "theta", "radius", "X", "Y", "Z", "sph_theta",
+        "sph_phi", "sph_radius", "urchan", "ref"
+    };
+    const size_t offsets[NUM_CHANLOC_FIELDS] = {
+        offsetof(struct channel_locations, labels),
+        offsetof(struct channel_locations, type),
+        offsetof(struct channel_locations, theta),
+        offsetof(struct channel_locations, radius),
+        offsetof(struct channel_locations, X),
+        offsetof(struct channel_locations, Y),
+        offsetof(struct channel_locations, Z),
+        offsetof(struct channel_locations, sph_theta),
+        offsetof(struct channel_locations, sph_phi),
+        offsetof(struct channel_locations, sph_radius),
+        offsetof(struct channel_locations, urchan),
+        offsetof(struct channel_locations, ref)
+    };
+    hid_t types[NUM_CHANLOC_FIELDS];
+
+    if ((locs = (struct channel_locations *)
+                calloc(channels, sizeof(struct channel_locations))) == NULL) {
+        perror("malloc failed in write_channel_locations():locs");
+        return -1;
+    }
+    for (i = 0; i < channels; i++) {
+        // a Fibonacci spiral from the vertex down to the ears
+        z       = 1.0 - (i + 0.5) / channels;
+        r       = sqrt(1.0 - z * z);
+        azimuth = i * M_PI * (3.0 - sqrt(5.0));
+
+        locs[i].labels     = (char *) malloc(24);
+        locs[i].type       = "EEG";
+        locs[i].ref        = "average";
+        if (locs[i].labels == NULL) {
+            perror("malloc failed in write_channel_locations():labels");
+            status = -1;
+            goto done;
+        }
+        snprintf(locs[i].labels, 24, "E%llu", (unsigned long long) i + 1);
+        locs[i].X          = r * cos(azimuth);
+        locs[i].Y          = r * sin(azimuth);
+        locs[i].Z          = z;
+        locs[i].sph_theta  = atan2(locs[i].Y, locs[i].X) * 180.0 / M_PI;
+        locs[i].sph_phi    = asin(z) * 180.0 / M_PI;
+        locs[i].sph_radius = 1.0;
+        locs[i].theta      = -locs[i].sph_theta;
+        locs[i].radius     = 0.5 - locs[i].sph_phi / 180.0;
+        locs[i].urchan     = (double) (i + 1);
+    }
+
+    str_type = H5Tcopy(H5T_C_S1);
+    H5Tset_size(str_type, H5T_VARIABLE);
+    for (i = 0; i < NUM_CHANLOC_FIELDS; i++) {
+        types[i] = H5T_NATIVE_DOUBLE;
+    }
+    types[0] = types[1] = types[NUM_CHANLOC_FIELDS - 1] = str_type;
+
+    status = H5TBmake_table("channelLocations", group, "channelLocations",
+                            NUM_CHANLOC_FIELDS, channels,
+                            sizeof(struct channel_locations), names, offsets,
+                            types, channels, NULL, 0, locs);
+    H5Tclose(str_type);
+
+done:
+    for (i = 0; i < channels; i++) {
+        free(locs[i].labels);
+    }
+    free(locs);
+    return status < 0 ? -1 : 0;
+}
+
+/*
+ * Writes /EEG/etc with `groups` groups of `datasets` small double datasets,
+ * like the nested structs of a processing pipeline's output
+ * \param group /EEG
+ * \param opts the options of the file
+ * \return 0 on success or -1 on failure
+ */
+static int write_fan_out(hid_t group, const struct gen_options *opts) {
+    int     g;
+    int     d;
+    int     i;
+    int     status = 0;
+    char    name[MAX_LEN];
+    double  values[SMALL_DATASET_LEN];
+    hid_t   etc;
+    hid_t   sub;
+    hsize_t dims[1] = {SMALL_DATASET_LEN};
+
+    if ((etc = H5Gcreate(group, "etc", H5P_DEFAULT, H5P_DEFAULT,
+                         H5P_DEFAULT)) < 0) {
+        return -1;
+    }
+    for (g = 0; g < opts->groups && status >= 0; g++) {
+        snprintf(name, MAX_LEN, "group%04d", g);
+        if ((sub = H5Gcreate(etc, name, H5P_DEFAULT, H5P_DEFAULT,
+                             H5P_DEFAULT)) < 0) {
+            status = -1;
+            break;
+        }
+        for (d = 0; d < opts->datasets && status >= 0; d++) {
+            for (i = 0; i < SMALL_DATASET_LEN; i++) {
+                values[i] = sample(opts, (hsize_t) d * SMALL_DATASET_LEN + i,
+                                   (hsize_t) g);
+            }
+            snprintf(name, MAX_LEN, "value%04d", d);
+            status = H5LTmake_dataset_double(sub, name, 1, dims, values);
+        }
+        H5Gclose(sub);
+    }
+    H5Gclose(etc);
+    return status < 0 ? -1 : 0;
+}
+
+/*
+ * Creates /EEG/data and fills it a block of rows at a time through
+ * write_double_rows, so the recording doesn't have to fit in memory
+ * \param path the file created by write_metadata
+ * \param opts the options of the file
+ * \return 0 on success or -1 on failure
+ */
+static int write_data(const char *path, const struct gen_options *opts) {
+    int           status = 0;
+    long long     row;
+    hsize_t       start;
+    hsize_t       count;
+    hsize_t       rows;
+    hsize_t       col;
+    hsize_t       dims[2]  = {opts->samples, opts->channels};
+    hsize_t       chunk[2] = {opts->chunk_rows, opts->channels};
+    hid_t         plist;
+    double       *buf;
+    hdf5_struct_t hdf5;
+    hdf5_entry_t  eeg;
+    hdf5_entry_t  data;
+
+    if ((hdf5 = new_hdf5_struct(path)) == NULL) {
+        return -1;
+    }
+    if ((eeg = get_entry(hdf5, "EEG")) == NULL) {
+        free_hdf5_struct(hdf5);
+        return -1;
+    }
+
+    plist = H5Pcreate(H5P_DATASET_CREATE);
+    if (opts->chunk_rows > 0) {
+        H5Pset_chunk(plist, 2, chunk);
+    }
+    switch (opts->compression) {
+        case COMPRESSION_SHUFFLE:
+            H5Pset_shuffle(plist);
+            /* fall through */
+        case COMPRESSION_DEFLATE:
+            H5Pset_deflate(plist, opts->level);
+            break;
+        case COMPRESSION_EEG:
+            status = set_eeg_filter(plist);
+            break;
+    }
+    data = status < 0 ? NULL : create_dataset(eeg, "data", opts->type, 2, dims,
+                                              plist);
+    H5Pclose(plist);
+    if (data == NULL) {
+        free_hdf5_struct(hdf5);
+        return -1;
+    }
+
+    rows = block_rows(data);
+    if ((buf = (double *) malloc(sizeof(double) * rows *
+                                 opts->channels)) == NULL) {
+        perror("malloc failed in write_data():buf");
+        free_hdf5_struct(hdf5);
+        return -1;
+    }
+    for (start = 0; start < opts->samples && status >= 0; start += count) {
+        count = opts->samples - start < rows ? opts->samples - start : rows;
+        #pragma omp parallel for private(col)
+        for (row = 0; row < (long long) count; row++) {
+            for (col = 0; col < opts->channels; col++) {
+                buf[row * opts->channels + col] =
+                    sample(opts, start + row, col);
+            }
+        }
+        status = write_double_rows(data, start, count, buf);
+    }
+
+    free(buf);
+    free_hdf5_struct(hdf5);
+    return status;
+}
+
+/*
+ * Computes a sample of the synthetic signal
+ * \param opts the options of the file
+ * \param row the sample
+ * \param col the channel
+ * \return the sample in microvolts
+ */
+static double sample(const struct gen_options *opts, hsize_t row, hsize_t col) {
+    int      b;
+    double   t     = row / opts->srate;
+    double   value = 0;
+    uint64_t h     = mix(opts->seed ^ mix(row * 0x9e3779b97f4a7c15ull + col));
+
+    for (b = 0; b < NUM_BANDS; b++) {
+        value += band_amp[b] *
+                 sin(2 * M_PI * band_hz[b] * t + 0.37 * (col + 1) * (b + 1));
+    }
+    value += 30.0 * sin(2 * M_PI * 0.05 * t + col);
+    // uniform noise in [-5, 5)
+    value += 10.0 * ((h >> 11) * (1.0 / 9007199254740992.0) - 0.5);
+    if (opts->integer) {
+        value = floor(value + 0.5);
+    }
+    return value;
+}
+
+/*
+ * The finalizer of SplitMix64, which turns a counter into random bits
+ * \param x the value to mix
+ * \return the mixed value
+ */
+static uint64_t mix(uint64_t x) {
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9ull;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111ebull;
+    x ^= x >> 31;
+    return x;
+}
+
+static void usage(void) {
+    fprintf(stderr,
+            "usage: gen_eeg [-c channels] [-s samples] "
+            "[-t double|float|int32|int16]\n"
+            "               [-k chunk_rows] [-z none|deflate|shuffle|eeg] "
+            "[-l level]\n"
+            "               [-g groups] [-d datasets] [-r srate] [-S seed] "
+            "file.h5\n");
+}
@@ -0,0 +1,68 @@
+/*
+ * Exports a dataset of an HDF5 file as raw binary, .npy or CSV.
+ *
+ *   h5export [-f raw|npy|csv] file.h5 group/dataset [output]
+ *
+ * The output goes to stdout if no output file is given, and errors to stderr.
+ * The file is opened read-only. Build with `make h5export`.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "hdf5_export.h"
+#include "hdf5_struct.h"
+
+/* helper functions */
+static void usage(void);
+
+int main(int argc, char **argv) {
+    int           i      = 1;
+    int           status = 0;
+    int           format = EXPORT_CSV;
+    hdf5_struct_t hdf5;
+    hdf5_entry_t  entry;
+
+    if (argc > 2 && strcmp(argv[1], "-f") == 0) {
+        if (strcmp(argv[2], "raw") == 0) {
+            format = EXPORT_RAW;
+        } else if (strcmp(argv[2], "npy") == 0) {
+            format = EXPORT_NPY;
+        } else if (strcmp(argv[2], "csv") == 0) {
+            format = EXPORT_CSV;
+        } else {
+            usage();
+            return 1;
+        }
+        i = 3;
+    }
+    if (argc - i < 2 || argc - i > 3) {
+        usage();
+        return 1;
+    }
+
+    if ((hdf5 = new_hdf5_struct_readonly(argv[i])) == NULL) {
+        return 1;
+    }
+    if ((entry = find_entry(hdf5, argv[i + 1])) == NULL) {
+        fprintf(stderr, "no dataset %s in %s\n", argv[i + 1], argv[i]);
+        free_hdf5_struct(hdf5);
+        return 1;
+    }
+
+    if (argc - i == 3) {
+        status = export_dataset(entry, argv[i + 2], format);
+    } else {
+        setvbuf(stdout, NULL, _IOFBF, EXPORT_BUF_BYTES);
+        status = export_stream(entry, stdout, format);
+        fflush(stdout);
+    }
+
+    free_hdf5_struct(hdf5);
+    return status < 0 ? 1 : 0;
+}
+
+static void usage(void) {
+    fprintf(stderr,
+            "usage: h5export [-f raw|npy|csv] file.h5 group/dataset [output]\n");
+}
@@ -0,0 +1,406 @@
+/*
+ * Asynchronous reads and writes of blocks of rows.
+ *
+ * Requests are handed to a worker thread which makes all the HDF5 calls, so the
+ * thread submitting them never blocks on I/O unless `depth` requests are
+ * already in flight. The worker holds the HDF5 lock only while it reads or
+ * writes, so other threads can use the file between requests. A request stays
+ * in flight until it's reaped, either by poll_io_queue, by wait_request or, for
+ * requests with a callback, right after the callback returns.
+ *
+ * Completed requests can be found by polling, by waiting on the file descriptor
+ * returned by io_queue_fd (an eventfd on Linux) or through callbacks.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "hdf5_async.h"
+
+#ifdef __linux__
+#include <sys/eventfd.h>
+#endif
+
+/* helper functions */
+static void *run_worker(void *arg);
+static void push_request(hdf5_request_t *head, hdf5_request_t *tail,
+                         hdf5_request_t req);
+static bool remove_request(hdf5_request_t *head, hdf5_request_t *tail,
+                           hdf5_request_t req);
+static void complete_request(hdf5_io_queue_t queue, hdf5_request_t req);
+
+/*
+ * Starts an I/O worker.
+ * \param depth the maximum number of requests in flight, IO_QUEUE_DEPTH if 0
+ * \return a hdf5_io_queue_t or NULL on failure
+ */
+hdf5_io_queue_t new_io_queue(int depth) {
+    hdf5_io_queue_t queue;
+
+    if ((queue = (hdf5_io_queue_t)
+                 calloc(1, sizeof(struct hdf5_io_queue))) == NULL) {
+        perror("malloc failed in new_io_queue():queue");
+        return NULL;
+    }
+    queue->depth    = depth > 0 ? depth : IO_QUEUE_DEPTH;
+    queue->event_fd = -1;
+#ifdef __linux__
+    if ((queue->event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0) {
+        perror("eventfd failed in new_io_queue()");
+    }
+#endif
+    pthread_mutex_init(&queue->lock, NULL);
+    pthread_cond_init(&queue->changed, NULL);
+    if (pthread_create(&queue->worker, NULL, run_worker, queue) != 0) {
+        perror("failed to start I/O worker");
+        pthread_cond_destroy(&queue->changed);
+        pthread_mutex_destroy(&queue->lock);
+        if (queue->event_fd >= 0) {
+            close(queue->event_fd);
+        }
+        free(queue);
+        return NULL;
+    }
+
+    return queue;
+}
+
+/*
+ * Waits for the submitted requests to finish, stops the worker and frees the
+ * queue. Requests that were never reaped belong to whoever submitted them and
+ * still have to be freed with free_request, their status is final.
+ * \param queue the hdf5_io_queue_t to free
+ */
+void free_io_queue(hdf5_io_queue_t queue) {
+    pthread_mutex_lock(&queue->lock);
+    queue->stopping = true;
+    pthread_cond_broadcast(&queue->changed);
+    pthread_mutex_unlock(&queue->lock);
+    pthread_join(queue->worker, NULL);
+
+    if (queue->event_fd >= 0) {
+        close(queue->event_fd);
+    }
+    pthread_cond_destroy(&queue->changed);
+    pthread_mutex_destroy(&queue->lock);
+    free(queue);
+}
+
+/*
+ * Submits a read of `count` rows starting at row `start`. `buf` must not be
+ * touched until the request completes.
+ * \param queue the queue to submit to
+ * \param entry the dataset to read from
+ * \param start the first row to read
+ * \param count the number of rows to read
+ * \param buf a buffer of at least count * Y_DIM(entry) doubles
+ * \param req set to the submitted request
+ * \return 0 on success or -1 on failure
+ */
+int read_async(hdf5_io_queue_t queue,
+               hdf5_entry_t    entry,
+               hsize_t         start,
+               hsize_t         count,
+               double         *buf,
+               hdf5_request_t *req) {
+    return submit_request(queue, REQUEST_READ, entry, start, count, buf, NULL,
+                          NULL, req);
+}
+
+/*
+ * Submits a write of `count` rows starting at row `start`. `buf` must not be
+ * changed until the request completes.
+ * \param queue the queue to submit to
+ * \param entry the dataset to write to
+ * \param start the first row to write
+ * \param count the number of rows to write
+ * \param buf a buffer of count * Y_DIM(entry) doubles
+ * \param req set to the submitted request
+ * \return 0 on success or -1 on failure
+ */
+int write_async(hdf5_io_queue_t queue,
+                hdf5_entry_t    entry,
+                hsize_t         start,
+                hsize_t         count,
+                const double   *buf,
+                hdf5_request_t *req) {
+    return submit_request(queue, REQUEST_WRITE, entry, start, count,
+                          (double *) buf, NULL, NULL, req);
+}
+
+/*
+ * Submits a request, blocking while the queue already has `depth` requests in
+ * flight. Requests with a callback are freed once the callback returns and are
+ * never returned by poll_io_queue, so there's no handle to them: the worker
+ * could free one before the caller got to use it.
+ * \param queue the queue to submit to
+ * \param op REQUEST_READ or REQUEST_WRITE
+ * \param entry the dataset to read from or write to
+ * \param start the first row
+ * \param count the number of rows
+ * \param buf a buffer of count * Y_DIM(entry) doubles
+ * \param callback called on the worker when the request completes, or NULL
+ * \param arg passed to callback
+ * \param req set to the submitted request, NULL if and only if there's a
+ *            callback
+ * \return 0 on success or -1 on failure
+ */
+int submit_request(hdf5_io_queue_t queue,
+                   int             op,
+                   hdf5_entry_t    entry,
+                   hsize_t         start,
+                   hsize_t         count,
+                   double         *buf,
+                   hdf5_callback_t callback,
+                   void           *arg,
+                   hdf5_request_t *req) {
+    hdf5_request_t new_req;
+
+    if (IS_GROUP(entry) || (req == NULL) == (callback == NULL)) {
+        return -1;
+    }
+    if ((new_req = (hdf5_request_t)
+                   calloc(1, sizeof(struct hdf5_request))) == NULL) {
+        perror("malloc failed in submit_request():new_req");
+        return -1;
+    }
+    new_req->op       = op;
+    new_req->status   = REQUEST_PENDING;
+    new_req->entry    = entry;
+    new_req->start    = start;
+    new_req->count    = count;
+    new_req->buf      = buf;
+    new_req->callback = callback;
+    new_req->arg      = arg;
+
+    pthread_mutex_lock(&queue->lock);
+    while (queue->in_flight >= queue->depth && !queue->stopping) {
+        pthread_cond_wait(&queue->changed, &queue->lock);
+    }
+    if (queue->stopping) {
+        pthread_mutex_unlock(&queue->lock);
+        free(new_req);
+        return -1;
+    }
+    // the handle is set before the worker can see the request
+    if (req != NULL) {
+        *req = new_req;
+    }
+    queue->in_flight++;
+    push_request(&queue->pending, &queue->pending_tail, new_req);
+    pthread_cond_broadcast(&queue->changed);
+    pthread_mutex_unlock(&queue->lock);
+    return 0;
+}
+
+/*
+ * Reaps a completed request without blocking. Check its status to see whether
+ * it succeeded, then free it with free_request.
+ * \param queue the queue to poll
+ * \return a completed request or NULL if none are done
+ */
+hdf5_request_t poll_io_queue(hdf5_io_queue_t queue) {
+    hdf5_request_t req;
+
+    pthread_mutex_lock(&queue->lock);
+    if ((req = queue->done) != NULL) {
+        remove_request(&queue->done, &queue->done_tail, req);
+        queue->in_flight--;
+        pthread_cond_broadcast(&queue->changed);
+    }
+#ifdef __linux__
+    if (queue->done == NULL && queue->event_fd >= 0) {
+        eventfd_t value;
+        eventfd_read(queue->event_fd, &value);
+    }
+#endif
+    pthread_mutex_unlock(&queue->lock);
+
+    return req;
+}
+
+/*
+ * Blocks until a request completes and reaps it. The request still has to be
+ * freed with free_request.
+ * \param queue the queue the request was submitted to
+ * \param req the request to wait for
+ * \return 0 if the request succeeded or -1 if it failed or was cancelled
+ */
+int wait_request(hdf5_io_queue_t queue, hdf5_request_t req) {
+    pthread_mutex_lock(&queue->lock);
+    while (req->status < REQUEST_DONE) {
+        pthread_cond_wait(&queue->changed, &queue->lock);
+    }
+    if (remove_request(&queue->done, &queue->done_tail, req)) {
+        queue->in_flight--;
+        pthread_cond_broadcast(&queue->changed);
+    }
+#ifdef __linux__
+    if (queue->done == NULL && queue->event_fd >= 0) {
+        eventfd_t value;
+        eventfd_read(queue->event_fd, &value);
+    }
+#endif
+    pthread_mutex_unlock(&queue->lock);
+
+    return req->status == REQUEST_DONE ? 0 : -1;
+}
+
+/*
+ * Cancels a request. Only requests the worker hasn't started can be cancelled,
+ * they complete with the REQUEST_CANCELLED status.
+ * \param queue the queue the request was submitted to
+ * \param req the request to cancel
+ * \return 0 if the request was cancelled or -1 if it already started
+ */
+int cancel_request(hdf5_io_queue_t queue, hdf5_request_t req) {
+    int status = -1;
+
+    pthread_mutex_lock(&queue->lock);
+    if (req->status == REQUEST_PENDING &&
+        remove_request(&queue->pending, &queue->pending_tail, req)) {
+        req->status = REQUEST_CANCELLED;
+        complete_request(queue, req);
+        status = 0;
+    }
+    pthread_mutex_unlock(&queue->lock);
+
+    return status;
+}
+
+/*
+ * Returns a file descriptor that becomes readable when a request completes and
+ * stays readable until poll_io_queue has reaped every completed request. It can
+ * be passed to poll, select or epoll but must not be read or closed.
+ * \param queue the queue
+ * \return the file descriptor or -1 if the platform has no eventfd
+ */
+int io_queue_fd(const hdf5_io_queue_t queue) {
+    return queue->event_fd;
+}
+
+/*
+ * Frees a request returned by poll_io_queue or passed to wait_request
+ * \param req the request to free
+ */
+void free_request(hdf5_request_t req) {
+    free(req);
+}
+
+/*******************************************************************************
+ *                              Helper functions
+ ******************************************************************************/
+
+/*
+ * The I/O worker. Runs the pending requests in submission order until the queue
+ * is stopped and empty.
+ * \param arg the hdf5_io_queue_t
+ * \return NULL
+ */
+static void *run_worker(void *arg) {
+    int             status;
+    hdf5_request_t  req;
+    hdf5_io_queue_t queue = (hdf5_io_queue_t) arg;
+
+    pthread_mutex_lock(&queue->lock);
+    for (;;) {
+        while (queue->pending == NULL && !queue->stopping) {
+            pthread_cond_wait(&queue->changed, &queue->lock);
+        }
+        if ((req = queue->pending) == NULL) {
+            break;
+        }
+        remove_request(&queue->pending, &queue->pending_tail, req);
+        req->status = REQUEST_RUNNING;
+        pthread_mutex_unlock(&queue->lock);
+
+        if (req->op == REQUEST_READ) {
+            status = read_double_rows(req->entry, req->start, req->count,
+                                      req->buf);
+        } else {
+            status = write_double_rows(req->entry, req->start, req->count,
+                                       req->buf);
+        }
+
+        pthread_mutex_lock(&queue->lock);
+        req->status = status < 0 ? REQUEST_FAILED : REQUEST_DONE;
+        complete_request(queue, req);
+    }
+    pthread_mutex_unlock(&queue->lock);
+
+    return NULL;
+}
+
+/*
+ * Hands a completed request to its callback or to the done list. Must be called
+ * with the queue locked; the lock is released while the callback runs.
+ * \param queue the queue the request was submitted to
+ * \param req the completed request
+ */
+static void complete_request(hdf5_io_queue_t queue, hdf5_request_t req) {
+    if (req->callback != NULL) {
+        pthread_mutex_unlock(&queue->lock);
+        req->callback(req, req->arg);
+        pthread_mutex_lock(&queue->lock);
+        queue->in_flight--;
+        free(req);
+    } else {
+        push_request(&queue->done, &queue->done_tail, req);
+#ifdef __linux__
+        if (queue->event_fd >= 0) {
+            eventfd_write(queue->event_fd, 1);
+        }
+#endif
+    }
+    pthread_cond_broadcast(&queue->changed);
+}
+
+/*
+ * Appends a request to a list
+ * \param head the first request of the list
+ * \param tail the last request of the list
+ * \param req the request to append
+ */
+static void push_request(hdf5_request_t *head,
+                         hdf5_request_t *tail,
+                         hdf5_request_t  req) {
+    req->next = NULL;
+    if (*tail != NULL) {
+        (*tail)->next = req;
+    } else {
+        *head = req;
+    }
+    *tail = req;
+}
+
+/*
+ * Removes a request from a list
+ * \param head the first request of the list
+ * \param tail the last request of the list
+ * \param req the request to remove
+ * \return true if the request was in the list
+ */
+static bool remove_request(hdf5_request_t *head,
+                           hdf5_request_t *tail,
+                           hdf5_request_t  req) {
+    hdf5_request_t prev = NULL;
+    hdf5_request_t cur;
+
+    for (cur = *head; cur != NULL && cur != req; cur = cur->next) {
+        prev = cur;
+    }
+    if (cur == NULL) {
+        return false;
+    }
+    if (prev != NULL) {
+        prev->next = cur->next;
+    } else {
+        *head = cur->next;
+    }
+    if (*tail == cur) {
+        *tail = prev;
+    }
+    cur->next = NULL;
+    return true;
+}
@@ -0,0 +1,114 @@
+#ifndef _HDF5_ASYNC_H_
+#define _HDF5_ASYNC_H_
+
+#include <pthread.h>
+#include "hdf5_struct.h"
+
+#define IO_QUEUE_DEPTH    16   // default number of requests in flight
+
+// operations
+#define REQUEST_READ      0
+#define REQUEST_WRITE     1
+
+// states of a request
+#define REQUEST_PENDING   0
+#define REQUEST_RUNNING   1
+#define REQUEST_DONE      2
+#define REQUEST_FAILED    3
+#define REQUEST_CANCELLED 4
+
+typedef struct hdf5_request *hdf5_request_t;
+
+/*
+ * Called on the I/O worker when a request completes
+ */
+typedef void (*hdf5_callback_t)(hdf5_request_t req, void *arg);
+
+/*
+ * A read or write of a block of rows submitted to an hdf5_io_queue_t
+ */
+struct hdf5_request {
+    int             op;        // REQUEST_READ or REQUEST_WRITE
+    int             status;    // one of the REQUEST_* states
+    hdf5_entry_t    entry;     // the dataset to read or write
+    hsize_t         start;     // the first row
+    hsize_t         count;     // the number of rows
+    double         *buf;       // count * Y_DIM(entry) doubles
+    hdf5_callback_t callback;  // called on completion or NULL
+    void           *arg;       // passed to callback
+    struct hdf5_request *next; // next request in the pending or done list
+};
+
+/*
+ * An I/O worker thread and its completion queue. The worker is the only thread
+ * making HDF5 calls for the requests submitted to it.
+ */
+typedef struct hdf5_io_queue {
+    pthread_t       worker;     // the thread running the requests
+    pthread_mutex_t lock;       // protects everything below
+    pthread_cond_t  changed;    // signalled on submission and completion
+    int             depth;      // maximum number of requests in flight
+    int             in_flight;  // submitted and not yet reaped
+    bool            stopping;   // set by free_io_queue
+    int             event_fd;   // readable while requests are done, or -1
+    hdf5_request_t  pending;    // requests waiting for the worker
+    hdf5_request_t  pending_tail;
+    hdf5_request_t  done;       // completed requests waiting to be reaped
+    hdf5_request_t  done_tail;
+} *hdf5_io_queue_t;
+
+/*
+ * Starts an I/O worker with at most `depth` requests in flight
+ */
+hdf5_io_queue_t new_io_queue(int depth);
+
+/*
+ * Finishes the submitted requests, stops the worker and frees the queue
+ */
+void free_io_queue(hdf5_io_queue_t queue);
+
+/*
+ * Submits a read of a block of rows
+ */
+int read_async(hdf5_io_queue_t queue, hdf5_entry_t entry, hsize_t start,
+               hsize_t count, double *buf, hdf5_request_t *req);
+
+/*
+ * Submits a write of a block of rows
+ */
+int write_async(hdf5_io_queue_t queue, hdf5_entry_t entry, hsize_t start,
+                hsize_t count, const double *buf, hdf5_request_t *req);
+
+/*
+ * Submits a read or write that calls `callback` when it completes
+ */
+int submit_request(hdf5_io_queue_t queue, int op, hdf5_entry_t entry,
+                   hsize_t start, hsize_t count, double *buf,
+                   hdf5_callback_t callback, void *arg, hdf5_request_t *req);
+
+/*
+ * Returns a completed request or NULL if none are done
+ */
+hdf5_request_t poll_io_queue(hdf5_io_queue_t queue);
+
+/*
+ * Blocks until a request completes and reaps it
+ */
+int wait_request(hdf5_io_queue_t queue, hdf5_request_t req);
+
+/*
+ * Cancels a request that hasn't started yet
+ */
+int cancel_request(hdf5_io_queue_t queue, hdf5_request_t req);
+
+/*
+ * Returns a file descriptor that is readable while requests are done, or -1
+ */
+int io_queue_fd(const hdf5_io_queue_t queue);
+
+/*
+ * Frees a reaped request
+ */
+void free_request(hdf5_request_t req);
+
+#endif
@@ -0,0 +1,615 @@
+/*
+ * Batched writes of nested groups, datasets and attributes, for dumping
+ * structures like writeStructure.m does in MATLAB.
+ *
+ * A batch is a description of the tree to write, built in memory without
+ * touching the file. commit_batch then writes the whole tree under the HDF5
+ * lock in one depth-first pass:
+ *
+ *   - dataspaces and string types are cached by shape and length and shared by
+ *     every object that needs them, instead of being created and closed for
+ *     each object like the H5LT helpers do
+ *   - groups are created knowing how many links they'll hold, so in the
+ *     latest format their links are stored compactly in the group's header
+ *     with room reserved up front
+ *   - nothing is flushed: like with the write_* functions, HDF5 writes the
+ *     metadata out as it evicts it and when the file is closed
+ *
+ * None of that makes small datasets faster to write than write_double_array.
+ * H5Dcreate takes 15-20 us of CPU for each dataset, whatever the file driver
+ * or the metadata cache and block sizes, and the rest of writing one is small
+ * beside it. 100k datasets of 16 doubles, 1000 per group, took 1.9-2.4 s with
+ * write_double_array and 1.8-2.4 s with commit_batch. A batch is for writing
+ * nested groups, datasets and attributes in one call, which the write_*
+ * functions can't do; many small values are cheaper as attributes of one
+ * group or dataset, at about half the cost of a dataset each.
+ *
+ * The file format is left as the file has it unless the batch has the
+ * BATCH_LATEST_FORMAT flag, which raises it to the latest for the commit. The
+ * new groups and datasets then can't be read by HDF5 1.8 or the versions of
+ * MATLAB built on it, and are slower to write: 2.3-2.7 s for the same 100k
+ * datasets.
+ *
+ * Datasets keep the default creation properties. One creation property list
+ * shared by the whole commit is slower still: with compact layout 1000
+ * datasets took 26 ms instead of 21 ms, and without modification times,
+ * which only the latest format leaves out, 31 ms.
+ *
+ * Nodes and names are allocated from blocks of BATCH_BLOCK_BYTES so building a
+ * batch of many small datasets doesn't make a malloc per node.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "hdf5.h"
+#include "hdf5_batch.h"
+#include "hdf5_stats.h"
+
+#define MIN_COMPACT_LINKS 8    // HDF5's default
+#define MAX_COMPACT_LINKS 256  // larger groups are faster to search when dense
+#define MIN_DENSE_LINKS   6    // HDF5's default
+
+/* a block of memory for the nodes and names of a batch */
+struct batch_block {
+    struct batch_block *next;
+    size_t              used;
+    size_t              size;
+    char                data[];
+};
+
+/* the handles shared by the objects written by a commit */
+struct commit {
+    hid_t    spaces[BATCH_SPACES];
+    int      space_rank[BATCH_SPACES];
+    hsize_t  space_dims[BATCH_SPACES][2];
+    hid_t    string_types[BATCH_STRING_TYPES];
+    hid_t    gcpl;          // group creation, adjusted for each group
+};
+
+/* helper functions */
+static void *batch_alloc(hdf5_batch_t batch, size_t size);
+static batch_node_t new_node(hdf5_batch_t batch, batch_node_t parent,
+                             const char *name, int kind);
+static int write_node(struct commit *commit, hid_t parent,
+                      const batch_node_t node);
+static int write_attributes(struct commit *commit, hid_t object,
+                            const batch_node_t node);
+static hid_t get_space(struct commit *commit, const batch_node_t node);
+static hid_t get_type(struct commit *commit, const batch_node_t node);
+static void put_type(const batch_node_t node, hid_t type);
+
+/*
+ * Creates an empty batch. Add groups, datasets and attributes to it with the
+ * batch_* functions, then write it with commit_batch.
+ * \return the batch or NULL on failure
+ */
+hdf5_batch_t new_batch(void) {
+    hdf5_batch_t batch;
+
+    if ((batch = (hdf5_batch_t) calloc(1, sizeof(struct hdf5_batch))) == NULL) {
+        perror("malloc failed in new_batch():batch");
+        return NULL;
+    }
+    batch->root.kind = NODE_GROUP;
+    batch->root.name = "";
+    return batch;
+}
+
+/*
+ * Frees a batch. The buffers of its datasets and attributes belong to the
+ * caller and aren't freed.
+ * \param batch the batch to free
+ */
+void free_batch(hdf5_batch_t batch) {
+    struct batch_block *block;
+    struct batch_block *next;
+
+    if (batch == NULL) {
+        return;
+    }
+    for (block = batch->blocks; block != NULL; block = next) {
+        next = block->next;
+        free(block);
+    }
+    free(batch);
+}
+
+/*
+ * Adds a group to a batch
+ * \param batch the batch
+ * \param parent the group to add it to, or NULL for the group the batch is
+ *               committed to
+ * \param name the name of the group
+ * \return the new group or NULL on failure
+ */
+batch_node_t batch_group(hdf5_batch_t batch,
+                         batch_node_t parent,
+                         const char  *name) {
+    return new_node(batch, parent, name, NODE_GROUP);
+}
+
+/*
+ * Adds a dataset to a batch. The type is used both in memory and in the file.
+ * Strings go through batch_string: H5T_C_S1 itself is refused, but a copy of
+ * it with a size set makes an array of fixed length strings.
+ * \param batch the batch
+ * \param parent the group to add it to, or NULL for the group the batch is
+ *               committed to
+ * \param name the name of the dataset
+ * \param type the type of the elements, e.g. H5T_NATIVE_DOUBLE
+ * \param rank the number of dimensions, 0 to 2
+ * \param dims the dimensions
+ * \param buf the data, which must stay valid until the batch is committed
+ * \return the new dataset or NULL on failure
+ */
+batch_node_t batch_dataset(hdf5_batch_t   batch,
+                           batch_node_t   parent,
+                           const char    *name,
+                           hid_t          type,
+                           int            rank,
+                           const hsize_t *dims,
+                           const void    *buf) {
+    int          i;
+    batch_node_t node;
+
+    if (rank < 0 || rank > 2) {
+        fprintf(stderr, "can't batch %d dimensional dataset %s\n", rank, name);
+        return NULL;
+    }
+    if (type == H5T_C_S1) {
+        fprintf(stderr, "can't batch H5T_C_S1 dataset %s, use batch_string\n",
+                name);
+        return NULL;
+    }
+    if ((node = new_node(batch, parent, name, NODE_DATASET)) == NULL) {
+        return NULL;
+    }
+    lock_hdf5();
+    node->type = type;
+    node->rank = rank;
+    node->buf  = buf;
+    node->size = H5Tget_size(type);
+    unlock_hdf5();
+    for (i = 0; i < rank; i++) {
+        node->dims[i] = dims[i];
+        node->size   *= dims[i];
+    }
+    return node;
+}
+
+/*
+ * Adds a one dimensional double dataset to a batch, like write_double_array
+ * \param batch the batch
+ * \param parent the group to add it to or NULL
+ * \param name the name of the dataset
+ * \param len the number of elements
+ * \param buf the data, which must stay valid until the batch is committed
+ * \return the new dataset or NULL on failure
+ */
+batch_node_t batch_double_array(hdf5_batch_t  batch,
+                                batch_node_t  parent,
+                                const char   *name,
+                                hsize_t       len,
+                                const double *buf) {
+    return batch_dataset(batch, parent, name, H5T_NATIVE_DOUBLE, 1, &len, buf);
+}
+
+/*
+ * Adds a one dimensional int dataset to a batch, like write_int_array
+ * \param batch the batch
+ * \param parent the group to add it to or NULL
+ * \param name the name of the dataset
+ * \param len the number of elements
+ * \param buf the data, which must stay valid until the batch is committed
+ * \return the new dataset or NULL on failure
+ */
+batch_node_t batch_int_array(hdf5_batch_t batch,
+                             batch_node_t parent,
+                             const char  *name,
+                             hsize_t      len,
+                             const int   *buf) {
+    return batch_dataset(batch, parent, name, H5T_NATIVE_INT, 1, &len, buf);
+}
+
+/*
+ * Adds a string dataset to a batch, stored like write_string stores it
+ * \param batch the batch
+ * \param parent the group to add it to or NULL
+ * \param name the name of the dataset
+ * \param buf the string, which must stay valid until the batch is committed
+ * \return the new dataset or NULL on failure
+ */
+batch_node_t batch_string(hdf5_batch_t batch,
+                          batch_node_t parent,
+                          const char  *name,
+                          const char  *buf) {
+    batch_node_t node;
+
+    if ((node = new_node(batch, parent, name, NODE_DATASET)) == NULL) {
+        return NULL;
+    }
+    node->type = H5T_C_S1;
+    node->buf  = buf;
+    node->size = strlen(buf) + 1;
+    return node;
+}
+
+/*
+ * Adds a one dimensional attribute to a group or dataset of a batch. Strings
+ * go through batch_string_attribute, as for batch_dataset.
+ * \param batch the batch
+ * \param node the group or dataset, or NULL for the group the batch is
+ *             committed to
+ * \param name the name of the attribute
+ * \param type the type of the elements
+ * \param len the number of elements
+ * \param buf the data, which must stay valid until the batch is committed
+ * \return the new attribute or NULL on failure
+ */
+batch_node_t batch_attribute(hdf5_batch_t batch,
+                             batch_node_t node,
+                             const char  *name,
+                             hid_t        type,
+                             hsize_t      len,
+                             const void  *buf) {
+    batch_node_t attr;
+
+    if (type == H5T_C_S1) {
+        fprintf(stderr, "can't batch H5T_C_S1 attribute %s, use "
+                        "batch_string_attribute\n", name);
+        return NULL;
+    }
+    if ((attr = new_node(batch, node, name, NODE_ATTRIBUTE)) == NULL) {
+        return NULL;
+    }
+    lock_hdf5();
+    attr->type    = type;
+    attr->rank    = 1;
+    attr->dims[0] = len;
+    attr->buf     = buf;
+    attr->size    = H5Tget_size(type) * len;
+    unlock_hdf5();
+    return attr;
+}
+
+/*
+ * Adds a string attribute to a group or dataset of a batch
+ * \param batch the batch
+ * \param node the group or dataset or NULL
+ * \param name the name of the attribute
+ * \param buf the string, which must stay valid until the batch is committed
+ * \return the new attribute or NULL on failure
+ */
+batch_node_t batch_string_attribute(hdf5_batch_t batch,
+                                    batch_node_t node,
+                                    const char  *name,
+                                    const char  *buf) {
+    batch_node_t attr;
+
+    if ((attr = new_node(batch, node, name, NODE_ATTRIBUTE)) == NULL) {
+        return NULL;
+    }
+    attr->type = H5T_C_S1;
+    attr->buf  = buf;
+    attr->size = strlen(buf) + 1;
+    return attr;
+}
+
+/*
+ * Writes everything in a batch under a group, holding the HDF5 lock. Like
+ * write_double_array, the new objects aren't added to the hdf5_struct_t. The
+ * batch can be freed or committed again afterwards. With BATCH_LATEST_FORMAT
+ * in its flags, the objects are written in the latest file format.
+ * \param batch the batch to write
+ * \param entry the group to write it to
+ * \return 0 on success or -1 on failure, which can leave part of the batch
+ *         written
+ */
+int commit_batch(hdf5_batch_t batch, hdf5_entry_t entry) {
+    int           i;
+    int           status = 0;
+    hid_t         file;
+    hid_t         fapl;
+    H5F_libver_t  low    = H5F_LIBVER_EARLIEST;
+    H5F_libver_t  high   = H5F_LIBVER_LATEST;
+    batch_node_t  node;
+    struct commit commit;
+    STATS_TIMER(COMMIT_BATCH);
+
+    if (!IS_GROUP(entry)) {
+        return -1;
+    }
+
+    lock_hdf5();
+    memset(&commit, 0, sizeof(struct commit));
+    for (i = 0; i < BATCH_SPACES; i++) {
+        commit.spaces[i] = -1;
+    }
+    for (i = 0; i < BATCH_STRING_TYPES; i++) {
+        commit.string_types[i] = -1;
+    }
+    commit.gcpl = H5Pcreate(H5P_GROUP_CREATE);
+
+    // raise the format for the commit if asked to, and put it back afterwards
+    file = H5Iget_file_id(entry->id);
+    if (batch->flags & BATCH_LATEST_FORMAT) {
+        if ((fapl = H5Fget_access_plist(file)) >= 0) {
+            H5Pget_libver_bounds(fapl, &low, &high);
+            H5Pclose(fapl);
+        }
+        H5Fset_libver_bounds(file, H5F_LIBVER_LATEST, H5F_LIBVER_LATEST);
+    }
+
+    if (write_attributes(&commit, entry->id, &batch->root) < 0) {
+        status = -1;
+    }
+    for (node = batch->root.children; node != NULL && status == 0;
+         node = node->next) {
+        status = write_node(&commit, entry->id, node);
+    }
+
+    if (batch->flags & BATCH_LATEST_FORMAT) {
+        H5Fset_libver_bounds(file, low, high);
+    }
+    H5Fclose(file);
+    for (i = 0; i < BATCH_SPACES; i++) {
+        if (commit.spaces[i] >= 0) {
+            H5Sclose(commit.spaces[i]);
+        }
+    }
+    for (i = 0; i < BATCH_STRING_TYPES; i++) {
+        if (commit.string_types[i] >= 0) {
+            H5Tclose(commit.string_types[i]);
+        }
+    }
+    H5Pclose(commit.gcpl);
+    unlock_hdf5();
+    return status;
+}
+
+/*******************************************************************************
+ *                              Helper functions
+ ******************************************************************************/
+
+/*
+ * Allocates memory that lives as long as the batch, 8-byte aligned
+ */
+static void *batch_alloc(hdf5_batch_t batch, size_t size) {
+    void               *mem;
+    size_t              block_size;
+    struct batch_block *block = batch->blocks;
+
+    size = (size + 7) & ~(size_t) 7;
+    if (block == NULL || block->size - block->used < size) {
+        block_size = size > BATCH_BLOCK_BYTES ? size : BATCH_BLOCK_BYTES;
+        if ((block = (struct batch_block *)
+                     malloc(sizeof(struct batch_block) + block_size)) == NULL) {
+            perror("malloc failed in batch_alloc():block");
+            return NULL;
+        }
+        STATS_ALLOC(block_size);
+        block->used    = 0;
+        block->size    = block_size;
+        block->next    = batch->blocks;
+        batch->blocks  = block;
+    }
+    mem          = block->data + block->used;
+    block->used += size;
+    return mem;
+}
+
+/*
+ * Adds a node to a group of a batch, or an attribute to a group or dataset
+ * \param batch the batch
+ * \param parent the group or dataset, NULL for the root of the batch
+ * \param name the name of the node, copied
+ * \param kind one of the NODE_* kinds
+ * \return the node or NULL on failure
+ */
+static batch_node_t new_node(hdf5_batch_t batch,
+                             batch_node_t parent,
+                             const char  *name,
+                             int          kind) {
+    size_t       len = strlen(name);
+    char        *copy;
+    batch_node_t node;
+
+    if (parent == NULL) {
+        parent = &batch->root;
+    }
+    if ((kind != NODE_ATTRIBUTE && parent->kind != NODE_GROUP) ||
+        parent->kind == NODE_ATTRIBUTE) {
+        fprintf(stderr, "can't add %s to %s\n", name, parent->name);
+        return NULL;
+    }
+    node = (batch_node_t) batch_alloc(batch, sizeof(struct batch_node));
+    copy = (char *) batch_alloc(batch, len + 1);
+    if (node == NULL || copy == NULL) {
+        return NULL;
+    }
+    memset(node, 0, sizeof(struct batch_node));
+    memcpy(copy, name, len + 1);
+    node->kind = kind;
+    node->name = copy;
+
+    if (kind == NODE_ATTRIBUTE) {
+        if (parent->last_attribute == NULL) {
+            parent->attributes = node;
+        } else {
+            parent->last_attribute->next = node;
+        }
+        parent->last_attribute = node;
+    } else {
+        if (parent->last_child == NULL) {
+            parent->children = node;
+        } else {
+            parent->last_child->next = node;
+        }
+        parent->last_child = node;
+        parent->num_children++;
+        parent->name_bytes += len;
+    }
+    batch->nodes++;
+    return node;
+}
+
+/*
+ * Writes a group with everything in it, or a dataset, and their attributes
+ * \param commit the shared handles
+ * \param parent the group to write to
+ * \param node the group or dataset
+ * \return 0 on success or -1 on failure
+ */
+static int write_node(struct commit     *commit,
+                      hid_t              parent,
+                      const batch_node_t node) {
+    int          status = 0;
+    hid_t        id;
+    hid_t        space;
+    hid_t        type;
+    unsigned     max_compact;
+    batch_node_t child;
+
+    STATS_COUNT(HDF5_CALLS, 1);
+    if (node->kind == NODE_GROUP) {
+        max_compact = node->num_children > MAX_COMPACT_LINKS
+                      ? MAX_COMPACT_LINKS
+                      : node->num_children < MIN_COMPACT_LINKS
+                      ? MIN_COMPACT_LINKS : (unsigned) node->num_children;
+        H5Pset_link_phase_change(commit->gcpl, max_compact, MIN_DENSE_LINKS);
+        if (node->num_children > 0) {
+            H5Pset_est_link_info(commit->gcpl,
+                                 (unsigned) (node->num_children < 65535
+                                             ? node->num_children : 65535),
+                                 (unsigned) (node->name_bytes /
+                                             node->num_children));
+        }
+        if ((id = H5Gcreate(parent, node->name, H5P_DEFAULT, commit->gcpl,
+                            H5P_DEFAULT)) < 0) {
+            fprintf(stderr, "failed to create group %s\n", node->name);
+            return -1;
+        }
+        status = write_attributes(commit, id, node);
+        for (child = node->children; child != NULL && status == 0;
+             child = child->next) {
+            status = write_node(commit, id, child);
+        }
+        H5Gclose(id);
+        return status;
+    }
+
+    space = get_space(commit, node);
+    type  = get_type(commit, node);
+    id    = H5Dcreate(parent, node->name, type, space, H5P_DEFAULT, H5P_DEFAULT,
+                      H5P_DEFAULT);
+    if (id < 0 || (node->size > 0 && H5Dwrite(id, type, H5S_ALL, H5S_ALL,
+                                              H5P_DEFAULT, node->buf) < 0)) {
+        fprintf(stderr, "failed to write dataset %s\n", node->name);
+        status = -1;
+    } else {
+        STATS_COUNT(BYTES_WRITTEN, node->size);
+        status = write_attributes(commit, id, node);
+    }
+    if (id >= 0) {
+        H5Dclose(id);
+    }
+    put_type(node, type);
+    return status;
+}
+
+/*
+ * Writes the attributes of a group or dataset
+ * \param commit the shared handles
+ * \param object the group or dataset
+ * \param node its node
+ * \return 0 on success or -1 on failure
+ */
+static int write_attributes(struct commit     *commit,
+                            hid_t              object,
+                            const batch_node_t node) {
+    int          status = 0;
+    hid_t        id;
+    hid_t        type;
+    batch_node_t attr;
+
+    for (attr = node->attributes; attr != NULL && status == 0;
+         attr = attr->next) {
+        STATS_COUNT(HDF5_CALLS, 1);
+        type = get_type(commit, attr);
+        id   = H5Acreate(object, attr->name, type, get_space(commit, attr),
+                         H5P_DEFAULT, H5P_DEFAULT);
+        if (id < 0 || H5Awrite(id, type, attr->buf) < 0) {
+            fprintf(stderr, "failed to write attribute %s\n", attr->name);
+            status = -1;
+        }
+        if (id >= 0) {
+            H5Aclose(id);
+        }
+        put_type(attr, type);
+    }
+    return status;
+}
+
+/*
+ * Returns a dataspace of the shape of a node, from the cache if one's open.
+ * The cache is indexed by a hash of the shape and a slot is replaced when
+ * another shape needs it.
+ */
+static hid_t get_space(struct commit *commit, const batch_node_t node) {
+    uint64_t h    = (uint64_t) node->rank * 0x9e3779b97f4a7c15ull;
+    int      slot;
+
+    h    = (h ^ node->dims[0]) * 0xbf58476d1ce4e5b9ull;
+    h    = (h ^ node->dims[1]) * 0x94d049bb133111ebull;
+    slot = (int) ((h >> 32) % BATCH_SPACES);
+    if (commit->spaces[slot] >= 0 && commit->space_rank[slot] == node->rank &&
+        commit->space_dims[slot][0] == node->dims[0] &&
+        commit->space_dims[slot][1] == node->dims[1]) {
+        return commit->spaces[slot];
+    }
+    if (commit->spaces[slot] >= 0) {
+        H5Sclose(commit->spaces[slot]);
+    }
+    commit->spaces[slot]        = node->rank == 0
+                                  ? H5Screate(H5S_SCALAR)
+                                  : H5Screate_simple(node->rank, node->dims,
+                                                     NULL);
+    commit->space_rank[slot]    = node->rank;
+    commit->space_dims[slot][0] = node->dims[0];
+    commit->space_dims[slot][1] = node->dims[1];
+    return commit->spaces[slot];
+}
+
+/*
+ * Returns the type of a node. Strings get a null-terminated string type of
+ * their length, cached if it's short.
+ */
+static hid_t get_type(struct commit *commit, const batch_node_t node) {
+    hid_t type;
+
+    if (node->type != H5T_C_S1) {
+        return node->type;
+    }
+    if (node->size < BATCH_STRING_TYPES &&
+        commit->string_types[node->size] >= 0) {
+        return commit->string_types[node->size];
+    }
+    type = H5Tcopy(H5T_C_S1);
+    H5Tset_size(type, node->size);
+    H5Tset_strpad(type, H5T_STR_NULLTERM);
+    if (node->size < BATCH_STRING_TYPES) {
+        commit->string_types[node->size] = type;
+    }
+    return type;
+}
+
+/*
+ * Closes a type returned by get_type if it isn't cached
+ */
+static void put_type(const batch_node_t node, hid_t type) {
+    if (node->type == H5T_C_S1 && node->size >= BATCH_STRING_TYPES) {
+        H5Tclose(type);
+    }
+}
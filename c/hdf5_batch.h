@@ -0,0 +1,109 @@
+#ifndef _HDF5_BATCH_H_
+#define _HDF5_BATCH_H_
+
+#include "hdf5_struct.h"
+
+#define BATCH_BLOCK_BYTES   (64 << 10) // memory of the nodes and names
+#define BATCH_SPACES        64         // dataspaces kept open during a commit
+#define BATCH_STRING_TYPES  256        // string types kept open, by length
+
+// flags of a batch
+#define BATCH_LATEST_FORMAT 1          // commit in the latest file format
+
+// kinds of nodes
+#define NODE_GROUP          0
+#define NODE_DATASET        1
+#define NODE_ATTRIBUTE      2
+
+/*
+ * A group, dataset or attribute to be written by commit_batch. Data isn't
+ * copied, it must stay valid until the batch is committed.
+ */
+typedef struct batch_node {
+    int         kind;           // one of the NODE_* kinds
+    const char *name;
+    hid_t       type;           // the memory type, also used in the file
+    int         rank;           // 0 for a scalar
+    hsize_t     dims[2];
+    size_t      size;           // size of the data in bytes
+    const void *buf;
+    struct batch_node *children;    // groups and datasets of a group
+    struct batch_node *attributes;  // attributes of a group or dataset
+    struct batch_node *last_child;
+    struct batch_node *last_attribute;
+    struct batch_node *next;
+    hsize_t     num_children;
+    size_t      name_bytes;     // total length of the children's names
+} *batch_node_t;
+
+/*
+ * A tree of groups, datasets and attributes written in one go
+ */
+typedef struct hdf5_batch {
+    struct batch_node   root;   // stands for the group the batch is written to
+    struct batch_block *blocks; // memory of the nodes and names
+    size_t              nodes;  // number of nodes, for the stats
+    int                 flags;  // BATCH_* flags, none by default
+} *hdf5_batch_t;
+
+/*
+ * Creates an empty batch
+ */
+hdf5_batch_t new_batch(void);
+
+/*
+ * Frees a batch and all its nodes
+ */
+void free_batch(hdf5_batch_t batch);
+
+/*
+ * Adds a group to a batch
+ */
+batch_node_t batch_group(hdf5_batch_t batch, batch_node_t parent,
+                         const char *name);
+
+/*
+ * Adds a dataset of any type to a batch
+ */
+batch_node_t batch_dataset(hdf5_batch_t batch, batch_node_t parent,
+                           const char *name, hid_t type, int rank,
+                           const hsize_t *dims, const void *buf);
+
+/*
+ * Adds a one dimensional double dataset to a batch
+ */
+batch_node_t batch_double_array(hdf5_batch_t batch, batch_node_t parent,
+                                const char *name, hsize_t len,
+                                const double *buf);
+
+/*
+ * Adds a one dimensional int dataset to a batch
+ */
+batch_node_t batch_int_array(hdf5_batch_t batch, batch_node_t parent,
+                             const char *name, hsize_t len, const int *buf);
+
+/*
+ * Adds a string dataset to a batch
+ */
+batch_node_t batch_string(hdf5_batch_t batch, batch_node_t parent,
+                          const char *name, const char *buf);
+
+/*
+ * Adds an attribute to a group or dataset of a batch
+ */
+batch_node_t batch_attribute(hdf5_batch_t batch, batch_node_t node,
+                             const char *name, hid_t type, hsize_t len,
+                             const void *buf);
+
+/*
+ * Adds a string attribute to a group or dataset of a batch
+ */
+batch_node_t batch_string_attribute(hdf5_batch_t batch, batch_node_t node,
+                                    const char *name, const char *buf);
+
+/*
+ * Writes everything in a batch to a group
+ */
+int commit_batch(hdf5_batch_t batch, hdf5_entry_t entry);
+
+#endif
@@ -0,0 +1,278 @@
+/*
+ * Compressed writes with the compression spread over the threads.
+ *
+ * Writing through the HDF5 filter pipeline compresses one chunk at a time on
+ * the calling thread. Here the chunks are cut out of the source buffer,
+ * shuffled and deflated in parallel a batch at a time, and each batch is handed
+ * to H5Dwrite_chunk in order by one thread while the others compress the next
+ * batch. The dataset is created with the same shuffle and deflate filters, so
+ * the result is an ordinary compressed dataset that any HDF5 reader can decode.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <zlib.h>
+#include "hdf5.h"
+#include "hdf5_chunk.h"
+#include "hdf5_eeg_filter.h"
+#include "hdf5_stats.h"
+
+/* one chunk of a batch */
+struct chunk {
+    hsize_t   offset[2];  // position of the chunk in the dataset
+    double   *raw;        // the chunk, padded with zeros at the edges
+    uint8_t  *shuffled;   // raw with the bytes of each element grouped
+    uint8_t  *packed;     // the deflated or EEG encoded chunk
+    uLongf    size;       // the number of bytes to write
+    uint32_t  mask;       // the filters that were skipped
+    void     *data;       // raw, shuffled or packed
+};
+
+/* helper functions */
+static void compress_chunk(struct chunk *c, const double *buf,
+                           const hsize_t *dims, const hsize_t *chunk, int flags,
+                           int level);
+static int write_batch(hdf5_entry_t out, const struct chunk *chunks, long n);
+static void shuffle(const uint8_t *src, uint8_t *dst, size_t n, size_t size);
+
+/*
+ * Writes a double matrix to a new chunked dataset, compressing the chunks on
+ * all the threads. Chunks that don't get smaller are stored without deflate,
+ * which is allowed because the deflate filter is optional. If anything fails
+ * the new dataset is deleted, so there's never a partly written one.
+ * \param entry the group to create the dataset in
+ * \param name the name of the new dataset
+ * \param dims the dimensions of the new dataset
+ * \param chunk the chunk dimensions
+ * \param buf the data to write, dims[0] x dims[1]
+ * \param flags COMPRESS_DEFLATE and/or COMPRESS_SHUFFLE, or COMPRESS_EEG
+ * \param level the deflate level, 1 to 9
+ * \return the hdf5_entry_t of the new dataset or NULL on failure
+ */
+hdf5_entry_t write_compressed_matrix(hdf5_entry_t   entry,
+                                     const char    *name,
+                                     const hsize_t *dims,
+                                     const hsize_t *chunk,
+                                     const double  *buf,
+                                     int            flags,
+                                     int            level) {
+    long    b;
+    long    k;
+    long    total;
+    long    num_batches;
+    long    batch     = (long) NUM_THREADS() * CHUNK_BATCH;
+    int     failed    = 0;
+    hsize_t grid_cols = (dims[1] + chunk[1] - 1) / chunk[1];
+    size_t  raw_size  = sizeof(double) * chunk[0] * chunk[1];
+    size_t  packed_size;
+    hid_t   plist;
+    struct chunk *chunks;
+    hdf5_entry_t  out;
+    STATS_TIMER(WRITE_COMPRESSED_MATRIX);
+
+    if (!IS_GROUP(entry) || chunk[0] == 0 || chunk[1] == 0) {
+        return NULL;
+    }
+
+    // the filters are recorded in the dataset even though they're run here
+    lock_hdf5();
+    plist = H5Pcreate(H5P_DATASET_CREATE);
+    H5Pset_chunk(plist, 2, chunk);
+    if (flags & COMPRESS_EEG) {
+        flags &= ~(COMPRESS_DEFLATE | COMPRESS_SHUFFLE);
+        if (set_eeg_filter(plist) < 0) {
+            H5Pclose(plist);
+            unlock_hdf5();
+            return NULL;
+        }
+    }
+    if (flags & COMPRESS_SHUFFLE) {
+        H5Pset_shuffle(plist);
+    }
+    if (flags & COMPRESS_DEFLATE) {
+        H5Pset_deflate(plist, level);
+    }
+    out = create_dataset(entry, name, H5T_NATIVE_DOUBLE, 2, dims, plist);
+    H5Pclose(plist);
+    unlock_hdf5();
+    if (out == NULL) {
+        return NULL;
+    }
+
+    total = (long) (((dims[0] + chunk[0] - 1) / chunk[0]) * grid_cols);
+    if (total == 0) {
+        return out;
+    }
+    batch       = batch < total ? batch : total;
+    num_batches = (total + batch - 1) / batch;
+    packed_size = (flags & COMPRESS_EEG) ? EEG_BOUND(raw_size)
+                                         : compressBound(raw_size);
+    // two sets of buffers: one batch is written while the next is compressed
+    if ((chunks = (struct chunk *) calloc(2 * batch, sizeof(struct chunk))) ==
+        NULL) {
+        perror("malloc failed in write_compressed_matrix():chunks");
+        delete_dataset(out);
+        return NULL;
+    }
+    for (k = 0; k < 2 * batch && !failed; k++) {
+        chunks[k].raw      = (double *) malloc(raw_size);
+        chunks[k].shuffled = (uint8_t *) malloc(raw_size);
+        chunks[k].packed   = (uint8_t *) malloc(packed_size);
+        if (chunks[k].raw == NULL || chunks[k].shuffled == NULL ||
+            chunks[k].packed == NULL) {
+            perror("malloc failed in write_compressed_matrix():chunk");
+            failed = 1;
+        }
+    }
+    STATS_ALLOC(2 * batch * (2 * raw_size + packed_size));
+
+    // batch b is compressed while batch b - 1 is written
+    for (b = 0; b <= num_batches && !failed; b++) {
+        struct chunk *filling = chunks + (b % 2) * batch;
+        struct chunk *writing = chunks + ((b + 1) % 2) * batch;
+        long          first   = b * batch;
+        long          fill_n  = b < num_batches ? total - first : 0;
+        long          write_n = b > 0 ? total - (first - batch) : 0;
+
+        fill_n  = fill_n < batch ? fill_n : batch;
+        write_n = write_n < batch ? write_n : batch;
+
+        #pragma omp parallel
+        {
+            // HDF5 calls are made by one thread at a time, in chunk order
+            #pragma omp single nowait
+            if (write_n > 0) {
+                failed = write_batch(out, writing, write_n) < 0;
+            }
+
+            #pragma omp for schedule(dynamic) nowait
+            for (k = 0; k < fill_n; k++) {
+                hsize_t index = (hsize_t) (first + k);
+                filling[k].offset[0] = index / grid_cols * chunk[0];
+                filling[k].offset[1] = index % grid_cols * chunk[1];
+                compress_chunk(&filling[k], buf, dims, chunk, flags, level);
+            }
+        }
+    }
+
+    for (k = 0; k < 2 * batch; k++) {
+        free(chunks[k].raw);
+        free(chunks[k].shuffled);
+        free(chunks[k].packed);
+    }
+    free(chunks);
+    if (failed) {
+        delete_dataset(out);
+        return NULL;
+    }
+    return out;
+}
+
+/*******************************************************************************
+ *                              Helper functions
+ ******************************************************************************/
+
+/*
+ * Cuts a chunk out of the source buffer and runs the filters on it
+ * \param c the chunk, with its offset set
+ * \param buf the source buffer
+ * \param dims the dimensions of the source buffer
+ * \param chunk the chunk dimensions
+ * \param flags COMPRESS_DEFLATE and/or COMPRESS_SHUFFLE, or COMPRESS_EEG
+ * \param level the deflate level
+ */
+static void compress_chunk(struct chunk  *c,
+                           const double  *buf,
+                           const hsize_t *dims,
+                           const hsize_t *chunk,
+                           int            flags,
+                           int            level) {
+    hsize_t r;
+    hsize_t rows     = dims[0] - c->offset[0];
+    hsize_t cols     = dims[1] - c->offset[1];
+    size_t  raw_size = sizeof(double) * chunk[0] * chunk[1];
+    int     deflate_index = (flags & COMPRESS_SHUFFLE) ? 1 : 0;
+
+    rows = rows < chunk[0] ? rows : chunk[0];
+    cols = cols < chunk[1] ? cols : chunk[1];
+    if (rows < chunk[0] || cols < chunk[1]) {
+        memset(c->raw, 0, raw_size);
+    }
+    for (r = 0; r < rows; r++) {
+        memcpy(c->raw + r * chunk[1],
+               buf + (c->offset[0] + r) * dims[1] + c->offset[1],
+               sizeof(double) * cols);
+    }
+
+    c->data = c->raw;
+    c->size = raw_size;
+    c->mask = 0;
+    if (flags & COMPRESS_EEG) {
+        // the EEG filter is mandatory, so its output is always written
+        c->size = eeg_encode(c->raw, raw_size, sizeof(double), chunk[1],
+                             c->packed);
+        c->data = c->packed;
+        return;
+    }
+    if (flags & COMPRESS_SHUFFLE) {
+        shuffle((const uint8_t *) c->raw, c->shuffled, chunk[0] * chunk[1],
+                sizeof(double));
+        c->data = c->shuffled;
+    }
+    if (flags & COMPRESS_DEFLATE) {
+        uLongf packed_size = compressBound(raw_size);
+        if (compress2(c->packed, &packed_size, c->data, raw_size, level) ==
+                Z_OK && packed_size < raw_size) {
+            c->data = c->packed;
+            c->size = packed_size;
+        } else {
+            c->mask |= 1u << deflate_index;
+        }
+    }
+}
+
+/*
+ * Writes a batch of compressed chunks with H5Dwrite_chunk, in order
+ * \param out the dataset
+ * \param chunks the chunks
+ * \param n the number of chunks
+ * \return 0 on success or -1 on failure
+ */
+static int write_batch(hdf5_entry_t out, const struct chunk *chunks, long n) {
+    long k;
+    int  status = 0;
+
+    lock_hdf5();
+    for (k = 0; k < n && status == 0; k++) {
+        STATS_COUNT(HDF5_CALLS, 1);
+        STATS_COUNT(BYTES_WRITTEN, chunks[k].size);
+        if (chunks[k].size == 0 ||
+            H5Dwrite_chunk(out->id, H5P_DEFAULT, chunks[k].mask,
+                           chunks[k].offset, chunks[k].size,
+                           chunks[k].data) < 0) {
+            fprintf(stderr, "failed to write chunk of %s\n", out->name);
+            status = -1;
+        }
+    }
+    unlock_hdf5();
+    return status;
+}
+
+/*
+ * Groups the bytes of every element by their position, the same as the HDF5
+ * shuffle filter
+ * \param src n elements
+ * \param dst the shuffled bytes
+ * \param n the number of elements
+ * \param size the size of an element in bytes
+ */
+static void shuffle(const uint8_t *src, uint8_t *dst, size_t n, size_t size) {
+    size_t i, j;
+    for (j = 0; j < size; j++) {
+        uint8_t *out = dst + j * n;
+        for (i = 0; i < n; i++) {
+            out[i] = src[i * size + j];
+        }
+    }
+}
@@ -0,0 +1,20 @@
+#ifndef _HDF5_CHUNK_H_
+#define _HDF5_CHUNK_H_
+
+#include "hdf5_struct.h"
+
+// compression of the chunks written by write_compressed_matrix
+#define COMPRESS_DEFLATE  0x1
+#define COMPRESS_SHUFFLE  0x2
+#define COMPRESS_EEG      0x4 // the EEG filter instead of shuffle and deflate
+
+#define CHUNK_BATCH       4   // chunks compressed per thread between writes
+
+/*
+ * Writes a double matrix as chunks compressed in parallel
+ */
+hdf5_entry_t write_compressed_matrix(hdf5_entry_t entry, const char *name,
+                                     const hsize_t *dims, const hsize_t *chunk,
+                                     const double *buf, int flags, int level);
+
+#endif
@@ -0,0 +1,911 @@
+/*
+ * A lossless HDF5 filter for EEG.
+ *
+ * EEG changes slowly from one sample to the next, so each chunk is coded as:
+ *   1. the difference between every sample and the previous sample of the same
+ *      channel (integer subtraction, floats are subtracted as their bits)
+ *   2. bit shuffle: the bits of EEG_BLOCK elements are regrouped so all their
+ *      bit 0s come first, then all their bit 1s, ... Small deltas leave long
+ *      runs of zero bytes in the high bit planes
+ *   3. LZ4 block compression, which decodes at several GB/s
+ *
+ * An encoded chunk starts with a header: the decoded size (8 bytes), the
+ * payload size (4 bytes), the codec (1 byte) and 3 reserved bytes, all little
+ * endian. The payload is stored without LZ4 if LZ4 doesn't make it smaller.
+ *
+ * Deltas are computed on the element bytes as they are in the chunk, which is
+ * only meaningful on little endian hosts; files written on a big endian host
+ * still decode there but compress worse.
+ *
+ * Compile with -DH5Z_EEG_PLUGIN into a shared library on HDF5_PLUGIN_PATH to
+ * make the filter available to h5py, rhdf5, MATLAB and the HDF5 tools.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "hdf5.h"
+#include "hdf5_eeg_filter.h"
+#include "hdf5_stats.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#ifdef H5Z_EEG_PLUGIN
+#include "H5PLextern.h"
+#endif
+
+#define LZ4_HASH_LOG  14
+#define LZ4_MIN_MATCH 4
+#define LZ4_MAX_DIST  65535
+#define LZ4_MF_LIMIT  12     // no match may start in the last 12 bytes
+#define LZ4_LAST_LITS 5      // the last 5 bytes are always literals
+
+// an LZ4 payload of n bytes decodes to at most 255 bytes per byte
+#define EEG_MAX_DECODED(n) (255 * ((n) - EEG_HEADER_SIZE) + 255)
+
+/* helper functions */
+static htri_t can_apply_eeg(hid_t dcpl, hid_t type, hid_t space);
+static herr_t set_local_eeg(hid_t dcpl, hid_t type, hid_t space);
+static size_t eeg_filter(unsigned flags, size_t cd_nelmts,
+                         const unsigned cd_values[], size_t nbytes,
+                         size_t *buf_size, void **buf);
+static void   delta_encode(const void *in, void *out, size_t n,
+                           size_t elem_size, size_t row_len);
+static void   delta_decode(void *buf, size_t n, size_t elem_size,
+                           size_t row_len);
+static void   bit_shuffle(const uint8_t *in, uint8_t *out, size_t n,
+                          size_t elem_size, uint8_t *scratch);
+static void   bit_unshuffle(const uint8_t *in, uint8_t *out, size_t n,
+                            size_t elem_size, uint8_t *scratch);
+static void   transpose_bits(const uint8_t *in, uint8_t *out, size_t n);
+static void   untranspose_bits(const uint8_t *in, uint8_t *out, size_t n);
+static size_t lz4_compress(const uint8_t *src, size_t n, uint8_t *dst);
+static size_t lz4_decompress(const uint8_t *src, size_t n, uint8_t *dst,
+                             size_t dst_size);
+
+static const H5Z_class2_t H5Z_EEG[1] = {{
+    H5Z_CLASS_T_VERS,
+    (H5Z_filter_t) H5Z_FILTER_EEG,
+    1,                                  // encoder present
+    1,                                  // decoder present
+    "eeg: delta + bitshuffle + lz4",
+    can_apply_eeg,
+    set_local_eeg,
+    eeg_filter
+}};
+
+#ifdef H5Z_EEG_PLUGIN
+H5PL_type_t H5PLget_plugin_type(void) {
+    return H5PL_TYPE_FILTER;
+}
+
+const void *H5PLget_plugin_info(void) {
+    return H5Z_EEG;
+}
+#endif
+
+/*
+ * Registers the EEG filter with HDF5. It's safe to call more than once.
+ * \return 0 on success or -1 on failure
+ */
+int register_eeg_filter(void) {
+    if (H5Zfilter_avail(H5Z_FILTER_EEG) > 0) {
+        return 0;
+    }
+    if (H5Zregister(H5Z_EEG) < 0) {
+        fprintf(stderr, "failed to register the EEG filter\n");
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Adds the EEG filter to a dataset creation property list. The dataset must be
+ * chunked, with time as the first dimension of the chunk.
+ * \param plist the dataset creation property list
+ * \return 0 on success or -1 on failure
+ */
+int set_eeg_filter(hid_t plist) {
+    if (register_eeg_filter() < 0) {
+        return -1;
+    }
+    if (H5Pset_filter(plist, H5Z_FILTER_EEG, H5Z_FLAG_MANDATORY, 0,
+                      NULL) < 0) {
+        fprintf(stderr, "failed to add the EEG filter\n");
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Encodes a chunk. `out` must hold EEG_BOUND(nbytes) bytes.
+ * \param in the chunk
+ * \param nbytes the size of the chunk in bytes
+ * \param elem_size the size of an element: 1, 2, 4 or 8 bytes
+ * \param row_len the number of elements per row (channels)
+ * \param out the encoded chunk
+ * \return the size of the encoded chunk or 0 on failure
+ */
+size_t eeg_encode(const void *in,
+                  size_t      nbytes,
+                  size_t      elem_size,
+                  size_t      row_len,
+                  void       *out) {
+    size_t   n = nbytes / elem_size;
+    size_t   payload;
+    uint8_t  codec = EEG_CODEC_LZ4;
+    uint8_t *header = (uint8_t *) out;
+    uint8_t *deltas;
+    uint8_t *shuffled;
+    uint8_t *scratch;
+    STATS_TIMER(EEG_ENCODE);
+
+    deltas   = (uint8_t *) malloc(nbytes + 1);
+    shuffled = (uint8_t *) malloc(nbytes + 1);
+    scratch  = (uint8_t *) malloc(EEG_BLOCK * elem_size);
+    if (deltas == NULL || shuffled == NULL || scratch == NULL) {
+        perror("malloc failed in eeg_encode()");
+        free(deltas);
+        free(shuffled);
+        free(scratch);
+        return 0;
+    }
+
+    delta_encode(in, deltas, n, elem_size, row_len);
+    // a trailing partial element is copied as is
+    memcpy(deltas + n * elem_size, (const uint8_t *) in + n * elem_size,
+           nbytes - n * elem_size);
+    bit_shuffle(deltas, shuffled, n, elem_size, scratch);
+    memcpy(shuffled + n * elem_size, deltas + n * elem_size,
+           nbytes - n * elem_size);
+
+    payload = lz4_compress(shuffled, nbytes, header + EEG_HEADER_SIZE);
+    if (payload >= nbytes) {
+        codec   = EEG_CODEC_STORED;
+        payload = nbytes;
+        memcpy(header + EEG_HEADER_SIZE, shuffled, nbytes);
+    }
+
+    memset(header, 0, EEG_HEADER_SIZE);
+    for (n = 0; n < 8; n++) {
+        header[n] = (uint8_t) ((uint64_t) nbytes >> (8 * n));
+    }
+    for (n = 0; n < 4; n++) {
+        header[8 + n] = (uint8_t) ((uint32_t) payload >> (8 * n));
+    }
+    header[12] = codec;
+
+    free(deltas);
+    free(shuffled);
+    free(scratch);
+    return EEG_HEADER_SIZE + payload;
+}
+
+/*
+ * Decodes a chunk encoded by eeg_encode
+ * \param in the encoded chunk
+ * \param nbytes the size of the encoded chunk
+ * \param elem_size the size of an element
+ * \param row_len the number of elements per row
+ * \param out the decoded chunk
+ * \param out_size the size of out
+ * \return the size of the decoded chunk or 0 if the chunk is corrupt
+ */
+size_t eeg_decode(const void *in,
+                  size_t      nbytes,
+                  size_t      elem_size,
+                  size_t      row_len,
+                  void       *out,
+                  size_t      out_size) {
+    int      i;
+    size_t   n;
+    uint64_t size    = 0;
+    uint32_t payload = 0;
+    const uint8_t *header = (const uint8_t *) in;
+    uint8_t *shuffled;
+    uint8_t *scratch;
+    STATS_TIMER(EEG_DECODE);
+
+    if (nbytes < EEG_HEADER_SIZE) {
+        return 0;
+    }
+    for (i = 0; i < 8; i++) {
+        size |= (uint64_t) header[i] << (8 * i);
+    }
+    for (i = 0; i < 4; i++) {
+        payload |= (uint32_t) header[8 + i] << (8 * i);
+    }
+    if (size > out_size || payload > nbytes - EEG_HEADER_SIZE) {
+        return 0;
+    }
+    n = (size_t) size / elem_size;
+
+    shuffled = (uint8_t *) malloc(size + 1);
+    scratch  = (uint8_t *) malloc(EEG_BLOCK * elem_size);
+    if (shuffled == NULL || scratch == NULL) {
+        perror("malloc failed in eeg_decode()");
+        free(shuffled);
+        free(scratch);
+        return 0;
+    }
+
+    if (header[12] == EEG_CODEC_LZ4) {
+        if (lz4_decompress(header + EEG_HEADER_SIZE, payload, shuffled,
+                           size) != size) {
+            free(shuffled);
+            free(scratch);
+            return 0;
+        }
+    } else if (header[12] == EEG_CODEC_STORED && payload == size) {
+        memcpy(shuffled, header + EEG_HEADER_SIZE, size);
+    } else {
+        free(shuffled);
+        free(scratch);
+        return 0;
+    }
+
+    bit_unshuffle(shuffled, (uint8_t *) out, n, elem_size, scratch);
+    memcpy((uint8_t *) out + n * elem_size, shuffled + n * elem_size,
+           size - n * elem_size);
+    delta_decode(out, n, elem_size, row_len);
+
+    free(shuffled);
+    free(scratch);
+    return (size_t) size;
+}
+
+/*******************************************************************************
+ *                              Helper functions
+ ******************************************************************************/
+
+/*
+ * HDF5 callback: the filter works on chunked integer and float datasets
+ */
+static htri_t can_apply_eeg(hid_t dcpl, hid_t type, hid_t space) {
+    size_t size = H5Tget_size(type);
+    H5T_class_t class = H5Tget_class(type);
+    (void) space;
+
+    if (H5Pget_layout(dcpl) != H5D_CHUNKED) {
+        return 0;
+    }
+    if (class != H5T_INTEGER && class != H5T_FLOAT) {
+        return 0;
+    }
+    return size == 1 || size == 2 || size == 4 || size == 8;
+}
+
+/*
+ * HDF5 callback: records the element size, the row length and the size of the
+ * chunks in the filter's parameters: version, element size, row length, chunk
+ * bytes. Files from before the chunk size was recorded have only the first 3.
+ */
+static herr_t set_local_eeg(hid_t dcpl, hid_t type, hid_t space) {
+    int      i;
+    int      rank;
+    hsize_t  chunk[H5S_MAX_RANK];
+    unsigned values[4];
+    (void) space;
+
+    if ((rank = H5Pget_chunk(dcpl, H5S_MAX_RANK, chunk)) < 1) {
+        return -1;
+    }
+    values[0] = EEG_FILTER_VERSION;
+    values[1] = (unsigned) H5Tget_size(type);
+    values[2] = 1;
+    for (i = 1; i < rank; i++) {
+        values[2] *= (unsigned) chunk[i];
+    }
+    // HDF5 limits chunks to 4 GB, so this fits
+    values[3] = values[1] * values[2] * (unsigned) chunk[0];
+    return H5Pmodify_filter(dcpl, H5Z_FILTER_EEG, H5Z_FLAG_MANDATORY, 4,
+                            values);
+}
+
+/*
+ * HDF5 callback: encodes or decodes a chunk, replacing *buf
+ */
+static size_t eeg_filter(unsigned       flags,
+                         size_t         cd_nelmts,
+                         const unsigned cd_values[],
+                         size_t         nbytes,
+                         size_t        *buf_size,
+                         void         **buf) {
+    size_t size;
+    size_t out_size;
+    void  *out;
+
+    if (cd_nelmts < 3 || cd_values[0] != EEG_FILTER_VERSION) {
+        return 0;
+    }
+    if (flags & H5Z_FLAG_REVERSE) {
+        const uint8_t *header = (const uint8_t *) *buf;
+        int i;
+        if (nbytes < EEG_HEADER_SIZE) {
+            return 0;
+        }
+        for (i = 0, out_size = 0; i < 8; i++) {
+            out_size |= (size_t) header[i] << (8 * i);
+        }
+        // the size comes from the file: no larger than a chunk, or than LZ4
+        // can expand the payload to when the chunk size isn't recorded
+        if (cd_nelmts >= 4 ? out_size > cd_values[3]
+                           : out_size > EEG_MAX_DECODED(nbytes)) {
+            fprintf(stderr, "EEG chunk claims %zu bytes, more than a chunk\n",
+                    out_size);
+            return 0;
+        }
+        if ((out = H5allocate_memory(out_size, 0)) == NULL) {
+            return 0;
+        }
+        size = eeg_decode(*buf, nbytes, cd_values[1], cd_values[2], out,
+                          out_size);
+    } else {
+        out_size = EEG_BOUND(nbytes);
+        if ((out = H5allocate_memory(out_size, 0)) == NULL) {
+            return 0;
+        }
+        size = eeg_encode(*buf, nbytes, cd_values[1], cd_values[2], out);
+    }
+    if (size == 0) {
+        H5free_memory(out);
+        return 0;
+    }
+
+    H5free_memory(*buf);
+    *buf      = out;
+    *buf_size = out_size;
+    return size;
+}
+
+/*
+ * Generates delta coding for unsigned integers of one width. Subtraction wraps
+ * around so the coding is lossless for any bits. Both loops are over
+ * independent elements, so the compiler vectorizes them across channels.
+ */
+#define DELTA_CODING(bits)                                                     \
+static void delta_encode_##bits(const uint##bits##_t *restrict in,             \
+                                uint##bits##_t *restrict out, size_t n,        \
+                                size_t row_len) {                              \
+    size_t i;                                                                  \
+    size_t head = row_len < n ? row_len : n;                                   \
+    for (i = 0; i < head; i++) {                                               \
+        out[i] = in[i];                                                        \
+    }                                                                          \
+    for (i = head; i < n; i++) {                                               \
+        out[i] = (uint##bits##_t) (in[i] - in[i - row_len]);                   \
+    }                                                                          \
+}                                                                              \
+static void add_row_##bits(uint##bits##_t *restrict row,                       \
+                           const uint##bits##_t *restrict prev, size_t n) {    \
+    size_t i;                                                                  \
+    for (i = 0; i < n; i++) {                                                  \
+        row[i] = (uint##bits##_t) (row[i] + prev[i]);                          \
+    }                                                                          \
+}                                                                              \
+static void delta_decode_##bits(uint##bits##_t *x, size_t n, size_t row_len) { \
+    size_t i;                                                                  \
+    for (i = row_len; i + row_len <= n; i += row_len) {                        \
+        add_row_##bits(x + i, x + i - row_len, row_len);                       \
+    }                                                                          \
+    for (; i < n; i++) {                                                       \
+        x[i] = (uint##bits##_t) (x[i] + x[i - row_len]);                       \
+    }                                                                          \
+}
+
+DELTA_CODING(8)
+DELTA_CODING(16)
+DELTA_CODING(32)
+DELTA_CODING(64)
+
+/*
+ * Replaces every element by its difference with the element one row earlier
+ * \param in n elements
+ * \param out the deltas
+ * \param n the number of elements
+ * \param elem_size the size of an element
+ * \param row_len the number of elements per row
+ */
+static void delta_encode(const void *in,
+                         void       *out,
+                         size_t      n,
+                         size_t      elem_size,
+                         size_t      row_len) {
+    row_len = row_len ? row_len : 1;
+    switch (elem_size) {
+        case 1:
+            delta_encode_8(in, out, n, row_len);
+            break;
+        case 2:
+            delta_encode_16(in, out, n, row_len);
+            break;
+        case 4:
+            delta_encode_32(in, out, n, row_len);
+            break;
+        case 8:
+            delta_encode_64(in, out, n, row_len);
+            break;
+        default:
+            memcpy(out, in, n * elem_size);
+    }
+}
+
+/*
+ * Undoes delta_encode in place
+ * \param buf n deltas
+ * \param n the number of elements
+ * \param elem_size the size of an element
+ * \param row_len the number of elements per row
+ */
+static void delta_decode(void *buf, size_t n, size_t elem_size,
+                         size_t row_len) {
+    row_len = row_len ? row_len : 1;
+    switch (elem_size) {
+        case 1:
+            delta_decode_8(buf, n, row_len);
+            break;
+        case 2:
+            delta_decode_16(buf, n, row_len);
+            break;
+        case 4:
+            delta_decode_32(buf, n, row_len);
+            break;
+        case 8:
+            delta_decode_64(buf, n, row_len);
+            break;
+        default:
+            break;
+    }
+}
+
+/*
+ * Generates byte (un)shuffling for one element size. With the size known at
+ * compile time the strided loops are unrolled and vectorized.
+ */
+#define BYTE_SHUFFLE(size)                                                     \
+static void byte_shuffle_##size(const uint8_t *restrict src,                   \
+                                uint8_t *restrict dst, size_t n) {             \
+    size_t i, j;                                                               \
+    for (i = 0; i < n; i++) {                                                  \
+        for (j = 0; j < size; j++) {                                           \
+            dst[j * n + i] = src[i * size + j];                                \
+        }                                                                      \
+    }                                                                          \
+}                                                                              \
+static void byte_unshuffle_##size(const uint8_t *restrict src,                 \
+                                  uint8_t *restrict dst, size_t n) {           \
+    size_t i, j;                                                               \
+    for (i = 0; i < n; i++) {                                                  \
+        for (j = 0; j < size; j++) {                                           \
+            dst[i * size + j] = src[j * n + i];                                \
+        }                                                                      \
+    }                                                                          \
+}
+
+BYTE_SHUFFLE(2)
+BYTE_SHUFFLE(4)
+BYTE_SHUFFLE(8)
+
+/*
+ * Groups the bytes of n elements by their position in the element
+ * \param src n elements
+ * \param dst elem_size planes of n bytes
+ * \param n the number of elements
+ * \param elem_size the size of an element
+ */
+static void byte_shuffle(const uint8_t *src, uint8_t *dst, size_t n,
+                         size_t elem_size) {
+    size_t i, j;
+    switch (elem_size) {
+        case 1:
+            memcpy(dst, src, n);
+            break;
+        case 2:
+            byte_shuffle_2(src, dst, n);
+            break;
+        case 4:
+            byte_shuffle_4(src, dst, n);
+            break;
+        case 8:
+            byte_shuffle_8(src, dst, n);
+            break;
+        default:
+            for (j = 0; j < elem_size; j++) {
+                for (i = 0; i < n; i++) {
+                    dst[j * n + i] = src[i * elem_size + j];
+                }
+            }
+    }
+}
+
+/*
+ * Undoes byte_shuffle
+ * \param src elem_size planes of n bytes
+ * \param dst n elements
+ * \param n the number of elements
+ * \param elem_size the size of an element
+ */
+static void byte_unshuffle(const uint8_t *src, uint8_t *dst, size_t n,
+                           size_t elem_size) {
+    size_t i, j;
+    switch (elem_size) {
+        case 1:
+            memcpy(dst, src, n);
+            break;
+        case 2:
+            byte_unshuffle_2(src, dst, n);
+            break;
+        case 4:
+            byte_unshuffle_4(src, dst, n);
+            break;
+        case 8:
+            byte_unshuffle_8(src, dst, n);
+            break;
+        default:
+            for (j = 0; j < elem_size; j++) {
+                for (i = 0; i < n; i++) {
+                    dst[i * elem_size + j] = src[j * n + i];
+                }
+            }
+    }
+}
+
+/*
+ * Bit shuffles n elements in blocks of EEG_BLOCK. Within a block the bytes are
+ * first grouped by their position in the element, then each group is split into
+ * 8 bit planes. Elements past the last multiple of 8 in a block are copied.
+ * \param in n elements
+ * \param out the shuffled bytes
+ * \param n the number of elements
+ * \param elem_size the size of an element
+ * \param scratch EEG_BLOCK * elem_size bytes
+ */
+static void bit_shuffle(const uint8_t *in,
+                        uint8_t       *out,
+                        size_t         n,
+                        size_t         elem_size,
+                        uint8_t       *scratch) {
+    size_t j;
+    size_t start;
+
+    for (start = 0; start < n; start += EEG_BLOCK) {
+        size_t m  = n - start < EEG_BLOCK ? n - start : EEG_BLOCK;
+        size_t m8 = m & ~(size_t) 7;
+        const uint8_t *src = in + start * elem_size;
+        uint8_t       *dst = out + start * elem_size;
+
+        byte_shuffle(src, scratch, m8, elem_size);
+        for (j = 0; j < elem_size; j++) {
+            transpose_bits(scratch + j * m8, dst + j * m8, m8);
+        }
+        memcpy(dst + m8 * elem_size, src + m8 * elem_size,
+               (m - m8) * elem_size);
+    }
+}
+
+/*
+ * Undoes bit_shuffle
+ * \param in the shuffled bytes of n elements
+ * \param out the elements
+ * \param n the number of elements
+ * \param elem_size the size of an element
+ * \param scratch EEG_BLOCK * elem_size bytes
+ */
+static void bit_unshuffle(const uint8_t *in,
+                          uint8_t       *out,
+                          size_t         n,
+                          size_t         elem_size,
+                          uint8_t       *scratch) {
+    size_t j;
+    size_t start;
+
+    for (start = 0; start < n; start += EEG_BLOCK) {
+        size_t m  = n - start < EEG_BLOCK ? n - start : EEG_BLOCK;
+        size_t m8 = m & ~(size_t) 7;
+        const uint8_t *src = in + start * elem_size;
+        uint8_t       *dst = out + start * elem_size;
+
+        for (j = 0; j < elem_size; j++) {
+            untranspose_bits(src + j * m8, scratch + j * m8, m8);
+        }
+        byte_unshuffle(scratch, dst, m8, elem_size);
+        memcpy(dst + m8 * elem_size, src + m8 * elem_size,
+               (m - m8) * elem_size);
+    }
+}
+
+/*
+ * Transposes an 8x8 bit matrix held in a little endian word: bit c of byte r
+ * becomes bit r of byte c
+ */
+static uint64_t transpose8(uint64_t x) {
+    uint64_t t;
+    t = (x ^ (x >> 7)) & 0x00AA00AA00AA00AAULL;
+    x = x ^ t ^ (t << 7);
+    t = (x ^ (x >> 14)) & 0x0000CCCC0000CCCCULL;
+    x = x ^ t ^ (t << 14);
+    t = (x ^ (x >> 28)) & 0x00000000F0F0F0F0ULL;
+    x = x ^ t ^ (t << 28);
+    return x;
+}
+
+static uint64_t load64(const uint8_t *p) {
+    int      i;
+    uint64_t x = 0;
+    for (i = 0; i < 8; i++) {
+        x |= (uint64_t) p[i] << (8 * i);
+    }
+    return x;
+}
+
+#ifdef __SSE2__
+/* transpose8 on both 64 bit lanes */
+static __m128i transpose8_sse2(__m128i x) {
+    __m128i t;
+    t = _mm_and_si128(_mm_xor_si128(x, _mm_srli_epi64(x, 7)),
+                      _mm_set1_epi64x(0x00AA00AA00AA00AALL));
+    x = _mm_xor_si128(_mm_xor_si128(x, t), _mm_slli_epi64(t, 7));
+    t = _mm_and_si128(_mm_xor_si128(x, _mm_srli_epi64(x, 14)),
+                      _mm_set1_epi64x(0x0000CCCC0000CCCCLL));
+    x = _mm_xor_si128(_mm_xor_si128(x, t), _mm_slli_epi64(t, 14));
+    t = _mm_and_si128(_mm_xor_si128(x, _mm_srli_epi64(x, 28)),
+                      _mm_set1_epi64x(0x00000000F0F0F0F0LL));
+    x = _mm_xor_si128(_mm_xor_si128(x, t), _mm_slli_epi64(t, 28));
+    return x;
+}
+#endif
+
+/*
+ * Splits n bytes (a multiple of 8) into 8 bit planes of n / 8 bytes: bit i of
+ * byte g of plane b is bit b of input byte 8 g + i
+ * \param in n bytes
+ * \param out the 8 bit planes
+ * \param n the number of bytes
+ */
+static void transpose_bits(const uint8_t *in, uint8_t *out, size_t n) {
+    int    b;
+    size_t g     = 0;
+    size_t bytes = n / 8;
+
+#ifdef __SSE2__
+    // the top bit of 16 bytes at once, shifting the next bit up each time
+    for (; g + 2 <= bytes; g += 2) {
+        __m128i v = _mm_loadu_si128((const __m128i *) (in + 8 * g));
+        for (b = 7; b >= 0; b--) {
+            uint16_t mask = (uint16_t) _mm_movemask_epi8(v);
+            memcpy(out + b * bytes + g, &mask, sizeof(mask));
+            v = _mm_slli_epi16(v, 1);
+        }
+    }
+#endif
+    for (; g < bytes; g++) {
+        uint64_t x = transpose8(load64(in + 8 * g));
+        for (b = 0; b < 8; b++) {
+            out[b * bytes + g] = (uint8_t) (x >> (8 * b));
+        }
+    }
+}
+
+/*
+ * Undoes transpose_bits
+ * \param in the 8 bit planes of n / 8 bytes
+ * \param out n bytes
+ * \param n the number of bytes
+ */
+static void untranspose_bits(const uint8_t *in, uint8_t *out, size_t n) {
+    int    b;
+    size_t g     = 0;
+    size_t bytes = n / 8;
+
+#ifdef __SSE2__
+    // gather byte g of the 8 planes for 16 groups with unpacks, then transpose
+    for (; g + 16 <= bytes; g += 16) {
+        __m128i r[8], a[8], c[8];
+        for (b = 0; b < 8; b++) {
+            r[b] = _mm_loadu_si128((const __m128i *) (in + b * bytes + g));
+        }
+        for (b = 0; b < 4; b++) {
+            a[2 * b]     = _mm_unpacklo_epi8(r[2 * b], r[2 * b + 1]);
+            a[2 * b + 1] = _mm_unpackhi_epi8(r[2 * b], r[2 * b + 1]);
+        }
+        r[0] = _mm_unpacklo_epi16(a[0], a[2]);
+        r[1] = _mm_unpackhi_epi16(a[0], a[2]);
+        r[2] = _mm_unpacklo_epi16(a[1], a[3]);
+        r[3] = _mm_unpackhi_epi16(a[1], a[3]);
+        r[4] = _mm_unpacklo_epi16(a[4], a[6]);
+        r[5] = _mm_unpackhi_epi16(a[4], a[6]);
+        r[6] = _mm_unpacklo_epi16(a[5], a[7]);
+        r[7] = _mm_unpackhi_epi16(a[5], a[7]);
+        for (b = 0; b < 4; b++) {
+            c[2 * b]     = _mm_unpacklo_epi32(r[b], r[b + 4]);
+            c[2 * b + 1] = _mm_unpackhi_epi32(r[b], r[b + 4]);
+        }
+        for (b = 0; b < 8; b++) {
+            _mm_storeu_si128((__m128i *) (out + 8 * (g + 2 * b)),
+                             transpose8_sse2(c[b]));
+        }
+    }
+#endif
+    for (; g < bytes; g++) {
+        uint64_t x = 0;
+        for (b = 0; b < 8; b++) {
+            x |= (uint64_t) in[b * bytes + g] << (8 * b);
+        }
+        x = transpose8(x);
+        for (b = 0; b < 8; b++) {
+            out[8 * g + b] = (uint8_t) (x >> (8 * b));
+        }
+    }
+}
+
+static uint32_t read32(const uint8_t *p) {
+    uint32_t x;
+    memcpy(&x, p, sizeof(x));
+    return x;
+}
+
+/*
+ * Writes a length that didn't fit in a token as a run of 255s and a remainder
+ */
+static uint8_t *write_length(uint8_t *op, size_t len) {
+    while (len >= 255) {
+        *op++ = 255;
+        len  -= 255;
+    }
+    *op++ = (uint8_t) len;
+    return op;
+}
+
+/*
+ * Writes one LZ4 sequence: literals followed by a match, or only literals if
+ * match_len is 0
+ */
+static uint8_t *write_sequence(uint8_t       *op,
+                               const uint8_t *literals,
+                               size_t         lit_len,
+                               size_t         offset,
+                               size_t         match_len) {
+    uint8_t *token = op++;
+
+    *token = (uint8_t) ((lit_len < 15 ? lit_len : 15) << 4);
+    if (lit_len >= 15) {
+        op = write_length(op, lit_len - 15);
+    }
+    memcpy(op, literals, lit_len);
+    op += lit_len;
+    if (match_len == 0) {
+        return op;
+    }
+
+    *op++ = (uint8_t) offset;
+    *op++ = (uint8_t) (offset >> 8);
+    match_len -= LZ4_MIN_MATCH;
+    *token |= (uint8_t) (match_len < 15 ? match_len : 15);
+    if (match_len >= 15) {
+        op = write_length(op, match_len - 15);
+    }
+    return op;
+}
+
+/*
+ * Compresses a buffer into one LZ4 block with a greedy hash table match finder.
+ * `dst` must hold n + n / 255 + 16 bytes.
+ * \param src the bytes to compress
+ * \param n the number of bytes
+ * \param dst the LZ4 block
+ * \return the size of the block
+ */
+static size_t lz4_compress(const uint8_t *src, size_t n, uint8_t *dst) {
+    size_t   ip     = 0;
+    size_t   anchor = 0;
+    size_t   misses = 0;
+    uint8_t *op     = dst;
+    uint32_t table[1 << LZ4_HASH_LOG];
+
+    memset(table, 0, sizeof(table));
+    while (n > LZ4_MF_LIMIT && ip < n - LZ4_MF_LIMIT) {
+        uint32_t seq  = read32(src + ip);
+        uint32_t hash = (seq * 2654435761u) >> (32 - LZ4_HASH_LOG);
+        size_t   ref  = table[hash];
+
+        table[hash] = (uint32_t) ip;
+        if (ref < ip && ip - ref <= LZ4_MAX_DIST && read32(src + ref) == seq) {
+            size_t len = LZ4_MIN_MATCH;
+            while (ip + len < n - LZ4_LAST_LITS &&
+                   src[ref + len] == src[ip + len]) {
+                len++;
+            }
+            op = write_sequence(op, src + anchor, ip - anchor, ip - ref, len);
+            ip     += len;
+            anchor  = ip;
+            misses  = 0;
+        } else {
+            // skip faster through data that doesn't compress
+            ip += 1 + (misses++ >> 6);
+        }
+    }
+    op = write_sequence(op, src + anchor, n - anchor, 0, 0);
+
+    return (size_t) (op - dst);
+}
+
+/*
+ * Decompresses an LZ4 block, checking every length against the buffers
+ * \param src the LZ4 block
+ * \param n the size of the block
+ * \param dst the decompressed bytes
+ * \param dst_size the size of dst
+ * \return the number of bytes decompressed or 0 if the block is corrupt
+ */
+static size_t lz4_decompress(const uint8_t *src,
+                             size_t         n,
+                             uint8_t       *dst,
+                             size_t         dst_size) {
+    size_t ip = 0;
+    size_t op = 0;
+
+    while (ip < n) {
+        uint8_t token   = src[ip++];
+        size_t  lit_len = token >> 4;
+        size_t  match_len;
+        size_t  offset;
+        uint8_t b;
+
+        if (lit_len == 15) {
+            do {
+                if (ip >= n) {
+                    return 0;
+                }
+                b        = src[ip++];
+                lit_len += b;
+            } while (b == 255);
+        }
+        if (lit_len > n - ip || lit_len > dst_size - op) {
+            return 0;
+        }
+        memcpy(dst + op, src + ip, lit_len);
+        ip += lit_len;
+        op += lit_len;
+        if (ip == n) {
+            break;
+        }
+
+        if (n - ip < 2) {
+            return 0;
+        }
+        offset = src[ip] | (size_t) src[ip + 1] << 8;
+        ip    += 2;
+        if (offset == 0 || offset > op) {
+            return 0;
+        }
+        match_len = token & 15;
+        if (match_len == 15) {
+            do {
+                if (ip >= n) {
+                    return 0;
+                }
+                b          = src[ip++];
+                match_len += b;
+            } while (b == 255);
+        }
+        match_len += LZ4_MIN_MATCH;
+        if (match_len > dst_size - op) {
+            return 0;
+        }
+        if (offset >= match_len) {
+            memcpy(dst + op, dst + op - offset, match_len);
+            op += match_len;
+        } else {
+            // overlapping copy, repeats the last `offset` bytes
+            size_t end = op + match_len;
+            for (; op < end; op++) {
+                dst[op] = dst[op - offset];
+            }
+        }
+    }
+
+    return op;
+}
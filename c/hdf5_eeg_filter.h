@@ -0,0 +1,45 @@
+#ifndef _HDF5_EEG_FILTER_H_
+#define _HDF5_EEG_FILTER_H_
+
+#include <stddef.h>
+#include "hdf5.h"
+
+/*
+ * Filter id of the EEG filter. It's in the range HDF5 leaves for testing and
+ * should be swapped for a registered id before files are shared widely.
+ */
+#define H5Z_FILTER_EEG     307
+#define EEG_FILTER_VERSION 1
+#define EEG_HEADER_SIZE    16
+#define EEG_BLOCK          4096  // elements bit-shuffled together
+
+// payload codecs recorded in the header of each chunk
+#define EEG_CODEC_STORED   0
+#define EEG_CODEC_LZ4      1
+
+// worst case size of an encoded chunk
+#define EEG_BOUND(n)       ((EEG_HEADER_SIZE + (n) + (n) / 255 + 16))
+
+/*
+ * Registers the EEG filter with HDF5
+ */
+int register_eeg_filter(void);
+
+/*
+ * Adds the EEG filter to a dataset creation property list
+ */
+int set_eeg_filter(hid_t plist);
+
+/*
+ * Encodes a chunk: per channel delta, bit shuffle and LZ4
+ */
+size_t eeg_encode(const void *in, size_t nbytes, size_t elem_size,
+                  size_t row_len, void *out);
+
+/*
+ * Decodes a chunk encoded by eeg_encode
+ */
+size_t eeg_decode(const void *in, size_t nbytes, size_t elem_size,
+                  size_t row_len, void *out, size_t out_size);
+
+#endif
@@ -0,0 +1,996 @@
+/*
+ * Exports datasets as raw little endian binary, NumPy .npy or CSV.
+ *
+ * Datasets are streamed a block of rows at a time, so their size isn't limited
+ * by memory. Raw and .npy output keep the type of the dataset and only convert
+ * the byte order if the host is big endian. CSV is the expensive one: the rows
+ * of a block are split between the threads, each formats its share into its
+ * own part of a text buffer, and the parts are written out in order.
+ *
+ * Numbers in CSV are written with the fewest digits that read back as exactly
+ * the same value. The digits come from Grisu3 (Loitsch, "Printing
+ * floating-point numbers quickly and accurately with integers", PLDI 2010),
+ * which only uses 64 bit integer arithmetic and either finds the shortest
+ * digits or knows it can't; about 0.5% of numbers then go through snprintf and
+ * strtod instead.
+ */
+
+#include <float.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "hdf5.h"
+#include "hdf5_export.h"
+#include "hdf5_stats.h"
+
+#define NPY_HEADER_MAX  1024
+#define NPY_ALIGN       64        // the header is padded to a multiple of this
+
+// digits that always tell floats and doubles apart
+#define FLT_ROUND_TRIP_DIG  9
+#define DBL_ROUND_TRIP_DIG  17
+
+// Grisu scales numbers by a cached power of ten to at least this exponent
+#define GRISU_MIN_EXP   -60
+#define POW10_OFFSET    348       // -(decimal exponent of the first power)
+#define POW10_STEP      8         // decimal exponents between cached powers
+
+// numbers whose decimal point is this close to their digits aren't in e form
+#define FIXED_MIN_POINT -5
+#define FIXED_MAX_POINT 21
+
+// how an element is formatted in CSV
+#define KIND_DOUBLE     0
+#define KIND_FLOAT      1
+#define KIND_INT        2
+#define KIND_UINT       3
+
+/* a number f * 2^e, with a 64 bit significand */
+struct diy_fp {
+    uint64_t f;
+    int      e;
+};
+
+/* a cached power of ten, f * 2^e = 10^k */
+struct cached_pow10 {
+    uint64_t f;
+    int      e;
+    int      k;
+};
+
+/* how the elements of a dataset are read and written */
+struct element {
+    hid_t  mem_type;  // the type the elements are read as
+    size_t size;      // the size of mem_type
+    int    kind;      // KIND_* for CSV
+    char   descr[8];  // the NumPy dtype for .npy
+};
+
+/* helper functions */
+static int    get_element(const hdf5_entry_t entry, int format,
+                          struct element *elem);
+static int    write_npy_header(const hdf5_entry_t entry, const char *descr,
+                               FILE *out);
+static int    read_block(const hdf5_entry_t entry, hsize_t start,
+                         hsize_t count, hid_t mem_type, void *buf);
+static int    write_csv(const void *buf, const struct element *elem,
+                        hsize_t rows, hsize_t cols, char *text, FILE *out);
+static size_t format_rows(const void *buf, const struct element *elem,
+                          hsize_t rows, hsize_t cols, char *text);
+static long long          int_at(const void *buf, hsize_t i, size_t size);
+static unsigned long long uint_at(const void *buf, hsize_t i, size_t size);
+static int    format_shortest(uint64_t f, int e, bool closer_below,
+                              bool negative, char *buf);
+static int    format_digits(const char *digits, int len, int exp, bool negative,
+                            char *buf);
+static bool   grisu3(struct diy_fp v, bool closer_below, char *digits,
+                     int *len, int *exp);
+static bool   digit_gen(struct diy_fp low, struct diy_fp w, struct diy_fp high,
+                        char *digits, int *len, int *kappa);
+static bool   round_weed(char *digits, int len, uint64_t distance_high_w,
+                         uint64_t unsafe, uint64_t rest, uint64_t ten_kappa,
+                         uint64_t unit);
+static struct diy_fp multiply(struct diy_fp x, struct diy_fp y);
+static struct diy_fp normalize(struct diy_fp x);
+static int    format_general(double value, bool single, char *buf);
+static int    format_special(double value, char *buf);
+static int    format_uint(unsigned long long value, char *buf);
+static int    format_int(long long value, char *buf);
+
+static const uint32_t small_pow10s[10] = {
+    1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000, 1000000000
+};
+
+// 10^k for k = -348, -340, ..., 340, rounded to 64 bits
+static const struct cached_pow10 cached_pow10s[] = {
+    {0xfa8fd5a0081c0288ULL, -1220, -348},
+    {0xbaaee17fa23ebf76ULL, -1193, -340},
+    {0x8b16fb203055ac76ULL, -1166, -332},
+    {0xcf42894a5dce35eaULL, -1140, -324},
+    {0x9a6bb0aa55653b2dULL, -1113, -316},
+    {0xe61acf033d1a45dfULL, -1087, -308},
+    {0xab70fe17c79ac6caULL, -1060, -300},
+    {0xff77b1fcbebcdc4fULL, -1034, -292},
+    {0xbe5691ef416bd60cULL, -1007, -284},
+    {0x8dd01fad907ffc3cULL,  -980, -276},
+    {0xd3515c2831559a83ULL,  -954, -268},
+    {0x9d71ac8fada6c9b5ULL,  -927, -260},
+    {0xea9c227723ee8bcbULL,  -901, -252},
+    {0xaecc49914078536dULL,  -874, -244},
+    {0x823c12795db6ce57ULL,  -847, -236},
+    {0xc21094364dfb5637ULL,  -821, -228},
+    {0x9096ea6f3848984fULL,  -794, -220},
+    {0xd77485cb25823ac7ULL,  -768, -212},
+    {0xa086cfcd97bf97f4ULL,  -741, -204},
+    {0xef340a98172aace5ULL,  -715, -196},
+    {0xb23867fb2a35b28eULL,  -688, -188},
+    {0x84c8d4dfd2c63f3bULL,  -661, -180},
+    {0xc5dd44271ad3cdbaULL,  -635, -172},
+    {0x936b9fcebb25c996ULL,  -608, -164},
+    {0xdbac6c247d62a584ULL,  -582, -156},
+    {0xa3ab66580d5fdaf6ULL,  -555, -148},
+    {0xf3e2f893dec3f126ULL,  -529, -140},
+    {0xb5b5ada8aaff80b8ULL,  -502, -132},
+    {0x87625f056c7c4a8bULL,  -475, -124},
+    {0xc9bcff6034c13053ULL,  -449, -116},
+    {0x964e858c91ba2655ULL,  -422, -108},
+    {0xdff9772470297ebdULL,  -396, -100},
+    {0xa6dfbd9fb8e5b88fULL,  -369,  -92},
+    {0xf8a95fcf88747d94ULL,  -343,  -84},
+    {0xb94470938fa89bcfULL,  -316,  -76},
+    {0x8a08f0f8bf0f156bULL,  -289,  -68},
+    {0xcdb02555653131b6ULL,  -263,  -60},
+    {0x993fe2c6d07b7facULL,  -236,  -52},
+    {0xe45c10c42a2b3b06ULL,  -210,  -44},
+    {0xaa242499697392d3ULL,  -183,  -36},
+    {0xfd87b5f28300ca0eULL,  -157,  -28},
+    {0xbce5086492111aebULL,  -130,  -20},
+    {0x8cbccc096f5088ccULL,  -103,  -12},
+    {0xd1b71758e219652cULL,   -77,   -4},
+    {0x9c40000000000000ULL,   -50,    4},
+    {0xe8d4a51000000000ULL,   -24,   12},
+    {0xad78ebc5ac620000ULL,     3,   20},
+    {0x813f3978f8940984ULL,    30,   28},
+    {0xc097ce7bc90715b3ULL,    56,   36},
+    {0x8f7e32ce7bea5c70ULL,    83,   44},
+    {0xd5d238a4abe98068ULL,   109,   52},
+    {0x9f4f2726179a2245ULL,   136,   60},
+    {0xed63a231d4c4fb27ULL,   162,   68},
+    {0xb0de65388cc8ada8ULL,   189,   76},
+    {0x83c7088e1aab65dbULL,   216,   84},
+    {0xc45d1df942711d9aULL,   242,   92},
+    {0x924d692ca61be758ULL,   269,  100},
+    {0xda01ee641a708deaULL,   295,  108},
+    {0xa26da3999aef774aULL,   322,  116},
+    {0xf209787bb47d6b85ULL,   348,  124},
+    {0xb454e4a179dd1877ULL,   375,  132},
+    {0x865b86925b9bc5c2ULL,   402,  140},
+    {0xc83553c5c8965d3dULL,   428,  148},
+    {0x952ab45cfa97a0b3ULL,   455,  156},
+    {0xde469fbd99a05fe3ULL,   481,  164},
+    {0xa59bc234db398c25ULL,   508,  172},
+    {0xf6c69a72a3989f5cULL,   534,  180},
+    {0xb7dcbf5354e9beceULL,   561,  188},
+    {0x88fcf317f22241e2ULL,   588,  196},
+    {0xcc20ce9bd35c78a5ULL,   614,  204},
+    {0x98165af37b2153dfULL,   641,  212},
+    {0xe2a0b5dc971f303aULL,   667,  220},
+    {0xa8d9d1535ce3b396ULL,   694,  228},
+    {0xfb9b7cd9a4a7443cULL,   720,  236},
+    {0xbb764c4ca7a44410ULL,   747,  244},
+    {0x8bab8eefb6409c1aULL,   774,  252},
+    {0xd01fef10a657842cULL,   800,  260},
+    {0x9b10a4e5e9913129ULL,   827,  268},
+    {0xe7109bfba19c0c9dULL,   853,  276},
+    {0xac2820d9623bf429ULL,   880,  284},
+    {0x80444b5e7aa7cf85ULL,   907,  292},
+    {0xbf21e44003acdd2dULL,   933,  300},
+    {0x8e679c2f5e44ff8fULL,   960,  308},
+    {0xd433179d9c8cb841ULL,   986,  316},
+    {0x9e19db92b4e31ba9ULL,  1013,  324},
+    {0xeb96bf6ebadf77d9ULL,  1039,  332},
+    {0xaf87023b9bf0ee6bULL,  1066,  340},
+};
+
+static const char digit_pairs[201] =
+    "00010203040506070809101112131415161718192021222324"
+    "25262728293031323334353637383940414243444546474849"
+    "50515253545556575859606162636465666768697071727374"
+    "75767778798081828384858687888990919293949596979899";
+
+/*
+ * Exports a dataset to a file
+ * \param entry the dataset to export
+ * \param path the file to write, which is overwritten
+ * \param format EXPORT_RAW, EXPORT_NPY or EXPORT_CSV
+ * \return 0 on success or -1 on failure
+ */
+int export_dataset(const hdf5_entry_t entry, const char *path, int format) {
+    int   status;
+    FILE *out;
+
+    if ((out = fopen(path, "wb")) == NULL) {
+        perror("failed to open export file");
+        return -1;
+    }
+    setvbuf(out, NULL, _IOFBF, EXPORT_BUF_BYTES);
+
+    status = export_stream(entry, out, format);
+    if (fclose(out) != 0) {
+        perror("failed to close export file");
+        status = -1;
+    }
+    return status;
+}
+
+/*
+ * Exports a dataset to a stream, a block of rows at a time. Raw output is
+ * X_DIM(entry) x Y_DIM(entry) elements of the dataset's type in row order;
+ * .npy output adds a header with the dataset's real shape; CSV output has a
+ * line per row.
+ * \param entry the dataset to export, integer or floating point
+ * \param out the stream to write to
+ * \param format EXPORT_RAW, EXPORT_NPY or EXPORT_CSV
+ * \return 0 on success or -1 on failure
+ */
+int export_stream(const hdf5_entry_t entry, FILE *out, int format) {
+    int     status = -1;
+    char   *text   = NULL;
+    void   *buf;
+    hsize_t n;
+    hsize_t start;
+    hsize_t step;
+    hsize_t cols = Y_DIM(entry);
+    struct element elem;
+    STATS_TIMER(EXPORT_STREAM);
+
+    if (get_element(entry, format, &elem) < 0) {
+        return -1;
+    }
+    if (format == EXPORT_NPY && write_npy_header(entry, elem.descr, out) < 0) {
+        return -1;
+    }
+
+    step = block_rows(entry);
+    if ((buf = malloc(elem.size * step * cols)) == NULL) {
+        perror("malloc failed in export_stream():buf");
+        return -1;
+    }
+    if (format == EXPORT_CSV &&
+        (text = (char *) malloc(FORMAT_LEN * step * cols)) == NULL) {
+        perror("malloc failed in export_stream():text");
+        free(buf);
+        return -1;
+    }
+    STATS_ALLOC(elem.size * step * cols);
+
+    for (start = 0; start < X_DIM(entry); start += n) {
+        n = X_DIM(entry) - start < step ? X_DIM(entry) - start : step;
+        if (read_block(entry, start, n, elem.mem_type, buf) < 0) {
+            goto done;
+        }
+        if (format == EXPORT_CSV) {
+            if (write_csv(buf, &elem, n, cols, text, out) < 0) {
+                goto done;
+            }
+        } else if (fwrite(buf, elem.size, n * cols, out) != n * cols) {
+            perror("failed to write export");
+            goto done;
+        }
+    }
+    status = 0;
+
+done:
+    free(buf);
+    free(text);
+    return status;
+}
+
+/*
+ * Formats a double with the fewest significant digits that strtod reads back
+ * as the same double. `buf` must hold FORMAT_LEN characters.
+ * \param value the number to format
+ * \param buf the buffer to format it into
+ * \return the length of the formatted number
+ */
+int format_double(double value, char *buf) {
+    int      n;
+    int      exp;
+    uint64_t bits;
+    uint64_t f;
+
+    if (isnan(value) || isinf(value)) {
+        return format_special(value, buf);
+    }
+    memcpy(&bits, &value, sizeof(bits));
+    f   = bits & ((1ULL << 52) - 1);
+    exp = (int) (bits >> 52 & 0x7ff);
+    // the significand and exponent with the implicit bit, as in IEEE 754
+    if (exp == 0) {
+        exp = -1074;
+    } else {
+        f  |= 1ULL << 52;
+        exp = exp - 1075;
+    }
+    if ((n = format_shortest(f, exp, f == 1ULL << 52 && exp > -1074,
+                             signbit(value), buf)) > 0) {
+        return n;
+    }
+    return format_general(value, false, buf);
+}
+
+/*
+ * Formats a float with the fewest significant digits that strtof reads back as
+ * the same float. `buf` must hold FORMAT_LEN characters.
+ * \param value the number to format
+ * \param buf the buffer to format it into
+ * \return the length of the formatted number
+ */
+int format_float(float value, char *buf) {
+    int      n;
+    int      exp;
+    uint32_t bits;
+    uint64_t f;
+
+    if (isnan(value) || isinf(value)) {
+        return format_special(value, buf);
+    }
+    memcpy(&bits, &value, sizeof(bits));
+    f   = bits & ((1u << 23) - 1);
+    exp = (int) (bits >> 23 & 0xff);
+    if (exp == 0) {
+        exp = -149;
+    } else {
+        f  |= 1u << 23;
+        exp = exp - 150;
+    }
+    if ((n = format_shortest(f, exp, f == 1u << 23 && exp > -149,
+                             signbit(value), buf)) > 0) {
+        return n;
+    }
+    return format_general(value, true, buf);
+}
+
+/*******************************************************************************
+ *                              Helper functions
+ ******************************************************************************/
+
+/*
+ * Picks the type a dataset is read as. Raw and .npy keep the dataset's type in
+ * little endian, CSV reads the native type of the same class and width.
+ * \param entry the dataset
+ * \param format the export format
+ * \param elem filled in with the type
+ * \return 0 on success or -1 if the dataset can't be exported
+ */
+static int get_element(const hdf5_entry_t  entry,
+                       int                 format,
+                       struct element     *elem) {
+    hid_t type;
+    bool  is_signed = true;
+
+    if (IS_GROUP(entry) ||
+        (entry->class != H5T_INTEGER && entry->class != H5T_FLOAT)) {
+        fprintf(stderr, "%s isn't a numeric dataset\n", entry->name);
+        return -1;
+    }
+    if (entry->class == H5T_INTEGER) {
+        lock_hdf5();
+        if ((type = H5Dget_type(entry->id)) >= 0) {
+            is_signed = H5Tget_sign(type) != H5T_SGN_NONE;
+            H5Tclose(type);
+        }
+        unlock_hdf5();
+    }
+
+    if (format == EXPORT_CSV) {
+        if (entry->class == H5T_FLOAT) {
+            elem->kind     = entry->size <= 4 ? KIND_FLOAT : KIND_DOUBLE;
+            elem->mem_type = entry->size <= 4 ? H5T_NATIVE_FLOAT
+                                              : H5T_NATIVE_DOUBLE;
+        } else {
+            // the same width as in the file, which HDF5 converts quickly
+            elem->kind = is_signed ? KIND_INT : KIND_UINT;
+            switch (entry->size) {
+                case 1:
+                    elem->mem_type = is_signed ? H5T_NATIVE_SCHAR
+                                               : H5T_NATIVE_UCHAR;
+                    break;
+                case 2:
+                    elem->mem_type = is_signed ? H5T_NATIVE_SHORT
+                                               : H5T_NATIVE_USHORT;
+                    break;
+                case 4:
+                    elem->mem_type = is_signed ? H5T_NATIVE_INT
+                                               : H5T_NATIVE_UINT;
+                    break;
+                default:
+                    elem->mem_type = is_signed ? H5T_NATIVE_LLONG
+                                               : H5T_NATIVE_ULLONG;
+            }
+        }
+    } else if (format == EXPORT_RAW || format == EXPORT_NPY) {
+        if (entry->class == H5T_FLOAT) {
+            elem->mem_type = entry->size <= 4 ? H5T_IEEE_F32LE
+                                              : H5T_IEEE_F64LE;
+        } else {
+            switch (entry->size) {
+                case 1:
+                    elem->mem_type = is_signed ? H5T_STD_I8LE : H5T_STD_U8LE;
+                    break;
+                case 2:
+                    elem->mem_type = is_signed ? H5T_STD_I16LE : H5T_STD_U16LE;
+                    break;
+                case 4:
+                    elem->mem_type = is_signed ? H5T_STD_I32LE : H5T_STD_U32LE;
+                    break;
+                default:
+                    elem->mem_type = is_signed ? H5T_STD_I64LE : H5T_STD_U64LE;
+            }
+        }
+    } else {
+        fprintf(stderr, "unknown export format %d\n", format);
+        return -1;
+    }
+
+    elem->size = H5Tget_size(elem->mem_type);
+    // one byte types have no byte order in NumPy
+    sprintf(elem->descr, "%c%c%d", elem->size == 1 ? '|' : '<',
+            entry->class == H5T_FLOAT ? 'f' : (is_signed ? 'i' : 'u'),
+            (int) elem->size);
+    return 0;
+}
+
+/*
+ * Writes a version 1.0 .npy header: the magic string, the length of the header
+ * dictionary and the dictionary, padded with spaces to NPY_ALIGN bytes.
+ * \param entry the dataset, for its shape
+ * \param descr the NumPy dtype of the elements
+ * \param out the stream to write to
+ * \return 0 on success or -1 on failure
+ */
+static int write_npy_header(const hdf5_entry_t  entry,
+                            const char         *descr,
+                            FILE               *out) {
+    int     i;
+    int     rank = 0;
+    int     len;
+    hid_t   space;
+    hsize_t dims[H5S_MAX_RANK];
+    char    shape[NPY_HEADER_MAX / 2] = "(";
+    char    header[NPY_HEADER_MAX];
+
+    lock_hdf5();
+    if ((space = H5Dget_space(entry->id)) >= 0) {
+        rank = H5Sget_simple_extent_dims(space, dims, NULL);
+        H5Sclose(space);
+    }
+    unlock_hdf5();
+    if (space < 0 || rank < 0) {
+        fprintf(stderr, "failed to get the shape of %s\n", entry->name);
+        return -1;
+    }
+
+    for (i = 0; i < rank; i++) {
+        sprintf(shape + strlen(shape), i == 0 ? "%llu" : ", %llu",
+                (unsigned long long) dims[i]);
+    }
+    strcat(shape, rank == 1 ? ",)" : ")");
+
+    len = sprintf(header + 10,
+                  "{'descr': '%s', 'fortran_order': False, 'shape': %s, }",
+                  descr, shape) + 10;
+    while ((len + 1) % NPY_ALIGN != 0) {
+        header[len++] = ' ';
+    }
+    header[len++] = '\n';
+
+    memcpy(header, "\x93NUMPY\x01\x00", 8);
+    header[8] = (char) ((len - 10) & 0xff);
+    header[9] = (char) ((len - 10) >> 8);
+    if (fwrite(header, 1, len, out) != (size_t) len) {
+        perror("failed to write .npy header");
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Reads a block of rows, or the only element of a scalar dataset
+ */
+static int read_block(const hdf5_entry_t  entry,
+                      hsize_t             start,
+                      hsize_t             count,
+                      hid_t               mem_type,
+                      void               *buf) {
+    herr_t status;
+
+    if (entry->rank > 0) {
+        return read_rows(entry, start, count, mem_type, buf);
+    }
+    STATS_COUNT(HDF5_CALLS, 1);
+    STATS_COUNT(BYTES_READ, H5Tget_size(mem_type));
+    lock_hdf5();
+    status = H5Dread(entry->id, mem_type, H5S_ALL, H5S_ALL, H5P_DEFAULT, buf);
+    unlock_hdf5();
+    if (status < 0) {
+        fprintf(stderr, "failed to read %s\n", entry->name);
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Formats a block of rows as CSV on all the threads and writes it
+ * \param buf the rows
+ * \param elem the type of the elements in buf
+ * \param rows the number of rows
+ * \param cols the number of columns
+ * \param text a buffer of FORMAT_LEN * rows * cols characters
+ * \param out the stream to write to
+ * \return 0 on success or -1 on failure
+ */
+static int write_csv(const void            *buf,
+                     const struct element  *elem,
+                     hsize_t                rows,
+                     hsize_t                cols,
+                     char                  *text,
+                     FILE                  *out) {
+    long    t;
+    long    parts = NUM_THREADS();
+    size_t *lens;
+
+    if ((lens = (size_t *) malloc(sizeof(size_t) * parts)) == NULL) {
+        perror("malloc failed in write_csv():lens");
+        return -1;
+    }
+
+    // every part formats its rows into the text they would fill at worst
+    #pragma omp parallel for schedule(static)
+    for (t = 0; t < parts; t++) {
+        hsize_t first = rows * t / parts;
+        hsize_t last  = rows * (t + 1) / parts;
+        lens[t] = format_rows((const char *) buf + elem->size * first * cols,
+                              elem, last - first, cols,
+                              text + FORMAT_LEN * first * cols);
+    }
+
+    for (t = 0; t < parts; t++) {
+        hsize_t first = rows * t / parts;
+        if (fwrite(text + FORMAT_LEN * first * cols, 1, lens[t], out) !=
+            lens[t]) {
+            perror("failed to write export");
+            free(lens);
+            return -1;
+        }
+    }
+    free(lens);
+    return 0;
+}
+
+/*
+ * Formats rows as CSV lines
+ * \param buf the rows
+ * \param elem the type of the elements in buf
+ * \param rows the number of rows
+ * \param cols the number of columns
+ * \param text the buffer to format into
+ * \return the number of characters written
+ */
+static size_t format_rows(const void            *buf,
+                          const struct element  *elem,
+                          hsize_t                rows,
+                          hsize_t                cols,
+                          char                  *text) {
+    hsize_t i;
+    hsize_t n = rows * cols;
+    char   *p = text;
+
+    for (i = 0; i < n; i++) {
+        switch (elem->kind) {
+            case KIND_DOUBLE:
+                p += format_double(((const double *) buf)[i], p);
+                break;
+            case KIND_FLOAT:
+                p += format_float(((const float *) buf)[i], p);
+                break;
+            case KIND_INT:
+                p += format_int(int_at(buf, i, elem->size), p);
+                break;
+            case KIND_UINT:
+                p += format_uint(uint_at(buf, i, elem->size), p);
+                break;
+        }
+        *p++ = (i + 1) % cols == 0 ? '\n' : ',';
+    }
+    return p - text;
+}
+
+/*
+ * Formats f * 2^e with the fewest digits that read back as the same number,
+ * where the numbers that read back are those closer to it than to the next
+ * number of its type up or down
+ * \param f the significand, including the implicit bit
+ * \param e the binary exponent
+ * \param closer_below whether the next number down is closer than the next
+ *                     one up, which happens at powers of two
+ * \param negative whether to write a minus sign
+ * \param buf the buffer to format into
+ * \return the length of the formatted number or 0 if Grisu3 couldn't tell
+ */
+static int format_shortest(uint64_t  f,
+                           int       e,
+                           bool      closer_below,
+                           bool      negative,
+                           char     *buf) {
+    int  len;
+    int  exp;
+    char digits[FORMAT_LEN];
+    struct diy_fp v = {f, e};
+
+    if (f == 0) {
+        return format_digits("0", 1, 0, negative, buf);
+    }
+    if (!grisu3(v, closer_below, digits, &len, &exp)) {
+        return 0;
+    }
+    return format_digits(digits, len, exp, negative, buf);
+}
+
+/*
+ * Writes the number 0.d1d2...dn * 10^(len + exp), in e form if the decimal
+ * point is far from the digits
+ * \param digits the digits, without trailing zeros
+ * \param len the number of digits
+ * \param exp the exponent of the last digit
+ * \param negative whether to write a minus sign
+ * \param buf the buffer to format into
+ * \return the length of the formatted number
+ */
+static int format_digits(const char *digits,
+                         int         len,
+                         int         exp,
+                         bool        negative,
+                         char       *buf) {
+    int   point = len + exp;  // digits before the decimal point
+    char *out   = buf;
+
+    if (negative) {
+        *out++ = '-';
+    }
+    if (point > FIXED_MAX_POINT || point < FIXED_MIN_POINT) {
+        // d.ddde[-]xx
+        *out++ = digits[0];
+        if (len > 1) {
+            *out++ = '.';
+            memcpy(out, digits + 1, len - 1);
+            out += len - 1;
+        }
+        *out++ = 'e';
+        out   += format_int(point - 1, out);
+    } else if (point <= 0) {
+        // 0.000ddd
+        *out++ = '0';
+        *out++ = '.';
+        memset(out, '0', -point);
+        out += -point;
+        memcpy(out, digits, len);
+        out += len;
+    } else if (point >= len) {
+        // ddd000
+        memcpy(out, digits, len);
+        memset(out + len, '0', point - len);
+        out += point;
+    } else {
+        // ddd.ddd
+        memcpy(out, digits, point);
+        out   += point;
+        *out++ = '.';
+        memcpy(out, digits + point, len - point);
+        out += len - point;
+    }
+    *out = '\0';
+    return out - buf;
+}
+
+/*
+ * Finds the shortest digits of a positive number with Grisu3. The number and
+ * the boundaries of the numbers that read back as it are scaled by a cached
+ * power of ten so their integer parts fit in 32 bits, then digits are
+ * generated until they fall between the boundaries.
+ * \param v the number
+ * \param closer_below whether the lower boundary is closer than the upper one
+ * \param digits filled in with the digits
+ * \param len filled in with the number of digits
+ * \param exp filled in with the exponent of the last digit
+ * \return false if the digits might not be the shortest or closest
+ */
+static bool grisu3(struct diy_fp  v,
+                   bool           closer_below,
+                   char          *digits,
+                   int           *len,
+                   int           *exp) {
+    int           k;
+    int           index;
+    int           kappa;
+    struct diy_fp w = normalize(v);
+    struct diy_fp plus;
+    struct diy_fp minus;
+    struct diy_fp ten_mk;
+    struct cached_pow10 c;
+
+    // the boundaries halfway to the neighbors, with the exponent of w
+    plus.f = (v.f << 1) + 1;
+    plus.e = v.e - 1;
+    plus   = normalize(plus);
+    if (closer_below) {
+        minus.f = (v.f << 2) - 1;
+        minus.e = v.e - 2;
+    } else {
+        minus.f = (v.f << 1) - 1;
+        minus.e = v.e - 1;
+    }
+    minus.f <<= minus.e - plus.e;
+    minus.e   = plus.e;
+
+    // the cached power that brings w's exponent into the target range
+    k = (int) ceil((GRISU_MIN_EXP - (w.e + 64) + 63) * 0.30102999566398114);
+    index = (POW10_OFFSET + k - 1) / POW10_STEP + 1;
+    c = cached_pow10s[index];
+    ten_mk.f = c.f;
+    ten_mk.e = c.e;
+
+    if (!digit_gen(multiply(minus, ten_mk), multiply(w, ten_mk),
+                   multiply(plus, ten_mk), digits, len, &kappa)) {
+        return false;
+    }
+    *exp = kappa - c.k;
+    return true;
+}
+
+/*
+ * Generates the digits of the upper boundary until the rest is within the
+ * interval of numbers that are known to read back, then rounds the last digit
+ * towards w
+ * \param low the scaled lower boundary
+ * \param w the scaled number
+ * \param high the scaled upper boundary
+ * \param digits filled in with the digits
+ * \param len filled in with the number of digits
+ * \param kappa filled in with the exponent of the last digit before scaling
+ * \return false if Grisu3 can't tell the digits are right
+ */
+static bool digit_gen(struct diy_fp  low,
+                      struct diy_fp  w,
+                      struct diy_fp  high,
+                      char          *digits,
+                      int           *len,
+                      int           *kappa) {
+    int      shift = -w.e;
+    uint64_t unit  = 1;
+    uint64_t one   = 1ULL << shift;
+    uint64_t too_low   = low.f - unit;
+    uint64_t too_high  = high.f + unit;
+    uint64_t unsafe    = too_high - too_low;
+    uint32_t integrals = (uint32_t) (too_high >> shift);
+    uint64_t fractionals = too_high & (one - 1);
+    uint32_t divisor = 0;
+    uint64_t rest;
+    char     int_digits[FORMAT_LEN];
+
+    // the digits of the integral part without dividing by a variable
+    *kappa = integrals > 0 ? format_uint(integrals, int_digits) : 0;
+    if (*kappa > 0) {
+        divisor = small_pow10s[*kappa - 1];
+    }
+    *len = 0;
+
+    while (*kappa > 0) {
+        digits[*len] = int_digits[*len];
+        integrals -= (uint32_t) (digits[(*len)++] - '0') * divisor;
+        (*kappa)--;
+        rest = ((uint64_t) integrals << shift) + fractionals;
+        if (rest < unsafe) {
+            return round_weed(digits, *len, too_high - w.f, unsafe, rest,
+                              (uint64_t) divisor << shift, unit);
+        }
+        divisor /= 10;
+    }
+
+    for (;;) {
+        fractionals *= 10;
+        unit        *= 10;
+        unsafe      *= 10;
+        digits[(*len)++] = (char) ('0' + (fractionals >> shift));
+        fractionals &= one - 1;
+        (*kappa)--;
+        if (fractionals < unsafe) {
+            return round_weed(digits, *len, (too_high - w.f) * unit, unsafe,
+                              fractionals, one, unit);
+        }
+    }
+}
+
+/*
+ * Moves the last digit down while that brings the digits closer to w, then
+ * checks that the result is certainly inside the safe interval and closest
+ * \param digits the digits
+ * \param len the number of digits
+ * \param distance_high_w the distance from the upper boundary to w
+ * \param unsafe the size of the interval, with the error
+ * \param rest the distance from the digits to the upper boundary
+ * \param ten_kappa the weight of the last digit
+ * \param unit the error of the computation
+ * \return whether the digits are known to be right
+ */
+static bool round_weed(char     *digits,
+                       int       len,
+                       uint64_t  distance_high_w,
+                       uint64_t  unsafe,
+                       uint64_t  rest,
+                       uint64_t  ten_kappa,
+                       uint64_t  unit) {
+    uint64_t small = distance_high_w - unit;
+    uint64_t big   = distance_high_w + unit;
+
+    while (rest < small && unsafe - rest >= ten_kappa &&
+           (rest + ten_kappa < small ||
+            small - rest >= rest + ten_kappa - small)) {
+        digits[len - 1]--;
+        rest += ten_kappa;
+    }
+    if (rest < big && unsafe - rest >= ten_kappa &&
+        (rest + ten_kappa < big || big - rest > rest + ten_kappa - big)) {
+        return false;
+    }
+    return 2 * unit <= rest && rest <= unsafe - 4 * unit;
+}
+
+/*
+ * Multiplies two numbers, keeping the upper 64 bits rounded
+ */
+static struct diy_fp multiply(struct diy_fp x, struct diy_fp y) {
+    uint64_t a = x.f >> 32;
+    uint64_t b = x.f & 0xffffffff;
+    uint64_t c = y.f >> 32;
+    uint64_t d = y.f & 0xffffffff;
+    uint64_t ac = a * c;
+    uint64_t bc = b * c;
+    uint64_t ad = a * d;
+    uint64_t bd = b * d;
+    uint64_t mid = (bd >> 32) + (ad & 0xffffffff) + (bc & 0xffffffff) +
+                   (1ULL << 31);
+    struct diy_fp r;
+
+    r.f = ac + (ad >> 32) + (bc >> 32) + (mid >> 32);
+    r.e = x.e + y.e + 64;
+    return r;
+}
+
+/*
+ * Shifts a number's significand up until its top bit is set
+ */
+static struct diy_fp normalize(struct diy_fp x) {
+    while (!(x.f & 0xffc0000000000000ULL)) {
+        x.f <<= 10;
+        x.e  -= 10;
+    }
+    while (!(x.f & 0x8000000000000000ULL)) {
+        x.f <<= 1;
+        x.e  -= 1;
+    }
+    return x;
+}
+
+/*
+ * Returns element i of a buffer of signed integers of `size` bytes
+ */
+static long long int_at(const void *buf, hsize_t i, size_t size) {
+    switch (size) {
+        case 1:
+            return ((const signed char *) buf)[i];
+        case 2:
+            return ((const short *) buf)[i];
+        case 4:
+            return ((const int *) buf)[i];
+        default:
+            return ((const long long *) buf)[i];
+    }
+}
+
+/*
+ * Returns element i of a buffer of unsigned integers of `size` bytes
+ */
+static unsigned long long uint_at(const void *buf, hsize_t i, size_t size) {
+    switch (size) {
+        case 1:
+            return ((const unsigned char *) buf)[i];
+        case 2:
+            return ((const unsigned short *) buf)[i];
+        case 4:
+            return ((const unsigned int *) buf)[i];
+        default:
+            return ((const unsigned long long *) buf)[i];
+    }
+}
+
+/*
+ * Formats a number with snprintf, adding digits until it reads back as the
+ * same value. With fewer than DBL_DIG (FLT_DIG) digits the rounded number is
+ * the only one that reads back, so the first one that does is the shortest.
+ * Subnormals have less precision and are tried from one digit up.
+ * \param value the number, finite
+ * \param single whether value is a float
+ * \param buf the buffer to format into
+ * \return the length of the formatted number
+ */
+static int format_general(double value, bool single, char *buf) {
+    int prec = single ? FLT_DIG : DBL_DIG;
+    int max  = single ? FLT_ROUND_TRIP_DIG : DBL_ROUND_TRIP_DIG;
+    int len;
+
+    if (fabs(value) < (single ? FLT_MIN : DBL_MIN)) {
+        prec = 1;
+    }
+    for (;; prec++) {
+        len = snprintf(buf, FORMAT_LEN, "%.*g", prec, value);
+        if (prec >= max) {
+            break;
+        }
+        if (single ? strtof(buf, NULL) == (float) value
+                   : strtod(buf, NULL) == value) {
+            break;
+        }
+    }
+    return len;
+}
+
+/*
+ * Formats a NaN or an infinity the way NumPy reads them
+ */
+static int format_special(double value, char *buf) {
+    strcpy(buf, isnan(value) ? "nan" : (value < 0 ? "-inf" : "inf"));
+    return strlen(buf);
+}
+
+/*
+ * Formats an unsigned integer two digits at a time
+ * \param value the integer
+ * \param buf the buffer to format into
+ * \return the number of digits
+ */
+static int format_uint(unsigned long long value, char *buf) {
+    int  len;
+    char tmp[FORMAT_LEN];
+    char *p = tmp + sizeof(tmp);
+
+    while (value >= 100) {
+        p -= 2;
+        memcpy(p, digit_pairs + 2 * (value % 100), 2);
+        value /= 100;
+    }
+    if (value >= 10) {
+        p -= 2;
+        memcpy(p, digit_pairs + 2 * value, 2);
+    } else {
+        *--p = (char) ('0' + value);
+    }
+
+    len = tmp + sizeof(tmp) - p;
+    memcpy(buf, p, len);
+    buf[len] = '\0';
+    return len;
+}
+
+/*
+ * Formats a signed integer
+ */
+static int format_int(long long value, char *buf) {
+    if (value < 0) {
+        *buf = '-';
+        return 1 + format_uint(0ULL - (unsigned long long) value, buf + 1);
+    }
+    return format_uint((unsigned long long) value, buf);
+}
@@ -0,0 +1,35 @@
+#ifndef _HDF5_EXPORT_H_
+#define _HDF5_EXPORT_H_
+
+#include <stdio.h>
+#include "hdf5_struct.h"
+
+// output formats of export_dataset
+#define EXPORT_RAW        0   // the elements, little endian, no header
+#define EXPORT_NPY        1   // NumPy .npy, version 1.0
+#define EXPORT_CSV        2   // one row per line, columns separated by commas
+
+#define EXPORT_BUF_BYTES  (4 << 20)  // stdio buffer of the output file
+#define FORMAT_LEN        32         // longest formatted number, with the '\0'
+
+/*
+ * Streams a dataset to a file as raw binary, .npy or CSV
+ */
+int export_dataset(const hdf5_entry_t entry, const char *path, int format);
+
+/*
+ * Streams a dataset to an open stream as raw binary, .npy or CSV
+ */
+int export_stream(const hdf5_entry_t entry, FILE *out, int format);
+
+/*
+ * Formats a double with the fewest digits that read back as the same double
+ */
+int format_double(double value, char *buf);
+
+/*
+ * Formats a float with the fewest digits that read back as the same float
+ */
+int format_float(float value, char *buf);
+
+#endif
@@ -0,0 +1,715 @@
+/*
+ * Streaming FIR and IIR filtering of datasets.
+ *
+ * A dataset is filtered one block of rows at a time. Each block is transposed
+ * so every channel is contiguous, then the channels are filtered in parallel
+ * with their state (the last taps - 1 inputs of a FIR filter or the delays of
+ * the IIR sections) carried over to the next block. Peak memory is a few blocks
+ * no matter how long the recording is.
+ *
+ * Zero-phase filtering runs the filter forward into the output dataset and then
+ * backward over the output, reading the blocks from the end of the dataset.
+ * Like filtfilt, both ends are padded with an odd reflection of the signal and
+ * each pass starts from the state the filter would settle in if its first input
+ * had always been there, so a DC offset doesn't ring at the ends. Only the
+ * padding is kept in memory.
+ */
+
+#include <complex.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "hdf5.h"
+#include "hdf5_filter.h"
+#include "hdf5_stats.h"
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+#define STATE_LEN(f) (((f)->type == FIR_FILTER ? (f)->order - 1 : 2 * (f)->order))
+
+/* per-thread buffers used while filtering a block */
+struct scratch {
+    double         *ext_a;  // history followed by the block, first channel
+    double         *ext_b;  // history followed by the block, second channel
+    double complex *fft;    // one overlap-save segment
+};
+
+/* helper functions */
+static void fft(double complex *x, int n, const double complex *twiddles,
+                bool inverse);
+static void init_state(const hdf5_filter_t filter, double *state,
+                       const double *first, hsize_t stride, hsize_t channels);
+static void run_block(const hdf5_filter_t filter, double *state, double *x,
+                      hsize_t n, hsize_t channels, struct scratch *scratch);
+static void iir_channel(const hdf5_filter_t filter, double *z, double *x,
+                        hsize_t n);
+static void fir_channel(const hdf5_filter_t filter, double *hist, double *x,
+                        hsize_t n, double *ext);
+static void fir_fft_pair(const hdf5_filter_t filter, double *hist_a,
+                         double *x_a, double *hist_b, double *x_b, hsize_t n,
+                         struct scratch *scratch);
+static void to_channels(const double *rows, double *chans, hsize_t n,
+                        hsize_t channels, bool reverse);
+static void to_rows(const double *chans, double *rows, hsize_t n,
+                    hsize_t channels, bool reverse);
+static struct scratch *new_scratch(const hdf5_filter_t filter, hsize_t n);
+static void free_scratch(struct scratch *scratch);
+
+/*
+ * Creates a FIR filter. Filters with more than FIR_FFT_TAPS taps are applied
+ * with overlap-save FFT convolution, shorter ones directly.
+ * \param taps the impulse response of the filter
+ * \param num_taps the number of taps
+ * \return a hdf5_filter_t or NULL on failure
+ */
+hdf5_filter_t new_fir_filter(const double *taps, int num_taps) {
+    int i;
+    hdf5_filter_t filter;
+
+    if (num_taps < 1) {
+        return NULL;
+    }
+    if ((filter = (hdf5_filter_t) calloc(1, sizeof(struct hdf5_filter))) ==
+        NULL) {
+        perror("malloc failed in new_fir_filter():filter");
+        return NULL;
+    }
+    filter->type  = FIR_FILTER;
+    filter->order = num_taps;
+    if ((filter->coeffs = (double *) malloc(sizeof(double) * num_taps)) ==
+        NULL) {
+        perror("malloc failed in new_fir_filter():coeffs");
+        free_filter(filter);
+        return NULL;
+    }
+    memcpy(filter->coeffs, taps, sizeof(double) * num_taps);
+
+    if (num_taps > FIR_FFT_TAPS) {
+        double complex *h;
+        double complex *tw;
+
+        // segments of at least 3 * num_taps new samples
+        for (filter->fft_len = 1; filter->fft_len < 4 * num_taps;
+             filter->fft_len <<= 1);
+        filter->fft_taps = (double *) calloc(2 * filter->fft_len,
+                                             sizeof(double));
+        filter->twiddles = (double *) malloc(sizeof(double complex) *
+                                             filter->fft_len / 2);
+        if (filter->fft_taps == NULL || filter->twiddles == NULL) {
+            perror("malloc failed in new_fir_filter():fft");
+            free_filter(filter);
+            return NULL;
+        }
+        h  = (double complex *) filter->fft_taps;
+        tw = (double complex *) filter->twiddles;
+        for (i = 0; i < filter->fft_len / 2; i++) {
+            tw[i] = cexp(-2.0 * M_PI * I * i / filter->fft_len);
+        }
+        for (i = 0; i < num_taps; i++) {
+            h[i] = taps[i];
+        }
+        fft(h, filter->fft_len, tw, false);
+    }
+
+    return filter;
+}
+
+/*
+ * Creates an IIR filter from second-order sections. Each section is given as
+ * b0 b1 b2 a0 a1 a2, the same layout as scipy's sos arrays.
+ * \param sos num_sections * SOS_COEFFS coefficients
+ * \param num_sections the number of sections
+ * \return a hdf5_filter_t or NULL on failure
+ */
+hdf5_filter_t new_iir_filter(const double *sos, int num_sections) {
+    int    i;
+    double dc = 1;  // the DC gain of the sections so far
+    hdf5_filter_t filter;
+
+    if (num_sections < 1) {
+        return NULL;
+    }
+    for (i = 0; i < num_sections; i++) {
+        if (sos[i * SOS_COEFFS + 3] == 0.0) {
+            fprintf(stderr, "a0 of section %d is 0\n", i);
+            return NULL;
+        }
+    }
+    if ((filter = (hdf5_filter_t) calloc(1, sizeof(struct hdf5_filter))) ==
+        NULL) {
+        perror("malloc failed in new_iir_filter():filter");
+        return NULL;
+    }
+    filter->type  = IIR_FILTER;
+    filter->order = num_sections;
+    if ((filter->coeffs = (double *) malloc(sizeof(double) * 5 *
+                                            num_sections)) == NULL) {
+        perror("malloc failed in new_iir_filter():coeffs");
+        free_filter(filter);
+        return NULL;
+    }
+    // normalize so a0 is 1
+    for (i = 0; i < num_sections; i++) {
+        const double *s = sos + i * SOS_COEFFS;
+        double       *c = filter->coeffs + i * 5;
+        c[0] = s[0] / s[3];
+        c[1] = s[1] / s[3];
+        c[2] = s[2] / s[3];
+        c[3] = s[4] / s[3];
+        c[4] = s[5] / s[3];
+    }
+
+    // the steady state of each section, like scipy's sosfilt_zi: a section's
+    // input at rest is the DC gain of the sections before it
+    if ((filter->zi = (double *) malloc(sizeof(double) * 2 *
+                                        num_sections)) == NULL) {
+        perror("malloc failed in new_iir_filter():zi");
+        free_filter(filter);
+        return NULL;
+    }
+    for (i = 0; i < num_sections; i++) {
+        const double *c    = filter->coeffs + i * 5;
+        double        den  = 1 + c[3] + c[4];
+        double        gain = (c[0] + c[1] + c[2]) / den;
+
+        // a pole at DC never settles, that section starts at rest
+        if (fabs(den) < 1e-12) {
+            filter->zi[2 * i]     = 0;
+            filter->zi[2 * i + 1] = 0;
+            dc                    = 0;
+            continue;
+        }
+        filter->zi[2 * i]     = dc * (gain - c[0]);
+        filter->zi[2 * i + 1] = dc * (c[2] - c[4] * gain);
+        dc                   *= gain;
+    }
+
+    return filter;
+}
+
+/*
+ * Frees the memory associated with a hdf5_filter_t
+ * \param filter the hdf5_filter_t to free
+ */
+void free_filter(hdf5_filter_t filter) {
+    if (filter == NULL) {
+        return;
+    }
+    free(filter->coeffs);
+    free(filter->zi);
+    free(filter->fft_taps);
+    free(filter->twiddles);
+    free(filter);
+}
+
+/*
+ * Filters every channel of a dataset into a new dataset in the same group.
+ * \param entry the dataset to filter (samples x channels)
+ * \param filter the filter to apply
+ * \param name the name of the filtered dataset
+ * \param zero_phase true to filter forward and backward, false for a causal
+ *        filter
+ * \return the hdf5_entry_t of the filtered dataset or NULL on failure, which
+ *         deletes the partly written dataset
+ */
+hdf5_entry_t filter_dataset(hdf5_entry_t        entry,
+                            const hdf5_filter_t filter,
+                            const char         *name,
+                            bool                zero_phase) {
+    int     status = 0;
+    hsize_t i, c;
+    hsize_t n;
+    hsize_t start;
+    hsize_t pad      = 0;
+    hsize_t channels = Y_DIM(entry);
+    hsize_t samples  = X_DIM(entry);
+    hsize_t step     = block_rows(entry);
+    hsize_t cap;
+    hsize_t dims[2];
+    hsize_t chunk[2];
+    double *state = NULL;
+    double *rows  = NULL;
+    double *chans = NULL;
+    double *edge  = NULL;
+    hdf5_entry_t    out    = NULL;
+    struct scratch *scratch = NULL;
+    STATS_TIMER(FILTER_DATASET);
+
+    if (IS_GROUP(entry) || entry->parent == NULL || samples == 0) {
+        return NULL;
+    }
+    if (zero_phase) {
+        pad = 3 * (filter->type == FIR_FILTER ? filter->order
+                                              : 2 * filter->order + 1);
+        pad = pad < samples ? pad : samples - 1;
+    }
+    cap = step > pad + 1 ? step : pad + 1;
+
+    dims[0]  = samples;
+    dims[1]  = channels;
+    chunk[0] = (1 << 20) / (sizeof(double) * channels);
+    chunk[0] = chunk[0] < 1 ? 1 : chunk[0] > samples ? samples : chunk[0];
+    chunk[1] = channels;
+    if ((out = create_double_matrix(entry->parent, name, dims, chunk)) ==
+        NULL) {
+        return NULL;
+    }
+
+    state   = (double *) calloc(STATE_LEN(filter) * channels + 1,
+                                sizeof(double));
+    rows    = (double *) malloc(sizeof(double) * cap * channels);
+    chans   = (double *) malloc(sizeof(double) * cap * channels);
+    edge    = (double *) malloc(sizeof(double) * (pad + 1) * channels);
+    scratch = new_scratch(filter, cap);
+    STATS_ALLOC(sizeof(double) * (2 * cap + pad + 1) * channels);
+    if (state == NULL || rows == NULL || chans == NULL || edge == NULL ||
+        scratch == NULL) {
+        perror("malloc failed in filter_dataset()");
+        status = -1;
+        goto done;
+    }
+
+    // warm up with 2 x[0] - x[pad], ..., 2 x[0] - x[1]
+    if (pad > 0) {
+        if (read_double_rows(entry, 0, pad + 1, rows) < 0) {
+            status = -1;
+            goto done;
+        }
+        for (c = 0; c < channels; c++) {
+            for (i = 0; i < pad; i++) {
+                chans[c * pad + i] = 2 * rows[c] - rows[(pad - i) * channels + c];
+            }
+        }
+        init_state(filter, state, chans, pad, channels);
+        run_block(filter, state, chans, pad, channels, scratch);
+    } else if (zero_phase) {
+        if (read_double_rows(entry, 0, 1, rows) < 0) {
+            status = -1;
+            goto done;
+        }
+        init_state(filter, state, rows, 1, channels);
+    }
+
+    for (start = 0; start < samples; start += n) {
+        n = samples - start < step ? samples - start : step;
+        if (read_double_rows(entry, start, n, rows) < 0) {
+            status = -1;
+            goto done;
+        }
+        to_channels(rows, chans, n, channels, false);
+        run_block(filter, state, chans, n, channels, scratch);
+        to_rows(chans, rows, n, channels, false);
+        if (write_double_rows(out, start, n, rows) < 0) {
+            status = -1;
+            goto done;
+        }
+    }
+    if (!zero_phase) {
+        goto done;
+    }
+
+    // run on past the end with 2 x[N-1] - x[N-2], ..., 2 x[N-1] - x[N-1-pad]
+    if (pad > 0) {
+        if (read_double_rows(entry, samples - pad - 1, pad + 1, rows) < 0) {
+            status = -1;
+            goto done;
+        }
+        for (c = 0; c < channels; c++) {
+            for (i = 0; i < pad; i++) {
+                edge[c * pad + i] = 2 * rows[pad * channels + c] -
+                                    rows[(pad - 1 - i) * channels + c];
+            }
+        }
+        run_block(filter, state, edge, pad, channels, scratch);
+    }
+
+    // backward pass, starting with the padding past the end
+    if (pad > 0) {
+        for (c = 0; c < channels; c++) {
+            double *e = edge + c * pad;
+            for (i = 0; i < pad / 2; i++) {
+                double tmp       = e[i];
+                e[i]             = e[pad - 1 - i];
+                e[pad - 1 - i]   = tmp;
+            }
+        }
+        init_state(filter, state, edge, pad, channels);
+        run_block(filter, state, edge, pad, channels, scratch);
+    } else {
+        if (read_double_rows(out, samples - 1, 1, rows) < 0) {
+            status = -1;
+            goto done;
+        }
+        init_state(filter, state, rows, 1, channels);
+    }
+    for (start = (samples - 1) / step * step;; start -= step) {
+        n = samples - start < step ? samples - start : step;
+        if (read_double_rows(out, start, n, rows) < 0) {
+            status = -1;
+            goto done;
+        }
+        to_channels(rows, chans, n, channels, true);
+        run_block(filter, state, chans, n, channels, scratch);
+        to_rows(chans, rows, n, channels, true);
+        if (write_double_rows(out, start, n, rows) < 0) {
+            status = -1;
+            goto done;
+        }
+        if (start == 0) {
+            break;
+        }
+    }
+
+done:
+    // a half filtered dataset would be taken for a filtered one
+    if (status < 0) {
+        delete_dataset(out);
+        out = NULL;
+    }
+    free(state);
+    free(rows);
+    free(chans);
+    free(edge);
+    free_scratch(scratch);
+    return out;
+}
+
+/*******************************************************************************
+ *                              Helper functions
+ ******************************************************************************/
+
+/*
+ * In-place iterative radix-2 FFT
+ * \param x the n values to transform
+ * \param n the size of the transform, a power of 2
+ * \param twiddles exp(-2 pi i k / n) for k < n / 2
+ * \param inverse true for the inverse transform, which isn't scaled by 1 / n
+ */
+static void fft(double complex       *x,
+                int                   n,
+                const double complex *twiddles,
+                bool                  inverse) {
+    int i, j, k;
+    int len;
+    int bit;
+
+    for (i = 1, j = 0; i < n; i++) {
+        for (bit = n >> 1; j & bit; bit >>= 1) {
+            j ^= bit;
+        }
+        j ^= bit;
+        if (i < j) {
+            double complex tmp = x[i];
+            x[i] = x[j];
+            x[j] = tmp;
+        }
+    }
+    for (len = 2; len <= n; len <<= 1) {
+        int half   = len / 2;
+        int stride = n / len;
+        for (i = 0; i < n; i += len) {
+            for (k = 0; k < half; k++) {
+                double complex w = twiddles[k * stride];
+                double complex u = x[i + k];
+                double complex v;
+                w = inverse ? conj(w) : w;
+                v = x[i + k + half] * w;
+                x[i + k]        = u + v;
+                x[i + k + half] = u - v;
+            }
+        }
+    }
+}
+
+/*
+ * Sets the state of every channel to the steady state for a constant input
+ * equal to the channel's first sample, like filtfilt's initial conditions
+ * \param filter the filter
+ * \param state the state of every channel
+ * \param first the first sample of channel c is first[c * stride]
+ * \param stride the distance between the first samples of two channels
+ * \param channels the number of channels
+ */
+static void init_state(const hdf5_filter_t filter,
+                       double             *state,
+                       const double       *first,
+                       hsize_t             stride,
+                       hsize_t             channels) {
+    int     k;
+    hsize_t c;
+    int     state_len = STATE_LEN(filter);
+
+    for (c = 0; c < channels; c++) {
+        double *z = state + c * state_len;
+        double  x = first[c * stride];
+        for (k = 0; k < state_len; k++) {
+            // a FIR filter's state is its last inputs
+            z[k] = filter->type == FIR_FILTER ? x : x * filter->zi[k];
+        }
+    }
+}
+
+/*
+ * Filters a block of channels in place, in parallel across the channels
+ * \param filter the filter to apply
+ * \param state the state of every channel, carried over between blocks
+ * \param x the block, channels x n
+ * \param n the number of samples per channel
+ * \param channels the number of channels
+ * \param scratch the buffers of each thread
+ */
+static void run_block(const hdf5_filter_t filter,
+                      double             *state,
+                      double             *x,
+                      hsize_t             n,
+                      hsize_t             channels,
+                      struct scratch     *scratch) {
+    long p;
+    long pairs     = (long) (channels + 1) / 2;
+    int  state_len = STATE_LEN(filter);
+
+    // channels are handled in pairs so the FFT path can pack them as re, im
+    #pragma omp parallel for schedule(dynamic)
+    for (p = 0; p < pairs; p++) {
+        struct scratch *s = &scratch[THREAD_NUM()];
+        hsize_t a   = 2 * (hsize_t) p;
+        hsize_t b   = a + 1;
+        double *x_b = b < channels ? x + b * n : NULL;
+        double *z_b = b < channels ? state + b * state_len : NULL;
+
+        if (filter->type == IIR_FILTER) {
+            iir_channel(filter, state + a * state_len, x + a * n, n);
+            if (x_b != NULL) {
+                iir_channel(filter, z_b, x_b, n);
+            }
+        } else if (filter->fft_len > 0) {
+            fir_fft_pair(filter, state + a * state_len, x + a * n, z_b, x_b, n,
+                         s);
+        } else {
+            fir_channel(filter, state + a * state_len, x + a * n, n, s->ext_a);
+            if (x_b != NULL) {
+                fir_channel(filter, z_b, x_b, n, s->ext_a);
+            }
+        }
+    }
+}
+
+/*
+ * Runs one channel through the IIR sections, transposed direct form II
+ * \param filter the IIR filter
+ * \param z the two delays of every section
+ * \param x the samples of the channel, filtered in place
+ * \param n the number of samples
+ */
+static void iir_channel(const hdf5_filter_t filter,
+                        double             *z,
+                        double             *x,
+                        hsize_t             n) {
+    int     s;
+    hsize_t i;
+
+    for (s = 0; s < filter->order; s++) {
+        const double *c = filter->coeffs + s * 5;
+        double z1 = z[2 * s];
+        double z2 = z[2 * s + 1];
+        for (i = 0; i < n; i++) {
+            double in  = x[i];
+            double out = c[0] * in + z1;
+            z1   = c[1] * in - c[3] * out + z2;
+            z2   = c[2] * in - c[4] * out;
+            x[i] = out;
+        }
+        z[2 * s]     = z1;
+        z[2 * s + 1] = z2;
+    }
+}
+
+/*
+ * Runs one channel through a short FIR filter by direct convolution
+ * \param filter the FIR filter
+ * \param hist the last taps - 1 inputs of the previous block
+ * \param x the samples of the channel, filtered in place
+ * \param n the number of samples
+ * \param ext a buffer of n + taps - 1 doubles
+ */
+static void fir_channel(const hdf5_filter_t filter,
+                        double             *hist,
+                        double             *x,
+                        hsize_t             n,
+                        double             *ext) {
+    int     k;
+    hsize_t i;
+    int     taps = filter->order;
+
+    memcpy(ext, hist, sizeof(double) * (taps - 1));
+    memcpy(ext + taps - 1, x, sizeof(double) * n);
+    memset(x, 0, sizeof(double) * n);
+    for (k = 0; k < taps; k++) {
+        const double  h = filter->coeffs[k];
+        const double *e = ext + taps - 1 - k;
+        for (i = 0; i < n; i++) {
+            x[i] += h * e[i];
+        }
+    }
+    memcpy(hist, ext + n, sizeof(double) * (taps - 1));
+}
+
+/*
+ * Runs two channels through a long FIR filter with overlap-save FFT
+ * convolution. The channels are packed as the real and imaginary parts of one
+ * transform, which works because the taps are real.
+ * \param filter the FIR filter
+ * \param hist_a the history of the first channel
+ * \param x_a the samples of the first channel, filtered in place
+ * \param hist_b the history of the second channel or NULL
+ * \param x_b the samples of the second channel or NULL
+ * \param n the number of samples
+ * \param scratch the buffers of the calling thread
+ */
+static void fir_fft_pair(const hdf5_filter_t filter,
+                         double             *hist_a,
+                         double             *x_a,
+                         double             *hist_b,
+                         double             *x_b,
+                         hsize_t             n,
+                         struct scratch     *scratch) {
+    int     i;
+    hsize_t j;
+    int     taps = filter->order;
+    int     m    = filter->fft_len;
+    int     len  = m - taps + 1;
+    hsize_t ext_len = n + taps - 1;
+    double *ext_a   = scratch->ext_a;
+    double *ext_b   = scratch->ext_b;
+    double complex       *buf = scratch->fft;
+    const double complex *h   = (const double complex *) filter->fft_taps;
+    const double complex *tw  = (const double complex *) filter->twiddles;
+
+    memcpy(ext_a, hist_a, sizeof(double) * (taps - 1));
+    memcpy(ext_a + taps - 1, x_a, sizeof(double) * n);
+    if (x_b != NULL) {
+        memcpy(ext_b, hist_b, sizeof(double) * (taps - 1));
+        memcpy(ext_b + taps - 1, x_b, sizeof(double) * n);
+    }
+
+    for (j = 0; j < n; j += len) {
+        for (i = 0; i < m; i++) {
+            hsize_t idx = j + i;
+            double  re  = idx < ext_len ? ext_a[idx] : 0.0;
+            double  im  = idx < ext_len && x_b != NULL ? ext_b[idx] : 0.0;
+            buf[i] = re + im * I;
+        }
+        fft(buf, m, tw, false);
+        for (i = 0; i < m; i++) {
+            buf[i] *= h[i];
+        }
+        fft(buf, m, tw, true);
+        // the first taps - 1 outputs wrapped around and are discarded
+        for (i = 0; i < len && j + i < n; i++) {
+            x_a[j + i] = creal(buf[taps - 1 + i]) / m;
+            if (x_b != NULL) {
+                x_b[j + i] = cimag(buf[taps - 1 + i]) / m;
+            }
+        }
+    }
+
+    memcpy(hist_a, ext_a + n, sizeof(double) * (taps - 1));
+    if (x_b != NULL) {
+        memcpy(hist_b, ext_b + n, sizeof(double) * (taps - 1));
+    }
+}
+
+/*
+ * Transposes a block of rows so each channel is contiguous
+ * \param rows the block, n x channels
+ * \param chans the transposed block, channels x n
+ * \param n the number of rows
+ * \param channels the number of channels
+ * \param reverse true to also reverse the samples in time
+ */
+static void to_channels(const double *rows,
+                        double       *chans,
+                        hsize_t       n,
+                        hsize_t       channels,
+                        bool          reverse) {
+    hsize_t i, c;
+    for (i = 0; i < n; i++) {
+        const double *row = rows + (reverse ? n - 1 - i : i) * channels;
+        for (c = 0; c < channels; c++) {
+            chans[c * n + i] = row[c];
+        }
+    }
+}
+
+/*
+ * Transposes a block of channels back to rows, undoing to_channels
+ * \param chans the block, channels x n
+ * \param rows the transposed block, n x channels
+ * \param n the number of rows
+ * \param channels the number of channels
+ * \param reverse true to also reverse the samples in time
+ */
+static void to_rows(const double *chans,
+                    double       *rows,
+                    hsize_t       n,
+                    hsize_t       channels,
+                    bool          reverse) {
+    hsize_t i, c;
+    for (i = 0; i < n; i++) {
+        double *row = rows + (reverse ? n - 1 - i : i) * channels;
+        for (c = 0; c < channels; c++) {
+            row[c] = chans[c * n + i];
+        }
+    }
+}
+
+/*
+ * Allocates the buffers of every thread
+ * \param filter the filter that will be run
+ * \param n the largest block that will be filtered
+ * \return NUM_THREADS() scratch buffers or NULL on failure
+ */
+static struct scratch *new_scratch(const hdf5_filter_t filter, hsize_t n) {
+    int i;
+    int threads = NUM_THREADS();
+    hsize_t ext_len = n + (filter->type == FIR_FILTER ? filter->order : 0);
+    struct scratch *scratch;
+
+    if ((scratch = (struct scratch *) calloc(threads,
+                                             sizeof(struct scratch))) == NULL) {
+        return NULL;
+    }
+    for (i = 0; i < threads; i++) {
+        scratch[i].ext_a = (double *) malloc(sizeof(double) * ext_len);
+        scratch[i].ext_b = (double *) malloc(sizeof(double) * ext_len);
+        scratch[i].fft   = (double complex *)
+                           malloc(sizeof(double complex) *
+                                  (filter->fft_len ? filter->fft_len : 1));
+        if (scratch[i].ext_a == NULL || scratch[i].ext_b == NULL ||
+            scratch[i].fft == NULL) {
+            free_scratch(scratch);
+            return NULL;
+        }
+    }
+    return scratch;
+}
+
+/*
+ * Frees the buffers allocated by new_scratch
+ * \param scratch the buffers to free
+ */
+static void free_scratch(struct scratch *scratch) {
+    int i;
+    if (scratch == NULL) {
+        return;
+    }
+    for (i = 0; i < NUM_THREADS(); i++) {
+        free(scratch[i].ext_a);
+        free(scratch[i].ext_b);
+        free(scratch[i].fft);
+    }
+    free(scratch);
+}
@@ -0,0 +1,48 @@
+#ifndef _HDF5_FILTER_H_
+#define _HDF5_FILTER_H_
+
+#include <stdbool.h>
+#include "hdf5_struct.h"
+
+#define FIR_FILTER     0
+#define IIR_FILTER     1
+#define FIR_FFT_TAPS   64     // FIR filters with more taps are run with FFTs
+#define SOS_COEFFS     6      // b0 b1 b2 a0 a1 a2 per second-order section
+
+/*
+ * A linear filter applied to every channel of a dataset
+ */
+typedef struct hdf5_filter {
+    int     type;         // FIR_FILTER or IIR_FILTER
+    int     order;        // number of taps or second-order sections
+    double *coeffs;       // the taps, or b0 b1 b2 a1 a2 of each section
+    double *zi;           // the delays of each section at rest with an input
+                          // of 1, which filtfilt starts from
+    /* overlap-save of long FIR filters, complex values stored as re, im */
+    int     fft_len;      // the FFT size
+    double *fft_taps;     // the FFT of the taps
+    double *twiddles;     // exp(-2 pi i k / fft_len) for k < fft_len / 2
+} *hdf5_filter_t;
+
+/*
+ * Creates a FIR filter from its taps
+ */
+hdf5_filter_t new_fir_filter(const double *taps, int num_taps);
+
+/*
+ * Creates an IIR filter from a cascade of second-order sections
+ */
+hdf5_filter_t new_iir_filter(const double *sos, int num_sections);
+
+/*
+ * Frees a hdf5_filter_t
+ */
+void free_filter(hdf5_filter_t filter);
+
+/*
+ * Filters every channel of a dataset into a new dataset, one block at a time
+ */
+hdf5_entry_t filter_dataset(hdf5_entry_t entry, const hdf5_filter_t filter,
+                            const char *name, bool zero_phase);
+
+#endif
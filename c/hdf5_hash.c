@@ -0,0 +1,750 @@
+/*
+ * Per chunk hashes, for rewriting only what changed and comparing datasets
+ * without comparing every sample.
+ *
+ * A dataset is cut into a grid of chunks, the chunks of the dataset itself if
+ * it's chunked or blocks of HASH_ROWS rows if it isn't. The XXH64 of every
+ * chunk, taken over its elements as doubles in row-major order, is stored in a
+ * sibling dataset named <name>_hashes with one element per chunk of the grid.
+ * The chunk dimensions are stored in the "hash_chunk" attribute of the dataset.
+ *
+ * Hashing the values rather than the stored bytes means a dataset hashes the
+ * same whatever its type, byte order or filters, so files written by the C,
+ * Python and MATLAB writers can be compared by their hashes alone. The stored
+ * hashes are only kept up to date by update_region: data written any other way
+ * needs write_hashes to be called again before they're compared. update_region
+ * doesn't trust them to skip a chunk, it checks the chunk in the file first.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "hdf5.h"
+#include "hdf5_hl.h"
+#include "hdf5_hash.h"
+#include "hdf5_stats.h"
+
+// XXH64 primes
+#define PRIME64_1 0x9E3779B185EBCA87ULL
+#define PRIME64_2 0xC2B2AE3D27D4EB4FULL
+#define PRIME64_3 0x165667B19E3779F9ULL
+#define PRIME64_4 0x85EBCA77C2B2AE63ULL
+#define PRIME64_5 0x27D4EB2F165667C5ULL
+
+#define ROTL64(x, r) ((((x) << (r)) | ((x) >> (64 - (r)))))
+
+/* a chunk of the region passed to update_region */
+struct region_chunk {
+    hsize_t   offset[2];  // first row and column of the chunk
+    hsize_t   extent[2];  // rows and columns of the chunk inside the dataset
+    hsize_t   index;      // position of the chunk in the grid
+    bool      covered;    // whether the region covers all of the chunk
+    uint64_t  hash;       // hash of the new contents
+    uint64_t  disk;       // hash of the contents in the file if not covered
+    double   *data;       // the new contents, extent[0] x extent[1]
+};
+
+/* helper functions */
+static void      default_chunk(const hdf5_entry_t entry, hsize_t *chunk);
+static bool      get_chunk(const hdf5_entry_t entry, hsize_t *chunk);
+static int       hashes_name(const hdf5_entry_t entry, char *name);
+static uint64_t *read_hashes(const hdf5_entry_t entry, const hsize_t *chunk);
+static int       store_hashes(const hdf5_entry_t entry, const hsize_t *chunk,
+                              const uint64_t *hashes);
+static uint64_t  hash_chunk(const double *rows, hsize_t num_rows,
+                            hsize_t width, hsize_t row, hsize_t col,
+                            const hsize_t *chunk, double *scratch);
+static void      overlay(struct region_chunk *c, const hsize_t *start,
+                         const hsize_t *count, const double *buf);
+static int       transfer_region(const hdf5_entry_t entry,
+                                 const hsize_t *offset, const hsize_t *extent,
+                                 double *data, bool write);
+static uint64_t  read64(const uint8_t *p);
+static uint32_t  read32(const uint8_t *p);
+static uint64_t  xxh64_round(uint64_t acc, uint64_t input);
+static uint64_t  xxh64_merge(uint64_t acc, uint64_t val);
+
+/*
+ * Hashes the chunks of a dataset and stores the hashes in <name>_hashes, next
+ * to the dataset. The dataset is read once, in blocks of rows, and the chunks
+ * of a block are hashed on all the threads.
+ * \param entry the dataset to hash
+ * \return 0 on success or -1 on failure
+ */
+int write_hashes(hdf5_entry_t entry) {
+    int       status;
+    hsize_t   chunk[2];
+    uint64_t *hashes;
+    STATS_TIMER(WRITE_HASHES);
+
+    if (IS_GROUP(entry) || entry->parent == NULL) {
+        return -1;
+    }
+    default_chunk(entry, chunk);
+    if ((hashes = compute_hashes(entry, chunk)) == NULL) {
+        return -1;
+    }
+    status = store_hashes(entry, chunk, hashes);
+    free(hashes);
+    return status;
+}
+
+/*
+ * Hashes the chunks of a dataset. Chunk (i, j) of the grid covers the rows
+ * [i * chunk[0], (i + 1) * chunk[0]) and the columns [j * chunk[1],
+ * (j + 1) * chunk[1]), clipped to the dataset.
+ * \param entry the dataset to hash
+ * \param chunk the chunk dimensions
+ * \return ceil(rows / chunk[0]) x ceil(columns / chunk[1]) hashes in row-major
+ *         order, to be freed by the caller, or NULL on failure
+ */
+uint64_t *compute_hashes(const hdf5_entry_t entry, const hsize_t *chunk) {
+    long      k;
+    long      num_chunks;
+    double   *rows;
+    double   *scratch = NULL;
+    hsize_t   n;
+    hsize_t   start;
+    hsize_t   width     = Y_DIM(entry);
+    hsize_t   grid_rows = (X_DIM(entry) + chunk[0] - 1) / chunk[0];
+    hsize_t   grid_cols = (width + chunk[1] - 1) / chunk[1];
+    hsize_t   step      = block_rows(entry);
+    uint64_t *hashes;
+    STATS_TIMER(COMPUTE_HASHES);
+
+    if (IS_GROUP(entry) || chunk[0] == 0 || chunk[1] == 0) {
+        return NULL;
+    }
+    // a block is made of whole chunk rows
+    step = step < chunk[0] ? chunk[0] : step - step % chunk[0];
+
+    hashes = (uint64_t *) malloc(sizeof(uint64_t) *
+                                 (grid_rows * grid_cols + 1));
+    rows   = (double *) malloc(sizeof(double) * (step * width + 1));
+    if (grid_cols > 1) {
+        scratch = (double *) malloc(sizeof(double) * chunk[0] * chunk[1] *
+                                    NUM_THREADS());
+    }
+    if (hashes == NULL || rows == NULL || (grid_cols > 1 && scratch == NULL)) {
+        perror("malloc failed in compute_hashes()");
+        free(hashes);
+        free(rows);
+        free(scratch);
+        return NULL;
+    }
+    STATS_ALLOC(sizeof(double) * step * width);
+
+    for (start = 0; start < X_DIM(entry); start += n) {
+        uint64_t *out = hashes + start / chunk[0] * grid_cols;
+        n = X_DIM(entry) - start < step ? X_DIM(entry) - start : step;
+        if (read_double_rows(entry, start, n, rows) < 0) {
+            free(hashes);
+            hashes = NULL;
+            break;
+        }
+        num_chunks = (long) (((n + chunk[0] - 1) / chunk[0]) * grid_cols);
+
+        #pragma omp parallel for schedule(dynamic)
+        for (k = 0; k < num_chunks; k++) {
+            double *own = scratch == NULL ? NULL
+                          : scratch + THREAD_NUM() * chunk[0] * chunk[1];
+            out[k] = hash_chunk(rows, n, width, k / grid_cols * chunk[0],
+                                k % grid_cols * chunk[1], chunk, own);
+        }
+    }
+
+    free(rows);
+    free(scratch);
+    return hashes;
+}
+
+/*
+ * Writes a region of a dataset, rewriting only the chunks whose contents
+ * changed. The chunks the region touches are hashed with the new data on all
+ * the threads and compared to the stored hashes; a chunk the region only
+ * partly covers is read first to hash its new contents. A chunk is only skipped
+ * once its contents in the file hash the same too, so data written by other
+ * means since the hashes were stored is still overwritten. The stored hashes
+ * are updated, and built first if the dataset doesn't have any. Data of the
+ * entry that's already loaded isn't updated.
+ * \param entry the dataset to write to, one or two dimensional
+ * \param start the first row and column of the region
+ * \param count the number of rows and columns of the region
+ * \param buf the new contents of the region, count[0] x count[1]
+ * \return the number of chunks rewritten or -1 on failure
+ */
+long update_region(hdf5_entry_t   entry,
+                   const hsize_t *start,
+                   const hsize_t *count,
+                   const double  *buf) {
+    long      k;
+    long      n;
+    long      first;
+    long      total;
+    long      batch = (long) NUM_THREADS() * HASH_BATCH;
+    long      rewritten = 0;
+    hsize_t   chunk[2];
+    hsize_t   first_row;
+    hsize_t   first_col;
+    hsize_t   region_cols;
+    hsize_t   grid_cols;
+    double   *on_disk = NULL;
+    uint64_t *hashes;
+    struct region_chunk *chunks;
+    STATS_TIMER(UPDATE_REGION);
+
+    if (IS_GROUP(entry) || entry->rank < 1 || entry->rank > 2) {
+        fprintf(stderr,
+                "can only update regions of 1 or 2 dimensional datasets\n");
+        return -1;
+    }
+    if (count[0] == 0 || count[1] == 0) {
+        return 0;
+    }
+    if (start[0] + count[0] > X_DIM(entry) ||
+        start[1] + count[1] > Y_DIM(entry)) {
+        fprintf(stderr, "region is outside of %s\n", entry->name);
+        return -1;
+    }
+    if (!get_chunk(entry, chunk) && write_hashes(entry) < 0) {
+        return -1;
+    }
+    if (!get_chunk(entry, chunk) || (hashes = read_hashes(entry, chunk)) ==
+        NULL) {
+        return -1;
+    }
+
+    grid_cols   = (Y_DIM(entry) + chunk[1] - 1) / chunk[1];
+    first_row   = start[0] / chunk[0];
+    first_col   = start[1] / chunk[1];
+    region_cols = (start[1] + count[1] - 1) / chunk[1] - first_col + 1;
+    total       = (long) (((start[0] + count[0] - 1) / chunk[0] - first_row + 1)
+                          * region_cols);
+    batch       = batch < total ? batch : total;
+
+    if ((chunks = (struct region_chunk *)
+                  calloc(batch, sizeof(struct region_chunk))) == NULL) {
+        perror("malloc failed in update_region():chunks");
+        free(hashes);
+        return -1;
+    }
+    for (k = 0; k < batch; k++) {
+        if ((chunks[k].data = (double *) malloc(sizeof(double) * chunk[0] *
+                                                chunk[1])) == NULL) {
+            perror("malloc failed in update_region():chunk");
+            rewritten = -1;
+            goto done;
+        }
+    }
+    if ((on_disk = (double *) malloc(sizeof(double) * chunk[0] * chunk[1])) ==
+        NULL) {
+        perror("malloc failed in update_region():on_disk");
+        rewritten = -1;
+        goto done;
+    }
+
+    for (first = 0; first < total; first += n) {
+        n = total - first < batch ? total - first : batch;
+        for (k = 0; k < n; k++) {
+            struct region_chunk *c = &chunks[k];
+            hsize_t row = first_row + (hsize_t) (first + k) / region_cols;
+            hsize_t col = first_col + (hsize_t) (first + k) % region_cols;
+            c->index     = row * grid_cols + col;
+            c->offset[0] = row * chunk[0];
+            c->offset[1] = col * chunk[1];
+            c->extent[0] = X_DIM(entry) - c->offset[0];
+            c->extent[1] = Y_DIM(entry) - c->offset[1];
+            c->extent[0] = c->extent[0] < chunk[0] ? c->extent[0] : chunk[0];
+            c->extent[1] = c->extent[1] < chunk[1] ? c->extent[1] : chunk[1];
+            c->covered   = start[0] <= c->offset[0] &&
+                           start[1] <= c->offset[1] &&
+                           start[0] + count[0] >= c->offset[0] + c->extent[0] &&
+                           start[1] + count[1] >= c->offset[1] + c->extent[1];
+        }
+
+        // the rest of the chunks the region doesn't cover comes from the file
+        for (k = 0; k < n; k++) {
+            if (!chunks[k].covered &&
+                transfer_region(entry, chunks[k].offset, chunks[k].extent,
+                                chunks[k].data, false) < 0) {
+                rewritten = -1;
+                goto done;
+            }
+        }
+
+        #pragma omp parallel for schedule(dynamic)
+        for (k = 0; k < n; k++) {
+            struct region_chunk *c = &chunks[k];
+            if (!c->covered) {
+                c->disk = hash_bytes(c->data, sizeof(double) * c->extent[0] *
+                                     c->extent[1], HASH_SEED);
+            }
+            overlay(c, start, count, buf);
+            c->hash = hash_bytes(c->data, sizeof(double) * c->extent[0] *
+                                 c->extent[1], HASH_SEED);
+        }
+
+        for (k = 0; k < n; k++) {
+            struct region_chunk *c = &chunks[k];
+            // the stored hash may be stale: skip only what the file holds
+            if (c->hash == hashes[c->index]) {
+                if (c->covered) {
+                    if (transfer_region(entry, c->offset, c->extent, on_disk,
+                                        false) < 0) {
+                        rewritten = -1;
+                        goto done;
+                    }
+                    c->disk = hash_bytes(on_disk, sizeof(double) *
+                                         c->extent[0] * c->extent[1],
+                                         HASH_SEED);
+                }
+                if (c->disk == c->hash) {
+                    continue;
+                }
+            }
+            if (transfer_region(entry, chunks[k].offset, chunks[k].extent,
+                                chunks[k].data, true) < 0) {
+                rewritten = -1;
+                goto done;
+            }
+            hashes[chunks[k].index] = chunks[k].hash;
+            rewritten++;
+        }
+    }
+
+done:
+    // the hashes of the chunks written so far are kept even on failure
+    if (rewritten != 0 && store_hashes(entry, chunk, hashes) < 0) {
+        rewritten = -1;
+    }
+    for (k = 0; k < batch; k++) {
+        free(chunks[k].data);
+    }
+    free(chunks);
+    free(on_disk);
+    free(hashes);
+    return rewritten;
+}
+
+/*
+ * Compares two datasets chunk by chunk. Stored hashes are used when both have
+ * them for the same chunk dimensions, otherwise the chunks are hashed on the
+ * grid of the stored hashes of either dataset, or the chunks of `a`. Stored
+ * hashes that are out of date give wrong results.
+ * \param a a dataset
+ * \param b a dataset with the same dimensions
+ * \param first_row where to return the first row of the first chunk that
+ *                  differs, can be NULL
+ * \return the number of chunks that differ or -1 on failure
+ */
+long diff_datasets(const hdf5_entry_t a, const hdf5_entry_t b,
+                   hsize_t *first_row) {
+    long      diffs = 0;
+    bool      stored_a;
+    bool      stored_b;
+    hsize_t   i;
+    hsize_t   num_chunks;
+    hsize_t   grid_cols;
+    hsize_t   chunk[2];
+    hsize_t   chunk_a[2];
+    hsize_t   chunk_b[2];
+    uint64_t *hashes_a;
+    uint64_t *hashes_b;
+    STATS_TIMER(DIFF_DATASETS);
+
+    if (IS_GROUP(a) || IS_GROUP(b)) {
+        return -1;
+    }
+    if (X_DIM(a) != X_DIM(b) || Y_DIM(a) != Y_DIM(b)) {
+        fprintf(stderr, "%s is %llu x %llu but %s is %llu x %llu\n",
+                a->name, X_DIM(a), Y_DIM(a), b->name, X_DIM(b), Y_DIM(b));
+        return -1;
+    }
+
+    stored_a = get_chunk(a, chunk_a);
+    stored_b = get_chunk(b, chunk_b);
+    if (stored_a) {
+        memcpy(chunk, chunk_a, sizeof(chunk));
+    } else if (stored_b) {
+        memcpy(chunk, chunk_b, sizeof(chunk));
+    } else {
+        default_chunk(a, chunk);
+    }
+    stored_a = stored_a && memcmp(chunk, chunk_a, sizeof(chunk)) == 0;
+    stored_b = stored_b && memcmp(chunk, chunk_b, sizeof(chunk)) == 0;
+
+    hashes_a = stored_a ? read_hashes(a, chunk) : compute_hashes(a, chunk);
+    hashes_b = stored_b ? read_hashes(b, chunk) : compute_hashes(b, chunk);
+    if (hashes_a == NULL || hashes_b == NULL) {
+        free(hashes_a);
+        free(hashes_b);
+        return -1;
+    }
+
+    grid_cols  = (Y_DIM(a) + chunk[1] - 1) / chunk[1];
+    num_chunks = (X_DIM(a) + chunk[0] - 1) / chunk[0] * grid_cols;
+    for (i = 0; i < num_chunks; i++) {
+        if (hashes_a[i] != hashes_b[i]) {
+            if (diffs++ == 0 && first_row != NULL) {
+                *first_row = i / grid_cols * chunk[0];
+            }
+        }
+    }
+
+    free(hashes_a);
+    free(hashes_b);
+    return diffs;
+}
+
+/*
+ * XXH64 of a buffer, read as little endian words
+ * \param data the buffer
+ * \param len the size of the buffer in bytes
+ * \param seed the seed of the hash
+ * \return the hash
+ */
+uint64_t hash_bytes(const void *data, size_t len, uint64_t seed) {
+    const uint8_t *p   = (const uint8_t *) data;
+    const uint8_t *end = p + len;
+    uint64_t       h;
+
+    if (len >= 32) {
+        uint64_t v1 = seed + PRIME64_1 + PRIME64_2;
+        uint64_t v2 = seed + PRIME64_2;
+        uint64_t v3 = seed;
+        uint64_t v4 = seed - PRIME64_1;
+        do {
+            v1 = xxh64_round(v1, read64(p));
+            v2 = xxh64_round(v2, read64(p + 8));
+            v3 = xxh64_round(v3, read64(p + 16));
+            v4 = xxh64_round(v4, read64(p + 24));
+            p += 32;
+        } while (end - p >= 32);
+        h = ROTL64(v1, 1) + ROTL64(v2, 7) + ROTL64(v3, 12) + ROTL64(v4, 18);
+        h = xxh64_merge(h, v1);
+        h = xxh64_merge(h, v2);
+        h = xxh64_merge(h, v3);
+        h = xxh64_merge(h, v4);
+    } else {
+        h = seed + PRIME64_5;
+    }
+    h += (uint64_t) len;
+
+    for (; end - p >= 8; p += 8) {
+        h ^= xxh64_round(0, read64(p));
+        h  = ROTL64(h, 27) * PRIME64_1 + PRIME64_4;
+    }
+    if (end - p >= 4) {
+        h ^= (uint64_t) read32(p) * PRIME64_1;
+        h  = ROTL64(h, 23) * PRIME64_2 + PRIME64_3;
+        p += 4;
+    }
+    for (; p < end; p++) {
+        h ^= *p * PRIME64_5;
+        h  = ROTL64(h, 11) * PRIME64_1;
+    }
+
+    h ^= h >> 33;
+    h *= PRIME64_2;
+    h ^= h >> 29;
+    h *= PRIME64_3;
+    h ^= h >> 32;
+    return h;
+}
+
+/*******************************************************************************
+ *                              Helper functions
+ ******************************************************************************/
+
+/*
+ * Picks the chunk dimensions to hash a dataset with: its own chunks if it's a
+ * chunked one or two dimensional dataset, HASH_ROWS full rows otherwise
+ * \param entry the dataset
+ * \param chunk where to return the chunk dimensions
+ */
+static void default_chunk(const hdf5_entry_t entry, hsize_t *chunk) {
+    hid_t   plist;
+    hsize_t dims[H5S_MAX_RANK];
+
+    chunk[0] = HASH_ROWS;
+    chunk[1] = Y_DIM(entry) ? Y_DIM(entry) : 1;
+
+    lock_hdf5();
+    if (entry->rank >= 1 && entry->rank <= 2 &&
+        (plist = H5Dget_create_plist(entry->id)) >= 0) {
+        if (H5Pget_layout(plist) == H5D_CHUNKED &&
+            H5Pget_chunk(plist, entry->rank, dims) == entry->rank) {
+            chunk[0] = dims[0];
+            chunk[1] = entry->rank == 2 ? dims[1] : 1;
+        }
+        H5Pclose(plist);
+    }
+    unlock_hdf5();
+}
+
+/*
+ * Reads the chunk dimensions the stored hashes of a dataset cover
+ * \param entry the dataset
+ * \param chunk where to return the chunk dimensions
+ * \return whether the dataset has hashes
+ */
+static bool get_chunk(const hdf5_entry_t entry, hsize_t *chunk) {
+    int         rank;
+    bool        found = false;
+    size_t      size;
+    hsize_t     dims[1];
+    long long   values[2];
+    H5T_class_t class;
+
+    lock_hdf5();
+    if (H5LTfind_attribute(entry->id, HASH_ATTR) > 0) {
+        if (H5LTget_attribute_ndims(entry->id, ".", HASH_ATTR, &rank) < 0 ||
+            rank != 1 ||
+            H5LTget_attribute_info(entry->id, ".", HASH_ATTR, dims, &class,
+                                   &size) < 0 ||
+            dims[0] != 2 ||
+            H5LTget_attribute_long_long(entry->id, ".", HASH_ATTR,
+                                        values) < 0 ||
+            values[0] <= 0 || values[1] <= 0) {
+            fprintf(stderr, "%s of %s is malformed\n", HASH_ATTR, entry->name);
+        } else {
+            chunk[0] = (hsize_t) values[0];
+            chunk[1] = (hsize_t) values[1];
+            found    = true;
+        }
+    }
+    unlock_hdf5();
+    return found;
+}
+
+/*
+ * Fills in the name of the dataset holding the hashes of a dataset
+ * \param entry the dataset
+ * \param name a buffer of MAX_LEN characters
+ * \return 0 on success or -1 if the name doesn't fit
+ */
+static int hashes_name(const hdf5_entry_t entry, char *name) {
+    if (snprintf(name, MAX_LEN, "%s" HASH_SUFFIX, entry->name) >= MAX_LEN) {
+        fprintf(stderr, "the hashes of %s need a shorter name\n", entry->name);
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Reads the stored hashes of a dataset
+ * \param entry the dataset
+ * \param chunk the chunk dimensions of the hashes
+ * \return the hashes, to be freed by the caller, or NULL
+ */
+static uint64_t *read_hashes(const hdf5_entry_t entry, const hsize_t *chunk) {
+    char         name[MAX_LEN];
+    hsize_t      num_chunks;
+    uint64_t    *hashes;
+    hdf5_entry_t stored;
+
+    if (hashes_name(entry, name) < 0) {
+        return NULL;
+    }
+    num_chunks = ((X_DIM(entry) + chunk[0] - 1) / chunk[0]) *
+                 ((Y_DIM(entry) + chunk[1] - 1) / chunk[1]);
+    if ((stored = get_dataset(entry->parent, name)) == NULL ||
+        X_DIM(stored) * Y_DIM(stored) != num_chunks) {
+        fprintf(stderr, "%s of %s are missing or out of date\n",
+                name, entry->name);
+        return NULL;
+    }
+    if ((hashes = (uint64_t *) malloc(sizeof(uint64_t) * (num_chunks + 1))) ==
+        NULL) {
+        perror("malloc failed in read_hashes():hashes");
+        return NULL;
+    }
+
+    STATS_COUNT(HDF5_CALLS, 1);
+    STATS_COUNT(BYTES_READ, sizeof(uint64_t) * num_chunks);
+    lock_hdf5();
+    if (H5Dread(stored->id, H5T_NATIVE_UINT64, H5S_ALL, H5S_ALL, H5P_DEFAULT,
+                hashes) < 0) {
+        fprintf(stderr, "failed to read %s\n", name);
+        free(hashes);
+        hashes = NULL;
+    }
+    unlock_hdf5();
+    return hashes;
+}
+
+/*
+ * Writes the hashes of a dataset to <name>_hashes, creating it if needed, and
+ * records the chunk dimensions in the "hash_chunk" attribute
+ * \param entry the dataset
+ * \param chunk the chunk dimensions of the hashes
+ * \param hashes the hashes of the chunks
+ * \return 0 on success or -1 on failure
+ */
+static int store_hashes(const hdf5_entry_t entry, const hsize_t *chunk,
+                        const uint64_t *hashes) {
+    int          status = 0;
+    char         name[MAX_LEN];
+    hsize_t      dims[2];
+    long long    values[2] = {(long long) chunk[0], (long long) chunk[1]};
+    hdf5_entry_t stored;
+
+    if (hashes_name(entry, name) < 0) {
+        return -1;
+    }
+    dims[0] = (X_DIM(entry) + chunk[0] - 1) / chunk[0];
+    dims[1] = (Y_DIM(entry) + chunk[1] - 1) / chunk[1];
+
+    STATS_COUNT(HDF5_CALLS, 2);
+    STATS_COUNT(BYTES_WRITTEN, sizeof(uint64_t) * dims[0] * dims[1]);
+    lock_hdf5();
+    if ((stored = get_dataset(entry->parent, name)) == NULL) {
+        stored = create_dataset(entry->parent, name, H5T_STD_U64LE, 2, dims,
+                                H5P_DEFAULT);
+    } else if (X_DIM(stored) * Y_DIM(stored) != dims[0] * dims[1]) {
+        fprintf(stderr, "%s doesn't match the chunks of %s\n",
+                name, entry->name);
+        stored = NULL;
+    }
+    if (stored == NULL ||
+        H5Dwrite(stored->id, H5T_NATIVE_UINT64, H5S_ALL, H5S_ALL, H5P_DEFAULT,
+                 hashes) < 0 ||
+        H5LTset_attribute_long_long(entry->id, ".", HASH_ATTR, values, 2) < 0) {
+        fprintf(stderr, "failed to write the hashes of %s\n", entry->name);
+        status = -1;
+    }
+    unlock_hdf5();
+    return status;
+}
+
+/*
+ * Hashes a chunk of a block of rows. The chunk is copied to a scratch buffer
+ * first unless it spans whole rows, in which case it's already contiguous.
+ * \param rows the block of rows
+ * \param num_rows the number of rows in the block
+ * \param width the number of columns of a row
+ * \param row the first row of the chunk in the block
+ * \param col the first column of the chunk
+ * \param chunk the chunk dimensions
+ * \param scratch room for a chunk, can be NULL if chunks span whole rows
+ * \return the hash of the chunk
+ */
+static uint64_t hash_chunk(const double  *rows,
+                           hsize_t        num_rows,
+                           hsize_t        width,
+                           hsize_t        row,
+                           hsize_t        col,
+                           const hsize_t *chunk,
+                           double        *scratch) {
+    hsize_t r;
+    hsize_t n    = num_rows - row < chunk[0] ? num_rows - row : chunk[0];
+    hsize_t cols = width - col < chunk[1] ? width - col : chunk[1];
+
+    if (cols == width) {
+        return hash_bytes(rows + row * width, sizeof(double) * n * cols,
+                          HASH_SEED);
+    }
+    for (r = 0; r < n; r++) {
+        memcpy(scratch + r * cols, rows + (row + r) * width + col,
+               sizeof(double) * cols);
+    }
+    return hash_bytes(scratch, sizeof(double) * n * cols, HASH_SEED);
+}
+
+/*
+ * Copies the part of a region that falls in a chunk over the chunk
+ * \param c the chunk
+ * \param start the first row and column of the region
+ * \param count the number of rows and columns of the region
+ * \param buf the contents of the region
+ */
+static void overlay(struct region_chunk *c,
+                    const hsize_t       *start,
+                    const hsize_t       *count,
+                    const double        *buf) {
+    hsize_t r;
+    hsize_t r0 = start[0] > c->offset[0] ? start[0] : c->offset[0];
+    hsize_t c0 = start[1] > c->offset[1] ? start[1] : c->offset[1];
+    hsize_t r1 = start[0] + count[0];
+    hsize_t c1 = start[1] + count[1];
+
+    r1 = r1 < c->offset[0] + c->extent[0] ? r1 : c->offset[0] + c->extent[0];
+    c1 = c1 < c->offset[1] + c->extent[1] ? c1 : c->offset[1] + c->extent[1];
+    for (r = r0; r < r1; r++) {
+        memcpy(c->data + (r - c->offset[0]) * c->extent[1] + c0 - c->offset[1],
+               buf + (r - start[0]) * count[1] + c0 - start[1],
+               sizeof(double) * (c1 - c0));
+    }
+}
+
+/*
+ * Reads or writes a rectangle of a one or two dimensional dataset as doubles
+ * \param entry the dataset
+ * \param offset the first row and column
+ * \param extent the number of rows and columns
+ * \param data the rectangle, extent[0] x extent[1]
+ * \param write whether to write rather than read
+ * \return 0 on success or -1 on failure
+ */
+static int transfer_region(const hdf5_entry_t entry,
+                           const hsize_t     *offset,
+                           const hsize_t     *extent,
+                           double            *data,
+                           bool               write) {
+    hid_t   mem_space;
+    hid_t   file_space;
+    hsize_t mem_dims[1] = {extent[0] * extent[1]};
+    herr_t  status      = -1;
+
+    STATS_COUNT(HDF5_CALLS, 1);
+    if (write) {
+        STATS_COUNT(BYTES_WRITTEN, sizeof(double) * mem_dims[0]);
+    } else {
+        STATS_COUNT(BYTES_READ, sizeof(double) * mem_dims[0]);
+    }
+    lock_hdf5();
+    mem_space  = H5Screate_simple(1, mem_dims, NULL);
+    file_space = H5Dget_space(entry->id);
+    if (H5Sselect_hyperslab(file_space, H5S_SELECT_SET, offset, NULL, extent,
+                            NULL) >= 0) {
+        if (write) {
+            status = H5Dwrite(entry->id, H5T_NATIVE_DOUBLE, mem_space,
+                              file_space, H5P_DEFAULT, data);
+        } else {
+            status = H5Dread(entry->id, H5T_NATIVE_DOUBLE, mem_space,
+                             file_space, H5P_DEFAULT, data);
+        }
+    }
+    H5Sclose(file_space);
+    H5Sclose(mem_space);
+    unlock_hdf5();
+    if (status < 0) {
+        fprintf(stderr, "failed to %s a chunk of %s\n",
+                write ? "write" : "read", entry->name);
+        return -1;
+    }
+    return 0;
+}
+
+static uint64_t read64(const uint8_t *p) {
+    return (uint64_t) p[0] | (uint64_t) p[1] << 8 | (uint64_t) p[2] << 16 |
+           (uint64_t) p[3] << 24 | (uint64_t) p[4] << 32 |
+           (uint64_t) p[5] << 40 | (uint64_t) p[6] << 48 |
+           (uint64_t) p[7] << 56;
+}
+
+static uint32_t read32(const uint8_t *p) {
+    return (uint32_t) p[0] | (uint32_t) p[1] << 8 | (uint32_t) p[2] << 16 |
+           (uint32_t) p[3] << 24;
+}
+
+static uint64_t xxh64_round(uint64_t acc, uint64_t input) {
+    acc += input * PRIME64_2;
+    acc  = ROTL64(acc, 31);
+    return acc * PRIME64_1;
+}
+
+static uint64_t xxh64_merge(uint64_t acc, uint64_t val) {
+    acc ^= xxh64_round(0, val);
+    return acc * PRIME64_1 + PRIME64_4;
+}
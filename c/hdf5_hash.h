@@ -0,0 +1,41 @@
+#ifndef _HDF5_HASH_H_
+#define _HDF5_HASH_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include "hdf5_struct.h"
+
+#define HASH_ATTR   "hash_chunk" // the chunk dimensions the hashes cover
+#define HASH_SUFFIX "_hashes"    // the companion dataset holding the hashes
+#define HASH_ROWS   4096         // rows per chunk if the dataset isn't chunked
+#define HASH_SEED   0
+#define HASH_BATCH  4            // chunks per thread between reads and writes
+
+/*
+ * Hashes the chunks of a dataset and stores them in <name>_hashes
+ */
+int write_hashes(hdf5_entry_t entry);
+
+/*
+ * Hashes the chunks of a dataset for a given chunk size without storing them
+ */
+uint64_t *compute_hashes(const hdf5_entry_t entry, const hsize_t *chunk);
+
+/*
+ * Rewrites the chunks of a region of a dataset whose contents changed
+ */
+long update_region(hdf5_entry_t entry, const hsize_t *start,
+                   const hsize_t *count, const double *buf);
+
+/*
+ * Counts the chunks that differ between two datasets by their hashes
+ */
+long diff_datasets(const hdf5_entry_t a, const hdf5_entry_t b,
+                   hsize_t *first_row);
+
+/*
+ * XXH64 of a buffer
+ */
+uint64_t hash_bytes(const void *data, size_t len, uint64_t seed);
+
+#endif
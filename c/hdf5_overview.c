@@ -0,0 +1,512 @@
+/*
+ * Min/max/mean pyramids for drawing long recordings at any zoom level.
+ *
+ * Each level of the pyramid is a sibling of the raw dataset named
+ * <name>_overview_<factor> with one row per bin of `factor` samples. A row
+ * holds the minimum of every channel, then the maximums, then the means, so a
+ * level is ceil(rows / factor) x (3 * channels). The factors of the levels are
+ * stored in the "overview_levels" attribute of the raw dataset.
+ *
+ * All the levels are built in the same pass: every sample is folded into the
+ * bin of the finest level and every finished bin is folded into the bin of the
+ * next level, so the raw data is only read once.
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "hdf5.h"
+#include "hdf5_hl.h"
+#include "hdf5_overview.h"
+#include "hdf5_stats.h"
+
+#define MAX_LEVELS 32
+
+/* the bin being filled and the buffered output of one pyramid level */
+struct level {
+    hsize_t      factor;   // samples per bin
+    hdf5_entry_t out;      // the dataset of the level
+    double      *acc;      // running min, max and sum of the current bin
+    hsize_t      count;    // samples folded into the current bin
+    hsize_t      parts;    // samples or bins of the level below folded in
+    double      *buf;      // finished bins waiting to be written
+    hsize_t      buf_len;  // number of bins in buf
+    hsize_t      buf_cap;  // capacity of buf in bins
+    hsize_t      written;  // number of bins written to the dataset
+};
+
+/* helper functions */
+static int  level_name(const hdf5_entry_t entry, hsize_t factor, char *name);
+static int  delete_overview(hdf5_entry_t entry);
+static void reset_bin(struct level *level, hsize_t channels);
+static void fold_samples(struct level *level, const double *rows, hsize_t n,
+                         hsize_t channels);
+static void fold_bin(struct level *level, const double *acc, hsize_t count,
+                     hsize_t channels);
+static int  finish_bin(struct level *levels, int i, int num_levels,
+                       hsize_t channels);
+static int  flush_level(struct level *level);
+static int  get_levels(const hdf5_entry_t entry, long long *factors);
+
+/*
+ * Builds the min/max/mean pyramid of a dataset. Levels are added until one has
+ * OVERVIEW_MIN_BINS bins or less, each level is `factor` times coarser than the
+ * one below it.
+ * \param entry the dataset to build the pyramid for (samples x channels)
+ * \param factor the decimation between levels, OVERVIEW_FACTOR if 0
+ * \return 0 on success or -1 on failure
+ */
+int write_overview(hdf5_entry_t entry, hsize_t factor) {
+    int     i;
+    int     num_levels = 0;
+    int     status     = -1;
+    char    name[MAX_LEN];
+    double *rows;
+    hsize_t n;
+    hsize_t start;
+    hsize_t bins;
+    hsize_t span;
+    hsize_t chunk[2];
+    hsize_t dims[2];
+    hsize_t channels = Y_DIM(entry);
+    hsize_t samples  = X_DIM(entry);
+    hsize_t step     = block_rows(entry);
+    long long    factors[MAX_LEVELS];
+    struct level levels[MAX_LEVELS];
+    hdf5_entry_t stale;
+    STATS_TIMER(WRITE_OVERVIEW);
+
+    if (IS_GROUP(entry) || entry->parent == NULL || samples == 0) {
+        return -1;
+    }
+    factor = factor ? factor : OVERVIEW_FACTOR;
+    if (factor < 2) {
+        fprintf(stderr, "overview factor must be at least 2\n");
+        return -1;
+    }
+    if (delete_overview(entry) < 0) {
+        return -1;
+    }
+
+    memset(levels, 0, sizeof(levels));
+    for (span = factor; num_levels < MAX_LEVELS; span *= factor) {
+        struct level *level = &levels[num_levels];
+        bins     = (samples + span - 1) / span;
+        dims[0]  = bins;
+        dims[1]  = OVERVIEW_STATS * channels;
+        chunk[0] = (1 << 20) / (sizeof(double) * dims[1]);
+        chunk[0] = chunk[0] < 1 ? 1 : chunk[0] > bins ? bins : chunk[0];
+        chunk[1] = dims[1];
+
+        // levels left over from a pyramid that wasn't finished are replaced
+        if (level_name(entry, span, name) < 0 ||
+            ((stale = get_dataset(entry->parent, name)) != NULL &&
+             delete_dataset(stale) < 0) ||
+            (level->out = create_double_matrix(entry->parent, name, dims,
+                                               chunk)) == NULL) {
+            goto done;
+        }
+        level->factor  = span;
+        level->buf_cap = chunk[0];
+        level->acc = (double *) malloc(sizeof(double) * dims[1]);
+        level->buf = (double *) malloc(sizeof(double) * dims[1] * chunk[0]);
+        if (level->acc == NULL || level->buf == NULL) {
+            perror("malloc failed in write_overview():level");
+            goto done;
+        }
+        reset_bin(level, channels);
+        factors[num_levels++] = (long long) span;
+        if (bins <= OVERVIEW_MIN_BINS || span > samples / factor) {
+            break;
+        }
+    }
+
+    if ((rows = (double *) malloc(sizeof(double) * step * channels)) == NULL) {
+        perror("malloc failed in write_overview():rows");
+        goto done;
+    }
+    STATS_ALLOC(sizeof(double) * step * channels);
+    for (start = 0; start < samples; start += n) {
+        hsize_t offset = 0;
+        n = samples - start < step ? samples - start : step;
+        if (read_double_rows(entry, start, n, rows) < 0) {
+            free(rows);
+            goto done;
+        }
+        // fold the block one bin of the finest level at a time
+        while (offset < n) {
+            hsize_t room = factor - levels[0].parts;
+            hsize_t take = n - offset < room ? n - offset : room;
+            fold_samples(&levels[0], rows + offset * channels, take, channels);
+            offset += take;
+            if (levels[0].parts == factor &&
+                finish_bin(levels, 0, num_levels, channels) < 0) {
+                free(rows);
+                goto done;
+            }
+        }
+    }
+    free(rows);
+
+    // the last bin of every level is usually partial
+    for (i = 0; i < num_levels; i++) {
+        if (levels[i].parts > 0 &&
+            finish_bin(levels, i, num_levels, channels) < 0) {
+            goto done;
+        }
+        if (flush_level(&levels[i]) < 0) {
+            goto done;
+        }
+    }
+
+    lock_hdf5();
+    status = H5LTset_attribute_long_long(entry->id, ".", OVERVIEW_ATTR,
+                                         factors, num_levels) < 0 ? -1 : 0;
+    unlock_hdf5();
+    if (status < 0) {
+        fprintf(stderr, "failed to write %s of %s\n",
+                OVERVIEW_ATTR, entry->name);
+    }
+
+done:
+    for (i = 0; i < MAX_LEVELS; i++) {
+        // a partial pyramid would be read as a complete one
+        if (status < 0 && levels[i].out != NULL) {
+            delete_dataset(levels[i].out);
+        }
+        free(levels[i].acc);
+        free(levels[i].buf);
+    }
+    return status;
+}
+
+/*
+ * Reads the part of a pyramid covering the samples [t0, t1). The coarsest level
+ * that still has at least `npixels` bins in the window is used, so between
+ * npixels and factor * npixels bins are returned. If the window is too short
+ * for any level, the raw samples are returned as bins of one sample.
+ * \param entry the raw dataset the pyramid was built for
+ * \param t0 the first sample of the window
+ * \param t1 one past the last sample of the window
+ * \param npixels the number of bins needed to draw the window
+ * \return a hdf5_overview_t or NULL if the window can't be read
+ */
+hdf5_overview_t read_overview(const hdf5_entry_t entry,
+                              hsize_t            t0,
+                              hsize_t            t1,
+                              hsize_t            npixels) {
+    int     i;
+    int     num_levels;
+    char    name[MAX_LEN];
+    double *rows;
+    hsize_t b, c;
+    hsize_t last;
+    hsize_t channels;
+    hsize_t factor = 1;
+    hdf5_entry_t    level = entry;
+    hdf5_overview_t overview;
+    long long       factors[MAX_LEVELS];
+    STATS_TIMER(READ_OVERVIEW);
+
+    if (IS_GROUP(entry)) {
+        return NULL;
+    }
+    t1 = t1 > X_DIM(entry) ? X_DIM(entry) : t1;
+    if (t0 >= t1 || npixels == 0) {
+        return NULL;
+    }
+
+    lock_hdf5();
+    num_levels = get_levels(entry, factors);
+    unlock_hdf5();
+    for (i = 0; i < num_levels; i++) {
+        hsize_t f = (hsize_t) factors[i];
+        if ((t1 - t0) / f >= npixels && f > factor) {
+            factor = f;
+        }
+    }
+    if (factor > 1) {
+        if (level_name(entry, factor, name) < 0 ||
+            (level = get_dataset(entry->parent, name)) == NULL) {
+            fprintf(stderr, "missing overview level %s\n", name);
+            return NULL;
+        }
+    }
+
+    if ((overview = (hdf5_overview_t)
+                    calloc(1, sizeof(struct hdf5_overview))) == NULL) {
+        perror("malloc failed in read_overview():overview");
+        return NULL;
+    }
+    channels = Y_DIM(entry);
+    last     = (t1 + factor - 1) / factor;
+    last     = last > X_DIM(level) ? X_DIM(level) : last;
+    overview->factor       = factor;
+    overview->first_bin    = t0 / factor;
+    overview->num_bins     = last - overview->first_bin;
+    overview->num_channels = channels;
+    overview->min = (double *) malloc(sizeof(double) * OVERVIEW_STATS *
+                                      overview->num_bins * channels);
+    rows = (double *) malloc(sizeof(double) * Y_DIM(level) *
+                             overview->num_bins);
+    STATS_ALLOC(sizeof(double) * (OVERVIEW_STATS * channels + Y_DIM(level)) *
+                overview->num_bins);
+    if (overview->min == NULL || rows == NULL) {
+        perror("malloc failed in read_overview():min");
+        free(rows);
+        free_overview(overview);
+        return NULL;
+    }
+    overview->max  = overview->min + overview->num_bins * channels;
+    overview->mean = overview->max + overview->num_bins * channels;
+
+    if (read_double_rows(level, overview->first_bin, overview->num_bins,
+                         rows) < 0) {
+        free(rows);
+        free_overview(overview);
+        return NULL;
+    }
+
+    if (factor == 1) {
+        size_t bytes = sizeof(double) * overview->num_bins * channels;
+        memcpy(overview->min, rows, bytes);
+        memcpy(overview->max, rows, bytes);
+        memcpy(overview->mean, rows, bytes);
+    } else {
+        for (b = 0; b < overview->num_bins; b++) {
+            const double *row = rows + b * OVERVIEW_STATS * channels;
+            for (c = 0; c < channels; c++) {
+                OVERVIEW_MIN(overview, b, c)  = row[c];
+                OVERVIEW_MAX(overview, b, c)  = row[channels + c];
+                OVERVIEW_MEAN(overview, b, c) = row[2 * channels + c];
+            }
+        }
+    }
+    free(rows);
+
+    return overview;
+}
+
+/*
+ * Frees the memory associated with a hdf5_overview_t
+ * \param overview the hdf5_overview_t to free
+ */
+void free_overview(hdf5_overview_t overview) {
+    if (overview == NULL) {
+        return;
+    }
+    // max and mean point into the same allocation as min
+    free(overview->min);
+    free(overview);
+}
+
+/*******************************************************************************
+ *                              Helper functions
+ ******************************************************************************/
+
+/*
+ * Builds the name of a pyramid level
+ * \param entry the raw dataset
+ * \param factor the decimation factor of the level
+ * \param name a buffer of MAX_LEN characters for the name
+ * \return 0 on success or -1 if the name doesn't fit
+ */
+static int level_name(const hdf5_entry_t entry, hsize_t factor, char *name) {
+    if (snprintf(name, MAX_LEN, "%s_overview_%llu", entry->name, factor) >=
+        MAX_LEN) {
+        fprintf(stderr, "the overview levels of %s need a shorter name\n",
+                entry->name);
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Deletes the pyramid of a dataset, if it has one: the levels listed in its
+ * OVERVIEW_ATTR and the attribute itself
+ * \param entry the raw dataset
+ * \return 0 on success or -1 on failure
+ */
+static int delete_overview(hdf5_entry_t entry) {
+    int          i;
+    int          num_levels;
+    char         name[MAX_LEN];
+    long long    factors[MAX_LEVELS];
+    hdf5_entry_t level;
+
+    lock_hdf5();
+    num_levels = get_levels(entry, factors);
+    for (i = 0; i < num_levels; i++) {
+        if (level_name(entry, (hsize_t) factors[i], name) == 0 &&
+            (level = get_dataset(entry->parent, name)) != NULL &&
+            delete_dataset(level) < 0) {
+            unlock_hdf5();
+            return -1;
+        }
+    }
+    STATS_COUNT(HDF5_CALLS, 1);
+    if (H5Aexists(entry->id, OVERVIEW_ATTR) > 0 &&
+        H5Adelete(entry->id, OVERVIEW_ATTR) < 0) {
+        fprintf(stderr, "failed to delete %s of %s\n",
+                OVERVIEW_ATTR, entry->name);
+        unlock_hdf5();
+        return -1;
+    }
+    unlock_hdf5();
+    return 0;
+}
+
+/*
+ * Empties the current bin of a level
+ * \param level the level to reset
+ * \param channels the number of channels
+ */
+static void reset_bin(struct level *level, hsize_t channels) {
+    hsize_t c;
+    for (c = 0; c < channels; c++) {
+        level->acc[c]                = INFINITY;
+        level->acc[channels + c]     = -INFINITY;
+        level->acc[2 * channels + c] = 0.0;
+    }
+    level->count = 0;
+    level->parts = 0;
+}
+
+/*
+ * Folds raw samples into the current bin of the finest level
+ * \param level the finest level
+ * \param rows n rows of samples
+ * \param n the number of rows
+ * \param channels the number of channels
+ */
+static void fold_samples(struct level *level,
+                         const double *rows,
+                         hsize_t       n,
+                         hsize_t       channels) {
+    hsize_t i, c;
+    double *min = level->acc;
+    double *max = level->acc + channels;
+    double *sum = level->acc + 2 * channels;
+
+    for (i = 0; i < n; i++) {
+        const double *row = rows + i * channels;
+        for (c = 0; c < channels; c++) {
+            min[c]  = row[c] < min[c] ? row[c] : min[c];
+            max[c]  = row[c] > max[c] ? row[c] : max[c];
+            sum[c] += row[c];
+        }
+    }
+    level->count += n;
+    level->parts += n;
+}
+
+/*
+ * Folds a finished bin of the level below into the current bin of a level
+ * \param level the level to fold into
+ * \param acc the min, max and sum of the finished bin
+ * \param count the number of samples in the finished bin
+ * \param channels the number of channels
+ */
+static void fold_bin(struct level *level,
+                     const double *acc,
+                     hsize_t       count,
+                     hsize_t       channels) {
+    hsize_t c;
+    double *min = level->acc;
+    double *max = level->acc + channels;
+    double *sum = level->acc + 2 * channels;
+
+    for (c = 0; c < channels; c++) {
+        min[c]  = acc[c] < min[c] ? acc[c] : min[c];
+        max[c]  = acc[channels + c] > max[c] ? acc[channels + c] : max[c];
+        sum[c] += acc[2 * channels + c];
+    }
+    level->count += count;
+    level->parts++;
+}
+
+/*
+ * Moves the current bin of a level to its output buffer and folds it into the
+ * level above, finishing that bin too when it's full.
+ * \param levels all the levels
+ * \param i the index of the level whose bin is finished
+ * \param num_levels the number of levels
+ * \param channels the number of channels
+ * \return 0 on success or -1 if the buffer couldn't be written
+ */
+static int finish_bin(struct level *levels,
+                      int           i,
+                      int           num_levels,
+                      hsize_t       channels) {
+    hsize_t c;
+    struct level *level = &levels[i];
+    double *row = level->buf + level->buf_len * OVERVIEW_STATS * channels;
+
+    memcpy(row, level->acc, sizeof(double) * 2 * channels);
+    for (c = 0; c < channels; c++) {
+        row[2 * channels + c] = level->acc[2 * channels + c] / level->count;
+    }
+    if (++level->buf_len == level->buf_cap && flush_level(level) < 0) {
+        return -1;
+    }
+
+    if (i + 1 < num_levels) {
+        struct level *up = &levels[i + 1];
+        fold_bin(up, level->acc, level->count, channels);
+        if (up->parts == up->factor / level->factor &&
+            finish_bin(levels, i + 1, num_levels, channels) < 0) {
+            return -1;
+        }
+    }
+    reset_bin(level, channels);
+    return 0;
+}
+
+/*
+ * Writes the buffered bins of a level to its dataset
+ * \param level the level to flush
+ * \return 0 on success or -1 on failure
+ */
+static int flush_level(struct level *level) {
+    if (level->buf_len == 0) {
+        return 0;
+    }
+    if (write_double_rows(level->out, level->written, level->buf_len,
+                          level->buf) < 0) {
+        return -1;
+    }
+    level->written += level->buf_len;
+    level->buf_len  = 0;
+    return 0;
+}
+
+/*
+ * Reads the factors of the pyramid levels of a dataset, with the HDF5 lock held
+ * \param entry the raw dataset
+ * \param factors a buffer of MAX_LEVELS factors
+ * \return the number of levels, 0 if the dataset has no pyramid
+ */
+static int get_levels(const hdf5_entry_t entry, long long *factors) {
+    int         rank;
+    size_t      size;
+    hsize_t     dims[1];
+    H5T_class_t class;
+
+    if (H5LTfind_attribute(entry->id, OVERVIEW_ATTR) <= 0) {
+        return 0;
+    }
+    if (H5LTget_attribute_ndims(entry->id, ".", OVERVIEW_ATTR, &rank) < 0 ||
+        rank != 1 ||
+        H5LTget_attribute_info(entry->id, ".", OVERVIEW_ATTR, dims, &class,
+                               &size) < 0 ||
+        dims[0] > MAX_LEVELS) {
+        fprintf(stderr, "%s of %s is malformed\n", OVERVIEW_ATTR, entry->name);
+        return 0;
+    }
+    if (H5LTget_attribute_long_long(entry->id, ".", OVERVIEW_ATTR,
+                                    factors) < 0) {
+        return 0;
+    }
+    return (int) dims[0];
+}
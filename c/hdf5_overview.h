@@ -0,0 +1,47 @@
+#ifndef _HDF5_OVERVIEW_H_
+#define _HDF5_OVERVIEW_H_
+
+#include "hdf5_struct.h"
+
+#define OVERVIEW_FACTOR   4            // decimation between pyramid levels
+#define OVERVIEW_MIN_BINS 256          // the coarsest level has fewer bins
+#define OVERVIEW_ATTR     "overview_levels"
+#define OVERVIEW_STATS    3            // min, max, mean
+
+// access to the planes of a hdf5_overview_t--bin b, channel c
+#define OVERVIEW_MIN(o, b, c)  ((o->min[(b) * o->num_channels + (c)]))
+#define OVERVIEW_MAX(o, b, c)  ((o->max[(b) * o->num_channels + (c)]))
+#define OVERVIEW_MEAN(o, b, c) ((o->mean[(b) * o->num_channels + (c)]))
+
+/*
+ * A window of a min/max/mean pyramid level. Each plane is
+ * num_bins x num_channels, bin i covers the samples
+ * [(first_bin + i) * factor, (first_bin + i + 1) * factor)
+ */
+typedef struct hdf5_overview {
+    hsize_t factor;        // samples per bin, 1 if the raw data was read
+    hsize_t first_bin;     // index of the first bin in the level
+    hsize_t num_bins;      // number of bins read
+    hsize_t num_channels;  // number of channels per bin
+    double *min;           // per bin minimum
+    double *max;           // per bin maximum
+    double *mean;          // per bin mean
+} *hdf5_overview_t;
+
+/*
+ * Builds the min/max/mean pyramid of a dataset in one pass over the data
+ */
+int write_overview(hdf5_entry_t entry, hsize_t factor);
+
+/*
+ * Reads the coarsest pyramid level that still has npixels bins in [t0, t1)
+ */
+hdf5_overview_t read_overview(const hdf5_entry_t entry, hsize_t t0, hsize_t t1,
+                              hsize_t npixels);
+
+/*
+ * Frees a hdf5_overview_t
+ */
+void free_overview(hdf5_overview_t overview);
+
+#endif
@@ -0,0 +1,317 @@
+/*
+ * Streaming re-referencing of datasets, the average and robust references of
+ * PREP's noiseDetection.
+ *
+ * The reference of a sample depends on that sample alone, so the blocks of a
+ * dataset are independent: each thread reads a block of rows, computes the
+ * mean or median of the included channels of every row and subtracts it from
+ * the row, then writes the block back. One thread's computation overlaps the
+ * others' reads and writes, which take the HDF5 lock. Peak memory is a block
+ * per thread no matter how long the recording is.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "hdf5.h"
+#include "hdf5_reref.h"
+#include "hdf5_stats.h"
+
+/* helper functions */
+static double row_mean(const double *row, const bool *mask, hsize_t channels,
+                       hsize_t included);
+static double row_median(const double *row, const bool *mask, hsize_t channels,
+                         double *values);
+static double select_kth(double *values, hsize_t n, hsize_t k);
+static bool is_writable(const hdf5_entry_t entry);
+
+/*
+ * Re-references every channel of a dataset: for each sample, the average or
+ * median of the channels in `mask` is subtracted from all the channels. The
+ * dataset is streamed a block of rows at a time with the blocks spread over
+ * the threads.
+ *
+ * With a name, the result goes to a new chunked double dataset in the same
+ * group. Without one, the dataset is rewritten in place, which needs a floating
+ * point dataset in a file opened for writing. Data of the entry that's already
+ * loaded isn't updated.
+ * \param entry the dataset to re-reference, samples x channels
+ * \param mask the channels to estimate the reference from, Y_DIM(entry) flags,
+ *             or NULL for all of them
+ * \param method REREF_AVERAGE or REREF_MEDIAN
+ * \param name the name of the new dataset or NULL to write in place
+ * \return the dataset written to or NULL on failure, which deletes a new
+ *         dataset but can leave a dataset re-referenced in place partly done
+ */
+hdf5_entry_t rereference_dataset(hdf5_entry_t entry,
+                                 const bool  *mask,
+                                 int          method,
+                                 const char  *name) {
+    long         k;
+    long         num_blocks;
+    int          status   = 0;
+    int          threads  = NUM_THREADS();
+    hsize_t      c;
+    hsize_t      included = 0;
+    hsize_t      channels = Y_DIM(entry);
+    hsize_t      samples  = X_DIM(entry);
+    hsize_t      step;
+    hsize_t      dims[2];
+    hsize_t      chunk[2];
+    double      *rows;
+    double      *values;
+    hdf5_entry_t out = entry;
+    STATS_TIMER(REREFERENCE_DATASET);
+
+    if (IS_GROUP(entry) || samples == 0 || channels == 0 ||
+        (method != REREF_AVERAGE && method != REREF_MEDIAN)) {
+        return NULL;
+    }
+    for (c = 0; c < channels; c++) {
+        included += mask == NULL || mask[c];
+    }
+    if (included == 0) {
+        fprintf(stderr, "no channels to re-reference %s to\n", entry->name);
+        return NULL;
+    }
+
+    if (name != NULL) {
+        if (entry->parent == NULL) {
+            fprintf(stderr, "%s has no group to write %s to\n", entry->name,
+                    name);
+            return NULL;
+        }
+        dims[0]  = samples;
+        dims[1]  = channels;
+        chunk[0] = (1 << 20) / (sizeof(double) * channels);
+        chunk[0] = chunk[0] < 1 ? 1 : chunk[0] > samples ? samples : chunk[0];
+        chunk[1] = channels;
+        if ((out = create_double_matrix(entry->parent, name, dims, chunk)) ==
+            NULL) {
+            return NULL;
+        }
+    } else if (entry->class != H5T_FLOAT || !is_writable(entry)) {
+        fprintf(stderr, "%s can't be re-referenced in place\n", entry->name);
+        return NULL;
+    }
+
+    // the blocks of the output, so blocks written in place never share chunks
+    step       = block_rows(out);
+    num_blocks = (long) ((samples + step - 1) / step);
+    rows       = (double *) malloc(sizeof(double) * step * channels * threads);
+    values     = (double *) malloc(sizeof(double) * included * threads);
+    if (rows == NULL || values == NULL) {
+        perror("malloc failed in rereference_dataset()");
+        free(rows);
+        free(values);
+        if (out != entry) {
+            delete_dataset(out);
+        }
+        return NULL;
+    }
+    STATS_ALLOC(sizeof(double) * (step * channels + included) * threads);
+
+    #pragma omp parallel for schedule(dynamic)
+    for (k = 0; k < num_blocks; k++) {
+        hsize_t start = (hsize_t) k * step;
+        hsize_t n     = samples - start < step ? samples - start : step;
+        double *block = rows + THREAD_NUM() * step * channels;
+
+        if (__atomic_load_n(&status, __ATOMIC_RELAXED) < 0) {
+            continue;
+        }
+        if (read_double_rows(entry, start, n, block) < 0 ||
+            rereference_rows(block, n, channels, mask, method,
+                             values + THREAD_NUM() * included) < 0 ||
+            write_double_rows(out, start, n, block) < 0) {
+            __atomic_store_n(&status, -1, __ATOMIC_RELAXED);
+        }
+    }
+
+    free(rows);
+    free(values);
+    // a partly re-referenced new dataset would pass for a finished one
+    if (status < 0 && out != entry) {
+        delete_dataset(out);
+    }
+    return status < 0 ? NULL : out;
+}
+
+/*
+ * Re-references n rows in memory, the computation of rereference_dataset
+ * \param rows the rows, n x channels, overwritten with the result
+ * \param n the number of rows
+ * \param channels the number of channels per row
+ * \param mask the channels to estimate the reference from or NULL for all
+ * \param method REREF_AVERAGE or REREF_MEDIAN
+ * \param scratch space for the median, a double per included channel, or
+ *                NULL to allocate it
+ * \return 0 on success or -1 on failure
+ */
+int rereference_rows(double     *rows,
+                     hsize_t     n,
+                     hsize_t     channels,
+                     const bool *mask,
+                     int         method,
+                     double     *scratch) {
+    hsize_t i, c;
+    hsize_t included = 0;
+    double  ref;
+    double *values   = scratch;
+
+    for (c = 0; c < channels; c++) {
+        included += mask == NULL || mask[c];
+    }
+    if (included == 0) {
+        return -1;
+    }
+    if (method == REREF_MEDIAN && values == NULL &&
+        (values = (double *) malloc(sizeof(double) * included)) == NULL) {
+        perror("malloc failed in rereference_rows():values");
+        return -1;
+    }
+
+    for (i = 0; i < n; i++) {
+        double *row = rows + i * channels;
+
+        ref = method == REREF_MEDIAN ? row_median(row, mask, channels, values)
+                                     : row_mean(row, mask, channels, included);
+        #pragma omp simd
+        for (c = 0; c < channels; c++) {
+            row[c] -= ref;
+        }
+    }
+
+    if (values != scratch) {
+        free(values);
+    }
+    return 0;
+}
+
+/*******************************************************************************
+ *                              Helper functions
+ ******************************************************************************/
+
+/*
+ * Returns the mean of the included channels of a row. Excluded channels are
+ * skipped rather than weighted by zero so a NaN in a bad channel doesn't
+ * spread.
+ */
+static double row_mean(const double *row,
+                       const bool   *mask,
+                       hsize_t       channels,
+                       hsize_t       included) {
+    hsize_t c;
+    double  sum = 0;
+
+    if (mask == NULL) {
+        #pragma omp simd reduction(+:sum)
+        for (c = 0; c < channels; c++) {
+            sum += row[c];
+        }
+    } else {
+        #pragma omp simd reduction(+:sum)
+        for (c = 0; c < channels; c++) {
+            sum += mask[c] ? row[c] : 0.0;
+        }
+    }
+    return sum / included;
+}
+
+/*
+ * Returns the median of the included channels of a row, the mean of the two
+ * middle values if there's an even number of them
+ * \param row the row
+ * \param mask the included channels or NULL for all
+ * \param channels the number of channels
+ * \param values scratch space for the included values
+ */
+static double row_median(const double *row,
+                         const bool   *mask,
+                         hsize_t       channels,
+                         double       *values) {
+    hsize_t c;
+    hsize_t i;
+    hsize_t n = 0;
+    double  upper;
+    double  lower;
+
+    for (c = 0; c < channels; c++) {
+        if (mask == NULL || mask[c]) {
+            values[n++] = row[c];
+        }
+    }
+    upper = select_kth(values, n, n / 2);
+    if (n % 2) {
+        return upper;
+    }
+    // the lower middle is the largest value left of the upper one
+    lower = values[0];
+    for (i = 1; i < n / 2; i++) {
+        lower = values[i] > lower ? values[i] : lower;
+    }
+    return (lower + upper) / 2;
+}
+
+/*
+ * Quickselect: reorders values so the k-th smallest is at index k with no
+ * larger value before it and no smaller value after it
+ * \param values the values, reordered
+ * \param n the number of values
+ * \param k the index to select, less than n
+ * \return the k-th smallest value
+ */
+static double select_kth(double *values, hsize_t n, hsize_t k) {
+    hsize_t lo = 0;
+    hsize_t hi = n - 1;
+    hsize_t i, j;
+    double  pivot;
+    double  tmp;
+
+    while (lo < hi) {
+        pivot = values[lo + (hi - lo) / 2];
+        i     = lo;
+        j     = hi;
+        while (i <= j) {
+            while (values[i] < pivot) {
+                i++;
+            }
+            while (values[j] > pivot) {
+                j--;
+            }
+            if (i <= j) {
+                tmp       = values[i];
+                values[i] = values[j];
+                values[j] = tmp;
+                i++;
+                if (j == 0) {
+                    break;
+                }
+                j--;
+            }
+        }
+        if (k <= j) {
+            hi = j;
+        } else if (k >= i) {
+            lo = i;
+        } else {
+            break;
+        }
+    }
+    return values[k];
+}
+
+/*
+ * Returns whether the file of a dataset is open for writing
+ */
+static bool is_writable(const hdf5_entry_t entry) {
+    hid_t    file;
+    unsigned intent = 0;
+
+    lock_hdf5();
+    if ((file = H5Iget_file_id(entry->id)) >= 0) {
+        H5Fget_intent(file, &intent);
+        H5Fclose(file);
+    }
+    unlock_hdf5();
+    return (intent & H5F_ACC_RDWR) != 0;
+}
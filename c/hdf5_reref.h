@@ -0,0 +1,24 @@
+#ifndef _HDF5_REREF_H_
+#define _HDF5_REREF_H_
+
+#include <stdbool.h>
+#include "hdf5_struct.h"
+
+// how the reference of each sample is estimated from the included channels
+#define REREF_AVERAGE  0
+#define REREF_MEDIAN   1   // robust to a few bad channels
+
+/*
+ * Subtracts the average or median of a set of channels from every channel of a
+ * dataset, in place or into a new dataset
+ */
+hdf5_entry_t rereference_dataset(hdf5_entry_t entry, const bool *mask,
+                                 int method, const char *name);
+
+/*
+ * Re-references a block of rows in memory
+ */
+int rereference_rows(double *rows, hsize_t n, hsize_t channels,
+                     const bool *mask, int method, double *scratch);
+
+#endif
@@ -0,0 +1,329 @@
+/*
+ * Counters, timers and traces of where the library spends its time.
+ *
+ * Everything is opt-in: the library is only instrumented when compiled with
+ * -DHDF5_STATS. Each thread counts into its own stats_local, found through a
+ * thread-local pointer, so counting never takes a lock or a locked
+ * instruction. The stats_local of every thread is kept in a registry that
+ * snapshots add up. Timers are declared with STATS_TIMER at the top of the
+ * public functions and stopped by the compiler when the function returns.
+ *
+ * Traces are recorded while stats_trace is on: every timed call becomes a
+ * complete event ("ph": "X") of the Chrome trace event format, which
+ * chrome://tracing and Perfetto can load.
+ */
+
+#define _XOPEN_SOURCE 700   // clock_gettime
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "hdf5_stats.h"
+
+#define STATS_OP_NAME(id, name) name,
+static const char *op_names[] = {STATS_OPS(STATS_OP_NAME)};
+#undef STATS_OP_NAME
+
+static const char *counter_names[] = {
+    "bytes_read", "bytes_written", "hdf5_calls", "entries_evaluated", "allocs",
+    "alloc_bytes"
+};
+
+#ifdef HDF5_STATS
+
+__thread struct stats_local *stats_thread;
+
+static pthread_mutex_t     stats_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct stats_local *registry;     // every thread, newest first
+static struct stats_local  spare;        // used if a thread can't get its own
+static uint32_t            num_threads;
+static bool                tracing;
+
+/* helper functions */
+static uint64_t now_ns(void);
+static void     add_event(struct stats_local *local, int op, uint64_t start_ns,
+                          uint64_t dur_ns);
+
+/*
+ * Gives the calling thread its counters and adds them to the registry
+ * \return the counters of the thread
+ */
+struct stats_local *stats_attach(void) {
+    struct stats_local *local;
+
+    if ((local = (struct stats_local *)
+                 calloc(1, sizeof(struct stats_local))) == NULL) {
+        perror("malloc failed in stats_attach():local");
+        stats_thread = &spare;
+        return stats_thread;
+    }
+    pthread_mutex_lock(&stats_lock);
+    local->tid  = ++num_threads;
+    local->next = registry;
+    registry    = local;
+    pthread_mutex_unlock(&stats_lock);
+    stats_thread = local;
+    return local;
+}
+
+/*
+ * Starts timing a call
+ * \param op the stats_op of the call
+ * \return the timer
+ */
+struct stats_timer stats_start(int op) {
+    struct stats_timer timer = {op, now_ns()};
+    return timer;
+}
+
+/*
+ * Stops a timer and adds the call to the counters of the thread, and to the
+ * trace if it's being recorded
+ * \param timer the timer started by stats_start
+ */
+void stats_stop(struct stats_timer *timer) {
+    uint64_t            dur   = now_ns() - timer->start_ns;
+    int                 op    = timer->op;
+    struct stats_local *local = STATS_LOCAL();
+
+    __atomic_store_n(&local->calls[op], local->calls[op] + 1, __ATOMIC_RELAXED);
+    __atomic_store_n(&local->total_ns[op], local->total_ns[op] + dur,
+                     __ATOMIC_RELAXED);
+    if (dur > local->max_ns[op]) {
+        __atomic_store_n(&local->max_ns[op], dur, __ATOMIC_RELAXED);
+    }
+    if (__atomic_load_n(&tracing, __ATOMIC_RELAXED)) {
+        add_event(local, op, timer->start_ns, dur);
+    }
+}
+
+/*
+ * Adds up the counters and timers of all the threads. The counts of calls that
+ * are still running aren't included.
+ * \param stats where to return the totals
+ */
+void stats_snapshot(struct hdf5_stats *stats) {
+    int                 i;
+    uint64_t            max;
+    struct stats_local *local;
+
+    memset(stats, 0, sizeof(struct hdf5_stats));
+    pthread_mutex_lock(&stats_lock);
+    for (local = registry; local != NULL; local = local->next) {
+        for (i = 0; i < STAT_NUM_COUNTERS; i++) {
+            stats->counters[i] += __atomic_load_n(&local->counters[i],
+                                                  __ATOMIC_RELAXED);
+        }
+        for (i = 0; i < STATS_NUM_OPS; i++) {
+            stats->ops[i].calls += __atomic_load_n(&local->calls[i],
+                                                   __ATOMIC_RELAXED);
+            stats->ops[i].total_ns += __atomic_load_n(&local->total_ns[i],
+                                                      __ATOMIC_RELAXED);
+            max = __atomic_load_n(&local->max_ns[i], __ATOMIC_RELAXED);
+            if (max > stats->ops[i].max_ns) {
+                stats->ops[i].max_ns = max;
+            }
+        }
+        stats->dropped_events += __atomic_load_n(&local->dropped_events,
+                                                 __ATOMIC_RELAXED);
+    }
+    pthread_mutex_unlock(&stats_lock);
+}
+
+/*
+ * Zeroes the counters and timers of all the threads and frees their trace
+ * events. Must not run while another thread is calling into the library.
+ */
+void stats_reset(void) {
+    struct stats_local       *local;
+    struct stats_event_block *block;
+    struct stats_event_block *next;
+
+    pthread_mutex_lock(&stats_lock);
+    for (local = registry; local != NULL; local = local->next) {
+        for (block = local->first; block != NULL; block = next) {
+            next = block->next;
+            free(block);
+        }
+        memset(local->counters, 0, sizeof(local->counters));
+        memset(local->calls, 0, sizeof(local->calls));
+        memset(local->total_ns, 0, sizeof(local->total_ns));
+        memset(local->max_ns, 0, sizeof(local->max_ns));
+        local->num_events     = 0;
+        local->dropped_events = 0;
+        local->first          = NULL;
+        local->last           = NULL;
+    }
+    pthread_mutex_unlock(&stats_lock);
+}
+
+/*
+ * Starts or stops recording trace events. Calls that are running when the
+ * recording starts are recorded when they return.
+ * \param on whether to record
+ */
+void stats_trace(bool on) {
+    __atomic_store_n(&tracing, on, __ATOMIC_RELAXED);
+}
+
+/*
+ * Writes the trace events of all the threads as a Chrome trace. Timestamps are
+ * in microseconds of the monotonic clock.
+ * \param path the file to write
+ * \return 0 on success or -1 on failure
+ */
+int stats_write_trace(const char *path) {
+    int                       status = 0;
+    bool                      first  = true;
+    uint32_t                  i;
+    uint32_t                  count;
+    FILE                     *out;
+    struct stats_local       *local;
+    struct stats_event_block *block;
+
+    if ((out = fopen(path, "w")) == NULL) {
+        perror("failed to open trace file");
+        return -1;
+    }
+    fprintf(out, "{\"traceEvents\":[");
+    pthread_mutex_lock(&stats_lock);
+    for (local = registry; local != NULL; local = local->next) {
+        block = __atomic_load_n(&local->first, __ATOMIC_ACQUIRE);
+        for (; block != NULL;
+             block = __atomic_load_n(&block->next, __ATOMIC_ACQUIRE)) {
+            count = __atomic_load_n(&block->count, __ATOMIC_ACQUIRE);
+            for (i = 0; i < count; i++) {
+                fprintf(out,
+                        "%s\n{\"name\":\"%s\",\"cat\":\"hdf5\",\"ph\":\"X\","
+                        "\"ts\":%.3f,\"dur\":%.3f,\"pid\":1,\"tid\":%u}",
+                        first ? "" : ",", op_names[block->events[i].op],
+                        block->events[i].start_ns / 1e3,
+                        block->events[i].dur_ns / 1e3, local->tid);
+                first = false;
+            }
+        }
+    }
+    pthread_mutex_unlock(&stats_lock);
+    fprintf(out, "\n],\"displayTimeUnit\":\"ns\"}\n");
+    if (ferror(out)) {
+        status = -1;
+    }
+    if (fclose(out) != 0 || status < 0) {
+        fprintf(stderr, "failed to write trace to %s\n", path);
+        return -1;
+    }
+    return 0;
+}
+
+/*******************************************************************************
+ *                              Helper functions
+ ******************************************************************************/
+
+static uint64_t now_ns(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (uint64_t) t.tv_sec * 1000000000u + (uint64_t) t.tv_nsec;
+}
+
+/*
+ * Appends a trace event to the events of a thread. The event is filled in
+ * before the count of its block is published, and a new block before it's
+ * linked, so stats_write_trace can run at the same time.
+ * \param local the counters of the calling thread
+ * \param op the stats_op of the call
+ * \param start_ns when the call started
+ * \param dur_ns how long the call took
+ */
+static void add_event(struct stats_local *local, int op, uint64_t start_ns,
+                      uint64_t dur_ns) {
+    uint32_t                  count;
+    struct stats_event_block *block = local->last;
+
+    if (local->num_events >= STATS_MAX_EVENTS || local == &spare) {
+        __atomic_store_n(&local->dropped_events, local->dropped_events + 1,
+                         __ATOMIC_RELAXED);
+        return;
+    }
+    if (block == NULL || block->count == STATS_EVENT_BLOCK) {
+        if ((block = (struct stats_event_block *)
+                     calloc(1, sizeof(struct stats_event_block))) == NULL) {
+            __atomic_store_n(&local->dropped_events, local->dropped_events + 1,
+                             __ATOMIC_RELAXED);
+            return;
+        }
+        if (local->last == NULL) {
+            __atomic_store_n(&local->first, block, __ATOMIC_RELEASE);
+        } else {
+            __atomic_store_n(&local->last->next, block, __ATOMIC_RELEASE);
+        }
+        local->last = block;
+    }
+    count = block->count;
+    block->events[count].op       = (uint32_t) op;
+    block->events[count].start_ns = start_ns;
+    block->events[count].dur_ns   = dur_ns;
+    __atomic_store_n(&block->count, count + 1, __ATOMIC_RELEASE);
+    local->num_events++;
+}
+
+#else
+
+void stats_snapshot(struct hdf5_stats *stats) {
+    memset(stats, 0, sizeof(struct hdf5_stats));
+}
+
+void stats_reset(void) {
+}
+
+void stats_trace(bool on) {
+    (void) on;
+}
+
+int stats_write_trace(const char *path) {
+    FILE *out;
+    if ((out = fopen(path, "w")) == NULL) {
+        perror("failed to open trace file");
+        return -1;
+    }
+    fprintf(out, "{\"traceEvents\":[]}\n");
+    return fclose(out) == 0 ? 0 : -1;
+}
+
+#endif
+
+/*
+ * Writes a snapshot of the counters and timers as a JSON object, with an entry
+ * for every operation even if it wasn't called
+ * \param out the stream to write to
+ * \return 0 on success or -1 on failure
+ */
+int stats_write_json(FILE *out) {
+    int               i;
+    struct hdf5_stats stats;
+#ifdef HDF5_STATS
+    bool              enabled = true;
+#else
+    bool              enabled = false;
+#endif
+
+    stats_snapshot(&stats);
+    fprintf(out, "{\n  \"enabled\": %s,\n  \"counters\": {",
+            enabled ? "true" : "false");
+    for (i = 0; i < STAT_NUM_COUNTERS; i++) {
+        fprintf(out, "%s\n    \"%s\": %llu", i ? "," : "", counter_names[i],
+                (unsigned long long) stats.counters[i]);
+    }
+    fprintf(out, "\n  },\n  \"ops\": {");
+    for (i = 0; i < STATS_NUM_OPS; i++) {
+        fprintf(out,
+                "%s\n    \"%s\": {\"calls\": %llu, \"total_ns\": %llu, "
+                "\"max_ns\": %llu}", i ? "," : "", op_names[i],
+                (unsigned long long) stats.ops[i].calls,
+                (unsigned long long) stats.ops[i].total_ns,
+                (unsigned long long) stats.ops[i].max_ns);
+    }
+    fprintf(out, "\n  },\n  \"dropped_events\": %llu\n}\n",
+            (unsigned long long) stats.dropped_events);
+    return ferror(out) ? -1 : 0;
+}
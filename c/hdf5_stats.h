@@ -0,0 +1,174 @@
+#ifndef _HDF5_STATS_H_
+#define _HDF5_STATS_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/*
+ * Counters and timers of the library. They're compiled in with -DHDF5_STATS,
+ * otherwise the STATS_* macros expand to nothing and the functions below
+ * report zeros.
+ */
+
+// counters
+#define STAT_BYTES_READ         0  // bytes of data read from datasets
+#define STAT_BYTES_WRITTEN      1  // bytes of data written to datasets
+#define STAT_HDF5_CALLS         2  // opens, creates, reads and writes
+#define STAT_ENTRIES_EVALUATED  3  // groups and datasets opened
+#define STAT_ALLOCS             4  // buffers allocated for data
+#define STAT_ALLOC_BYTES        5  // bytes of those buffers
+#define STAT_NUM_COUNTERS       6
+
+#define STATS_EVENT_BLOCK       4096       // trace events allocated at a time
+#define STATS_MAX_EVENTS        (1 << 20)  // trace events kept per thread
+
+/*
+ * The timed operations, one per public function. X(id, name) is expanded for
+ * each one.
+ */
+#define STATS_OPS(X)                                       \
+    X(NEW_HDF5_STRUCT,         "new_hdf5_struct")          \
+    X(FREE_HDF5_STRUCT,        "free_hdf5_struct")         \
+    X(GET_SUBENTRY,            "get_subentry")             \
+    X(READ_DATASET,            "read_dataset")             \
+    X(WRITE_INT_ARRAY,         "write_int_array")          \
+    X(WRITE_INT_MATRIX,        "write_int_matrix")         \
+    X(WRITE_DOUBLE_ARRAY,      "write_double_array")       \
+    X(WRITE_DOUBLE_MATRIX,     "write_double_matrix")      \
+    X(WRITE_STRING,            "write_string")             \
+    X(CREATE_DATASET,          "create_dataset")           \
+    X(READ_ROWS,               "read_rows")                \
+    X(WRITE_DOUBLE_ROWS,       "write_double_rows")        \
+    X(WRITE_COMPRESSED_MATRIX, "write_compressed_matrix")  \
+    X(EEG_ENCODE,              "eeg_encode")               \
+    X(EEG_DECODE,              "eeg_decode")               \
+    X(WRITE_OVERVIEW,          "write_overview")           \
+    X(READ_OVERVIEW,           "read_overview")            \
+    X(FILTER_DATASET,          "filter_dataset")           \
+    X(REREFERENCE_DATASET,     "rereference_dataset")      \
+    X(EXPORT_STREAM,           "export_stream")            \
+    X(COMPUTE_HASHES,          "compute_hashes")           \
+    X(WRITE_HASHES,            "write_hashes")             \
+    X(UPDATE_REGION,           "update_region")            \
+    X(DIFF_DATASETS,           "diff_datasets")            \
+    X(COMMIT_BATCH,            "commit_batch")
+
+#define STATS_OP_ID(id, name) OP_##id,
+enum stats_op { STATS_OPS(STATS_OP_ID) STATS_NUM_OPS };
+#undef STATS_OP_ID
+
+/*
+ * Totals of the counters and timers of all the threads
+ */
+struct hdf5_stats {
+    uint64_t counters[STAT_NUM_COUNTERS];
+    struct {
+        uint64_t calls;     // number of calls
+        uint64_t total_ns;  // wall time of all the calls
+        uint64_t max_ns;    // wall time of the slowest call
+    } ops[STATS_NUM_OPS];
+    uint64_t dropped_events; // trace events over STATS_MAX_EVENTS
+};
+
+#ifdef HDF5_STATS
+
+/*
+ * A block of trace events of a thread. Blocks are never moved, so the trace
+ * can be written while the thread adds events.
+ */
+struct stats_event_block {
+    struct {
+        uint32_t op;        // the stats_op
+        uint64_t start_ns;  // monotonic clock
+        uint64_t dur_ns;
+    } events[STATS_EVENT_BLOCK];
+    uint32_t count;         // events filled in, published with release
+    struct stats_event_block *next;
+};
+
+/*
+ * The counters of a thread. Only the thread updates them, other threads read
+ * them for snapshots, so they're accessed with relaxed atomics.
+ */
+struct stats_local {
+    uint64_t counters[STAT_NUM_COUNTERS];
+    uint64_t calls[STATS_NUM_OPS];
+    uint64_t total_ns[STATS_NUM_OPS];
+    uint64_t max_ns[STATS_NUM_OPS];
+    uint64_t num_events;
+    uint64_t dropped_events;
+    uint32_t tid;                    // 1 for the first thread, 2, ...
+    struct stats_event_block *first; // trace events, oldest first
+    struct stats_event_block *last;
+    struct stats_local       *next;  // next thread in the registry
+};
+
+/* a running timer, stopped when it goes out of scope */
+struct stats_timer {
+    int      op;
+    uint64_t start_ns;
+};
+
+extern __thread struct stats_local *stats_thread;
+struct stats_local *stats_attach(void);
+struct stats_timer stats_start(int op);
+void stats_stop(struct stats_timer *timer);
+
+#define STATS_LOCAL()  ((stats_thread != NULL ? stats_thread : stats_attach()))
+
+/*
+ * Adds n to a counter of the calling thread
+ */
+static inline void stats_count(int counter, uint64_t n) {
+    struct stats_local *local = STATS_LOCAL();
+    __atomic_store_n(&local->counters[counter], local->counters[counter] + n,
+                     __ATOMIC_RELAXED);
+}
+
+#define STATS_COUNT(counter, n) stats_count(STAT_##counter, (uint64_t) (n))
+#define STATS_ALLOC(bytes)                         \
+    do {                                           \
+        stats_count(STAT_ALLOCS, 1);               \
+        stats_count(STAT_ALLOC_BYTES, (bytes));    \
+    } while (0)
+// times the rest of the enclosing block, declare it after the other variables
+#define STATS_TIMER(op)                                     \
+    struct stats_timer stats_timer_                         \
+        __attribute__((cleanup(stats_stop))) = stats_start(OP_##op)
+
+#else
+
+#define STATS_COUNT(counter, n) ((void) 0)
+#define STATS_ALLOC(bytes)      ((void) 0)
+#define STATS_TIMER(op)         ((void) 0)
+
+#endif
+
+/*
+ * Adds up the counters and timers of all the threads
+ */
+void stats_snapshot(struct hdf5_stats *stats);
+
+/*
+ * Zeroes the counters and timers and drops the trace events. No other thread
+ * may be calling into the library.
+ */
+void stats_reset(void);
+
+/*
+ * Starts or stops recording trace events for stats_write_trace
+ */
+void stats_trace(bool on);
+
+/*
+ * Writes a snapshot as JSON
+ */
+int stats_write_json(FILE *out);
+
+/*
+ * Writes the trace events in the Chrome trace event format
+ */
+int stats_write_trace(const char *path);
+
+#endif
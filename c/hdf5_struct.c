@@ -6,26 +6,85 @@
  * Just like the other versions, this was written with laziness in mind. It does
  * add some complications to the implementation but after testing with valgrind
  * and massif, it keeps memory usage reasonably low.
+ *
+ * Laziness means lookups modify the tree, so every public function that calls
+ * into HDF5 or fills in an entry holds the HDF5 lock while it does. Entries and
+ * data that are already filled in are read without it.
  */
 
+#define _XOPEN_SOURCE 700   // PTHREAD_MUTEX_RECURSIVE
+
+#include <pthread.h>
 #include <stdlib.h>
 #include <string.h>
 #include "hdf5.h"
 #include "hdf5_hl.h"
+#include "hdf5_eeg_filter.h"
+#include "hdf5_stats.h"
 #include "hdf5_struct.h"
 
+#define STRING_BLOCK_BYTES (1 << 20) // block HDF5 allocates vlen strings from
+
+/*
+ * A block variable-length strings are allocated from while they're read, so
+ * HDF5 doesn't call malloc for every string. The blocks are freed together once
+ * the strings are copied into the arena of the dataset.
+ */
+struct string_block {
+    struct string_block *next;  // the block filled in before this one
+    size_t used;                // bytes handed out
+    size_t capacity;            // bytes in data
+    char   data[];
+};
+
 /* helper functions */
 static void fill_entry_data(const hid_t, hdf5_entry_t);
 static void set_dataset(hdf5_entry_t entry);
 static void set_group(hdf5_entry_t entry);
 static void hdf5_struct_get_entries(hdf5_struct_t);
-static void read_dataset(hid_t root, hdf5_entry_t entry);
+static void open_dataset(hid_t root, hdf5_entry_t entry);
+static void read_dataset(hdf5_entry_t entry);
+static void load_dataset(hdf5_entry_t entry);
+static int read_strings(hdf5_entry_t entry, char **arena);
+static int read_fixed_strings(hdf5_entry_t entry, hid_t type, hsize_t n,
+                              char **arena);
+static int read_variable_strings(hdf5_entry_t entry, hid_t type, hsize_t n,
+                                 char **arena);
+static void *string_block_alloc(size_t size, void *info);
+static void string_block_free(void *mem, void *info);
+static void init_hdf5_lock(void);
+static hid_t select_rows(const hdf5_entry_t entry, hsize_t start,
+                         hsize_t count);
 static void print_data(hdf5_entry_t entry);
 static void print_data_type(hdf5_entry_t entry);
 static void free_dataset(hdf5_entry_t entry);
 static void free_group(hdf5_entry_t entry);
 static void free_entry(hdf5_entry_t entry);
+static void free_retired(hdf5_entry_t entry);
+static int reserve_retired(hdf5_entry_t entry);
+static void replace_entries(hdf5_entry_t entry, hdf5_entry_t *entries,
+                            hsize_t capacity);
 static hdf5_entry_t get_entry_info(const hid_t, int);
+static hdf5_struct_t open_hdf5_struct(const char *path, unsigned flags);
+
+static pthread_mutex_t hdf5_lock;
+static pthread_once_t  hdf5_lock_once = PTHREAD_ONCE_INIT;
+
+/*
+ * Takes the lock that every call into HDF5 is made under. The lock is
+ * recursive, so a function holding it can call others that take it.
+ */
+void lock_hdf5(void) {
+    pthread_once(&hdf5_lock_once, init_hdf5_lock);
+    pthread_mutex_lock(&hdf5_lock);
+}
+
+/*
+ * Releases the lock taken by lock_hdf5
+ */
+void unlock_hdf5(void) {
+    pthread_mutex_unlock(&hdf5_lock);
+}
 
 /*
  * Creates a new hdf5_struct_t from a file.
@@ -39,40 +98,73 @@ static hdf5_entry_t get_entry_info(const hid_t, int);
  *     - fill_entry_data: dispatch function based on the type of entry
  *       - set_group: allocates the array for the entries in this group
  *         - get_entry_info: same as above
- *       - read_dataset: reads in the dataset based on data type
+ *       - open_dataset: opens the dataset and gets its type and dimensions
  *
  * new_hdf5_struct only gets the information for entries located at the root of
- * the HDF5 file.
+ * the HDF5 file. The data of a dataset isn't read until it's asked for, see
+ * read_dataset.
  */
 hdf5_struct_t new_hdf5_struct(const char *path) {
+    return open_hdf5_struct(path, H5F_ACC_RDWR);
+}
+
+/*
+ * Creates a new hdf5_struct_t from a file opened read-only, for reading files
+ * that aren't writable or that other programs are reading. Creating or deleting
+ * datasets in it fails.
+ * \param path: the path to the HDF5 file.
+ * \return a pointer to a hdf5_struct_t object.
+ */
+hdf5_struct_t new_hdf5_struct_readonly(const char *path) {
+    return open_hdf5_struct(path, H5F_ACC_RDONLY);
+}
+
+/*
+ * Opens a file and evaluates its root, see new_hdf5_struct
+ * \param path the path to the HDF5 file
+ * \param flags H5F_ACC_RDWR or H5F_ACC_RDONLY
+ * \return a pointer to a hdf5_struct_t object or NULL on failure
+ */
+static hdf5_struct_t open_hdf5_struct(const char *path, unsigned flags) {
     hdf5_struct_t hdf5;
+    STATS_TIMER(NEW_HDF5_STRUCT);
     if ((hdf5 = (hdf5_struct_t) malloc(sizeof(struct hdf5_struct))) == NULL) {
         perror("malloc failed in new_hdf5_struct():hdf5");
         return NULL;
     }
 
-    if ((hdf5->in_file = H5Fopen(path, H5F_ACC_RDWR, H5P_DEFAULT)) < 0) {
+    lock_hdf5();
+    // so datasets written with the EEG filter, by any program, can be read
+    register_eeg_filter();
+    STATS_COUNT(HDF5_CALLS, 2);
+    if ((hdf5->in_file = H5Fopen(path, flags, H5P_DEFAULT)) < 0) {
         perror("failed to open file");
+        unlock_hdf5();
         free(hdf5);
         return NULL;
     }
 
     if ((hdf5->root = (hdf5_entry_t)
-                      malloc(sizeof(struct hdf5_entry))) == NULL) {
+                      calloc(1, sizeof(struct hdf5_entry))) == NULL) {
         perror("malloc failed in new_hdf5_struct():root");
+        unlock_hdf5();
         free(hdf5);
         return NULL;
     }
 
     strcpy(hdf5->root->name, "/");
+    hdf5->root->type      = H5G_GROUP;
+    hdf5->root->evaluated = true;
     if ((hdf5->root->id = H5Gopen(hdf5->in_file, "/", H5P_DEFAULT)) < 0) {
         perror("failed to open root");
+        unlock_hdf5();
         free(hdf5);
         return NULL;
     }
 
     // evaluate the first layer
     hdf5_struct_get_entries(hdf5);
+    unlock_hdf5();
 
     return hdf5;
 }
@@ -91,6 +183,8 @@ hdf5_struct_t new_hdf5_struct(const char *path) {
  */
 void free_hdf5_struct(const hdf5_struct_t hdf5) {
     int i;
+    STATS_TIMER(FREE_HDF5_STRUCT);
+    lock_hdf5();
     for (i = 0; i < hdf5->root->num_entries; i++) {
         free_entry(hdf5->root->entries[i]);
         free(hdf5->root->entries[i]);
@@ -102,8 +196,10 @@ void free_hdf5_struct(const hdf5_struct_t hdf5) {
     if ((H5Fclose(hdf5->in_file)) < 0) {
         perror("failed to close file");
     }
+    unlock_hdf5();
 
     free(hdf5->root->entries);
+    free_retired(hdf5->root);
     free(hdf5->root);
     free(hdf5);
 }
@@ -141,6 +237,32 @@ hdf5_entry_t get_entry(const hdf5_struct_t hdf5, const char *path) {
     return entry;
 }
 
+/*
+ * Returns the entry at a path from the root of the file, looking up each name
+ * with get_subentry. Empty names, as in "/EEG//data", are skipped.
+ * \param hdf5 the hdf5_struct_t object to get the entry from
+ * \param path the names of the groups and the entry, separated by '/'
+ * \return an hdf5_entry_t object or NULL if no object found
+ */
+hdf5_entry_t find_entry(const hdf5_struct_t hdf5, const char *path) {
+    size_t       len;
+    char         name[MAX_LEN];
+    hdf5_entry_t entry = hdf5->root;
+
+    while (entry != NULL && *path != '\0') {
+        if ((len = strcspn(path, "/")) >= MAX_LEN) {
+            return NULL;
+        }
+        if (len > 0) {
+            memcpy(name, path, len);
+            name[len] = '\0';
+            entry     = get_subentry(entry, name);
+        }
+        path += len + (path[len] == '/');
+    }
+    return entry == hdf5->root ? NULL : entry;
+}
+
 /*
  * Returns a group from a hdf5_entry_t or NULL if the path doesn't point to a
  * group.
@@ -186,23 +308,31 @@ hdf5_entry_t get_dataset(const hdf5_entry_t entry, const char *path) {
  * \return an hdf5_entry_t object or NULL if no object found
  */
 hdf5_entry_t get_subentry(const hdf5_entry_t entry, const char *path) {
+    STATS_TIMER(GET_SUBENTRY);
     if (!IS_GROUP(entry)) {
         return NULL;
     }
-    int i;
+    hsize_t i;
     hdf5_entry_t sub_entry;
-    for (i = 0; i < entry->num_entries; i++) {
-        if (strcmp(entry->entries[i]->name, path) == 0) {
-            if ((sub_entry = entry->entries[i]) == NULL) {
-                return NULL;
-            }
-            if (!sub_entry->evaluated) {
-                fill_entry_data(entry->id, sub_entry);
+    // the count first: the entries it counts are published before it
+    hsize_t num_entries = LOAD_ACQUIRE(&entry->num_entries);
+    hdf5_entry_t *entries = LOAD_ACQUIRE(&entry->entries);
+    for (i = 0; i < num_entries; i++) {
+        sub_entry = LOAD_ACQUIRE(&entries[i]);
+        if (sub_entry != NULL && strcmp(sub_entry->name, path) == 0) {
+            // the first thread to get here evaluates it, the rest wait
+            if (!IS_EVALUATED(sub_entry)) {
+                lock_hdf5();
+                if (!sub_entry->evaluated) {
+                    fill_entry_data(entry->id, sub_entry);
+                }
+                unlock_hdf5();
             }
+            return sub_entry;
         }
     }
 
-    return sub_entry;
+    return NULL;
 }
 
 /*
@@ -212,9 +342,10 @@ hdf5_entry_t get_subentry(const hdf5_entry_t entry, const char *path) {
  */
 int **get_int_data(const hdf5_entry_t entry) {
     if (IS_GROUP(entry) || (entry->class != H5T_INTEGER)) {
-        printf("%s does not contain integer data\n", entry->name);
+        fprintf(stderr, "%s does not contain integer data\n", entry->name);
         return NULL;
     }
+    load_dataset(entry);
     return INT_DATA(entry);
 }
 
@@ -225,9 +356,10 @@ int **get_int_data(const hdf5_entry_t entry) {
  */
 double **get_double_data(const hdf5_entry_t entry) {
     if (IS_GROUP(entry) || (entry->class != H5T_FLOAT)) {
-        printf("%s does not contain float data\n", entry->name);
+        fprintf(stderr, "%s does not contain float data\n", entry->name);
         return NULL;
     }
+    load_dataset(entry);
     return FLOAT_DATA(entry);
 }
 
@@ -238,12 +370,38 @@ double **get_double_data(const hdf5_entry_t entry) {
  */
 char *get_string_data(const hdf5_entry_t entry) {
     if (IS_GROUP(entry) || (entry->class != H5T_STRING)) {
-        printf("%s does not contain string data\n", entry->name);
+        fprintf(stderr, "%s does not contain string data\n", entry->name);
         return NULL;
     }
+    load_dataset(entry);
     return STR_DATA(entry);
 }
 
+/*
+ * Returns one string of a string dataset. The strings of a dataset are read in
+ * one go into a single buffer, so this is a lookup in the offsets of the
+ * strings and doesn't allocate.
+ * \param entry the hdf5_entry_t object to access
+ * \param index the index of the string, with the elements in row-major order
+ * \return the string or NULL
+ */
+char *get_string_at(const hdf5_entry_t entry, hsize_t index) {
+    if (IS_GROUP(entry) || (entry->class != H5T_STRING)) {
+        fprintf(stderr, "%s does not contain string data\n", entry->name);
+        return NULL;
+    }
+    if (index >= X_DIM(entry) * Y_DIM(entry)) {
+        fprintf(stderr, "%s has no string %llu\n", entry->name,
+                (unsigned long long) index);
+        return NULL;
+    }
+    load_dataset(entry);
+    if (!IS_LOADED(entry)) {
+        return NULL;
+    }
+    return STR_DATA(entry) + entry->str_offsets[index];
+}
+
 /*
  * Returns the compound data associated with a hdf5_entry_t object.
  * \param entry the hdf5_entry_t object to access
@@ -251,9 +409,10 @@ char *get_string_data(const hdf5_entry_t entry) {
  */
 void *get_cmpd_data(const hdf5_entry_t entry) {
     if (IS_GROUP(entry) || (entry->class != H5T_COMPOUND)) {
-        printf("%s does not contain compound data\n", entry->name);
+        fprintf(stderr, "%s does not contain compound data\n", entry->name);
         return NULL;
     }
+    load_dataset(entry);
     return GEN_DATA(entry);
 }
 
@@ -268,12 +427,17 @@ void write_int_array(hdf5_entry_t   entry,
                      const char    *name,
                      const hsize_t *dims,
                      int           *buf) {
+    STATS_TIMER(WRITE_INT_ARRAY);
     if (!IS_GROUP(entry)) {
         return;
     }
+    STATS_COUNT(HDF5_CALLS, 1);
+    STATS_COUNT(BYTES_WRITTEN, sizeof(int) * dims[0]);
+    lock_hdf5();
     if ((H5LTmake_dataset_int(entry->id, name, 1, (hsize_t *) dims, buf)) < 0) {
-        printf("failed to write dataset\n");
+        fprintf(stderr, "failed to write dataset\n");
     }
+    unlock_hdf5();
 }
 
 /*
@@ -287,12 +451,17 @@ void write_int_matrix(hdf5_entry_t   entry,
                       const char    *name,
                       const hsize_t *dims,
                       int           *buf) {
+    STATS_TIMER(WRITE_INT_MATRIX);
     if (!IS_GROUP(entry)) {
         return;
     }
+    STATS_COUNT(HDF5_CALLS, 1);
+    STATS_COUNT(BYTES_WRITTEN, sizeof(int) * dims[0] * dims[1]);
+    lock_hdf5();
     if ((H5LTmake_dataset_int(entry->id, name, 2, dims, buf)) < 0) {
-        printf("failed to write dataset\n");
+        fprintf(stderr, "failed to write dataset\n");
     }
+    unlock_hdf5();
 }
 
 /*
@@ -306,13 +475,18 @@ void write_double_array(hdf5_entry_t   entry,
                         const char    *name,
                         const hsize_t *dims,
                         double        *buf) {
+    STATS_TIMER(WRITE_DOUBLE_ARRAY);
     if (!IS_GROUP(entry)) {
         return;
     }
+    STATS_COUNT(HDF5_CALLS, 1);
+    STATS_COUNT(BYTES_WRITTEN, sizeof(double) * dims[0]);
+    lock_hdf5();
     if ((H5LTmake_dataset_double(entry->id, name, 1,
                                  (hsize_t *) dims, buf)) < 0) {
-        printf("failed to write dataset\n");
+        fprintf(stderr, "failed to write dataset\n");
     }
+    unlock_hdf5();
 }
 
 /*
@@ -326,12 +500,17 @@ void write_double_matrix(hdf5_entry_t   entry,
                          const char    *name,
                          const hsize_t *dims,
                          double        *buf) {
+    STATS_TIMER(WRITE_DOUBLE_MATRIX);
     if (!IS_GROUP(entry)) {
         return;
     }
+    STATS_COUNT(HDF5_CALLS, 1);
+    STATS_COUNT(BYTES_WRITTEN, sizeof(double) * dims[0] * dims[1]);
+    lock_hdf5();
     if ((H5LTmake_dataset_double(entry->id, name, 2, dims, buf)) < 0) {
-        printf("failed to write dataset\n");
+        fprintf(stderr, "failed to write dataset\n");
     }
+    unlock_hdf5();
 }
 
 /*
@@ -341,12 +520,322 @@ void write_double_matrix(hdf5_entry_t   entry,
  * \param buf the data to write
  */
 void write_string(hdf5_entry_t entry, const char *name, const char *buf) {
+    STATS_TIMER(WRITE_STRING);
     if (!IS_GROUP(entry)) {
         return;
     }
+    STATS_COUNT(HDF5_CALLS, 1);
+    STATS_COUNT(BYTES_WRITTEN, strlen(buf));
+    lock_hdf5();
     if ((H5LTmake_dataset_string(entry->id, name, buf)) < 0) {
-        printf("failed to write dataset\n");
+        fprintf(stderr, "failed to write dataset\n");
     }
+    unlock_hdf5();
+}
+
+/*
+ * Creates an empty dataset in a group. The dataset is added to the group's
+ * entries so it's freed along with the rest of the hdf5_struct_t. Other
+ * threads may keep looking up entries in the group meanwhile: the entry is
+ * filled in before it's published, and a full array of entries is replaced by
+ * a larger copy, keeping the old one until the group is freed.
+ * \param entry the group to create the dataset in
+ * \param name the name of the new dataset
+ * \param type the type of the elements in the file
+ * \param rank the number of dimensions
+ * \param dims the dimensions of the new dataset
+ * \param plist the dataset creation property list (layout, filters, ...)
+ * \return the hdf5_entry_t of the new dataset or NULL if it can't be created
+ */
+hdf5_entry_t create_dataset(hdf5_entry_t   entry,
+                            const char    *name,
+                            hid_t          type,
+                            int            rank,
+                            const hsize_t *dims,
+                            hid_t          plist) {
+    int i;
+    hid_t space;
+    hsize_t capacity;
+    hdf5_entry_t *entries;
+    hdf5_entry_t new_entry;
+    STATS_TIMER(CREATE_DATASET);
+
+    if (!IS_GROUP(entry)) {
+        return NULL;
+    }
+    if ((new_entry = (hdf5_entry_t)
+                     calloc(1, sizeof(struct hdf5_entry))) == NULL) {
+        perror("malloc failed in create_dataset():new_entry");
+        return NULL;
+    }
+
+    lock_hdf5();
+    if (entry->num_entries == entry->capacity) {
+        capacity = entry->capacity ? 2 * entry->capacity : 4;
+        if ((entries = (hdf5_entry_t *)
+                       malloc(sizeof(hdf5_entry_t) * capacity)) == NULL ||
+            reserve_retired(entry) < 0) {
+            perror("malloc failed in create_dataset():entries");
+            unlock_hdf5();
+            free(entries);
+            free(new_entry);
+            return NULL;
+        }
+        memcpy(entries, entry->entries,
+               sizeof(hdf5_entry_t) * entry->num_entries);
+        replace_entries(entry, entries, capacity);
+    }
+
+    STATS_COUNT(HDF5_CALLS, 1);
+    space = H5Screate_simple(rank, dims, NULL);
+    new_entry->id = H5Dcreate(entry->id, name, type, space, H5P_DEFAULT,
+                              plist, H5P_DEFAULT);
+    H5Sclose(space);
+    if (new_entry->id < 0) {
+        fprintf(stderr, "failed to create dataset %s\n", name);
+        unlock_hdf5();
+        free(new_entry);
+        return NULL;
+    }
+
+    strncpy(new_entry->name, name, MAX_LEN - 1);
+    new_entry->type      = H5G_DATASET;
+    new_entry->evaluated = true;
+    new_entry->parent    = entry;
+    new_entry->class     = H5Tget_class(type);
+    new_entry->rank      = rank;
+    new_entry->size      = H5Tget_size(type);
+    X_DIM(new_entry)     = rank > 0 ? dims[0] : 1;
+    Y_DIM(new_entry)     = 1;
+    for (i = 1; i < rank; i++) {
+        Y_DIM(new_entry) *= dims[i];
+    }
+    set_dataset(new_entry);
+
+    STORE_RELEASE(&entry->entries[entry->num_entries], new_entry);
+    STORE_RELEASE(&entry->num_entries, entry->num_entries + 1);
+    unlock_hdf5();
+    return new_entry;
+}
+
+/*
+ * Creates an empty double dataset in a group, see create_dataset.
+ * \param entry the group to create the dataset in
+ * \param name the name of the new dataset
+ * \param dims the dimensions of the new dataset (rows x columns)
+ * \param chunk the chunk dimensions or NULL for a contiguous dataset
+ * \return the hdf5_entry_t of the new dataset or NULL if it can't be created
+ */
+hdf5_entry_t create_double_matrix(hdf5_entry_t   entry,
+                                  const char    *name,
+                                  const hsize_t *dims,
+                                  const hsize_t *chunk) {
+    hid_t plist;
+    hdf5_entry_t new_entry;
+
+    lock_hdf5();
+    plist = H5Pcreate(H5P_DATASET_CREATE);
+    if (chunk != NULL) {
+        H5Pset_chunk(plist, 2, chunk);
+    }
+    new_entry = create_dataset(entry, name, H5T_NATIVE_DOUBLE, 2, dims, plist);
+    H5Pclose(plist);
+    unlock_hdf5();
+
+    return new_entry;
+}
+
+/*
+ * Deletes a dataset from the file and from the entries of its group, and
+ * closes it and frees its data. The space it took in the file is only
+ * reclaimed by repacking the file. Lookups in the group may carry on
+ * meanwhile, so the entry itself is kept until the hdf5_struct_t is freed, but
+ * it mustn't be used by any thread afterwards.
+ * \param entry the dataset to delete
+ * \return 0 on success or -1 on failure
+ */
+int delete_dataset(hdf5_entry_t entry) {
+    hsize_t       i;
+    hdf5_entry_t  parent;
+    hdf5_entry_t *entries;
+    hdf5_entry_t *deleted;
+
+    if (IS_GROUP(entry) || (parent = entry->parent) == NULL) {
+        return -1;
+    }
+
+    lock_hdf5();
+    for (i = 0; i < parent->num_entries && parent->entries[i] != entry; i++) {
+    }
+    // lookups may be reading the entries: they get a copy without this one,
+    // NULL past the end, as a lookup that counted the entries before earlier
+    // deletions reads that far
+    if ((entries = (hdf5_entry_t *)
+                   calloc(parent->capacity, sizeof(hdf5_entry_t))) == NULL ||
+        reserve_retired(parent) < 0) {
+        perror("malloc failed in delete_dataset():entries");
+        free(entries);
+        unlock_hdf5();
+        return -1;
+    }
+    // and may still be reading the entry, which is kept too
+    if ((deleted = (hdf5_entry_t *)
+                   realloc(parent->deleted, sizeof(hdf5_entry_t) *
+                                            (parent->num_deleted + 1))) ==
+        NULL) {
+        perror("malloc failed in delete_dataset():deleted");
+        free(entries);
+        unlock_hdf5();
+        return -1;
+    }
+    parent->deleted = deleted;
+    STATS_COUNT(HDF5_CALLS, 1);
+    if (i == parent->num_entries ||
+        H5Ldelete(parent->id, entry->name, H5P_DEFAULT) < 0) {
+        fprintf(stderr, "failed to delete dataset %s\n", entry->name);
+        unlock_hdf5();
+        free(entries);
+        return -1;
+    }
+    memcpy(entries, parent->entries, sizeof(hdf5_entry_t) * i);
+    memcpy(entries + i, parent->entries + i + 1,
+           sizeof(hdf5_entry_t) * (parent->num_entries - i - 1));
+    replace_entries(parent, entries, parent->capacity);
+    STORE_RELEASE(&parent->num_entries, parent->num_entries - 1);
+    free_entry(entry);
+    parent->deleted[parent->num_deleted++] = entry;
+    unlock_hdf5();
+    return 0;
+}
+
+/*
+ * Returns how many rows of a dataset to read or write at a time when streaming
+ * it. This is the number of rows that fit in BLOCK_BYTES of doubles, rounded
+ * down to whole chunks when the dataset is chunked so a block never reads a
+ * chunk twice.
+ * \param entry the dataset to stream
+ * \return the number of rows per block, at least 1
+ */
+hsize_t block_rows(const hdf5_entry_t entry) {
+    hid_t   plist;
+    hsize_t chunk[H5S_MAX_RANK];
+    hsize_t rows;
+    hsize_t chunk_rows = 0;
+
+    rows = BLOCK_BYTES / (sizeof(double) * (Y_DIM(entry) ? Y_DIM(entry) : 1));
+
+    lock_hdf5();
+    if ((plist = H5Dget_create_plist(entry->id)) >= 0) {
+        if (H5Pget_layout(plist) == H5D_CHUNKED &&
+            H5Pget_chunk(plist, H5S_MAX_RANK, chunk) > 0) {
+            chunk_rows = chunk[0];
+        }
+        H5Pclose(plist);
+    }
+    unlock_hdf5();
+    if (chunk_rows > 0) {
+        rows = rows < chunk_rows ? chunk_rows : rows - rows % chunk_rows;
+    }
+    if (rows > X_DIM(entry)) {
+        rows = X_DIM(entry);
+    }
+    return rows > 0 ? rows : 1;
+}
+
+/*
+ * Reads `count` rows starting at row `start` from a dataset. Integer and single
+ * precision data is converted to double by HDF5 while reading.
+ * \param entry the dataset to read from
+ * \param start the first row to read
+ * \param count the number of rows to read
+ * \param buf a buffer of at least count * Y_DIM(entry) doubles
+ * \return 0 on success or -1 on failure
+ */
+int read_double_rows(const hdf5_entry_t entry,
+                     hsize_t            start,
+                     hsize_t            count,
+                     double            *buf) {
+    return read_rows(entry, start, count, H5T_NATIVE_DOUBLE, buf);
+}
+
+/*
+ * Reads `count` rows starting at row `start` from a dataset, converting the
+ * elements to `mem_type`.
+ * \param entry the dataset to read from
+ * \param start the first row to read
+ * \param count the number of rows to read
+ * \param mem_type the type of the elements in buf
+ * \param buf a buffer of at least count * Y_DIM(entry) elements
+ * \return 0 on success or -1 on failure
+ */
+int read_rows(const hdf5_entry_t entry,
+              hsize_t            start,
+              hsize_t            count,
+              hid_t              mem_type,
+              void              *buf) {
+    hid_t   mem_space;
+    hid_t   file_space;
+    hsize_t mem_dims[1] = {count * Y_DIM(entry)};
+    herr_t  status;
+    STATS_TIMER(READ_ROWS);
+
+    lock_hdf5();
+    if ((file_space = select_rows(entry, start, count)) < 0) {
+        unlock_hdf5();
+        return -1;
+    }
+    STATS_COUNT(HDF5_CALLS, 1);
+    STATS_COUNT(BYTES_READ, mem_dims[0] * H5Tget_size(mem_type));
+    mem_space = H5Screate_simple(1, mem_dims, NULL);
+    status = H5Dread(entry->id, mem_type, mem_space, file_space, H5P_DEFAULT,
+                     buf);
+    H5Sclose(mem_space);
+    H5Sclose(file_space);
+    unlock_hdf5();
+    if (status < 0) {
+        fprintf(stderr, "failed to read rows from %s\n", entry->name);
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Writes `count` rows starting at row `start` to a dataset. The doubles are
+ * converted to the dataset's type by HDF5 while writing.
+ * \param entry the dataset to write to
+ * \param start the first row to write
+ * \param count the number of rows to write
+ * \param buf a buffer of count * Y_DIM(entry) doubles
+ * \return 0 on success or -1 on failure
+ */
+int write_double_rows(hdf5_entry_t  entry,
+                      hsize_t       start,
+                      hsize_t       count,
+                      const double *buf) {
+    hid_t   mem_space;
+    hid_t   file_space;
+    hsize_t mem_dims[1] = {count * Y_DIM(entry)};
+    herr_t  status;
+    STATS_TIMER(WRITE_DOUBLE_ROWS);
+
+    lock_hdf5();
+    if ((file_space = select_rows(entry, start, count)) < 0) {
+        unlock_hdf5();
+        return -1;
+    }
+    STATS_COUNT(HDF5_CALLS, 1);
+    STATS_COUNT(BYTES_WRITTEN, sizeof(double) * mem_dims[0]);
+    mem_space = H5Screate_simple(1, mem_dims, NULL);
+    status = H5Dwrite(entry->id, H5T_NATIVE_DOUBLE, mem_space, file_space,
+                      H5P_DEFAULT, buf);
+    H5Sclose(mem_space);
+    H5Sclose(file_space);
+    unlock_hdf5();
+    if (status < 0) {
+        fprintf(stderr, "failed to write rows to %s\n", entry->name);
+        return -1;
+    }
+    return 0;
 }
 
 /*
@@ -441,6 +930,59 @@ static void free_group(const hdf5_entry_t entry) {
         perror("failed to close group");
     }
     free(entry->entries);
+    free_retired(entry);
+}
+
+/*
+ * Makes room to retire the array of entries of a group, so replace_entries
+ * can't fail once a change is under way
+ * \param entry the group
+ * \return 0 on success or -1 on failure
+ */
+static int reserve_retired(const hdf5_entry_t entry) {
+    hdf5_entry_t **retired;
+
+    if ((retired = (hdf5_entry_t **)
+                   realloc(entry->retired, sizeof(hdf5_entry_t *) *
+                                           (entry->num_retired + 1))) == NULL) {
+        return -1;
+    }
+    entry->retired = retired;
+    return 0;
+}
+
+/*
+ * Publishes a new array of entries for a group, with room reserved by
+ * reserve_retired. The old array is kept until the group is freed, as lookups
+ * may still be reading it. The caller publishes the new count afterwards.
+ * \param entry the group
+ * \param entries the new array, holding at least the entries counted now
+ * \param capacity the size of the new array
+ */
+static void replace_entries(const hdf5_entry_t entry, hdf5_entry_t *entries,
+                            hsize_t capacity) {
+    if (entry->entries != NULL) {
+        entry->retired[entry->num_retired++] = entry->entries;
+    }
+    STORE_RELEASE(&entry->entries, entries);
+    entry->capacity = capacity;
+}
+
+/*
+ * Frees the arrays of entries a group has replaced and the entries of the
+ * datasets deleted from it, which delete_dataset already closed
+ * \param entry the group
+ */
+static void free_retired(const hdf5_entry_t entry) {
+    hsize_t i;
+    for (i = 0; i < entry->num_retired; i++) {
+        free(entry->retired[i]);
+    }
+    free(entry->retired);
+    for (i = 0; i < entry->num_deleted; i++) {
+        free(entry->deleted[i]);
+    }
+    free(entry->deleted);
 }
 
 /*
@@ -452,6 +994,9 @@ static void free_dataset(const hdf5_entry_t entry) {
     if ((H5Dclose(entry->id)) < 0) {
         perror("failed to close dataset");
     }
+    if (!IS_LOADED(entry)) {
+        return;
+    }
     switch (entry->class) {
         case H5T_INTEGER:
             free(INT_DATA(entry)[0]);
@@ -463,6 +1008,7 @@ static void free_dataset(const hdf5_entry_t entry) {
             break;
         case H5T_STRING:
             free(STR_DATA(entry));
+            free(entry->str_offsets);
             break;
         case H5T_COMPOUND:
             free(GEN_DATA(entry));
@@ -480,12 +1026,14 @@ static void free_dataset(const hdf5_entry_t entry) {
 static void hdf5_struct_get_entries(const hdf5_struct_t hdf5) {
     // get the entries from root
     H5G_info_t g_info;
+    STATS_COUNT(HDF5_CALLS, 1);
     if ((H5Gget_info(hdf5->root->id, &g_info) < 0)) {
         perror("H5Gget_info failed");
         return;
     }
 
     hdf5->root->num_entries = g_info.nlinks;
+    hdf5->root->capacity    = g_info.nlinks;
     hdf5->root->entries     = (hdf5_entry_t *) malloc(sizeof(hdf5_entry_t) *
                                                       hdf5->root->num_entries);
     if (hdf5->root->entries == NULL) {
@@ -501,6 +1049,7 @@ static void hdf5_struct_get_entries(const hdf5_struct_t hdf5) {
             perror("failed to get entry");
             return;
         }
+        hdf5->root->entries[i]->parent = hdf5->root;
         fill_entry_data(hdf5->root->id, hdf5->root->entries[i]);
     }
 }
@@ -518,6 +1067,7 @@ static hdf5_entry_t get_entry_info(const hid_t root, int index) {
         return NULL;
     }
 
+    STATS_COUNT(HDF5_CALLS, 2);
     H5Gget_objname_by_idx(root, (hsize_t) index, entry->name, MAX_LEN);
 
     // TODO objtype_by_idx is deprecated
@@ -534,8 +1084,10 @@ static hdf5_entry_t get_entry_info(const hid_t root, int index) {
  * \param entry the entry to fill
  */
 static void fill_entry_data(const hid_t root, const hdf5_entry_t entry) {
+    STATS_COUNT(ENTRIES_EVALUATED, 1);
     switch (entry->type) {
         case H5G_GROUP:
+            STATS_COUNT(HDF5_CALLS, 1);
             if ((entry->id = H5Gopen(root, entry->name, H5P_DEFAULT)) < 0) {
                 perror("failed to open group");
                 return;
@@ -543,8 +1095,9 @@ static void fill_entry_data(const hid_t root, const hdf5_entry_t entry) {
             set_group(entry);
             break;
         case H5G_DATASET:
-            read_dataset(root, entry);
+            // open_dataset publishes the entry, so this goes first
             set_dataset(entry);
+            open_dataset(root, entry);
             break;
         default:
             break;
@@ -562,108 +1115,175 @@ static void set_dataset(const hdf5_entry_t entry) {
 
 /*
  * Sets the attributes specific to a group. Allocates the array to store the
- * children entries.
+ * children entries. The group is marked evaluated once they're all set.
  * \param entry the entry to set to a group
  */
 static void set_group(const hdf5_entry_t entry) {
     H5G_info_t g_info;
-    entry->evaluated = true;
+    STATS_COUNT(HDF5_CALLS, 1);
     if ((H5Gget_info(entry->id, &g_info) < 0)) {
         perror("H5Gget_info failed");
+        STORE_RELEASE(&entry->evaluated, true);
         return;
     }
 
     entry->num_entries = g_info.nlinks;
+    entry->capacity    = g_info.nlinks;
     entry->entries     = (hdf5_entry_t *)
                          malloc(sizeof(hdf5_entry_t) * entry->num_entries);
     if (entry->entries == NULL) {
         perror("malloc failed in new_hdf5_struct():entries");
-        free(entry);
+        entry->num_entries = 0;
+        entry->capacity    = 0;
+        STORE_RELEASE(&entry->evaluated, true);
         return;
     }
 
     int i;
     for (i = 0; i < entry->num_entries; i++) {
-        entry->entries[i] = get_entry_info(entry->id, i);
+        if ((entry->entries[i] = get_entry_info(entry->id, i)) != NULL) {
+            entry->entries[i]->parent = entry;
+        }
     }
+    STORE_RELEASE(&entry->evaluated, true);
 }
 
 /*
- * Reads a dataset into the buffer of a hdf5_entry_t object
+ * Opens a dataset and fills in its type and dimensions without reading the
+ * data. Datasets with more than two dimensions have the trailing dimensions
+ * folded into the second one, one dimensional datasets have a second dimension
+ * of 1 so X_DIM(entry) * Y_DIM(entry) is always the number of elements.
  * \param root the parent group
- * \param entry the entry to read the data into
+ * \param entry the entry to open
  */
-static void read_dataset(const hid_t root, const hdf5_entry_t entry) {
+static void open_dataset(const hid_t root, const hdf5_entry_t entry) {
     int     i;
-    char   *buf;
     hid_t   type;
-    size_t  size;
-    size_t *sizes;
-    size_t *offsets;
-    hsize_t n_fields;
-    hsize_t n_records;
+    hid_t   super;
+    hid_t   space;
+    hsize_t dims[H5S_MAX_RANK];
 
+    STATS_COUNT(HDF5_CALLS, 3);
     if ((entry->id = H5Dopen(root, entry->name, H5P_DEFAULT)) < 0) {
         perror("failed to open dataset");
         return;
     }
-    if ((H5LTget_dataset_info(root, entry->name, entry->dims, NULL,
-                              &size)) < 0) {
+    if ((space = H5Dget_space(entry->id)) < 0) {
         perror("failed to get dataset info");
+        H5Dclose(entry->id);
         return;
     }
     if ((type = H5Dget_type(entry->id)) < 0) {
         perror("failed to get dataset type");
+        H5Sclose(space);
+        H5Dclose(entry->id);
         return;
     }
 
-    entry->evaluated = true;
-    entry->size  = size;
+    entry->rank  = H5Sget_simple_extent_dims(space, dims, NULL);
+    entry->size  = H5Tget_size(type);
     entry->class = H5Tget_class(type);
+    if (entry->class == H5T_VLEN) {
+        // sequences of bytes, as some writers store labels, are read as strings
+        super = H5Tget_super(type);
+        if (H5Tget_class(super) == H5T_INTEGER && H5Tget_size(super) == 1) {
+            entry->class = H5T_STRING;
+        }
+        H5Tclose(super);
+    }
+    X_DIM(entry) = entry->rank > 0 ? dims[0] : 1;
+    Y_DIM(entry) = 1;
+    for (i = 1; i < entry->rank; i++) {
+        Y_DIM(entry) *= dims[i];
+    }
+    STORE_RELEASE(&entry->evaluated, true);
+
+    H5Tclose(type);
+    H5Sclose(space);
+}
+
+/*
+ * Reads a dataset into the buffer of a hdf5_entry_t object if it hasn't been
+ * read yet. Only one thread reads it, the others wait for the data.
+ * \param entry the entry to read the data into
+ */
+static void load_dataset(const hdf5_entry_t entry) {
+    if (!IS_LOADED(entry)) {
+        lock_hdf5();
+        if (!IS_LOADED(entry)) {
+            read_dataset(entry);
+        }
+        unlock_hdf5();
+    }
+}
+
+/*
+ * Reads a dataset into the buffer of a hdf5_entry_t object. This is only called
+ * the first time the data of a dataset is asked for, with the HDF5 lock held.
+ * The buffer is filled in before it's published, so other threads never see a
+ * partially read dataset. On failure the entry is left unloaded.
+ * \param entry the entry to read the data into
+ */
+static void read_dataset(const hdf5_entry_t entry) {
+    int     i;
+    hid_t   root = entry->parent->id;
+    size_t  size = entry->size;
+    size_t *sizes;
+    size_t *offsets;
+    hsize_t n_fields;
+    hsize_t n_records;
+    union data_buffer data = {NULL};
+    STATS_TIMER(READ_DATASET);
 
     switch (entry->class) {
         case H5T_FLOAT:
-            FLOAT_DATA(entry) =
+            data.double_data =
                 (double **) malloc(sizeof(double *) * X_DIM(entry));
-            FLOAT_DATA(entry)[0] =
+            data.double_data[0] =
                 (double *) malloc(X_DIM(entry) * Y_DIM(entry) * sizeof(double));
             for (i = 1; i < X_DIM(entry); i++) {
-                FLOAT_DATA(entry)[i] = FLOAT_DATA(entry)[0] + i * Y_DIM(entry);
+                data.double_data[i] = data.double_data[0] + i * Y_DIM(entry);
             }
             if ((H5LTread_dataset_double(root, entry->name,
-                                         FLOAT_DATA(entry)[0])) < 0) {
+                                         data.double_data[0])) < 0) {
                 perror("failed to read dataset");
+                free(data.double_data[0]);
+                free(data.double_data);
                 return;
             }
+            STATS_COUNT(HDF5_CALLS, 1);
+            STATS_COUNT(BYTES_READ,
+                        X_DIM(entry) * Y_DIM(entry) * sizeof(double));
+            STATS_ALLOC(X_DIM(entry) * Y_DIM(entry) * sizeof(double));
             break;
         case H5T_INTEGER:
-            INT_DATA(entry)    = (int **) malloc(sizeof(int *) * X_DIM(entry));
-            INT_DATA(entry)[0] =
+            data.int_data    = (int **) malloc(sizeof(int *) * X_DIM(entry));
+            data.int_data[0] =
                 (int *) malloc(X_DIM(entry) * Y_DIM(entry) * sizeof(int));
             for (i = 1; i < X_DIM(entry); i++) {
-                INT_DATA(entry)[i] = INT_DATA(entry)[0] + i * Y_DIM(entry);
+                data.int_data[i] = data.int_data[0] + i * Y_DIM(entry);
             }
             if ((H5LTread_dataset_int(root, entry->name,
-                                      INT_DATA(entry)[0])) < 0) {
+                                      data.int_data[0])) < 0) {
                 perror("failed to read dataset");
+                free(data.int_data[0]);
+                free(data.int_data);
                 return;
             }
+            STATS_COUNT(HDF5_CALLS, 1);
+            STATS_COUNT(BYTES_READ, X_DIM(entry) * Y_DIM(entry) * sizeof(int));
+            STATS_ALLOC(X_DIM(entry) * Y_DIM(entry) * sizeof(int));
             break;
         case H5T_STRING:
-            buf = (char *) calloc(size + 1, sizeof(char));
-            STR_DATA(entry) = calloc(1, size + 1);
-            if ((H5LTread_dataset_string(root, entry->name, buf)) < 0) {
-                perror("failed to read dataset");
+            if ((read_strings(entry, &data.string_data)) < 0) {
                 return;
             }
-            strcpy(STR_DATA(entry), buf);
-            free(buf);
             break;
         case H5T_BITFIELD:
-            printf("bitfield: %s\n", entry->name);
+            fprintf(stderr, "bitfield: %s\n", entry->name);
             break;
         case H5T_OPAQUE:
-            printf("opaque: %s\n", entry->name);
+            fprintf(stderr, "opaque: %s\n", entry->name);
             break;
         case H5T_COMPOUND:
             H5TBget_table_info(root, entry->name, &n_fields, &n_records);
@@ -671,35 +1291,270 @@ static void read_dataset(const hid_t root, const hdf5_entry_t entry) {
             offsets = (size_t *) malloc(sizeof(size_t) * n_fields);
             H5TBget_field_info(root, entry->name, NULL, sizes, offsets, &size);
 
-            GEN_DATA(entry) = malloc(size * n_records);
+            data.gen_data = malloc(size * n_records);
+            STATS_COUNT(HDF5_CALLS, 3);
+            STATS_ALLOC(size * n_records);
             if ((H5TBread_table(root, entry->name, size, offsets,
-                                sizes, GEN_DATA(entry))) < 0) {
+                                sizes, data.gen_data)) < 0) {
                 perror("failed to read dataset");
+                free(data.gen_data);
+                data.gen_data = NULL;
+            } else {
+                STATS_COUNT(BYTES_READ, size * n_records);
             }
             free(sizes);
             free(offsets);
             break;
         case H5T_REFERENCE:
-            printf("TODO reference: %s\n", entry->name);
+            fprintf(stderr, "TODO reference: %s\n", entry->name);
             break;
         case H5T_ENUM:
-            printf("TODO enum: %s\n", entry->name);
+            fprintf(stderr, "TODO enum: %s\n", entry->name);
             break;
         case H5T_VLEN:
-            printf("TODO vlen: %s\n", entry->name);
+            fprintf(stderr, "TODO vlen: %s\n", entry->name);
             break;
         case H5T_ARRAY:
-            printf("TODO array: %s\n", entry->name);
+            fprintf(stderr, "TODO array: %s\n", entry->name);
             break;
         case H5T_NO_CLASS:
-            printf("Not a valid class: %s\n. No data read", entry->name);
+            fprintf(stderr, "Not a valid class: %s\n. No data read",
+                    entry->name);
             break;
         case H5T_NCLASSES:
-            printf("nclasses: %s\n. No data read", entry->name);
+            fprintf(stderr, "nclasses: %s\n. No data read", entry->name);
         case H5T_TIME:
-            printf("Time not supported: %s\n. No data read", entry->name);
+            fprintf(stderr, "Time not supported: %s\n. No data read",
+                    entry->name);
             break;
     }
+    STORE_RELEASE(&GEN_DATA(entry), data.gen_data);
+}
+
+/*
+ * Reads all the strings of a string dataset into one buffer, the arena, with
+ * the strings stored back to back and null-terminated. entry->str_offsets gets
+ * the start of each string and, as its last element, the size of the arena.
+ * \param entry the dataset to read
+ * \param arena where to return the arena
+ * \return 0 on success, -1 on failure
+ */
+static int read_strings(const hdf5_entry_t entry, char **arena) {
+    int     status;
+    hid_t   type;
+    hsize_t n = X_DIM(entry) * Y_DIM(entry);
+
+    if ((type = H5Dget_type(entry->id)) < 0) {
+        perror("failed to get dataset type");
+        return -1;
+    }
+    if ((entry->str_offsets = (size_t *) malloc(sizeof(size_t) * (n + 1)))
+        == NULL) {
+        perror("malloc failed in read_strings():str_offsets");
+        H5Tclose(type);
+        return -1;
+    }
+
+    if (H5Tget_class(type) == H5T_VLEN || H5Tis_variable_str(type) > 0) {
+        status = read_variable_strings(entry, type, n, arena);
+    } else {
+        status = read_fixed_strings(entry, type, n, arena);
+    }
+    if (status < 0) {
+        free(entry->str_offsets);
+        entry->str_offsets = NULL;
+    } else {
+        STATS_COUNT(HDF5_CALLS, 1);
+        STATS_COUNT(BYTES_READ, entry->str_offsets[n]);
+        STATS_ALLOC(entry->str_offsets[n] + sizeof(size_t) * (n + 1));
+    }
+    H5Tclose(type);
+    return status;
+}
+
+/*
+ * Reads fixed-length strings. They're read straight into the arena, one byte
+ * wider so each is null-terminated, then packed to the front to drop the
+ * padding.
+ * \param entry the dataset to read
+ * \param type the type of the dataset
+ * \param n the number of strings
+ * \param arena where to return the arena
+ * \return 0 on success, -1 on failure
+ */
+static int read_fixed_strings(const hdf5_entry_t entry, hid_t type, hsize_t n,
+                              char **arena) {
+    size_t  i;
+    size_t  len;
+    size_t  pos     = 0;
+    size_t  width   = H5Tget_size(type) + 1;
+    size_t *offsets = entry->str_offsets;
+    char   *buf;
+    char   *packed;
+    hid_t   mem_type;
+
+    if ((buf = (char *) malloc(n * width + 1)) == NULL) {
+        perror("malloc failed in read_fixed_strings():buf");
+        return -1;
+    }
+    buf[0]   = '\0';
+    mem_type = H5Tcopy(H5T_C_S1);
+    H5Tset_size(mem_type, width);
+    H5Tset_strpad(mem_type, H5T_STR_NULLTERM);
+    H5Tset_cset(mem_type, H5Tget_cset(type));
+    if ((H5Dread(entry->id, mem_type, H5S_ALL, H5S_ALL, H5P_DEFAULT,
+                 buf)) < 0) {
+        perror("failed to read dataset");
+        H5Tclose(mem_type);
+        free(buf);
+        return -1;
+    }
+    H5Tclose(mem_type);
+
+    for (i = 0; i < n; i++) {
+        len = strlen(buf + i * width);
+        memmove(buf + pos, buf + i * width, len + 1);
+        offsets[i] = pos;
+        pos       += len + 1;
+    }
+    offsets[n] = pos;
+
+    packed = (char *) realloc(buf, pos > 0 ? pos : 1);
+    *arena = packed != NULL ? packed : buf;
+    return 0;
+}
+
+/*
+ * Reads variable-length strings, or sequences of bytes, with one H5Dread. HDF5
+ * allocates the strings from blocks (see string_block_alloc), they're copied
+ * into the arena and the blocks are freed before returning.
+ * \param entry the dataset to read
+ * \param type the type of the dataset
+ * \param n the number of strings
+ * \param arena where to return the arena
+ * \return 0 on success, -1 on failure
+ */
+static int read_variable_strings(const hdf5_entry_t entry, hid_t type,
+                                 hsize_t n, char **arena) {
+    int     status = 0;
+    bool    bytes  = H5Tget_class(type) == H5T_VLEN;
+    size_t  i;
+    size_t  len;
+    size_t  pos     = 0;
+    size_t *offsets = entry->str_offsets;
+    void   *buf;
+    hvl_t  *seqs;
+    char  **strs;
+    hid_t   mem_type;
+    hid_t   super;
+    hid_t   native;
+    hid_t   xfer;
+    struct string_block *blocks = NULL;
+    struct string_block *next;
+
+    if (bytes) {
+        super    = H5Tget_super(type);
+        native   = H5Tget_native_type(super, H5T_DIR_ASCEND);
+        mem_type = H5Tvlen_create(native);
+        H5Tclose(native);
+        H5Tclose(super);
+    } else {
+        mem_type = H5Tcopy(H5T_C_S1);
+        H5Tset_size(mem_type, H5T_VARIABLE);
+        H5Tset_cset(mem_type, H5Tget_cset(type));
+    }
+    if ((buf = calloc(n + 1, bytes ? sizeof(hvl_t) : sizeof(char *))) == NULL) {
+        perror("calloc failed in read_variable_strings():buf");
+        H5Tclose(mem_type);
+        return -1;
+    }
+    seqs = (hvl_t *) buf;
+    strs = (char **) buf;
+
+    xfer = H5Pcreate(H5P_DATASET_XFER);
+    H5Pset_vlen_mem_manager(xfer, string_block_alloc, &blocks,
+                            string_block_free, NULL);
+    if ((H5Dread(entry->id, mem_type, H5S_ALL, H5S_ALL, xfer, buf)) < 0) {
+        perror("failed to read dataset");
+        status = -1;
+    } else {
+        // the lengths come first so the arena is allocated once
+        for (i = 0; i < n; i++) {
+            if (bytes) {
+                len = seqs[i].len;
+            } else {
+                len = strs[i] != NULL ? strlen(strs[i]) : 0;
+            }
+            offsets[i] = pos;
+            pos       += len + 1;
+        }
+        offsets[n] = pos;
+
+        if ((*arena = (char *) malloc(pos > 0 ? pos : 1)) == NULL) {
+            perror("malloc failed in read_variable_strings():arena");
+            status = -1;
+        } else {
+            (*arena)[0] = '\0';
+            for (i = 0; i < n; i++) {
+                len = offsets[i + 1] - offsets[i] - 1;
+                if (len > 0) {
+                    memcpy(*arena + offsets[i], bytes ? seqs[i].p : strs[i],
+                           len);
+                }
+                (*arena)[offsets[i] + len] = '\0';
+            }
+        }
+    }
+
+    // HDF5's copies of the strings are reclaimed all at once
+    for (; blocks != NULL; blocks = next) {
+        next = blocks->next;
+        free(blocks);
+    }
+    H5Pclose(xfer);
+    H5Tclose(mem_type);
+    free(buf);
+    return status;
+}
+
+/*
+ * Allocates memory for a variable-length string from the blocks of a read. This
+ * is the allocator HDF5 calls while reading variable-length data.
+ * \param size the number of bytes
+ * \param info the list of blocks, the newest first
+ * \return the memory or NULL
+ */
+static void *string_block_alloc(size_t size, void *info) {
+    size_t                capacity;
+    struct string_block **blocks = (struct string_block **) info;
+    struct string_block  *block  = *blocks;
+
+    if (block == NULL || block->capacity - block->used < size) {
+        capacity = size > STRING_BLOCK_BYTES ? size : STRING_BLOCK_BYTES;
+        block    = (struct string_block *) malloc(sizeof(struct string_block)
+                                                  + capacity);
+        if (block == NULL) {
+            perror("malloc failed in string_block_alloc():block");
+            return NULL;
+        }
+        block->next     = *blocks;
+        block->used     = 0;
+        block->capacity = capacity;
+        *blocks         = block;
+    }
+    block->used += size;
+    return block->data + block->used - size;
+}
+
+/*
+ * Memory from string_block_alloc is freed with its block, so HDF5 freeing a
+ * single string does nothing.
+ * \param mem the memory HDF5 frees
+ * \param info unused
+ */
+static void string_block_free(void *mem, void *info) {
+    (void) mem;
+    (void) info;
 }
 
 /*
@@ -735,6 +1590,11 @@ static void print_data_type(const hdf5_entry_t entry) {
  */
 static void print_data(const hdf5_entry_t entry) {
     int i, j;
+    load_dataset(entry);
+    if (!IS_LOADED(entry)) {
+        printf("[ ]\n");
+        return;
+    }
     printf("[ ");
     switch (entry->class) {
         case H5T_FLOAT:
@@ -752,7 +1612,9 @@ static void print_data(const hdf5_entry_t entry) {
             }
             break;
         case H5T_STRING:
-            printf("%s ", STR_DATA(entry));
+            for (i = 0; i < X_DIM(entry) * Y_DIM(entry); i++) {
+                printf("%s ", STR_DATA(entry) + entry->str_offsets[i]);
+            }
             break;
         case H5T_COMPOUND:
             printf("compound data type ");
@@ -762,3 +1624,50 @@ static void print_data(const hdf5_entry_t entry) {
     }
     printf("]\n");
 }
+
+/*
+ * Selects a block of rows in the file space of a dataset. The block spans all
+ * of the remaining dimensions.
+ * \param entry the dataset to select the rows from
+ * \param start the first row of the block
+ * \param count the number of rows in the block
+ * \return the file space with the rows selected or -1 on failure
+ */
+static hid_t select_rows(const hdf5_entry_t entry,
+                         hsize_t            start,
+                         hsize_t            count) {
+    hid_t   space;
+    hsize_t offset[H5S_MAX_RANK] = {0};
+    hsize_t dims[H5S_MAX_RANK];
+
+    if (IS_GROUP(entry) || start + count > X_DIM(entry)) {
+        fprintf(stderr, "rows %llu-%llu are out of range for %s\n", start,
+                start + count, entry->name);
+        return -1;
+    }
+    if ((space = H5Dget_space(entry->id)) < 0) {
+        perror("failed to get dataspace");
+        return -1;
+    }
+    H5Sget_simple_extent_dims(space, dims, NULL);
+    offset[0] = start;
+    dims[0]   = count;
+    if (H5Sselect_hyperslab(space, H5S_SELECT_SET, offset, NULL, dims,
+                            NULL) < 0) {
+        perror("failed to select rows");
+        H5Sclose(space);
+        return -1;
+    }
+    return space;
+}
+
+/*
+ * Creates the HDF5 lock, once
+ */
+static void init_hdf5_lock(void) {
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+    pthread_mutex_init(&hdf5_lock, &attr);
+    pthread_mutexattr_destroy(&attr);
+}
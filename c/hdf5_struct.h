@@ -4,13 +4,25 @@
 #include <stdbool.h>
 #include "hdf5.h"
 
+// work is split across threads when compiled with -fopenmp
+#ifdef _OPENMP
+#include <omp.h>
+#define NUM_THREADS()  ((omp_get_max_threads()))
+#define THREAD_NUM()   ((omp_get_thread_num()))
+#else
+#define NUM_THREADS()  1
+#define THREAD_NUM()   0
+#endif
+
 #define MAX_LEN        1024
+#define BLOCK_BYTES    (8 << 20) // target size of a block when streaming rows
 
 // shorter access to hdf5_entry_t->data.*
 #define FLOAT_DATA(e)  ((e->data.double_data))
 #define INT_DATA(e)    ((e->data.int_data))
 #define STR_DATA(e)    ((e->data.string_data))
 #define GEN_DATA(e)    ((e->data.gen_data))
+#define STR_LEN(e, i)  ((e->str_offsets[(i) + 1] - e->str_offsets[i] - 1))
 
 // access to hdf5_entry_t->dims[...]--mainly to prevent indexing errors
 #define X_DIM(e)       ((e->dims[0]))
@@ -19,6 +31,12 @@
 #define IS_GROUP(e)    ((e->type == H5G_GROUP))
 #define ENTRY_AT(e, i) ((e->entries[i]))
 #define NUM_ENTRY(e)   ((e->num_entries))
+#define IS_LOADED(e)   ((LOAD_ACQUIRE(&e->data.gen_data) != NULL))
+#define IS_EVALUATED(e) ((LOAD_ACQUIRE(&e->evaluated)))
+
+// entries and their data are published to other threads once they're filled in
+#define LOAD_ACQUIRE(p)     ((__atomic_load_n(p, __ATOMIC_ACQUIRE)))
+#define STORE_RELEASE(p, v) ((__atomic_store_n(p, v, __ATOMIC_RELEASE)))
 
 
 /*
@@ -33,21 +51,39 @@ union data_buffer {
 };
 
 /*
- * An entry in an HDF5 file. It can be either a group or a dataset
+ * An entry in an HDF5 file. It can be either a group or a dataset. The rows of
+ * a dataset (the first dimension) are treated as samples: that's how the MATLAB
+ * writer lays out EEG.data, channels end up in the second dimension.
+ *
+ * Entries are evaluated and their data is read at most once, under the HDF5
+ * lock, and `evaluated` and `data` are only set once the rest of the entry is
+ * filled in. Threads can share a hdf5_struct_t and look up entries that are
+ * already evaluated without taking the lock. create_dataset and delete_dataset
+ * never move or free an array of entries or an entry a lookup may be reading:
+ * they append to the array or publish a new one, and the old arrays and the
+ * deleted entries are kept until the group is freed.
  */
 typedef struct hdf5_entry {
     int   type;                  // the type of the entry (group or dataset)
     char  name[MAX_LEN];         // the name of the entry
     hid_t id;                    // the id of the entry
-    bool  evaluated;             // whether the dataset has been read
+    bool  evaluated;             // whether the entry has been opened
+    struct hdf5_entry *parent;   // the group containing the entry
     /* specific to datasets */
     H5T_class_t class;           // type of the dataset
-    hsize_t     dims[2];         // dimensions of the dataset
+    int         rank;            // number of dimensions in the file
+    hsize_t     dims[2];         // dimensions, trailing ones folded into [1]
     int size;                    // size of the dataset in bytes
     union data_buffer data;      // the actual data
+    size_t     *str_offsets;     // where each string starts in string_data
     /* specific to groups */
     hsize_t num_entries;         // the number of entries
     struct hdf5_entry **entries; // children entries
+    hsize_t capacity;            // the room in entries
+    struct hdf5_entry ***retired; // replaced arrays of entries
+    hsize_t num_retired;         // the number of replaced arrays
+    struct hdf5_entry **deleted; // deleted datasets, kept like the arrays
+    hsize_t num_deleted;         // the number of deleted datasets
 } *hdf5_entry_t;
 
 /*
@@ -58,11 +94,27 @@ typedef struct hdf5_struct {
     hdf5_entry_t root;  // the root entry
 } *hdf5_struct_t;
 
+/*
+ * Serializes calls into the HDF5 library, which isn't thread-safe unless built
+ * with --enable-threadsafe. The lock is recursive.
+ */
+void lock_hdf5(void);
+
+/*
+ * Releases the lock taken by lock_hdf5
+ */
+void unlock_hdf5(void);
+
 /*
  * Creates a new hdf5_struct_t from a file.
  */
 hdf5_struct_t new_hdf5_struct(const char *path);
 
+/*
+ * Creates a new hdf5_struct_t from a file opened read-only
+ */
+hdf5_struct_t new_hdf5_struct_readonly(const char *path);
+
 /*
  * Frees the memory associated with a hdf5_struct_t
  */
@@ -78,6 +130,11 @@ char **entries(const hdf5_struct_t hdf5);
  */
 hdf5_entry_t get_entry(const hdf5_struct_t hdf5, const char *path);
 
+/*
+ * Returns the entry at a path of names separated by '/' from the root
+ */
+hdf5_entry_t find_entry(const hdf5_struct_t hdf5, const char *path);
+
 /*
  * Returns a group/dataset from a group
  */
@@ -116,6 +173,11 @@ double **get_double_data(const hdf5_entry_t entry);
  */
 char *get_string_data(const hdf5_entry_t entry);
 
+/*
+ * Returns a string of a string dataset, without allocating, or NULL
+ */
+char *get_string_at(const hdf5_entry_t entry, hsize_t index);
+
 /*
  * Returns the compound data associated with hdf5_entry_t object or NULL if
  * compound data isn't available
@@ -153,6 +215,46 @@ void write_double_matrix(hdf5_entry_t entry, const char *name,
  */
 void write_string(hdf5_entry_t entry, const char *name, const char *buf);
 
+/*
+ * Creates an empty dataset from a creation property list and returns its entry
+ */
+hdf5_entry_t create_dataset(hdf5_entry_t entry, const char *name, hid_t type,
+                            int rank, const hsize_t *dims, hid_t plist);
+
+/*
+ * Creates an empty, optionally chunked, double dataset and returns its entry
+ */
+hdf5_entry_t create_double_matrix(hdf5_entry_t entry, const char *name,
+                                  const hsize_t *dims, const hsize_t *chunk);
+
+/*
+ * Deletes a dataset from the file and frees its entry
+ */
+int delete_dataset(hdf5_entry_t entry);
+
+/*
+ * Returns how many rows of a dataset to read or write at a time when streaming
+ */
+hsize_t block_rows(const hdf5_entry_t entry);
+
+/*
+ * Reads a block of rows from a dataset as doubles
+ */
+int read_double_rows(const hdf5_entry_t entry, hsize_t start, hsize_t count,
+                     double *buf);
+
+/*
+ * Reads a block of rows from a dataset, converted to a memory type
+ */
+int read_rows(const hdf5_entry_t entry, hsize_t start, hsize_t count,
+              hid_t mem_type, void *buf);
+
+/*
+ * Writes a block of rows to a dataset from doubles
+ */
+int write_double_rows(hdf5_entry_t entry, hsize_t start, hsize_t count,
+                      const double *buf);
+
 /*
  * Prints a hdf5_entry_t
  */
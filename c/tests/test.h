@@ -0,0 +1,46 @@
+#ifndef _TEST_H_
+#define _TEST_H_
+
+/*
+ * The little that the tests share: CHECK records a failure and carries on, so
+ * one run reports every broken case, and each test's main returns
+ * TEST_RESULT(). `make test` builds and runs every tests/test_*.c.
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include "hdf5.h"
+#include "hdf5_struct.h"
+
+static int test_failures = 0;
+
+#define CHECK(cond)                                                           \
+    do {                                                                      \
+        if (!(cond)) {                                                        \
+            fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__,  \
+                    #cond);                                                   \
+            test_failures++;                                                  \
+        }                                                                     \
+    } while (0)
+
+#define CHECK_NEAR(a, b, tol) CHECK(fabs((double) (a) - (double) (b)) <= (tol))
+
+#define TEST_RESULT()                                                         \
+    (test_failures == 0 ? (printf("%s: ok\n", __FILE__), 0)                   \
+                        : (printf("%s: %d failed\n", __FILE__,                \
+                                  test_failures), 1))
+
+/*
+ * Creates an empty file and opens it, or returns NULL
+ */
+static inline hdf5_struct_t new_test_file(const char *path) {
+    hid_t file = H5Fcreate(path, H5F_ACC_TRUNC, H5P_DEFAULT, H5P_DEFAULT);
+    if (file < 0) {
+        printf("failed to create %s\n", path);
+        return NULL;
+    }
+    H5Fclose(file);
+    return new_hdf5_struct(path);
+}
+
+#endif
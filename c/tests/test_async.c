@@ -0,0 +1,111 @@
+/*
+ * Asynchronous reads and writes: round trips, callbacks, cancellation and the
+ * lifetime of requests.
+ */
+
+#include <stdlib.h>
+#include "hdf5_async.h"
+#include "test.h"
+
+#define PATH     "test_async.h5"
+#define ROWS     1000
+#define CHANNELS 8
+#define BLOCK    100
+
+static int callbacks = 0;  // only touched by the worker until it's joined
+
+static void count_callback(hdf5_request_t req, void *arg) {
+    callbacks += req->status == REQUEST_DONE && arg == &callbacks;
+}
+
+int main(void) {
+    int             i;
+    int             done;
+    double         *in;
+    double         *out;
+    hsize_t         dims[2] = {ROWS, CHANNELS};
+    hdf5_struct_t   hdf5;
+    hdf5_entry_t    data;
+    hdf5_io_queue_t queue;
+    hdf5_request_t  req[ROWS / BLOCK];
+    hdf5_request_t  extra;
+
+    if ((hdf5 = new_test_file(PATH)) == NULL) {
+        return 1;
+    }
+    in   = (double *) malloc(sizeof(double) * ROWS * CHANNELS);
+    out  = (double *) calloc(ROWS * CHANNELS, sizeof(double));
+    for (i = 0; i < ROWS * CHANNELS; i++) {
+        in[i] = i * 0.25 - 17;
+    }
+    data  = create_double_matrix(hdf5->root, "data", dims, NULL);
+    queue = new_io_queue(ROWS / BLOCK);
+    CHECK(data != NULL && queue != NULL);
+
+    // a full queue of writes, then reads, reaped by waiting and by polling
+    for (i = 0; i < ROWS / BLOCK; i++) {
+        CHECK(write_async(queue, data, i * BLOCK, BLOCK,
+                          in + i * BLOCK * CHANNELS, &req[i]) == 0);
+    }
+    for (i = 0; i < ROWS / BLOCK; i++) {
+        CHECK(wait_request(queue, req[i]) == 0);
+        free_request(req[i]);
+    }
+    for (i = 0; i < ROWS / BLOCK; i++) {
+        CHECK(read_async(queue, data, i * BLOCK, BLOCK,
+                         out + i * BLOCK * CHANNELS, &req[i]) == 0);
+    }
+    for (done = 0; done < ROWS / BLOCK;) {
+        hdf5_request_t r = poll_io_queue(queue);
+        if (r != NULL) {
+            CHECK(r->status == REQUEST_DONE);
+            free_request(r);
+            done++;
+        }
+    }
+    for (i = 0; i < ROWS * CHANNELS && in[i] == out[i]; i++) {
+    }
+    CHECK(i == ROWS * CHANNELS);
+
+    // with the HDF5 lock held the worker can't finish anything, so the second
+    // request is still pending
+    lock_hdf5();
+    CHECK(read_async(queue, data, 0, BLOCK, out, &req[0]) == 0);
+    CHECK(read_async(queue, data, BLOCK, BLOCK, out, &req[1]) == 0);
+    CHECK(cancel_request(queue, req[1]) == 0);
+    unlock_hdf5();
+    CHECK(wait_request(queue, req[0]) == 0);
+    CHECK(wait_request(queue, req[1]) < 0);
+    CHECK(req[1]->status == REQUEST_CANCELLED);
+    free_request(req[0]);
+    free_request(req[1]);
+
+    // callback requests have no handle, since the queue frees them
+    CHECK(submit_request(queue, REQUEST_READ, data, 0, BLOCK, out,
+                         count_callback, &callbacks, &extra) < 0);
+    CHECK(submit_request(queue, REQUEST_READ, data, 0, BLOCK, out, NULL, NULL,
+                         NULL) < 0);
+    for (i = 0; i < 3; i++) {
+        CHECK(submit_request(queue, REQUEST_READ, data, i * BLOCK, BLOCK,
+                             out + i * BLOCK * CHANNELS, count_callback,
+                             &callbacks, NULL) == 0);
+    }
+
+    // out of range rows fail without taking the queue down
+    CHECK(read_async(queue, data, ROWS, BLOCK, out, &extra) == 0);
+    CHECK(wait_request(queue, extra) < 0 && extra->status == REQUEST_FAILED);
+    free_request(extra);
+
+    // a request that's never reaped outlives the queue
+    CHECK(read_async(queue, data, 0, BLOCK, out, &extra) == 0);
+    free_io_queue(queue);
+    CHECK(callbacks == 3);
+    CHECK(extra->status == REQUEST_DONE);
+    free_request(extra);
+
+    free(in);
+    free(out);
+    free_hdf5_struct(hdf5);
+    remove(PATH);
+    return TEST_RESULT();
+}
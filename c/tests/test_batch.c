@@ -0,0 +1,197 @@
+/*
+ * Batched writes: nested groups, int, double and string datasets, a scalar,
+ * fixed length strings and numeric and string attributes committed in the
+ * file's format and in the latest one, read back through a fresh
+ * hdf5_struct_t, and the batches and commits that must fail.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "hdf5_batch.h"
+#include "hdf5_hl.h"
+#include "test.h"
+
+#define PATH "test_batch.h5"
+
+/*
+ * Returns the version of the object header of an object, 1 for the earliest
+ * format and 2 for the latest
+ */
+static unsigned header_version(hid_t file, const char *path) {
+    H5O_info_t info;
+
+    if (H5Oget_info_by_name2(file, path, &info, H5O_INFO_HDR,
+                             H5P_DEFAULT) < 0) {
+        return 0;
+    }
+    return info.hdr.version;
+}
+
+int main(void) {
+    int           i;
+    int           j;
+    int           flags;
+    int           chans[5]    = {3, 1, 4, 1, 5};
+    int           grid[3][4];
+    int         **ints;
+    double        weights[10];
+    double        scale[3]    = {0.5, -2, 1e-3};
+    double        srate       = 256;
+    double        attr[3];
+    double      **doubles;
+    char          text[32];
+    char          labels[]    = "Fz\0\0Cz\0\0Pz\0\0";
+    hsize_t       grid_dims[2] = {3, 4};
+    hsize_t       label_dims[1] = {3};
+    hsize_t       dims[2]     = {4, 2};
+    hid_t         label_type;
+    hdf5_struct_t hdf5;
+    hdf5_entry_t  etc;
+    hdf5_entry_t  ica;
+    hdf5_entry_t  entry;
+    hdf5_batch_t  batch;
+    batch_node_t  etc_node;
+    batch_node_t  ica_node;
+    batch_node_t  node;
+
+    for (i = 0; i < 10; i++) {
+        weights[i] = i / 3.0 - 1;
+    }
+    for (i = 0; i < 3; i++) {
+        for (j = 0; j < 4; j++) {
+            grid[i][j] = 10 * i + j;
+        }
+    }
+    label_type = H5Tcopy(H5T_C_S1);
+    H5Tset_size(label_type, 4);
+
+    for (flags = 0; flags <= BATCH_LATEST_FORMAT;
+         flags += BATCH_LATEST_FORMAT) {
+        if ((hdf5 = new_test_file(PATH)) == NULL) {
+            return 1;
+        }
+        CHECK((batch = new_batch()) != NULL);
+        if (batch == NULL) {
+            return TEST_RESULT();
+        }
+        batch->flags = flags;
+        etc_node = batch_group(batch, NULL, "etc");
+        ica_node = batch_group(batch, etc_node, "ica");
+        CHECK(etc_node != NULL && ica_node != NULL);
+        CHECK(batch_string_attribute(batch, NULL, "MATLAB_class", "struct") !=
+              NULL);
+        CHECK(batch_string_attribute(batch, etc_node, "MATLAB_class",
+                                     "struct") != NULL);
+        node = batch_double_array(batch, ica_node, "weights", 10, weights);
+        CHECK(node != NULL);
+        CHECK(batch_attribute(batch, node, "scale", H5T_NATIVE_DOUBLE, 3,
+                              scale) != NULL);
+        CHECK(batch_int_array(batch, ica_node, "chans", 5, chans) != NULL);
+        CHECK(batch_string(batch, ica_node, "method", "runica") != NULL);
+        CHECK(batch_string(batch, ica_node, "empty", "") != NULL);
+        CHECK(batch_dataset(batch, etc_node, "srate", H5T_NATIVE_DOUBLE, 0,
+                            NULL, &srate) != NULL);
+        CHECK(batch_dataset(batch, etc_node, "grid", H5T_NATIVE_INT, 2,
+                            grid_dims, grid) != NULL);
+        CHECK(batch_dataset(batch, etc_node, "labels", label_type, 1,
+                            label_dims, labels) != NULL);
+        CHECK(batch_group(batch, etc_node, "nothing") != NULL);
+
+        // what can't be batched is refused up front
+        CHECK(batch_dataset(batch, NULL, "bad", H5T_C_S1, 1, label_dims,
+                            labels) == NULL);
+        CHECK(batch_attribute(batch, NULL, "bad", H5T_C_S1, 3, labels) ==
+              NULL);
+        CHECK(batch_dataset(batch, NULL, "bad", H5T_NATIVE_INT, 3, dims,
+                            grid) == NULL);
+        CHECK(batch_group(batch, node, "bad") == NULL);
+
+        CHECK(commit_batch(batch, hdf5->root) == 0);
+        // names that are already there fail
+        H5Eset_auto2(H5E_DEFAULT, NULL, NULL);
+        CHECK(commit_batch(batch, hdf5->root) < 0);
+        free_batch(batch);
+
+        // the same name twice in one batch
+        batch = new_batch();
+        batch->flags = flags;
+        batch_double_array(batch, NULL, "twice", 10, weights);
+        batch_double_array(batch, NULL, "twice", 10, weights);
+        CHECK(commit_batch(batch, hdf5->root) < 0);
+        free_batch(batch);
+        free_hdf5_struct(hdf5);
+
+        // everything reads back through a fresh hdf5_struct_t
+        CHECK((hdf5 = new_hdf5_struct(PATH)) != NULL);
+        if (hdf5 == NULL) {
+            return TEST_RESULT();
+        }
+        etc = get_entry(hdf5, "etc");
+        ica = get_subentry(etc, "ica");
+        CHECK(etc != NULL && IS_GROUP(etc) && ica != NULL && IS_GROUP(ica));
+        if (ica == NULL) {
+            return TEST_RESULT();
+        }
+        CHECK(get_subentry(etc, "nothing") != NULL &&
+              NUM_ENTRY(get_subentry(etc, "nothing")) == 0);
+
+        entry   = get_subentry(ica, "weights");
+        doubles = get_double_data(entry);
+        CHECK(doubles != NULL && X_DIM(entry) == 10 && Y_DIM(entry) == 1);
+        for (i = 0; doubles != NULL && i < 10; i++) {
+            CHECK(doubles[i][0] == weights[i]);
+        }
+        entry = get_subentry(ica, "chans");
+        ints  = get_int_data(entry);
+        CHECK(ints != NULL && X_DIM(entry) == 5);
+        for (i = 0; ints != NULL && i < 5; i++) {
+            CHECK(ints[i][0] == chans[i]);
+        }
+        entry = get_subentry(etc, "grid");
+        ints  = get_int_data(entry);
+        CHECK(ints != NULL && X_DIM(entry) == 3 && Y_DIM(entry) == 4);
+        for (i = 0; ints != NULL && i < 12; i++) {
+            CHECK(ints[i / 4][i % 4] == grid[i / 4][i % 4]);
+        }
+        entry   = get_subentry(etc, "srate");
+        doubles = get_double_data(entry);
+        CHECK(doubles != NULL && entry->rank == 0 && doubles[0][0] == srate);
+
+        entry = get_subentry(ica, "method");
+        CHECK(entry != NULL && get_string_at(entry, 0) != NULL &&
+              strcmp(get_string_at(entry, 0), "runica") == 0);
+        entry = get_subentry(ica, "empty");
+        CHECK(entry != NULL && get_string_at(entry, 0) != NULL &&
+              STR_LEN(entry, 0) == 0);
+        entry = get_subentry(etc, "labels");
+        CHECK(entry != NULL && X_DIM(entry) == 3);
+        for (i = 0; entry != NULL && i < 3; i++) {
+            CHECK(get_string_at(entry, i) != NULL &&
+                  strcmp(get_string_at(entry, i), labels + 4 * i) == 0);
+        }
+
+        CHECK(H5LTget_attribute_string(hdf5->in_file, "/", "MATLAB_class",
+                                       text) >= 0 &&
+              strcmp(text, "struct") == 0);
+        CHECK(H5LTget_attribute_string(hdf5->in_file, "/etc", "MATLAB_class",
+                                       text) >= 0 &&
+              strcmp(text, "struct") == 0);
+        CHECK(H5LTget_attribute_double(hdf5->in_file, "/etc/ica/weights",
+                                       "scale", attr) >= 0 &&
+              memcmp(attr, scale, sizeof(scale)) == 0);
+        // a failed commit leaves what it wrote before the failure
+        CHECK(get_entry(hdf5, "twice") != NULL);
+
+        // the format the objects were written in, and the file's put back
+        CHECK(header_version(hdf5->in_file, "/etc/ica/weights") ==
+              (flags ? 2u : 1u));
+        CHECK(create_double_matrix(hdf5->root, "after", dims, NULL) != NULL);
+        CHECK(header_version(hdf5->in_file, "/after") == 1);
+        free_hdf5_struct(hdf5);
+        H5Eset_auto2(H5E_DEFAULT, (H5E_auto2_t) H5Eprint2, stderr);
+    }
+
+    H5Tclose(label_type);
+    remove(PATH);
+    return TEST_RESULT();
+}
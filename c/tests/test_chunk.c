@@ -0,0 +1,66 @@
+/*
+ * Compressed writes: round trips through the filter pipeline with partial
+ * chunks and more chunks than one batch, and a clash leaving nothing behind.
+ */
+
+#include <stdlib.h>
+#include "hdf5_chunk.h"
+#include "test.h"
+
+#define PATH     "test_chunk.h5"
+#define ROWS     1001
+#define CHANNELS 7
+
+int main(void) {
+    int           i;
+    int           f;
+    int           flags[3] = {COMPRESS_DEFLATE,
+                              COMPRESS_SHUFFLE | COMPRESS_DEFLATE,
+                              COMPRESS_EEG};
+    char          name[16];
+    double       *in;
+    double       *out;
+    hsize_t       dims[2]  = {ROWS, CHANNELS};
+    hsize_t       chunk[2] = {64, 5};  // neither divides the matrix
+    hsize_t       before;
+    hdf5_struct_t hdf5;
+    hdf5_entry_t  data;
+
+    if ((hdf5 = new_test_file(PATH)) == NULL) {
+        return 1;
+    }
+    in  = (double *) malloc(sizeof(double) * ROWS * CHANNELS);
+    out = (double *) malloc(sizeof(double) * ROWS * CHANNELS);
+    for (i = 0; i < ROWS * CHANNELS; i++) {
+        in[i] = (i % CHANNELS) * 1000 + (i / CHANNELS) % 97 - 0.5 * (i % 3);
+    }
+
+    for (f = 0; f < 3; f++) {
+        snprintf(name, sizeof(name), "data%d", f);
+        data = write_compressed_matrix(hdf5->root, name, dims, chunk, in,
+                                       flags[f], 6);
+        CHECK(data != NULL);
+        if (data == NULL) {
+            continue;
+        }
+        for (i = 0; i < ROWS * CHANNELS; i++) {
+            out[i] = -1;
+        }
+        CHECK(read_double_rows(data, 0, ROWS, out) == 0);
+        for (i = 0; i < ROWS * CHANNELS && out[i] == in[i]; i++) {
+        }
+        CHECK(i == ROWS * CHANNELS);
+    }
+
+    // a name that's taken fails without touching the group
+    before = NUM_ENTRY(hdf5->root);
+    CHECK(write_compressed_matrix(hdf5->root, "data0", dims, chunk, in,
+                                  COMPRESS_DEFLATE, 6) == NULL);
+    CHECK(NUM_ENTRY(hdf5->root) == before);
+
+    free(in);
+    free(out);
+    free_hdf5_struct(hdf5);
+    remove(PATH);
+    return TEST_RESULT();
+}
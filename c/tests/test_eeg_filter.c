@@ -0,0 +1,219 @@
+/*
+ * The EEG filter: round trips of every element size with odd lengths, row
+ * lengths and trailing bytes, incompressible input, the SSE2 bit transposes
+ * against the scalar ones, partial chunks through HDF5, corrupt chunks, and
+ * reading back through a fresh hdf5_struct_t with the filter unregistered.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "hdf5_eeg_filter.h"
+#include "test.h"
+
+// a second copy of the codec with only the scalar code
+#undef __SSE2__
+#define eeg_encode          eeg_encode_scalar
+#define eeg_decode          eeg_decode_scalar
+#define register_eeg_filter register_eeg_filter_scalar
+#define set_eeg_filter      set_eeg_filter_scalar
+#include "../hdf5_eeg_filter.c"
+#undef eeg_encode
+#undef eeg_decode
+#undef register_eeg_filter
+#undef set_eeg_filter
+
+#define PATH     "test_eeg_filter.h5"
+#define ROWS     1001
+#define CHANNELS 7
+
+/*
+ * Fills buf with n elements of slow sines, one per channel, and the bytes
+ * after them with noise
+ */
+static void fill(uint8_t *buf, size_t nbytes, size_t elem_size,
+                 size_t row_len) {
+    size_t i;
+    size_t n = nbytes / elem_size;
+
+    for (i = 0; i < n; i++) {
+        double x = 1000 * sin(0.01 * (i / row_len) + i % row_len) + i % row_len;
+        switch (elem_size) {
+        case 1: ((int8_t *) buf)[i] = (int8_t) (x / 10); break;
+        case 2: ((int16_t *) buf)[i] = (int16_t) x; break;
+        case 4: ((float *) buf)[i] = (float) x; break;
+        case 8: ((double *) buf)[i] = x; break;
+        }
+    }
+    for (i = n * elem_size; i < nbytes; i++) {
+        buf[i] = (uint8_t) rand();
+    }
+}
+
+/*
+ * Encodes with both copies of the codec, checks they agree and that both
+ * decode either encoding back to the input
+ * \return the encoded size
+ */
+static size_t round_trip(const uint8_t *in, size_t nbytes, size_t elem_size,
+                         size_t row_len) {
+    size_t   size;
+    uint8_t *sse2   = (uint8_t *) malloc(EEG_BOUND(nbytes));
+    uint8_t *scalar = (uint8_t *) malloc(EEG_BOUND(nbytes));
+    uint8_t *out    = (uint8_t *) malloc(nbytes + 1);
+
+    size = eeg_encode(in, nbytes, elem_size, row_len, sse2);
+    CHECK(size > 0 && size <= EEG_BOUND(nbytes));
+    CHECK(eeg_encode_scalar(in, nbytes, elem_size, row_len, scalar) == size);
+    CHECK(memcmp(sse2, scalar, size) == 0);
+
+    memset(out, 0xAA, nbytes);
+    CHECK(eeg_decode(scalar, size, elem_size, row_len, out, nbytes) == nbytes);
+    CHECK(memcmp(in, out, nbytes) == 0);
+    memset(out, 0xAA, nbytes);
+    CHECK(eeg_decode_scalar(sse2, size, elem_size, row_len, out, nbytes) ==
+          nbytes);
+    CHECK(memcmp(in, out, nbytes) == 0);
+
+    // too little room, a truncated chunk and a bad codec are refused
+    if (nbytes > 0) {
+        CHECK(eeg_decode(sse2, size, elem_size, row_len, out, nbytes - 1) ==
+              0);
+    }
+    CHECK(eeg_decode(sse2, size - 1, elem_size, row_len, out, nbytes) == 0);
+    sse2[12] = 0x7F;
+    CHECK(eeg_decode(sse2, size, elem_size, row_len, out, nbytes) == 0);
+
+    free(sse2);
+    free(scalar);
+    free(out);
+    return size;
+}
+
+int main(void) {
+    int           e;
+    int           r;
+    int           l;
+    size_t        i;
+    size_t        size;
+    size_t        elem_sizes[4] = {1, 2, 4, 8};
+    size_t        row_lens[3]   = {1, 3, 7};
+    size_t        lengths[6]    = {0, 1, 15, 17, EEG_BLOCK + 9,
+                                   3 * EEG_BLOCK + 1};
+    uint8_t      *in;
+    uint8_t       chunk[64];
+    float        *floats;
+    float        *floats_out;
+    double       *doubles;
+    double       *doubles_out;
+    hsize_t       dims[2]  = {ROWS, CHANNELS};
+    hsize_t       cdims[2] = {256, 5};  // partial chunks along both
+    hsize_t       offset[2] = {0, 0};
+    hid_t         plist;
+    herr_t        err;
+    hdf5_struct_t hdf5;
+    hdf5_entry_t  fdata;
+    hdf5_entry_t  ddata;
+
+    in = (uint8_t *) malloc(8 * (3 * EEG_BLOCK + 1) + 7);
+
+    // every element size, row length and length, with trailing bytes
+    for (e = 0; e < 4; e++) {
+        for (r = 0; r < 3; r++) {
+            for (l = 0; l < 6; l++) {
+                size_t nbytes = lengths[l] * elem_sizes[e] + (e > 0 ? e : 0);
+                fill(in, nbytes, elem_sizes[e], row_lens[r]);
+                round_trip(in, nbytes, elem_sizes[e], row_lens[r]);
+            }
+        }
+    }
+
+    // smooth doubles compress, noise is stored as is
+    fill(in, 8 * 3 * EEG_BLOCK, 8, CHANNELS);
+    CHECK(round_trip(in, 8 * 3 * EEG_BLOCK, 8, CHANNELS) < 8 * 3 * EEG_BLOCK);
+    for (i = 0; i < 8 * 3 * EEG_BLOCK; i++) {
+        in[i] = (uint8_t) rand();
+    }
+    size = round_trip(in, 8 * 3 * EEG_BLOCK, 8, CHANNELS);
+    CHECK(size == EEG_HEADER_SIZE + 8 * 3 * EEG_BLOCK);
+    free(in);
+
+    // float and double datasets with partial chunks through the pipeline
+    if ((hdf5 = new_test_file(PATH)) == NULL) {
+        return 1;
+    }
+    floats      = (float *) malloc(sizeof(float) * ROWS * CHANNELS);
+    floats_out  = (float *) calloc(ROWS * CHANNELS, sizeof(float));
+    doubles     = (double *) malloc(sizeof(double) * ROWS * CHANNELS);
+    doubles_out = (double *) calloc(ROWS * CHANNELS, sizeof(double));
+    fill((uint8_t *) floats, sizeof(float) * ROWS * CHANNELS, sizeof(float),
+         CHANNELS);
+    fill((uint8_t *) doubles, sizeof(double) * ROWS * CHANNELS,
+         sizeof(double), CHANNELS);
+
+    plist = H5Pcreate(H5P_DATASET_CREATE);
+    H5Pset_chunk(plist, 2, cdims);
+    CHECK(set_eeg_filter(plist) == 0);
+    fdata = create_dataset(hdf5->root, "floats", H5T_NATIVE_FLOAT, 2, dims,
+                           plist);
+    ddata = create_dataset(hdf5->root, "doubles", H5T_NATIVE_DOUBLE, 2, dims,
+                           plist);
+    H5Pclose(plist);
+    CHECK(fdata != NULL && ddata != NULL);
+    if (fdata == NULL || ddata == NULL) {
+        return TEST_RESULT();
+    }
+    CHECK(H5Dwrite(fdata->id, H5T_NATIVE_FLOAT, H5S_ALL, H5S_ALL, H5P_DEFAULT,
+                   floats) >= 0);
+    CHECK(write_double_rows(ddata, 0, ROWS, doubles) == 0);
+    CHECK(H5Dread(fdata->id, H5T_NATIVE_FLOAT, H5S_ALL, H5S_ALL, H5P_DEFAULT,
+                  floats_out) >= 0);
+    CHECK(read_double_rows(ddata, 0, ROWS, doubles_out) == 0);
+    CHECK(memcmp(floats, floats_out, sizeof(float) * ROWS * CHANNELS) == 0);
+    CHECK(memcmp(doubles, doubles_out, sizeof(double) * ROWS * CHANNELS) == 0);
+
+    // a chunk claiming to decode to a terabyte fails without allocating it
+    memset(chunk, 0, sizeof(chunk));
+    chunk[5] = 1;
+    chunk[8] = sizeof(chunk) - EEG_HEADER_SIZE;
+    CHECK(H5Dwrite_chunk(ddata->id, H5P_DEFAULT, 0, offset, sizeof(chunk),
+                         chunk) >= 0);
+    H5Eset_auto2(H5E_DEFAULT, NULL, NULL);
+    err = H5Dread(ddata->id, H5T_NATIVE_DOUBLE, H5S_ALL, H5S_ALL, H5P_DEFAULT,
+                  doubles_out);
+    CHECK(err < 0);
+    CHECK(write_double_rows(ddata, 0, ROWS, doubles) == 0);
+    free_hdf5_struct(hdf5);
+
+    // a program that only reads hasn't registered the filter, opening does
+    CHECK(H5Zunregister(H5Z_FILTER_EEG) >= 0);
+    CHECK(H5Zfilter_avail(H5Z_FILTER_EEG) == 0);
+    CHECK((hdf5 = new_hdf5_struct_readonly(PATH)) != NULL);
+    if (hdf5 == NULL) {
+        return TEST_RESULT();
+    }
+    memset(floats_out, 0, sizeof(float) * ROWS * CHANNELS);
+    memset(doubles_out, 0, sizeof(double) * ROWS * CHANNELS);
+    fdata = get_entry(hdf5, "floats");
+    ddata = get_entry(hdf5, "doubles");
+    CHECK(fdata != NULL && ddata != NULL);
+    if (fdata == NULL || ddata == NULL) {
+        return TEST_RESULT();
+    }
+    CHECK(H5Dread(fdata->id, H5T_NATIVE_FLOAT, H5S_ALL, H5S_ALL, H5P_DEFAULT,
+                  floats_out) >= 0);
+    CHECK(read_double_rows(ddata, 0, ROWS, doubles_out) == 0);
+    CHECK(memcmp(floats, floats_out, sizeof(float) * ROWS * CHANNELS) == 0);
+    CHECK(memcmp(doubles, doubles_out, sizeof(double) * ROWS * CHANNELS) == 0);
+    CHECK(get_double_data(ddata) != NULL &&
+          get_double_data(ddata)[ROWS - 1][CHANNELS - 1] ==
+          doubles[ROWS * CHANNELS - 1]);
+
+    free(floats);
+    free(floats_out);
+    free(doubles);
+    free(doubles_out);
+    free_hdf5_struct(hdf5);
+    remove(PATH);
+    return TEST_RESULT();
+}
@@ -0,0 +1,146 @@
+/*
+ * Exports: CSV, raw and .npy of a nested dataset found by path in a file
+ * opened read-only, formatted numbers reading back exactly, and a failed
+ * export writing nothing to the stream.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "hdf5_export.h"
+#include "test.h"
+
+#define PATH     "test_export.h5"
+#define OUT      "test_export.out"
+#define ROWS     300
+#define CHANNELS 5
+
+/*
+ * Reads a whole file into memory
+ * \return the contents, NUL terminated, or NULL
+ */
+static char *slurp(const char *path, long *size) {
+    char *buf;
+    FILE *in;
+
+    if ((in = fopen(path, "rb")) == NULL) {
+        return NULL;
+    }
+    fseek(in, 0, SEEK_END);
+    *size = ftell(in);
+    rewind(in);
+    if ((buf = (char *) malloc(*size + 1)) != NULL) {
+        *size      = (long) fread(buf, 1, *size, in);
+        buf[*size] = '\0';
+    }
+    fclose(in);
+    return buf;
+}
+
+int main(void) {
+    int           i;
+    long          size;
+    char         *text;
+    char         *line;
+    FILE         *out;
+    char          num[FORMAT_LEN];
+    double        values[6] = {0.1, -1e-300, 1.0 / 3, 123456789.25, 5e-324,
+                               -0.0};
+    double       *data;
+    hsize_t       dims[2] = {ROWS, CHANNELS};
+    hdf5_struct_t hdf5;
+    hdf5_entry_t  entry;
+    hid_t         group;
+
+    // numbers print with the fewest digits that read back the same
+    for (i = 0; i < 6; i++) {
+        CHECK(format_double(values[i], num) > 0);
+        CHECK(strtod(num, NULL) == values[i]);
+        CHECK(format_float((float) values[i], num) > 0);
+        CHECK(strtof(num, NULL) == (float) values[i]);
+    }
+    CHECK(format_double(0.1, num) == 3 && strcmp(num, "0.1") == 0);
+
+    if ((hdf5 = new_test_file(PATH)) == NULL) {
+        return 1;
+    }
+    data = (double *) malloc(sizeof(double) * ROWS * CHANNELS);
+    for (i = 0; i < ROWS * CHANNELS; i++) {
+        data[i] = (i % CHANNELS) - (i / CHANNELS) * 0.125;
+    }
+    group = H5Gcreate(hdf5->in_file, "EEG", H5P_DEFAULT, H5P_DEFAULT,
+                      H5P_DEFAULT);
+    H5Gclose(group);
+    free_hdf5_struct(hdf5);
+    hdf5 = new_hdf5_struct(PATH);
+    entry = create_double_matrix(get_entry(hdf5, "EEG"), "data", dims, NULL);
+    CHECK(entry != NULL && write_double_rows(entry, 0, ROWS, data) == 0);
+    free_hdf5_struct(hdf5);
+
+    // found by path in a file opened read-only, which can't be written
+    CHECK((hdf5 = new_hdf5_struct_readonly(PATH)) != NULL);
+    if (hdf5 == NULL) {
+        return TEST_RESULT();
+    }
+    CHECK(find_entry(hdf5, "EEG") == get_entry(hdf5, "EEG"));
+    CHECK(find_entry(hdf5, "/") == NULL);
+    CHECK(find_entry(hdf5, "EEG/missing") == NULL);
+    CHECK(find_entry(hdf5, "missing/data") == NULL);
+    entry = find_entry(hdf5, "/EEG//data");
+    CHECK(entry != NULL && entry == find_entry(hdf5, "EEG/data"));
+    H5Eset_auto2(H5E_DEFAULT, NULL, NULL);
+    CHECK(create_double_matrix(find_entry(hdf5, "EEG"), "new", dims, NULL) ==
+          NULL);
+    if (entry == NULL) {
+        return TEST_RESULT();
+    }
+
+    // CSV: one line per row, every number reading back exactly
+    CHECK(export_dataset(entry, OUT, EXPORT_CSV) == 0);
+    text = slurp(OUT, &size);
+    CHECK(text != NULL);
+    for (i = 0, line = text; text != NULL && i < ROWS * CHANNELS; i++) {
+        char *end;
+        CHECK(strtod(line, &end) == data[i]);
+        CHECK(*end == ((i + 1) % CHANNELS ? ',' : '\n'));
+        line = end + 1;
+    }
+    CHECK(text != NULL && *line == '\0');
+    free(text);
+
+    // raw: the doubles as they are on a little endian host
+    CHECK(export_dataset(entry, OUT, EXPORT_RAW) == 0);
+    text = slurp(OUT, &size);
+    CHECK(text != NULL && size == (long) sizeof(double) * ROWS * CHANNELS &&
+          memcmp(text, data, size) == 0);
+    free(text);
+
+    // .npy: the header, padded to 64 bytes, then the same bytes
+    CHECK(export_dataset(entry, OUT, EXPORT_NPY) == 0);
+    text = slurp(OUT, &size);
+    CHECK(text != NULL && memcmp(text, "\x93NUMPY\x01\x00", 8) == 0);
+    if (text != NULL) {
+        long header = 10 + (unsigned char) text[8] +
+                      256 * (unsigned char) text[9];
+        CHECK(header % 64 == 0);
+        CHECK(strstr(text + 10, "'descr': '<f8'") != NULL);
+        CHECK(strstr(text + 10, "'shape': (300, 5)") != NULL);
+        CHECK(size == header + (long) sizeof(double) * ROWS * CHANNELS &&
+              memcmp(text + header, data, size - header) == 0);
+    }
+    free(text);
+
+    // a group can't be exported and leaves the stream empty
+    out = fopen(OUT, "w");
+    CHECK(export_stream(find_entry(hdf5, "EEG"), out, EXPORT_CSV) < 0);
+    CHECK(export_stream(entry, out, 42) < 0);
+    fclose(out);
+    text = slurp(OUT, &size);
+    CHECK(text != NULL && size == 0);
+    free(text);
+
+    free(data);
+    free_hdf5_struct(hdf5);
+    remove(OUT);
+    remove(PATH);
+    return TEST_RESULT();
+}
@@ -0,0 +1,152 @@
+/*
+ * Zero-phase filtering of a constant: a high-pass filter must give zeros and a
+ * low-pass filter the constant, up to the last sample at both ends. A filter
+ * failing halfway leaves no dataset behind.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "hdf5_eeg_filter.h"
+#include "hdf5_filter.h"
+#include "test.h"
+
+#define PATH     "test_filter.h5"
+#define SAMPLES  5000
+#define CHANNELS 3
+#define SRATE    256.0
+
+/*
+ * Fills sos with a second-order Butterworth section, high-pass or low-pass
+ */
+static void butterworth(double *sos, double cutoff, bool high_pass) {
+    double w0    = 2 * M_PI * cutoff / SRATE;
+    double alpha = sin(w0) / sqrt(2.0);
+    double k     = high_pass ? 1 + cos(w0) : 1 - cos(w0);
+
+    sos[0] = k / 2;
+    sos[1] = high_pass ? -k : k;
+    sos[2] = k / 2;
+    sos[3] = 1 + alpha;
+    sos[4] = -2 * cos(w0);
+    sos[5] = 1 - alpha;
+}
+
+static const double offsets[CHANNELS] = {100.0, -4000.0, 0.5};
+
+/*
+ * Filters the constant dataset and checks every sample of the result is the
+ * constant times `gain`
+ */
+static void check_filter(hdf5_entry_t data, hdf5_filter_t filter,
+                         const char *name, double gain) {
+    hsize_t      i;
+    double      *rows;
+    hdf5_entry_t out;
+
+    CHECK(filter != NULL);
+    if (filter == NULL) {
+        return;
+    }
+    out  = filter_dataset(data, filter, name, true);
+    rows = (double *) malloc(sizeof(double) * SAMPLES * CHANNELS);
+    CHECK(out != NULL);
+    if (out != NULL && read_double_rows(out, 0, SAMPLES, rows) == 0) {
+        CHECK_NEAR(rows[0], gain * offsets[0], 1e-6);
+        CHECK_NEAR(rows[(SAMPLES - 1) * CHANNELS], gain * offsets[0], 1e-6);
+        for (i = 0; i < SAMPLES * CHANNELS; i++) {
+            double expected = gain * offsets[i % CHANNELS];
+            if (fabs(rows[i] - expected) > 1e-6) {
+                printf("%s: sample %llu is %g, not %g\n", name, i / CHANNELS,
+                       rows[i], expected);
+                CHECK(fabs(rows[i] - expected) <= 1e-6);
+                break;
+            }
+        }
+    }
+    free(rows);
+    free_filter(filter);
+}
+
+int main(void) {
+    int           i;
+    double        sos[2 * SOS_COEFFS];
+    double        taps[101];
+    double       *rows;
+    uint8_t       chunk[64];
+    hsize_t       dims[2] = {SAMPLES, CHANNELS};
+    hsize_t       cdims[2] = {1000, CHANNELS};
+    hsize_t       offset[2] = {4000, 0};
+    hid_t         plist;
+    hdf5_struct_t hdf5;
+    hdf5_entry_t  data;
+    hdf5_entry_t  broken;
+    hdf5_filter_t filter;
+
+    if ((hdf5 = new_test_file(PATH)) == NULL) {
+        return 1;
+    }
+    rows = (double *) malloc(sizeof(double) * SAMPLES * CHANNELS);
+    for (i = 0; i < SAMPLES * CHANNELS; i++) {
+        rows[i] = offsets[i % CHANNELS];
+    }
+    data = create_double_matrix(hdf5->root, "data", dims, NULL);
+    CHECK(data != NULL && write_double_rows(data, 0, SAMPLES, rows) == 0);
+
+    // a 0.5 Hz high-pass takes seconds to settle, far longer than the padding
+    butterworth(sos, 0.5, true);
+    check_filter(data, new_iir_filter(sos, 1), "high_pass", 0.0);
+    butterworth(sos + SOS_COEFFS, 1.0, true);
+    check_filter(data, new_iir_filter(sos, 2), "high_pass2", 0.0);
+
+    // low-pass filters keep the offset, times a DC gain of 2 here so the second
+    // section starts from a different level than the first, squared by the two
+    // passes
+    butterworth(sos, 40.0, false);
+    butterworth(sos + SOS_COEFFS, 10.0, false);
+    for (i = 0; i < 3; i++) {
+        sos[i] *= 2;
+    }
+    check_filter(data, new_iir_filter(sos, 2), "low_pass", 4.0);
+
+    // FIR filters, both the direct and the FFT path
+    for (i = 0; i < 101; i++) {
+        taps[i] = 1.0 / 101;
+    }
+    check_filter(data, new_fir_filter(taps, 101), "fir_fft", 1.0);
+    for (i = 0; i < 9; i++) {
+        taps[i] = 1.0 / 9;
+    }
+    check_filter(data, new_fir_filter(taps, 9), "fir", 1.0);
+
+    // a chunk that can't be read near the end fails the filter after it has
+    // written most of its output, which mustn't be left behind
+    plist = H5Pcreate(H5P_DATASET_CREATE);
+    H5Pset_chunk(plist, 2, cdims);
+    CHECK(set_eeg_filter(plist) == 0);
+    broken = create_dataset(hdf5->root, "broken", H5T_NATIVE_DOUBLE, 2, dims,
+                            plist);
+    H5Pclose(plist);
+    CHECK(broken != NULL && write_double_rows(broken, 0, SAMPLES, rows) == 0);
+    if (broken == NULL) {
+        return TEST_RESULT();
+    }
+    memset(chunk, 0, sizeof(chunk));
+    chunk[5] = 1;
+    chunk[8] = sizeof(chunk) - EEG_HEADER_SIZE;
+    CHECK(H5Dwrite_chunk(broken->id, H5P_DEFAULT, 0, offset, sizeof(chunk),
+                         chunk) >= 0);
+    H5Eset_auto2(H5E_DEFAULT, NULL, NULL);
+    filter = new_fir_filter(taps, 9);
+    CHECK(filter_dataset(broken, filter, "broken_fir", true) == NULL);
+    free_filter(filter);
+    CHECK(get_subentry(hdf5->root, "broken_fir") == NULL);
+    CHECK(H5Lexists(hdf5->in_file, "broken_fir", H5P_DEFAULT) == 0);
+    // and the same name can be used once the input is fixed
+    CHECK(write_double_rows(broken, 0, SAMPLES, rows) == 0);
+    check_filter(broken, new_fir_filter(taps, 9), "broken_fir", 1.0);
+
+    free(rows);
+    free_hdf5_struct(hdf5);
+    remove(PATH);
+    return TEST_RESULT();
+}
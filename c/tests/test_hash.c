@@ -0,0 +1,105 @@
+/*
+ * Chunk hashes: XXH64 reference values, diffs, partial and full chunk updates,
+ * and updates after another writer changed the data behind the hashes.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "hdf5_hash.h"
+#include "test.h"
+
+#define PATH     "test_hash.h5"
+#define ROWS     1000
+#define CHANNELS 6
+
+int main(void) {
+    int           i;
+    double       *data;
+    double       *out;
+    double        region[10 * 3];
+    hsize_t       dims[2]  = {ROWS, CHANNELS};
+    hsize_t       chunk[2] = {128, 4};  // partial chunks along both
+    hsize_t       start[2];
+    hsize_t       count[2];
+    hsize_t       first_row = 0;
+    hdf5_struct_t hdf5;
+    hdf5_entry_t  a;
+    hdf5_entry_t  b;
+
+    // the reference XXH64 values, seed 0
+    CHECK(hash_bytes("", 0, 0) == 0xEF46DB3751D8E999ULL);
+    CHECK(hash_bytes("a", 1, 0) == 0xD24EC4F1A98C6E5BULL);
+    CHECK(hash_bytes("abc", 3, 0) == 0x44BC2CF5AD770999ULL);
+
+    if ((hdf5 = new_test_file(PATH)) == NULL) {
+        return 1;
+    }
+    data = (double *) malloc(sizeof(double) * ROWS * CHANNELS);
+    out  = (double *) malloc(sizeof(double) * ROWS * CHANNELS);
+    for (i = 0; i < ROWS * CHANNELS; i++) {
+        data[i] = i * 0.5;
+    }
+    a = create_double_matrix(hdf5->root, "a", dims, chunk);
+    b = create_double_matrix(hdf5->root, "b", dims, chunk);
+    CHECK(a != NULL && b != NULL);
+    if (a == NULL || b == NULL) {
+        return TEST_RESULT();
+    }
+    CHECK(write_double_rows(a, 0, ROWS, data) == 0);
+    CHECK(write_double_rows(b, 0, ROWS, data) == 0);
+    CHECK(write_hashes(a) == 0);
+    CHECK(diff_datasets(a, b, NULL) == 0);
+
+    // rewriting what's there changes nothing, a change rewrites its chunks
+    start[0] = 250;
+    start[1] = 2;
+    count[0] = 10;
+    count[1] = 3;
+    for (i = 0; i < 30; i++) {
+        region[i] = data[(start[0] + i / 3) * CHANNELS + start[1] + i % 3];
+    }
+    CHECK(update_region(a, start, count, region) == 0);
+    region[0] = -1;
+    region[29] = -2;
+    CHECK(update_region(a, start, count, region) == 2);
+    CHECK(diff_datasets(a, b, &first_row) == 2 && first_row == 128);
+    CHECK(read_double_rows(a, 0, ROWS, out) == 0);
+    CHECK(out[250 * CHANNELS + 2] == -1 && out[259 * CHANNELS + 4] == -2);
+
+    // a whole chunk the hashes say holds the data, but another writer changed
+    for (i = 0; i < ROWS * CHANNELS; i++) {
+        out[i] = -i;
+    }
+    CHECK(write_double_rows(a, 0, ROWS, out) == 0);
+    start[0] = 0;
+    start[1] = 0;
+    count[0] = 128;
+    count[1] = 4;
+    for (i = 0; i < 128 * 4; i++) {
+        out[i] = data[(i / 4) * CHANNELS + i % 4];
+    }
+    CHECK(update_region(a, start, count, out) == 1);
+    CHECK(read_double_rows(a, 0, 128, out) == 0);
+    for (i = 0; i < 128 * CHANNELS &&
+                (i % CHANNELS >= 4 || out[i] == data[i]); i++) {
+    }
+    CHECK(i == 128 * CHANNELS);
+    // and a chunk the region only covers part of
+    start[0] = 300;
+    count[0] = 1;
+    count[1] = 1;
+    CHECK(update_region(a, start, count, data + 300 * CHANNELS) == 1);
+    CHECK(read_double_rows(a, 300, 1, out) == 0);
+    CHECK(out[0] == data[300 * CHANNELS]);
+
+    // hashes are fresh again once rebuilt
+    CHECK(write_double_rows(a, 0, ROWS, data) == 0);
+    CHECK(write_hashes(a) == 0);
+    CHECK(diff_datasets(a, b, NULL) == 0);
+
+    free(data);
+    free(out);
+    free_hdf5_struct(hdf5);
+    remove(PATH);
+    return TEST_RESULT();
+}
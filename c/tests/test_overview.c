@@ -0,0 +1,155 @@
+/*
+ * Min/max/mean pyramids: every level, whole and in a window that isn't aligned
+ * to its bins, against a brute force reduction of a row count that isn't a
+ * power of the factor, the raw rows of a short window, a level left over from
+ * an unfinished build, and a rebuild with another factor over new data
+ * replacing the stale levels.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "hdf5_hl.h"
+#include "hdf5_overview.h"
+#include "test.h"
+
+#define PATH     "test_overview.h5"
+#define SAMPLES  100003
+#define CHANNELS 5
+
+/*
+ * Returns how many of the bins of an overview differ from the min, max and mean
+ * of the samples they cover, computed one bin at a time
+ */
+static hsize_t mismatches(const hdf5_overview_t o, const double *in) {
+    hsize_t b, c, i;
+    hsize_t first;
+    hsize_t last;
+    hsize_t bad = 0;
+    double  min, max, sum;
+
+    for (b = 0; b < o->num_bins; b++) {
+        first = (o->first_bin + b) * o->factor;
+        last  = first + o->factor < SAMPLES ? first + o->factor : SAMPLES;
+        for (c = 0; c < CHANNELS; c++) {
+            min = max = in[first * CHANNELS + c];
+            for (i = first, sum = 0; i < last; i++) {
+                double x = in[i * CHANNELS + c];
+                min  = x < min ? x : min;
+                max  = x > max ? x : max;
+                sum += x;
+            }
+            if (OVERVIEW_MIN(o, b, c) != min || OVERVIEW_MAX(o, b, c) != max ||
+                !(fabs(OVERVIEW_MEAN(o, b, c) - sum / (last - first)) <=
+                  1e-9)) {
+                bad++;
+            }
+        }
+    }
+    return bad;
+}
+
+/*
+ * Checks that each level of a pyramid is read, whole and in a window, and
+ * that the levels listed in the attribute are the expected ones
+ */
+static void check_levels(hdf5_entry_t data, const double *in,
+                         const hsize_t *factors, int num_levels) {
+    int             i;
+    long long       listed[32];
+    hsize_t         f;
+    hsize_t         t0 = 1001;
+    hsize_t         t1 = 77777;
+    hdf5_overview_t o;
+
+    memset(listed, 0, sizeof(listed));
+    CHECK(H5LTget_attribute_long_long(data->id, ".", OVERVIEW_ATTR, listed) >=
+          0);
+    for (i = 0; i < num_levels; i++) {
+        f = factors[i];
+        CHECK(listed[i] == (long long) f);
+
+        // the coarsest level with npixels bins is the one asked for
+        o = read_overview(data, 0, SAMPLES, SAMPLES / f);
+        CHECK(o != NULL && o->factor == f && o->first_bin == 0 &&
+              o->num_bins == (SAMPLES + f - 1) / f &&
+              o->num_channels == CHANNELS);
+        CHECK(o != NULL && mismatches(o, in) == 0);
+        free_overview(o);
+
+        o = read_overview(data, t0, t1, (t1 - t0) / f);
+        CHECK(o != NULL && o->factor == f && o->first_bin == t0 / f &&
+              o->num_bins == (t1 + f - 1) / f - t0 / f);
+        CHECK(o != NULL && mismatches(o, in) == 0);
+        free_overview(o);
+    }
+    CHECK(listed[num_levels] == 0);
+
+    // too few samples for any level: the raw rows
+    o = read_overview(data, t0, t0 + 100, 101);
+    CHECK(o != NULL && o->factor == 1 && o->first_bin == t0 &&
+          o->num_bins == 100 && mismatches(o, in) == 0);
+    free_overview(o);
+}
+
+int main(void) {
+    int           i;
+    char          name[MAX_LEN];
+    double       *in;
+    hsize_t       dims[2]    = {SAMPLES, CHANNELS};
+    hsize_t       stray[2]   = {3, 3};
+    hsize_t       by_4[5]    = {4, 16, 64, 256, 1024};
+    hsize_t       by_8[3]    = {8, 64, 512};
+    hdf5_struct_t hdf5;
+    hdf5_entry_t  data;
+    hdf5_entry_t  level;
+
+    if ((hdf5 = new_test_file(PATH)) == NULL) {
+        return 1;
+    }
+    in = (double *) malloc(sizeof(double) * SAMPLES * CHANNELS);
+    srand(26);
+    for (i = 0; i < SAMPLES * CHANNELS; i++) {
+        in[i] = (rand() % 20001 - 10000) / 16.0;
+    }
+    data = create_double_matrix(hdf5->root, "data", dims, NULL);
+    CHECK(data != NULL && write_double_rows(data, 0, SAMPLES, in) == 0);
+    if (data == NULL) {
+        return TEST_RESULT();
+    }
+
+    // a level of a build that didn't finish, which no attribute lists
+    CHECK(create_double_matrix(hdf5->root, "data_overview_16", stray, NULL) !=
+          NULL);
+    CHECK(write_overview(data, 0) == 0);
+    level = get_dataset(hdf5->root, "data_overview_16");
+    CHECK(level != NULL && X_DIM(level) == (SAMPLES + 15) / 16 &&
+          Y_DIM(level) == OVERVIEW_STATS * CHANNELS);
+    check_levels(data, in, by_4, 5);
+    free_hdf5_struct(hdf5);
+
+    // as read back from the file, then rebuilt by 8 over new data
+    CHECK((hdf5 = new_hdf5_struct(PATH)) != NULL);
+    if (hdf5 == NULL) {
+        return TEST_RESULT();
+    }
+    data = get_entry(hdf5, "data");
+    check_levels(data, in, by_4, 5);
+    for (i = 0; i < SAMPLES * CHANNELS; i++) {
+        in[i] = -2 * in[i] + i % 7;
+    }
+    CHECK(write_double_rows(data, 0, SAMPLES, in) == 0);
+    CHECK(write_overview(data, 8) == 0);
+    check_levels(data, in, by_8, 3);
+    for (i = 0; i < 5; i++) {
+        snprintf(name, MAX_LEN, "data_overview_%llu",
+                 (unsigned long long) by_4[i]);
+        CHECK((get_dataset(hdf5->root, name) != NULL) == (by_4[i] == 64));
+        CHECK(H5Lexists(hdf5->in_file, name, H5P_DEFAULT) ==
+              (by_4[i] == 64));
+    }
+    free_hdf5_struct(hdf5);
+
+    free(in);
+    remove(PATH);
+    return TEST_RESULT();
+}
@@ -0,0 +1,223 @@
+/*
+ * Re-referencing: the average and the median, of odd and even numbers of
+ * channels and of rows full of ties, against a brute force reference, a NaN
+ * channel left out by the mask, the new dataset and the in place paths over
+ * blocks that don't divide the samples, and the datasets that can't be done.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "hdf5_eeg_filter.h"
+#include "hdf5_reref.h"
+#include "test.h"
+
+#define PATH     "test_reref.h5"
+#define CHANNELS 64
+#define SAMPLES  (2 * 16384 + 1001)  // blocks of 16384 rows, the last partial
+#define BAD      5                   // the channel holding NaNs
+
+static int compare_doubles(const void *a, const void *b) {
+    double x = *(const double *) a;
+    double y = *(const double *) b;
+    return (x > y) - (x < y);
+}
+
+/*
+ * Re-references rows the slow way: sorts the included values of each row for
+ * the median and sums them for the mean
+ */
+static void reference(const double *in, double *out, hsize_t n,
+                      hsize_t channels, const bool *mask, int method) {
+    hsize_t i, c;
+    hsize_t m;
+    double  ref;
+    double *values = (double *) malloc(sizeof(double) * channels);
+
+    for (i = 0; i < n; i++) {
+        const double *row = in + i * channels;
+        for (c = m = 0; c < channels; c++) {
+            if (mask == NULL || mask[c]) {
+                values[m++] = row[c];
+            }
+        }
+        if (method == REREF_MEDIAN) {
+            qsort(values, m, sizeof(double), compare_doubles);
+            ref = m % 2 ? values[m / 2]
+                        : (values[m / 2 - 1] + values[m / 2]) / 2;
+        } else {
+            for (c = 0, ref = 0; c < m; c++) {
+                ref += values[c];
+            }
+            ref /= m;
+        }
+        for (c = 0; c < channels; c++) {
+            out[i * channels + c] = row[c] - ref;
+        }
+    }
+    free(values);
+}
+
+/*
+ * Returns how many of n values differ from the expected ones, NaN matching
+ * only NaN
+ */
+static hsize_t mismatches(const double *got, const double *expected,
+                          hsize_t n) {
+    hsize_t i;
+    hsize_t bad = 0;
+
+    for (i = 0; i < n; i++) {
+        if (isnan(expected[i]) ? !isnan(got[i])
+                               : !(fabs(got[i] - expected[i]) <= 1e-9)) {
+            bad++;
+        }
+    }
+    return bad;
+}
+
+/*
+ * Re-references a dataset into a new one and checks every value
+ */
+static void check_new(hdf5_entry_t data, const double *in, double *got,
+                      double *expected, const bool *mask, int method,
+                      const char *name) {
+    hdf5_entry_t out = rereference_dataset(data, mask, method, name);
+
+    CHECK(out != NULL && out != data);
+    if (out == NULL) {
+        return;
+    }
+    CHECK(X_DIM(out) == SAMPLES && Y_DIM(out) == CHANNELS);
+    CHECK(block_rows(out) < SAMPLES && SAMPLES % block_rows(out) != 0);
+    reference(in, expected, SAMPLES, CHANNELS, mask, method);
+    CHECK(read_double_rows(out, 0, SAMPLES, got) == 0);
+    CHECK(mismatches(got, expected, SAMPLES * CHANNELS) == 0);
+}
+
+int main(void) {
+    int           i;
+    int           n;
+    hsize_t       c;
+    hsize_t       bad;
+    bool          mask[CHANNELS];
+    double       *in;
+    double       *got;
+    double       *expected;
+    double        row[CHANNELS];
+    double        copy[CHANNELS];
+    double        want[CHANNELS];
+    uint8_t       chunk[64];
+    hsize_t       dims[2]  = {SAMPLES, CHANNELS};
+    hsize_t       cdims[2] = {2048, CHANNELS};
+    hsize_t       offset[2] = {4 * 2048, 0};
+    hid_t         plist;
+    hdf5_struct_t hdf5;
+    hdf5_entry_t  data;
+    hdf5_entry_t  entry;
+
+    // rows of an odd and an even number of values, with ties and constant,
+    // through rereference_rows, which exercises the quickselect
+    srand(38);
+    for (i = bad = 0; i < 200000; i++) {
+        n = 1 + rand() % CHANNELS;
+        for (c = 0; c < (hsize_t) n; c++) {
+            row[c] = i % 7 == 0 ? 1.5 : (rand() % (i % 3 ? 5 : 1000)) / 4.0;
+        }
+        memcpy(copy, row, sizeof(double) * n);
+        reference(copy, want, 1, n, NULL, REREF_MEDIAN);
+        CHECK(rereference_rows(row, 1, n, NULL, REREF_MEDIAN, NULL) == 0);
+        bad += mismatches(row, want, n);
+    }
+    CHECK(bad == 0);
+    memset(mask, 0, sizeof(mask));
+    CHECK(rereference_rows(row, 1, CHANNELS, mask, REREF_AVERAGE, NULL) < 0);
+
+    if ((hdf5 = new_test_file(PATH)) == NULL) {
+        return 1;
+    }
+    in       = (double *) malloc(sizeof(double) * SAMPLES * CHANNELS);
+    got      = (double *) malloc(sizeof(double) * SAMPLES * CHANNELS);
+    expected = (double *) malloc(sizeof(double) * SAMPLES * CHANNELS);
+    for (i = 0; i < SAMPLES * CHANNELS; i++) {
+        // eighths, so rows have ties, and a few rows all alike
+        in[i] = (i / CHANNELS) % 101 == 0 ? 3.0
+                                          : (rand() % 2001 - 1000) / 8.0;
+    }
+    data = create_double_matrix(hdf5->root, "data", dims, NULL);
+    CHECK(data != NULL && write_double_rows(data, 0, SAMPLES, in) == 0);
+    if (data == NULL) {
+        return TEST_RESULT();
+    }
+
+    // all 64 channels and 63 of them, for even and odd medians
+    for (c = 0; c < CHANNELS; c++) {
+        mask[c] = c != BAD;
+    }
+    check_new(data, in, got, expected, NULL, REREF_AVERAGE, "average");
+    check_new(data, in, got, expected, NULL, REREF_MEDIAN, "median_even");
+    check_new(data, in, got, expected, mask, REREF_MEDIAN, "median_odd");
+    check_new(data, in, got, expected, mask, REREF_AVERAGE, "average_63");
+
+    // a channel of NaNs left out: the others stay finite
+    for (i = 0; i < SAMPLES; i++) {
+        in[i * CHANNELS + BAD] = NAN;
+    }
+    CHECK(write_double_rows(data, 0, SAMPLES, in) == 0);
+    check_new(data, in, got, expected, mask, REREF_MEDIAN, "nan_median");
+    check_new(data, in, got, expected, mask, REREF_AVERAGE, "nan_average");
+    for (i = bad = 0; i < SAMPLES * CHANNELS; i++) {
+        bad += i % CHANNELS != BAD && !isfinite(got[i]);
+    }
+    CHECK(bad == 0);
+
+    // in place, block by block
+    CHECK(rereference_dataset(data, mask, REREF_MEDIAN, NULL) == data);
+    reference(in, expected, SAMPLES, CHANNELS, mask, REREF_MEDIAN);
+    CHECK(read_double_rows(data, 0, SAMPLES, got) == 0);
+    CHECK(mismatches(got, expected, SAMPLES * CHANNELS) == 0);
+
+    // an int dataset can't be done in place, nor any of a read-only file
+    // further down, and a name that's taken leaves its dataset alone
+    H5Eset_auto2(H5E_DEFAULT, NULL, NULL);
+    entry = create_dataset(hdf5->root, "ints", H5T_NATIVE_INT, 2, dims,
+                           H5P_DEFAULT);
+    CHECK(entry != NULL && rereference_dataset(entry, NULL, REREF_AVERAGE,
+                                               NULL) == NULL);
+    CHECK(rereference_dataset(data, NULL, REREF_AVERAGE, "average") == NULL);
+    CHECK(get_subentry(hdf5->root, "average") != NULL);
+
+    // a block that can't be read leaves no new dataset behind
+    plist = H5Pcreate(H5P_DATASET_CREATE);
+    H5Pset_chunk(plist, 2, cdims);
+    CHECK(set_eeg_filter(plist) == 0);
+    entry = create_dataset(hdf5->root, "broken", H5T_NATIVE_DOUBLE, 2, dims,
+                           plist);
+    H5Pclose(plist);
+    CHECK(entry != NULL && write_double_rows(entry, 0, SAMPLES, in) == 0);
+    memset(chunk, 0, sizeof(chunk));
+    chunk[5] = 1;
+    chunk[8] = sizeof(chunk) - EEG_HEADER_SIZE;
+    CHECK(entry != NULL && H5Dwrite_chunk(entry->id, H5P_DEFAULT, 0, offset,
+                                          sizeof(chunk), chunk) >= 0);
+    CHECK(rereference_dataset(entry, NULL, REREF_AVERAGE, "broken_ref") ==
+          NULL);
+    CHECK(get_subentry(hdf5->root, "broken_ref") == NULL);
+    CHECK(H5Lexists(hdf5->in_file, "broken_ref", H5P_DEFAULT) == 0);
+    free_hdf5_struct(hdf5);
+
+    CHECK((hdf5 = new_hdf5_struct_readonly(PATH)) != NULL);
+    if (hdf5 != NULL) {
+        data = get_entry(hdf5, "data");
+        CHECK(data != NULL && rereference_dataset(data, NULL, REREF_AVERAGE,
+                                                  NULL) == NULL);
+        CHECK(read_double_rows(data, 0, SAMPLES, in) == 0);
+        CHECK(mismatches(in, got, SAMPLES * CHANNELS) == 0);
+        free_hdf5_struct(hdf5);
+    }
+
+    free(in);
+    free(got);
+    free(expected);
+    remove(PATH);
+    return TEST_RESULT();
+}
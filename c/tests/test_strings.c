@@ -0,0 +1,154 @@
+/*
+ * The string arena: fixed length NULLPAD and SPACEPAD 2-D arrays,
+ * variable-length strings with NULL and empty elements and enough of them to
+ * fill several of the blocks HDF5 allocates from, one longer than a block, and
+ * variable-length byte sequences, read back through get_string_at and STR_LEN.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "test.h"
+
+#define PATH  "test_strings.h5"
+#define MANY  20000             // variable-length strings, about 2 MB of them
+#define LONG  (3 << 19)         // a string longer than a block
+
+/*
+ * Writes a dataset of the given type and shape straight through HDF5
+ */
+static void write_raw(hid_t file, const char *name, hid_t type, int rank,
+                      const hsize_t *dims, const void *data) {
+    hid_t space = H5Screate_simple(rank, dims, NULL);
+    hid_t id    = H5Dcreate2(file, name, type, space, H5P_DEFAULT, H5P_DEFAULT,
+                             H5P_DEFAULT);
+
+    CHECK(id >= 0 && H5Dwrite(id, type, H5S_ALL, H5S_ALL, H5P_DEFAULT,
+                              data) >= 0);
+    H5Dclose(id);
+    H5Sclose(space);
+}
+
+/*
+ * Writes strings of a fixed length of 4 with the given padding
+ */
+static void write_fixed(hid_t file, const char *name, H5T_str_t pad,
+                        const char *data) {
+    hsize_t dims[2] = {2, 3};
+    hid_t   type    = H5Tcopy(H5T_C_S1);
+
+    H5Tset_size(type, 4);
+    H5Tset_strpad(type, pad);
+    write_raw(file, name, type, 2, dims, data);
+    H5Tclose(type);
+}
+
+/*
+ * Returns whether a string of a dataset is the expected one, with its length
+ */
+static bool string_is(hdf5_entry_t entry, hsize_t i, const char *expected) {
+    char *s = get_string_at(entry, i);
+
+    return s != NULL && STR_LEN(entry, i) == strlen(expected) &&
+           strcmp(s, expected) == 0;
+}
+
+int main(void) {
+    int           i;
+    int           bad;
+    char         *s;
+    char         *text;
+    char         *longest;
+    char        **many;
+    // the fourth fills the width, with no terminator to read
+    const char    nullpad[]  = "Fz\0\0Cz\0\0\0\0\0\0Pz12a\0\0\0O1\0\0";
+    const char    spacepad[] = "Fz  Cz      Pz12a   O1  ";
+    const char   *expected[] = {"Fz", "Cz", "", "Pz12", "a", "O1"};
+    const char   *vlen[5]    = {"first", NULL, "", "the longest of them", "x"};
+    unsigned char bytes[]    = {'h', 'i', 0, '!', 0xff};
+    hvl_t         seqs[3]    = {{2, bytes}, {0, NULL}, {5, bytes}};
+    hsize_t       dims[1]    = {5};
+    hsize_t       many_dims[1] = {MANY};
+    hid_t         file;
+    hid_t         type;
+    hdf5_struct_t hdf5;
+    hdf5_entry_t  entry;
+
+    if ((hdf5 = new_test_file(PATH)) == NULL) {
+        return 1;
+    }
+    file = hdf5->in_file;
+    write_fixed(file, "nullpad", H5T_STR_NULLPAD, nullpad);
+    write_fixed(file, "spacepad", H5T_STR_SPACEPAD, spacepad);
+
+    type = H5Tcopy(H5T_C_S1);
+    H5Tset_size(type, H5T_VARIABLE);
+    write_raw(file, "vlen", type, 1, dims, vlen);
+    many = (char **) malloc(sizeof(char *) * MANY);
+    text = (char *) malloc(LONG + 201);
+    memset(text, 'e', LONG + 200);
+    text[LONG + 200] = '\0';
+    for (i = 0; i < MANY; i++) {
+        // each a tail of the same text, so their lengths tell them apart
+        many[i] = text + LONG + 200 - i % 200;
+    }
+    many[MANY / 2] = text + 200;
+    write_raw(file, "many", type, 1, many_dims, many);
+    H5Tclose(type);
+
+    type    = H5Tvlen_create(H5T_NATIVE_UCHAR);
+    dims[0] = 3;
+    write_raw(file, "bytes", type, 1, dims, seqs);
+    H5Tclose(type);
+    free_hdf5_struct(hdf5);
+
+    CHECK((hdf5 = new_hdf5_struct(PATH)) != NULL);
+    if (hdf5 == NULL) {
+        return TEST_RESULT();
+    }
+
+    // fixed length, in row-major order, the padding dropped either way
+    entry = get_entry(hdf5, "nullpad");
+    CHECK(entry != NULL && entry->class == H5T_STRING && entry->rank == 2 &&
+          X_DIM(entry) == 2 && Y_DIM(entry) == 3);
+    for (i = 0; entry != NULL && i < 6; i++) {
+        CHECK(string_is(entry, i, expected[i]));
+    }
+    entry = get_entry(hdf5, "spacepad");
+    CHECK(entry != NULL && entry->class == H5T_STRING && entry->rank == 2);
+    for (i = 0; entry != NULL && i < 6; i++) {
+        CHECK(string_is(entry, i, expected[i]));
+    }
+
+    // variable length, a NULL read as an empty string
+    entry = get_entry(hdf5, "vlen");
+    CHECK(entry != NULL && entry->class == H5T_STRING && X_DIM(entry) == 5);
+    for (i = 0; entry != NULL && i < 5; i++) {
+        CHECK(string_is(entry, i, vlen[i] != NULL ? vlen[i] : ""));
+    }
+    entry = get_entry(hdf5, "many");
+    CHECK(entry != NULL && X_DIM(entry) == MANY);
+    for (i = bad = 0; entry != NULL && i < MANY; i++) {
+        bad += !string_is(entry, i, many[i]);
+    }
+    CHECK(bad == 0);
+    longest = entry != NULL ? get_string_at(entry, MANY / 2) : NULL;
+    CHECK(longest != NULL && STR_LEN(entry, MANY / 2) == LONG);
+
+    // byte sequences, a NUL among them kept and counted in the length
+    entry = get_entry(hdf5, "bytes");
+    CHECK(entry != NULL && entry->class == H5T_STRING && X_DIM(entry) == 3);
+    for (i = 0; entry != NULL && i < 3; i++) {
+        s = get_string_at(entry, i);
+        CHECK(s != NULL && STR_LEN(entry, i) == seqs[i].len &&
+              memcmp(s, bytes, seqs[i].len) == 0 && s[seqs[i].len] == '\0');
+    }
+
+    // past the last string
+    CHECK(entry != NULL && get_string_at(entry, 3) == NULL);
+
+    free_hdf5_struct(hdf5);
+    free(many);
+    free(text);
+    remove(PATH);
+    return TEST_RESULT();
+}
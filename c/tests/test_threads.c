@@ -0,0 +1,150 @@
+/*
+ * Lock-free lookups under load: threads race to evaluate the same entries and
+ * keep looking datasets up, among them the ones being deleted and names that
+ * aren't there, while another thread creates and deletes datasets in the same
+ * group. `make tsan` runs it under ThreadSanitizer.
+ */
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include "test.h"
+
+#define PATH      "test_threads.h5"
+#define THREADS   4
+#define GROUPS    8
+#define DATASETS  8
+#define CHURN     64   // datasets created and deleted while the others look
+#define CYCLES    3
+
+static hdf5_struct_t hdf5;
+static int           stop = 0;
+
+/*
+ * Evaluates every group and dataset and checks what it finds, then keeps
+ * looking up datasets of /churn until told to stop: the ones that stay, the
+ * ones coming and going after them and missing ones, which walk past them all
+ */
+static void *look_up(void *arg) {
+    int          g;
+    int          d;
+    long         bad = 0;
+    char         name[32];
+    hdf5_entry_t group;
+    hdf5_entry_t data;
+    hdf5_entry_t churn = get_entry(hdf5, "churn");
+    (void) arg;
+
+    for (g = 0; g < GROUPS; g++) {
+        snprintf(name, sizeof(name), "g%d", g);
+        if ((group = get_entry(hdf5, name)) == NULL || !IS_GROUP(group)) {
+            bad++;
+            continue;
+        }
+        for (d = 0; d < DATASETS; d++) {
+            snprintf(name, sizeof(name), "d%d", d);
+            data = get_subentry(group, name);
+            bad += data == NULL || X_DIM(data) != (hsize_t) d + 1 ||
+                   Y_DIM(data) != (hsize_t) g + 1 || data->num_entries != 0 ||
+                   data->entries != NULL;
+        }
+    }
+    while (!__atomic_load_n(&stop, __ATOMIC_ACQUIRE)) {
+        for (d = 0; d < DATASETS; d++) {
+            snprintf(name, sizeof(name), "d%d", d);
+            data = get_subentry(churn, name);
+            bad += data == NULL || X_DIM(data) != (hsize_t) d + 1;
+        }
+        for (d = 0; d < CHURN; d += 7) {
+            snprintf(name, sizeof(name), "x%d", d);
+            data = get_subentry(churn, name);
+            bad += data != NULL && (strcmp(data->name, name) != 0 ||
+                                    X_DIM(data) != 1);
+        }
+        bad += get_subentry(churn, "missing") != NULL;
+    }
+    return (void *) bad;
+}
+
+int main(void) {
+    int           i;
+    int           g;
+    int           d;
+    int           round;
+    char          name[32];
+    void         *bad;
+    hsize_t       dims[2];
+    hid_t         group;
+    hid_t         space;
+    hid_t         id;
+    pthread_t     threads[THREADS];
+    hdf5_entry_t  churn;
+    hdf5_entry_t  extra[CHURN];
+
+    // groups of datasets no one has evaluated yet
+    if ((hdf5 = new_test_file(PATH)) == NULL) {
+        return 1;
+    }
+    for (g = 0; g < GROUPS; g++) {
+        snprintf(name, sizeof(name), "g%d", g);
+        group = H5Gcreate(hdf5->in_file, name, H5P_DEFAULT, H5P_DEFAULT,
+                          H5P_DEFAULT);
+        for (d = 0; d < DATASETS; d++) {
+            dims[0] = d + 1;
+            dims[1] = g + 1;
+            space   = H5Screate_simple(2, dims, NULL);
+            snprintf(name, sizeof(name), "d%d", d);
+            id = H5Dcreate(group, name, H5T_NATIVE_DOUBLE, space, H5P_DEFAULT,
+                           H5P_DEFAULT, H5P_DEFAULT);
+            H5Dclose(id);
+            H5Sclose(space);
+        }
+        H5Gclose(group);
+    }
+    H5Gclose(H5Gcreate(hdf5->in_file, "churn", H5P_DEFAULT, H5P_DEFAULT,
+                       H5P_DEFAULT));
+    free_hdf5_struct(hdf5);
+
+    for (round = 0; round < 4; round++) {
+        CHECK((hdf5 = new_hdf5_struct(PATH)) != NULL);
+        if (hdf5 == NULL) {
+            return TEST_RESULT();
+        }
+        churn = get_entry(hdf5, "churn");
+        for (d = 0; d < DATASETS; d++) {
+            dims[0] = d + 1;
+            dims[1] = 1;
+            snprintf(name, sizeof(name), "d%d", d);
+            if (get_subentry(churn, name) == NULL) {
+                CHECK(create_double_matrix(churn, name, dims, NULL) != NULL);
+            }
+        }
+
+        stop = 0;
+        for (i = 0; i < THREADS; i++) {
+            CHECK(pthread_create(&threads[i], NULL, look_up, NULL) == 0);
+        }
+        // grow the group's entries past their capacity and shrink them again
+        dims[0] = dims[1] = 1;
+        for (i = 0; i < 2 * CHURN * CYCLES; i++) {
+            snprintf(name, sizeof(name), "x%d", i % CHURN);
+            if (i % (2 * CHURN) < CHURN) {
+                extra[i % CHURN] = create_double_matrix(churn, name, dims,
+                                                        NULL);
+                CHECK(extra[i % CHURN] != NULL);
+            } else if (extra[i % CHURN] != NULL) {
+                CHECK(delete_dataset(extra[i % CHURN]) == 0);
+            }
+        }
+        __atomic_store_n(&stop, 1, __ATOMIC_RELEASE);
+        for (i = 0; i < THREADS; i++) {
+            CHECK(pthread_join(threads[i], &bad) == 0);
+            CHECK(bad == NULL);
+        }
+        CHECK(NUM_ENTRY(churn) == DATASETS);
+        free_hdf5_struct(hdf5);
+    }
+
+    remove(PATH);
+    return TEST_RESULT();
+}